@@ -0,0 +1,133 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "libmbx/common/xmalloc.h"
+#include "libmbx/common/log.h"
+#include "libmbx/core/timestretch.h"
+#include "libmbx/core/varispeed.h"
+
+/******************************************************************************
+ * Measures the CPU time the key lock costs per deck.
+ *
+ * One deck is rendered the way the render threads do it: blocks of 128
+ * frames are stretched from interleaved 16 bit audio data and added to a
+ * float mix bus. The time-stretch stage works on frames, so a second of
+ * audio at 48 kHz costs 48000/44100 of a second at 44.1 kHz; both rates are
+ * measured. The source is a chord with a click every half second, which
+ * keeps both WSOLA and the phase vocoder busy as with music.
+ *
+ * The result is the CPU time per second of output, in percent of one core.
+ * Build with "make bench" in src, the flags are the same as for music-box.
+ *****************************************************************************/
+
+/* Frames per block, as in the controller. */
+#define BLOCK_FRAMES 128
+
+/* Seconds of output rendered per measurement. */
+#define SECONDS 30
+
+static const int rates[] = { 44100, 48000 };
+static const double tempos[] = { 0.8, 0.94, 1.06, 1.25, 1.5 };
+
+struct source {
+    const sample_t *data; /* interleaved stereo */
+    int64_t n_frames;
+};
+
+static void fetch(void *userdata, int64_t first, size_t n, float *left,
+        float *right) {
+    struct source *src = userdata;
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+        int64_t pos = first + (int64_t) i;
+        if ( pos < 0 || pos >= src->n_frames ) {
+            left[i] = right[i] = 0;
+            continue;
+        }
+        left[i] = src->data[2 * pos] / 32768.0f;
+        right[i] = src->data[2 * pos + 1] / 32768.0f;
+    }
+}
+
+/* A chord with a click every half second, at rate. */
+static sample_t *make_source(int rate, int64_t n_frames) {
+    static const double chord[] = { 220, 277.18, 329.63, 440, 554.37, 880 };
+    sample_t *data = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        2 * n_frames * sizeof(sample_t));
+    int64_t i;
+    size_t k;
+    for ( i=0; i<n_frames; i++ ) {
+        double v = 0;
+        int64_t click = i % ( rate / 2 );
+        for ( k=0; k<sizeof(chord)/sizeof(chord[0]); k++ ) {
+            v += sin(2 * M_PI * chord[k] * i / rate) / 8;
+        }
+        if ( click < 64 ) {
+            v += 0.2 * exp(- (double) click / 16);
+        }
+        data[2 * i] = data[2 * i + 1] = (sample_t) lrint(v * 32767);
+    }
+    return data;
+}
+
+static double cpu_seconds(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Render SECONDS of output at rate, returns the CPU seconds used. */
+static double measure(mbx_keylock mode, int rate, double tempo,
+        struct source *src) {
+    struct _mbx_stretch *stretch = _mbx_stretch_new(mode);
+    struct _mbx_gain gain;
+    float bus[2 * BLOCK_FRAMES];
+    int64_t tempo_fixed = (int64_t) ( tempo * MBX_VARISPEED_ONE );
+    int64_t end = src->n_frames * MBX_VARISPEED_ONE;
+    int64_t left = (int64_t) rate * SECONDS;
+    double start;
+    _mbx_gain_ramp(&gain, 1, 1, 1, 1, BLOCK_FRAMES);
+    _mbx_stretch_reset(stretch, 0);
+    start = cpu_seconds();
+    while ( left > 0 ) {
+        size_t n = BLOCK_FRAMES;
+        memset(bus, 0, sizeof(bus));
+        _mbx_stretch_process(stretch, bus, &n, tempo_fixed, end, fetch, src,
+            &gain);
+        if ( n == 0 ) {
+            break; // the source is long enough for the slowest tempo
+        }
+        left -= n;
+    }
+    start = cpu_seconds() - start;
+    _mbx_stretch_free(stretch);
+    return start;
+}
+
+int main(void) {
+    static const mbx_keylock modes[] = {
+        MBX_KEYLOCK_WSOLA, MBX_KEYLOCK_PHASE_VOCODER
+    };
+    static const char *names[] = { "wsola", "vocoder" };
+    struct source src;
+    sample_t *data;
+    size_t r, m, t;
+    printf("%-8s %6s %8s %10s\n", "mode", "rate", "tempo", "CPU/core");
+    for ( r=0; r<sizeof(rates)/sizeof(rates[0]); r++ ) {
+        // Enough source frames for SECONDS of output at the fastest tempo.
+        src.n_frames = (int64_t) rates[r] * SECONDS * 2;
+        data = make_source(rates[r], src.n_frames);
+        src.data = data;
+        for ( m=0; m<sizeof(modes)/sizeof(modes[0]); m++ ) {
+            for ( t=0; t<sizeof(tempos)/sizeof(tempos[0]); t++ ) {
+                double cpu = measure(modes[m], rates[r], tempos[t], &src);
+                printf("%-8s %6d %8.2f %9.2f%%\n", names[m], rates[r],
+                    tempos[t], 100 * cpu / SECONDS);
+            }
+        }
+        _mbx_xfree(data);
+    }
+    return 0;
+}
@@ -2,6 +2,8 @@
 #define MBX_API_H
 
 #include "libmbx/common/mbx_errno.h"
+#include "libmbx/common/rt_check.h"
+#include "libmbx/common/mem_stats.h"
 #include "libmbx/config/config.h"
 #include "libmbx/out/device_name_list.h"
 #include "libmbx/core/controller.h"
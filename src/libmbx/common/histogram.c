@@ -0,0 +1,73 @@
+#include "histogram.h"
+
+/* Bucket layout: values 0..SUB-1 map to buckets 0..SUB-1. For larger values,
+ * the position of the highest set bit selects the octave, and the next
+ * log2(SUB) bits select the bucket within the octave. */
+#define SUB_BITS 2
+
+static int bucket_index(uint64_t value) {
+    int msb;
+    if ( value < _MBX_HISTOGRAM_SUB_BUCKETS ) {
+        return (int) value;
+    }
+    msb = 63 - __builtin_clzll(value);
+    int index = (msb - SUB_BITS + 1) * _MBX_HISTOGRAM_SUB_BUCKETS
+        + (int) ((value >> (msb - SUB_BITS)) & (_MBX_HISTOGRAM_SUB_BUCKETS-1));
+    if ( index >= _MBX_HISTOGRAM_BUCKETS ) {
+        return _MBX_HISTOGRAM_BUCKETS - 1;
+    }
+    return index;
+}
+
+/* The largest value that is counted in bucket i. */
+static uint64_t bucket_upper_bound(int i) {
+    int octave = i / _MBX_HISTOGRAM_SUB_BUCKETS;
+    uint64_t sub = i % _MBX_HISTOGRAM_SUB_BUCKETS;
+    if ( octave == 0 ) {
+        return sub;
+    }
+    int shift = octave - 1;
+    return ((_MBX_HISTOGRAM_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void _mbx_histogram_init(struct _mbx_histogram *h) {
+    int i;
+    for ( i=0; i<_MBX_HISTOGRAM_BUCKETS; i++ ) {
+        atomic_init(&h->buckets[i], 0);
+    }
+    atomic_init(&h->count, 0);
+    atomic_init(&h->max, 0);
+}
+
+void _mbx_histogram_add(struct _mbx_histogram *h, uint64_t value) {
+    atomic_fetch_add_explicit(&h->buckets[bucket_index(value)], 1,
+        memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    /* there is only one writer, so load and store need not be a CAS */
+    if ( value > atomic_load_explicit(&h->max, memory_order_relaxed) ) {
+        atomic_store_explicit(&h->max, value, memory_order_relaxed);
+    }
+}
+
+uint64_t _mbx_histogram_percentile(struct _mbx_histogram *h, double percent) {
+    unsigned long count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    unsigned long max = atomic_load_explicit(&h->max, memory_order_relaxed);
+    unsigned long seen = 0;
+    unsigned long rank;
+    int i;
+    if ( count == 0 ) {
+        return 0;
+    }
+    rank = (unsigned long) (count * percent / 100.0);
+    if ( rank >= count ) {
+        rank = count - 1;
+    }
+    for ( i=0; i<_MBX_HISTOGRAM_BUCKETS; i++ ) {
+        seen += atomic_load_explicit(&h->buckets[i], memory_order_relaxed);
+        if ( seen > rank ) {
+            uint64_t bound = bucket_upper_bound(i);
+            return bound < max ? bound : max;
+        }
+    }
+    return max;
+}
@@ -0,0 +1,46 @@
+#ifndef MBX_HISTOGRAM_H
+#define MBX_HISTOGRAM_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*! \file histogram.h
+ *  \brief Lock-free histogram for durations measured in the audio thread.
+ *
+ * Values are sorted into log-linear buckets: Each power of two is divided
+ * into #_MBX_HISTOGRAM_SUB_BUCKETS buckets, so the relative error of a
+ * percentile is below 1/#_MBX_HISTOGRAM_SUB_BUCKETS. A single thread adds
+ * values, any other thread may read the histogram at the same time.
+ */
+
+#define _MBX_HISTOGRAM_SUB_BUCKETS 4
+#define _MBX_HISTOGRAM_BUCKETS (32 * _MBX_HISTOGRAM_SUB_BUCKETS)
+
+struct _mbx_histogram {
+    atomic_ulong buckets[_MBX_HISTOGRAM_BUCKETS];
+    atomic_ulong count;
+    atomic_ulong max;
+};
+
+/**
+ * Reset all counters to zero.
+ */
+extern void _mbx_histogram_init(struct _mbx_histogram *h);
+
+/**
+ * Add a value. This never blocks and may be called from the audio thread.
+ * Values larger than 2^32 are counted in the last bucket.
+ */
+extern void _mbx_histogram_add(struct _mbx_histogram *h, uint64_t value);
+
+/**
+ * Estimate the value below which <tt>percent</tt> percent of the values
+ * fall. The estimate is the upper bound of the bucket where the percentile
+ * is found, but never more than the maximum value seen.
+ *
+ * @return The estimated percentile, or 0 if the histogram is empty.
+ */
+extern uint64_t _mbx_histogram_percentile(struct _mbx_histogram *h,
+        double percent);
+
+#endif
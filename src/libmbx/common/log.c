@@ -17,7 +17,6 @@ static enum log_level log_level = _MBX_DEFAULT_LOGLEVEL;
 
 static FILE *logfile = NULL; /* if NULL, log messages will go to stderr */
 
-static const char *component_to_string(enum _mbx_component);
 static const char *log_level_to_string(enum log_level);
 static void do_log(enum log_level, enum _mbx_component, const char *fmt,
         va_list ap);
@@ -99,7 +98,7 @@ static void do_log(enum log_level level, enum _mbx_component component,
         const char *format, va_list ap) {
     FILE *out = logfile == NULL ? stderr : logfile;
     fprintf(out, "%s: %s: ", log_level_to_string(level),
-        component_to_string(component));
+        mbx_log_component_name(component));
     vfprintf(out, format, ap);
     fprintf(out, "\n");
     fflush(out);
@@ -122,7 +121,7 @@ static const char *log_level_to_string(enum log_level level) {
     }
 }
 
-static const char *component_to_string(enum _mbx_component component) {
+const char *mbx_log_component_name(enum _mbx_component component) {
     switch ( component ) {
         case MBX_LOG_MP3LIB:
             return "MP3 handler";
@@ -134,6 +133,12 @@ static const char *component_to_string(enum _mbx_component component) {
             return "Memory management";
         case MBX_LOG_CONFIG:
             return "Config";
+        case MBX_LOG_RT_CHECK:
+            return "RT check";
+        case MBX_LOG_PCM:
+            return "Decoded audio";
+        case MBX_LOG_WORKER_POOL:
+            return "Worker pool";
         default:
             return "???";
     }
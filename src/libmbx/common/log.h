@@ -22,9 +22,26 @@ enum _mbx_component {
     /** The config file reader */
     MBX_LOG_CONFIG,
     /** The controller */
-    MBX_LOG_CONTROLLER
+    MBX_LOG_CONTROLLER,
+    /** The real-time checker, see rt_check.h */
+    MBX_LOG_RT_CHECK,
+    /** Decoded audio data. Used for memory accounting, see mem_stats.h */
+    MBX_LOG_PCM,
+    /** The worker threads, see worker_pool.h */
+    MBX_LOG_WORKER_POOL,
+    /** Number of components, not a component itself */
+    _MBX_N_COMPONENTS
 };
 
+/**
+ * Get a printable name of a component.
+ *
+ * @param  component
+ *         The component.
+ * @return The name, like "Controller". The string must not be freed.
+ */
+extern const char *mbx_log_component_name(enum _mbx_component component);
+
 /**
  * Set the logfile.
  *
@@ -16,6 +16,10 @@ const char *mbx_error_code_to_string(enum mbx_error_code err) {
             return "invalid device name for audio output";
         case MBX_FAILED_TO_LOAD_MP3:
             return "failed to load MP3 file";
+        case MBX_TOO_MANY_EVENTS:
+            return "too many scheduled events";
+        case MBX_LOAD_CANCELLED:
+            return "load cancelled";
         default:
             return "unknown error";
     }
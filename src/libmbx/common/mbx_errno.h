@@ -45,7 +45,18 @@ typedef enum mbx_error_code {
      * Failed to load an MP3 file. This happens either if the file cannot be
      * read, or if the MP3 data cannot be decoded.
      */
-    MBX_FAILED_TO_LOAD_MP3
+    MBX_FAILED_TO_LOAD_MP3,
+
+    /**
+     * Too many events are scheduled, and not applied yet.
+     */
+    MBX_TOO_MANY_EVENTS,
+
+    /**
+     * An asynchronous load was cancelled, because another file was loaded
+     * on the same deck or sample slot.
+     */
+    MBX_LOAD_CANCELLED
 
 } mbx_error_code;
 
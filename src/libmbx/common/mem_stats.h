@@ -0,0 +1,54 @@
+#ifndef MBX_MEM_STATS_H
+#define MBX_MEM_STATS_H
+
+#include <stddef.h>
+#include "log.h"
+
+/**
+ * Memory counters of a libmbx component, see mbx_mem_get_stats().
+ */
+typedef struct {
+    /** Number of bytes currently allocated. */
+    size_t current_bytes;
+    /** Highest value of current_bytes since the program was started. */
+    size_t peak_bytes;
+    /** Number of allocations since the program was started. */
+    unsigned long n_allocs;
+    /** Number of frees since the program was started. */
+    unsigned long n_frees;
+    /** The limit set with mbx_mem_set_limit(), 0 means unlimited. */
+    size_t limit_bytes;
+} mbx_mem_stats;
+
+/**
+ * Get the memory counters of a component.
+ *
+ * Every allocation in libmbx is accounted to the component using the memory.
+ * Decoded audio data is accounted to #MBX_LOG_PCM. The counters are updated
+ * without locking, so this function may be called at any time.
+ *
+ * @param  component
+ *         The component, use mbx_log_component_name() for a printable name.
+ * @param  stats
+ *         The current counters are put here.
+ */
+extern void mbx_mem_get_stats(enum _mbx_component component,
+        mbx_mem_stats *stats);
+
+/**
+ * Limit the memory used by a component.
+ *
+ * Only allocations that can fail gracefully respect the limit. At the moment,
+ * this is the decoded audio data (#MBX_LOG_PCM): Loading an MP3 file fails
+ * with #MBX_OUT_OF_MEMORY if the limit would be exceeded. Memory that is
+ * already allocated is not affected when the limit is lowered.
+ *
+ * @param  component
+ *         The component to be limited.
+ * @param  limit_bytes
+ *         The maximum number of bytes, or 0 for no limit.
+ */
+extern void mbx_mem_set_limit(enum _mbx_component component,
+        size_t limit_bytes);
+
+#endif
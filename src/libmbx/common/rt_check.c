@@ -0,0 +1,211 @@
+#include "rt_check.h"
+
+#ifndef MBX_RT_CHECK
+
+int mbx_rt_check_report(void) {
+    return 0;
+}
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <execinfo.h>
+#include "log.h"
+
+#define MAX_FRAMES 32
+#define MAX_VIOLATIONS 64
+
+/* A recorded violation. Violations are recorded in the audio thread, so the
+ * storage is preallocated. */
+struct violation {
+    const char *what;
+    void *frames[MAX_FRAMES];
+    int n_frames;
+};
+
+static struct violation violations[MAX_VIOLATIONS];
+static atomic_int n_recorded;  /* number of slots claimed by the audio thread */
+static atomic_int n_reported;  /* number of slots logged by report() */
+static atomic_int n_dropped;   /* violations that did not fit */
+
+static __thread int rt_depth = 0;
+static pthread_once_t warm_up_once = PTHREAD_ONCE_INIT;
+
+/* The first call to backtrace() loads libgcc, which allocates memory. */
+static void warm_up() {
+    void *frames[MAX_FRAMES];
+    backtrace(frames, MAX_FRAMES);
+}
+
+void _mbx_rt_enter(void) {
+    pthread_once(&warm_up_once, warm_up);
+    rt_depth++;
+}
+
+void _mbx_rt_leave(void) {
+    rt_depth--;
+}
+
+static int record_mode() {
+    const char *mode = getenv("MBX_RT_CHECK");
+    return mode != NULL && ! strcmp(mode, "record");
+}
+
+/* Write to stderr without stdio, which may be one of the wrapped functions */
+static void write_str(const char *s) {
+    ssize_t r = write(STDERR_FILENO, s, strlen(s));
+    (void) r;
+}
+
+void _mbx_rt_check(const char *what) {
+    int depth = rt_depth;
+    if ( depth == 0 ) {
+        return;
+    }
+    rt_depth = 0; /* don't report calls made by the violation handler */
+    if ( record_mode() ) {
+        int i = atomic_fetch_add(&n_recorded, 1);
+        if ( i < MAX_VIOLATIONS ) {
+            violations[i].what = what;
+            violations[i].n_frames = backtrace(violations[i].frames,
+                MAX_FRAMES);
+        }
+        else {
+            atomic_fetch_add(&n_dropped, 1);
+        }
+    }
+    else {
+        void *frames[MAX_FRAMES];
+        int n = backtrace(frames, MAX_FRAMES);
+        write_str("FATAL: RT check: ");
+        write_str(what);
+        write_str("() called from the audio thread.\n");
+        backtrace_symbols_fd(frames, n, STDERR_FILENO);
+        abort();
+    }
+    rt_depth = depth;
+}
+
+int mbx_rt_check_report(void) {
+    int n = atomic_load(&n_recorded);
+    int i, j, n_logged = 0;
+    if ( n > MAX_VIOLATIONS ) {
+        n = MAX_VIOLATIONS;
+    }
+    for ( i = atomic_load(&n_reported); i < n; i++ ) {
+        char **symbols = backtrace_symbols(violations[i].frames,
+            violations[i].n_frames);
+        mbx_log_error(MBX_LOG_RT_CHECK, "%s() called from the audio thread.",
+            violations[i].what);
+        for ( j=0; symbols != NULL && j<violations[i].n_frames; j++ ) {
+            mbx_log_error(MBX_LOG_RT_CHECK, "    %s", symbols[j]);
+        }
+        free(symbols);
+        n_logged++;
+    }
+    atomic_store(&n_reported, n);
+    if ( atomic_load(&n_dropped) > 0 ) {
+        mbx_log_error(MBX_LOG_RT_CHECK, "%d more violations were not recorded.",
+            atomic_exchange(&n_dropped, 0));
+    }
+    return n_logged;
+}
+
+/******************************************************************************
+ * Wrappers for libc functions.
+ * The linker redirects calls to malloc() etc. to __wrap_malloc() etc. when
+ * linking with -Wl,--wrap=malloc, see the RT_CHECK section in src/Makefile.
+ * Only calls from libmbx object files are redirected, libc and PulseAudio
+ * internals are not affected.
+ *****************************************************************************/
+
+extern void *__real_malloc(size_t size);
+extern void *__real_calloc(size_t n, size_t size);
+extern void *__real_realloc(void *p, size_t size);
+extern void __real_free(void *p);
+extern char *__real_strdup(const char *s);
+extern int __real_pthread_mutex_lock(pthread_mutex_t *m);
+extern FILE *__real_fopen(const char *path, const char *mode);
+extern int __real_vfprintf(FILE *f, const char *fmt, va_list ap);
+extern size_t __real_fwrite(const void *p, size_t size, size_t n, FILE *f);
+extern int __real_fputs(const char *s, FILE *f);
+extern int __real_fputc(int c, FILE *f);
+extern int __real_fflush(FILE *f);
+
+void *__wrap_malloc(size_t size) {
+    _mbx_rt_check("malloc");
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    _mbx_rt_check("calloc");
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *p, size_t size) {
+    _mbx_rt_check("realloc");
+    return __real_realloc(p, size);
+}
+
+void __wrap_free(void *p) {
+    _mbx_rt_check("free");
+    __real_free(p);
+}
+
+char *__wrap_strdup(const char *s) {
+    _mbx_rt_check("strdup");
+    return __real_strdup(s);
+}
+
+int __wrap_pthread_mutex_lock(pthread_mutex_t *m) {
+    _mbx_rt_check("pthread_mutex_lock");
+    return __real_pthread_mutex_lock(m);
+}
+
+FILE *__wrap_fopen(const char *path, const char *mode) {
+    _mbx_rt_check("fopen");
+    return __real_fopen(path, mode);
+}
+
+int __wrap_fprintf(FILE *f, const char *fmt, ...) {
+    va_list ap;
+    int r;
+    _mbx_rt_check("fprintf");
+    va_start(ap, fmt);
+    r = __real_vfprintf(f, fmt, ap);
+    va_end(ap);
+    return r;
+}
+
+int __wrap_vfprintf(FILE *f, const char *fmt, va_list ap) {
+    _mbx_rt_check("vfprintf");
+    return __real_vfprintf(f, fmt, ap);
+}
+
+size_t __wrap_fwrite(const void *p, size_t size, size_t n, FILE *f) {
+    _mbx_rt_check("fwrite");
+    return __real_fwrite(p, size, n, f);
+}
+
+int __wrap_fputs(const char *s, FILE *f) {
+    _mbx_rt_check("fputs");
+    return __real_fputs(s, f);
+}
+
+int __wrap_fputc(int c, FILE *f) {
+    _mbx_rt_check("fputc");
+    return __real_fputc(c, f);
+}
+
+int __wrap_fflush(FILE *f) {
+    _mbx_rt_check("fflush");
+    return __real_fflush(f);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef MBX_RT_CHECK_H
+#define MBX_RT_CHECK_H
+
+/*! \file rt_check.h
+ *  \brief Debug checker for the real-time audio thread.
+ *
+ * The code that renders audio must never allocate memory, lock a mutex, or
+ * do I/O, because any of these may block for an unbounded time and cause an
+ * audible drop-out.
+ *
+ * When music box is built with <tt>make RT_CHECK=1</tt>, the render threads
+ * of the controller and the audio output mark the audio threads while they
+ * render or copy audio. Calls to the _mbx_xmalloc() family, and calls to
+ * malloc(), free(), pthread_mutex_lock(), and stdio from libmbx code while
+ * the mark is set are violations. By default, a violation prints a
+ * backtrace and aborts. If the environment variable
+ * <tt>MBX_RT_CHECK</tt> is set to <tt>record</tt>, the backtrace is recorded
+ * instead, and can be logged later with mbx_rt_check_report().
+ *
+ * In normal builds, all functions in this file are no-ops.
+ */
+
+#ifdef MBX_RT_CHECK
+
+/* Mark the calling thread as rendering audio. Calls may be nested. */
+extern void _mbx_rt_enter(void);
+
+/* Remove the mark set by _mbx_rt_enter(). */
+extern void _mbx_rt_leave(void);
+
+/* Report a violation if the calling thread is marked. what is the name of
+ * the function that must not be called. */
+extern void _mbx_rt_check(const char *what);
+
+#else
+
+#define _mbx_rt_enter()     do { } while (0)
+#define _mbx_rt_leave()     do { } while (0)
+#define _mbx_rt_check(what) do { } while (0)
+
+#endif
+
+/**
+ * Log all violations recorded since the last call, see rt_check.h.
+ *
+ * This function must not be called from the audio thread. In builds without
+ * <tt>RT_CHECK=1</tt>, it does nothing and returns 0.
+ *
+ * @return The number of violations logged.
+ */
+extern int mbx_rt_check_report(void);
+
+#endif
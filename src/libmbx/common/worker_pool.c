@@ -0,0 +1,278 @@
+#define _GNU_SOURCE /* for the CPU affinity */
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "worker_pool.h"
+#include "log.h"
+#include "xmalloc.h"
+
+struct task {
+    _mbx_task_fn fn;
+    void *arg;
+};
+
+/* A deque of tasks in a ring. The owner pushes and pops at the tail, thieves
+ * take from the head. */
+struct deque {
+    pthread_mutex_t mutex;
+    struct task *tasks;
+    size_t capacity;  // a power of two
+    size_t head, tail;  // count forever, masked to index tasks
+};
+
+struct worker {
+    int index;
+    pthread_t thread;
+    struct deque deques[_MBX_N_PRIORITIES];
+};
+
+/* The pool. n_queued and n_background are protected by the mutex. A worker
+ * claims a task by decrementing n_queued before it looks for the task in
+ * the deques, so a claimed task is always in some deque. */
+static struct {
+    int n_workers;
+    struct worker *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    int n_queued[_MBX_N_PRIORITIES];
+    int n_background;  // running tasks below _MBX_PRIORITY_DECK_LOAD
+    unsigned next_worker;  // for tasks not submitted by a worker
+    int audio_cpu;
+    cpu_set_t background_cpus;
+} pool;
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* The worker running in this thread, or NULL. */
+static __thread struct worker *current = NULL;
+
+static void deque_init(struct deque *d) {
+    pthread_mutex_init(&d->mutex, NULL);
+    d->capacity = 16;
+    d->tasks = _mbx_xmalloc(MBX_LOG_WORKER_POOL,
+        d->capacity * sizeof(struct task));
+    d->head = d->tail = 0;
+}
+
+static void deque_push(struct deque *d, _mbx_task_fn fn, void *arg) {
+    struct task *t;
+    pthread_mutex_lock(&d->mutex);
+    if ( d->tail - d->head == d->capacity ) {
+        struct task *tasks = _mbx_xmalloc(MBX_LOG_WORKER_POOL,
+            2 * d->capacity * sizeof(struct task));
+        size_t i;
+        for ( i=d->head; i<d->tail; i++ ) {
+            tasks[i & ( 2 * d->capacity - 1 )] =
+                d->tasks[i & ( d->capacity - 1 )];
+        }
+        _mbx_xfree(d->tasks);
+        d->tasks = tasks;
+        d->capacity *= 2;
+    }
+    t = &d->tasks[d->tail++ & ( d->capacity - 1 )];
+    t->fn = fn;
+    t->arg = arg;
+    pthread_mutex_unlock(&d->mutex);
+}
+
+/* Take the newest task if owner, else the oldest. Returns 0 if the deque is
+ * empty. */
+static int deque_take(struct deque *d, int owner, struct task *t) {
+    int found;
+    pthread_mutex_lock(&d->mutex);
+    found = d->head != d->tail;
+    if ( found ) {
+        *t = owner ? d->tasks[--d->tail & ( d->capacity - 1 )]
+            : d->tasks[d->head++ & ( d->capacity - 1 )];
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return found;
+}
+
+/* Take a task of priority claimed by w: its own first, then stolen from the
+ * other workers, starting with the next one. */
+static void take(struct worker *w, int priority, struct task *t) {
+    int i;
+    for ( ;; ) {
+        for ( i=0; i<pool.n_workers; i++ ) {
+            struct worker *victim =
+                &pool.workers[( w->index + i ) % pool.n_workers];
+            if ( deque_take(&victim->deques[priority], victim == w, t) ) {
+                return;
+            }
+        }
+        // The task was taken by a worker whose own claim is still in a
+        // deque that was scanned already. Scan again.
+        sched_yield();
+    }
+}
+
+/* The most urgent priority with a task this worker may run, or -1. Called
+ * with the mutex held. */
+static int claim(void) {
+    int p;
+    for ( p=0; p<_MBX_N_PRIORITIES; p++ ) {
+        if ( pool.n_queued[p] == 0 ) {
+            continue;
+        }
+        if ( p == _MBX_PRIORITY_DECK_LOAD
+                || pool.n_background < pool.n_workers - 1 ) {
+            return p;
+        }
+        // Keep a worker free for deck loads.
+        return -1;
+    }
+    return -1;
+}
+
+static void *worker_main(void *userdata) {
+    struct worker *w = userdata;
+    struct task t;
+    int p;
+    current = w;
+    pthread_mutex_lock(&pool.mutex);
+    for ( ;; ) {
+        if ( ( p = claim() ) < 0 ) {
+            pthread_cond_wait(&pool.wakeup, &pool.mutex);
+            continue;
+        }
+        pool.n_queued[p]--;
+        pool.n_background += p != _MBX_PRIORITY_DECK_LOAD;
+        pthread_mutex_unlock(&pool.mutex);
+        take(w, p, &t);
+        t.fn(t.arg);
+        pthread_mutex_lock(&pool.mutex);
+        if ( p != _MBX_PRIORITY_DECK_LOAD ) {
+            pool.n_background--;
+            // A task that had to wait for this one may run now.
+            pthread_cond_signal(&pool.wakeup);
+        }
+    }
+    return NULL;
+}
+
+/* Reserve the last CPU the process may run on for audio, and size the pool
+ * to the others. */
+static void init_cpus(void) {
+    cpu_set_t allowed;
+    int cpu, n_cpus;
+    CPU_ZERO(&pool.background_cpus);
+    pool.audio_cpu = -1;
+    if ( sched_getaffinity(0, sizeof(allowed), &allowed) != 0 ) {
+        mbx_log_warn(MBX_LOG_WORKER_POOL, "Failed to get the CPU affinity. "
+            "No CPU is reserved for audio.");
+        pool.n_workers = 2;
+        return;
+    }
+    n_cpus = CPU_COUNT(&allowed);
+    for ( cpu=0; cpu<CPU_SETSIZE; cpu++ ) {
+        if ( CPU_ISSET(cpu, &allowed) ) {
+            CPU_SET(cpu, &pool.background_cpus);
+            if ( n_cpus > 1 ) {
+                pool.audio_cpu = cpu;
+            }
+        }
+    }
+    if ( pool.audio_cpu >= 0 ) {
+        CPU_CLR(pool.audio_cpu, &pool.background_cpus);
+    }
+    // With one worker, no task below _MBX_PRIORITY_DECK_LOAD could run.
+    pool.n_workers = n_cpus > 3 ? n_cpus - 1 : 2;
+}
+
+static void set_affinity(pthread_t thread) {
+    int r;
+    if ( pool.audio_cpu < 0 ) {
+        return;
+    }
+    if ( ( r = pthread_setaffinity_np(thread, sizeof(cpu_set_t),
+            &pool.background_cpus) ) != 0 ) {
+        mbx_log_warn(MBX_LOG_WORKER_POOL, "Failed to set the CPU affinity of "
+            "a background thread: %s", strerror(r));
+    }
+}
+
+static void start_pool(void) {
+    int i, p;
+    init_cpus();
+    pthread_mutex_init(&pool.mutex, NULL);
+    pthread_cond_init(&pool.wakeup, NULL);
+    for ( p=0; p<_MBX_N_PRIORITIES; p++ ) {
+        pool.n_queued[p] = 0;
+    }
+    pool.n_background = 0;
+    pool.next_worker = 0;
+    pool.workers = _mbx_xmalloc(MBX_LOG_WORKER_POOL,
+        pool.n_workers * sizeof(struct worker));
+    for ( i=0; i<pool.n_workers; i++ ) {
+        struct worker *w = &pool.workers[i];
+        w->index = i;
+        for ( p=0; p<_MBX_N_PRIORITIES; p++ ) {
+            deque_init(&w->deques[p]);
+        }
+    }
+    // The deques are complete before any worker steals from them.
+    for ( i=0; i<pool.n_workers; i++ ) {
+        struct worker *w = &pool.workers[i];
+        if ( pthread_create(&w->thread, NULL, worker_main, w) != 0 ) {
+            mbx_log_fatal(MBX_LOG_WORKER_POOL, "Failed to start a worker "
+                "thread.");
+            exit(-1);
+        }
+        set_affinity(w->thread);
+    }
+    if ( pool.audio_cpu >= 0 ) {
+        mbx_log_debug(MBX_LOG_WORKER_POOL, "Started %d workers, CPU %d is "
+            "reserved for audio.", pool.n_workers, pool.audio_cpu);
+    } else {
+        mbx_log_debug(MBX_LOG_WORKER_POOL, "Started %d workers, no CPU is "
+            "reserved for audio.", pool.n_workers);
+    }
+}
+
+void _mbx_pool_submit(enum _mbx_priority priority, _mbx_task_fn fn,
+        void *arg) {
+    struct worker *w;
+    pthread_once(&pool_once, start_pool);
+    if ( ( w = current ) == NULL ) {
+        pthread_mutex_lock(&pool.mutex);
+        w = &pool.workers[pool.next_worker++ % pool.n_workers];
+        pthread_mutex_unlock(&pool.mutex);
+    }
+    deque_push(&w->deques[priority], fn, arg);
+    pthread_mutex_lock(&pool.mutex);
+    pool.n_queued[priority]++;
+    pthread_cond_signal(&pool.wakeup);
+    pthread_mutex_unlock(&pool.mutex);
+}
+
+int _mbx_pool_get_n_workers(void) {
+    pthread_once(&pool_once, start_pool);
+    return pool.n_workers;
+}
+
+int _mbx_pool_get_audio_cpu(void) {
+    pthread_once(&pool_once, start_pool);
+    return pool.audio_cpu;
+}
+
+void _mbx_pool_set_background_affinity(pthread_t thread) {
+    pthread_once(&pool_once, start_pool);
+    set_affinity(thread);
+}
+
+void _mbx_pool_set_audio_affinity(pthread_t thread) {
+    cpu_set_t cpus;
+    int r;
+    pthread_once(&pool_once, start_pool);
+    if ( pool.audio_cpu < 0 ) {
+        return;
+    }
+    CPU_ZERO(&cpus);
+    CPU_SET(pool.audio_cpu, &cpus);
+    if ( ( r = pthread_setaffinity_np(thread, sizeof(cpus), &cpus) ) != 0 ) {
+        mbx_log_warn(MBX_LOG_WORKER_POOL, "Failed to move an audio thread to "
+            "CPU %d: %s", pool.audio_cpu, strerror(r));
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef MBX_WORKER_POOL_H
+#define MBX_WORKER_POOL_H
+
+#include <pthread.h>
+
+/*! \file worker_pool.h
+ *  \brief The worker threads running the background work of libmbx.
+ *
+ * There is one pool per process, started with the first task. It has one
+ * worker per CPU, except for the CPU reserved for audio, see
+ * _mbx_pool_get_audio_cpu(), and the workers never run there. Each worker
+ * has a deque of tasks per priority. A worker takes the tasks it submitted
+ * itself newest first, and steals the oldest task of another worker when
+ * its own deques are empty. Tasks of a higher priority are always taken
+ * before tasks of a lower priority, and at most all workers but one run
+ * tasks below #_MBX_PRIORITY_DECK_LOAD at a time, so a deck load starts
+ * right away even while the pool is busy.
+ *
+ * Tasks may block, for example on file I/O. They must not be submitted from
+ * the audio thread, because submitting takes a mutex.
+ */
+
+/**
+ * The priority of a task, from the most to the least urgent.
+ */
+enum _mbx_priority {
+    /** Loading a file on a deck, see mbx_ctrl_deck_load_async(). */
+    _MBX_PRIORITY_DECK_LOAD,
+    /** Loading a file into a sample slot. */
+    _MBX_PRIORITY_SAMPLE_LOAD,
+    /** Reading or decoding ahead of playback. */
+    _MBX_PRIORITY_PREFETCH,
+    /** Analysing files that are not played yet. */
+    _MBX_PRIORITY_ANALYSIS,
+    /** Number of priorities, not a priority itself */
+    _MBX_N_PRIORITIES
+};
+
+typedef void (*_mbx_task_fn)(void *arg);
+
+/**
+ * Run <tt>fn(arg)</tt> in a worker thread. Tasks submitted by a worker go to
+ * the worker's own deque, other tasks are spread over the workers.
+ */
+extern void _mbx_pool_submit(enum _mbx_priority priority, _mbx_task_fn fn,
+        void *arg);
+
+/**
+ * The number of worker threads.
+ */
+extern int _mbx_pool_get_n_workers(void);
+
+/**
+ * The CPU reserved for the audio threads, or <tt>-1</tt> if the process may
+ * only run on one CPU.
+ */
+extern int _mbx_pool_get_audio_cpu(void);
+
+/**
+ * Let <tt>thread</tt> run on the CPUs of the workers only. For background
+ * threads that are not workers, like the block decoder of block_cache.h.
+ */
+extern void _mbx_pool_set_background_affinity(pthread_t thread);
+
+/**
+ * Let <tt>thread</tt> run on the CPU reserved for audio only. Does nothing
+ * if no CPU is reserved.
+ */
+extern void _mbx_pool_set_audio_affinity(pthread_t thread);
+
+#endif
@@ -1,8 +1,79 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdalign.h>
+#include <stdatomic.h>
 #include "xmalloc.h"
+#include "mem_stats.h"
 #include "log.h"
+#include "rt_check.h"
+
+/* Each block starts with a header recording its size and component, such that
+ * _mbx_xfree() and _mbx_xrealloc() can update the counters. The header size
+ * keeps the user data aligned like memory returned by malloc(). */
+struct header {
+    size_t size;
+    enum _mbx_component component;
+};
+
+#define HEADER_SIZE ((sizeof(struct header) + alignof(max_align_t) - 1) \
+    / alignof(max_align_t) * alignof(max_align_t))
+
+struct counters {
+    atomic_size_t current;
+    atomic_size_t peak;
+    atomic_ulong n_allocs;
+    atomic_ulong n_frees;
+    atomic_size_t limit;
+};
+
+/* static storage is zero-initialized, which is a valid initial state for
+ * atomic types on all platforms we support */
+static struct counters counters[_MBX_N_COMPONENTS];
+
+static struct counters *counters_for(enum _mbx_component component) {
+    assert ( component >= 0 && component < _MBX_N_COMPONENTS );
+    return &counters[component];
+}
+
+/* Add size bytes, unless this exceeds the limit. Returns 0 if the limit
+ * would be exceeded and enforce_limit is true. */
+static int add(enum _mbx_component component, size_t size,
+        int enforce_limit) {
+    struct counters *c = counters_for(component);
+    size_t limit = atomic_load_explicit(&c->limit, memory_order_relaxed);
+    size_t current = atomic_fetch_add_explicit(&c->current, size,
+        memory_order_relaxed) + size;
+    size_t peak = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    if ( enforce_limit && limit > 0 && current > limit ) {
+        atomic_fetch_sub_explicit(&c->current, size, memory_order_relaxed);
+        return 0;
+    }
+    while ( current > peak && ! atomic_compare_exchange_weak_explicit(
+            &c->peak, &peak, current, memory_order_relaxed,
+            memory_order_relaxed) ) {
+        /* peak was reloaded by the failed CAS */
+    }
+    return 1;
+}
+
+static void sub(enum _mbx_component component, size_t size) {
+    atomic_fetch_sub_explicit(&counters_for(component)->current, size,
+        memory_order_relaxed);
+}
+
+static void count(atomic_ulong *counter) {
+    atomic_fetch_add_explicit(counter, 1, memory_order_relaxed);
+}
+
+static struct header *header_of(void *p) {
+    return (struct header *) ((char *) p - HEADER_SIZE);
+}
+
+static void *data_of(struct header *h) {
+    return (char *) h + HEADER_SIZE;
+}
 
 // return p unless out of memory
 static void *unless_out_of_memory(void *p) {
@@ -13,21 +84,107 @@ static void *unless_out_of_memory(void *p) {
     return p;
 }
 
-void *_mbx_xmalloc(size_t size) {
+/* Common implementation of the realloc functions. Returns NULL if the limit
+ * is exceeded (only if enforce_limit is true) or if the system is out of
+ * memory. */
+static void *do_realloc(enum _mbx_component component, void *p, size_t size,
+        int enforce_limit) {
+    struct header *h = p == NULL ? NULL : header_of(p);
+    size_t old_size = h == NULL ? 0 : h->size;
+    if ( h != NULL ) {
+        component = h->component;
+    }
+    if ( size > old_size && ! add(component, size - old_size,
+            enforce_limit) ) {
+        return NULL;
+    }
+    h = realloc(h, HEADER_SIZE + size);
+    if ( h == NULL ) {
+        if ( size > old_size ) {
+            sub(component, size - old_size);
+        }
+        return NULL;
+    }
+    if ( size < old_size ) {
+        sub(component, old_size - size);
+    }
+    if ( p == NULL ) {
+        count(&counters_for(component)->n_allocs);
+    }
+    h->size = size;
+    h->component = component;
+    return data_of(h);
+}
+
+void *_mbx_xmalloc(enum _mbx_component component, size_t size) {
+    _mbx_rt_check("_mbx_xmalloc");
     assert(size > 0);
-    return unless_out_of_memory(malloc(size));
+    return unless_out_of_memory(do_realloc(component, NULL, size, 0));
 }
 
-void *_mbx_xrealloc(void *p, size_t size) {
+void *_mbx_xrealloc(enum _mbx_component component, void *p, size_t size) {
+    _mbx_rt_check("_mbx_xrealloc");
     assert(size > 0);
-    return unless_out_of_memory(realloc(p, size));
+    return unless_out_of_memory(do_realloc(component, p, size, 0));
 }
 
-char *_mbx_xstrdup(const char *s) {
+void *_mbx_try_realloc(enum _mbx_component component, void *p, size_t size) {
+    _mbx_rt_check("_mbx_try_realloc");
+    assert(size > 0);
+    return do_realloc(component, p, size, 1);
+}
+
+char *_mbx_xstrdup(enum _mbx_component component, const char *s) {
+    char *copy;
+    size_t size;
+    _mbx_rt_check("_mbx_xstrdup");
     assert(s);
-    return unless_out_of_memory(strdup(s));
+    size = strlen(s) + 1;
+    copy = _mbx_xmalloc(component, size);
+    memcpy(copy, s, size);
+    return copy;
 }
 
 void _mbx_xfree(void *p) {
-    free(p);
+    struct header *h;
+    _mbx_rt_check("_mbx_xfree");
+    if ( p == NULL ) {
+        return;
+    }
+    h = header_of(p);
+    sub(h->component, h->size);
+    count(&counters_for(h->component)->n_frees);
+    free(h);
+}
+
+int _mbx_mem_account(enum _mbx_component component, long delta,
+        int blocks) {
+    if ( delta >= 0 && ! add(component, (size_t) delta, 1) ) {
+        return 0;
+    }
+    if ( delta < 0 ) {
+        sub(component, (size_t) -delta);
+    }
+    if ( blocks > 0 ) {
+        count(&counters_for(component)->n_allocs);
+    }
+    if ( blocks < 0 ) {
+        count(&counters_for(component)->n_frees);
+    }
+    return 1;
+}
+
+void mbx_mem_get_stats(enum _mbx_component component, mbx_mem_stats *stats) {
+    struct counters *c = counters_for(component);
+    stats->current_bytes = atomic_load_explicit(&c->current,
+        memory_order_relaxed);
+    stats->peak_bytes = atomic_load_explicit(&c->peak, memory_order_relaxed);
+    stats->n_allocs = atomic_load_explicit(&c->n_allocs, memory_order_relaxed);
+    stats->n_frees = atomic_load_explicit(&c->n_frees, memory_order_relaxed);
+    stats->limit_bytes = atomic_load_explicit(&c->limit, memory_order_relaxed);
+}
+
+void mbx_mem_set_limit(enum _mbx_component component, size_t limit_bytes) {
+    atomic_store_explicit(&counters_for(component)->limit, limit_bytes,
+        memory_order_relaxed);
 }
@@ -2,10 +2,30 @@
 #define MBX_XMALLOC
 
 #include <stddef.h>
+#include "log.h"
 
-extern void *_mbx_xmalloc(size_t size);
-extern void *_mbx_xrealloc(void *p, size_t size);
-extern char *_mbx_xstrdup(const char *s);
+/* All memory allocated by libmbx is tagged with the component that uses it,
+ * and accounted in the counters reported by mbx_mem_get_stats().
+ * Memory allocated with these functions must be freed with _mbx_xfree(). */
+extern void *_mbx_xmalloc(enum _mbx_component component, size_t size);
+extern void *_mbx_xrealloc(enum _mbx_component component, void *p,
+        size_t size);
+extern char *_mbx_xstrdup(enum _mbx_component component, const char *s);
 extern void _mbx_xfree(void *p);
 
+/* Like _mbx_xrealloc(), but returns NULL instead of terminating the
+ * application if the memory limit of the component (see mbx_mem_set_limit())
+ * would be exceeded, or if the system is out of memory. In that case, p is
+ * left untouched. */
+extern void *_mbx_try_realloc(enum _mbx_component component, void *p,
+        size_t size);
+
+/* Account memory that a component allocates without xmalloc, like mmap()ed
+ * regions. delta is the number of bytes allocated (positive) or freed
+ * (negative). blocks is 1 for a new block, -1 for a freed block, and 0 if an
+ * existing block changes its size. Returns 0 if a positive delta would exceed
+ * the component's memory limit; nothing is accounted in that case. */
+extern int _mbx_mem_account(enum _mbx_component component, long delta,
+        int blocks);
+
 #endif
@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <dirent.h>
@@ -15,10 +16,18 @@ struct _mbx_config {
     const char *headphones_output_device_name;
     const char *speakers_output_device_name;
     const char *mp3dir;
+    const char *mlock;
+    const char *compressed;
+    const char *decks;
+    const char *sample_slots;
+    const char *lookahead;
+    const char *idle;
+    const char *overload;
+    const char *dither;
 };
 
 mbx_error_code mbx_config_new(mbx_config *cfg_p) {
-    mbx_config cfg = (mbx_config) _mbx_xmalloc(sizeof(struct _mbx_config));
+    mbx_config cfg = (mbx_config) _mbx_xmalloc(MBX_LOG_CONFIG, sizeof(struct _mbx_config));
     bzero(cfg, sizeof(struct _mbx_config));
     *cfg_p = cfg;
     return MBX_SUCCESS;
@@ -33,6 +42,14 @@ mbx_error_code mbx_config_new(mbx_config *cfg_p) {
  * headphones alsa_output.pci-0000_00_1b.0.analog-stereo
  * speakers alsa_output.pci-0000_00_1b.0.analog-stereo
  * mp3dir /home/fabian/music/
+ * mlock yes
+ * compressed no
+ * decks 4
+ * samples 32
+ * lookahead 20
+ * idle 2000
+ * overload 75
+ * dither yes
  * ----------------------------------------------------------------------------
  */
 mbx_error_code mbx_config_load_file(mbx_config cfg, const char *path) {
@@ -55,13 +72,37 @@ mbx_error_code mbx_config_load_file(mbx_config cfg, const char *path) {
             result = MBX_CONFIG_FILE_SYNTAX_ERROR;
         }
         if ( ! strcmp("speakers", var) ) {
-            cfg->speakers_output_device_name = _mbx_xstrdup(value);
+            cfg->speakers_output_device_name = _mbx_xstrdup(MBX_LOG_CONFIG, value);
         }
         else if ( ! strcmp("headphones", var) ) {
-            cfg->headphones_output_device_name = _mbx_xstrdup(value);
+            cfg->headphones_output_device_name = _mbx_xstrdup(MBX_LOG_CONFIG, value);
         }
         else if ( ! strcmp("mp3dir", var) ) {
-            cfg->mp3dir = _mbx_xstrdup(value);
+            cfg->mp3dir = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("mlock", var) ) {
+            cfg->mlock = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("compressed", var) ) {
+            cfg->compressed = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("decks", var) ) {
+            cfg->decks = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("samples", var) ) {
+            cfg->sample_slots = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("lookahead", var) ) {
+            cfg->lookahead = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("idle", var) ) {
+            cfg->idle = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("overload", var) ) {
+            cfg->overload = _mbx_xstrdup(MBX_LOG_CONFIG, value);
+        }
+        else if ( ! strcmp("dither", var) ) {
+            cfg->dither = _mbx_xstrdup(MBX_LOG_CONFIG, value);
         }
         else {
             result = MBX_CONFIG_FILE_SYNTAX_ERROR;
@@ -72,7 +113,7 @@ mbx_error_code mbx_config_load_file(mbx_config cfg, const char *path) {
 }
 
 void mbx_config_set(mbx_config cfg, mbx_config_var var, const char *value) {
-    char *val = _mbx_xstrdup(value);
+    char *val = _mbx_xstrdup(MBX_LOG_CONFIG, value);
     switch ( var ) {
         case MBX_CFG_SPEAKERS_DEVICE:
             cfg->speakers_output_device_name = val;
@@ -83,11 +124,46 @@ void mbx_config_set(mbx_config cfg, mbx_config_var var, const char *value) {
         case MBX_CFG_MP3DIR:
             cfg->mp3dir = val;
             break;
+        case MBX_CFG_MLOCK:
+            cfg->mlock = val;
+            break;
+        case MBX_CFG_COMPRESSED:
+            cfg->compressed = val;
+            break;
+        case MBX_CFG_DECKS:
+            cfg->decks = val;
+            break;
+        case MBX_CFG_SAMPLE_SLOTS:
+            cfg->sample_slots = val;
+            break;
+        case MBX_CFG_LOOKAHEAD:
+            cfg->lookahead = val;
+            break;
+        case MBX_CFG_IDLE:
+            cfg->idle = val;
+            break;
+        case MBX_CFG_OVERLOAD:
+            cfg->overload = val;
+            break;
+        case MBX_CFG_DITHER:
+            cfg->dither = val;
+            break;
         default:
             assert("Unknown enum value for mbx_config_var" == NULL);
     }
 }
 
+/* 1 if value is a number between 1 and max. */
+static int is_count(const char *value, long max) {
+    char *endp;
+    long n;
+    if ( value == NULL || *value == '\0' ) {
+        return 0;
+    }
+    n = strtol(value, &endp, 10);
+    return *endp == '\0' && n >= 1 && n <= max;
+}
+
 mbx_error_code mbx_config_check(mbx_config cfg, mbx_config_var var,
         int *result) {
     DIR *mp3dir;
@@ -108,6 +184,33 @@ mbx_error_code mbx_config_check(mbx_config cfg, mbx_config_var var,
                 }
             }
             return MBX_SUCCESS;
+        case MBX_CFG_MLOCK:
+            *result = cfg->mlock != NULL && ( ! strcmp(cfg->mlock, "yes")
+                || ! strcmp(cfg->mlock, "no") );
+            return MBX_SUCCESS;
+        case MBX_CFG_COMPRESSED:
+            *result = cfg->compressed != NULL && ( ! strcmp(cfg->compressed, "yes")
+                || ! strcmp(cfg->compressed, "no") );
+            return MBX_SUCCESS;
+        case MBX_CFG_DECKS:
+            *result = is_count(cfg->decks, MBX_CTRL_MAX_DECKS);
+            return MBX_SUCCESS;
+        case MBX_CFG_SAMPLE_SLOTS:
+            *result = is_count(cfg->sample_slots, MBX_CTRL_MAX_SAMPLE_SLOTS);
+            return MBX_SUCCESS;
+        case MBX_CFG_LOOKAHEAD:
+            *result = is_count(cfg->lookahead, MBX_CTRL_MAX_LOOKAHEAD_MS);
+            return MBX_SUCCESS;
+        case MBX_CFG_IDLE:
+            *result = is_count(cfg->idle, MBX_CTRL_MAX_IDLE_MS);
+            return MBX_SUCCESS;
+        case MBX_CFG_OVERLOAD:
+            *result = is_count(cfg->overload, MBX_CTRL_MAX_OVERLOAD_PERCENT);
+            return MBX_SUCCESS;
+        case MBX_CFG_DITHER:
+            *result = cfg->dither != NULL && ( ! strcmp(cfg->dither, "yes")
+                || ! strcmp(cfg->dither, "no") );
+            return MBX_SUCCESS;
         default:
             assert("Unknown enum value for mbx_config_var" == NULL);
     }
@@ -121,6 +224,22 @@ const char *mbx_config_get(mbx_config cfg, mbx_config_var var) {
             return cfg->headphones_output_device_name;
         case MBX_CFG_MP3DIR:
             return cfg->mp3dir;
+        case MBX_CFG_MLOCK:
+            return cfg->mlock;
+        case MBX_CFG_COMPRESSED:
+            return cfg->compressed;
+        case MBX_CFG_DECKS:
+            return cfg->decks;
+        case MBX_CFG_SAMPLE_SLOTS:
+            return cfg->sample_slots;
+        case MBX_CFG_LOOKAHEAD:
+            return cfg->lookahead;
+        case MBX_CFG_IDLE:
+            return cfg->idle;
+        case MBX_CFG_OVERLOAD:
+            return cfg->overload;
+        case MBX_CFG_DITHER:
+            return cfg->dither;
         default:
             assert("Unknown enum value for mbx_config_var" == NULL);
     }
@@ -130,6 +249,14 @@ void mbx_config_free(mbx_config cfg) {
     _mbx_xfree((void *) cfg->speakers_output_device_name);
     _mbx_xfree((void *) cfg->headphones_output_device_name);
     _mbx_xfree((void *) cfg->mp3dir);
+    _mbx_xfree((void *) cfg->mlock);
+    _mbx_xfree((void *) cfg->compressed);
+    _mbx_xfree((void *) cfg->decks);
+    _mbx_xfree((void *) cfg->sample_slots);
+    _mbx_xfree((void *) cfg->lookahead);
+    _mbx_xfree((void *) cfg->idle);
+    _mbx_xfree((void *) cfg->overload);
+    _mbx_xfree((void *) cfg->dither);
     bzero(cfg, sizeof(struct _mbx_config));
     _mbx_xfree(cfg);
 }
@@ -25,7 +25,61 @@ typedef enum {
     /**
      * The path to the directory that contains the mp3 files.
      */
-    MBX_CFG_MP3DIR
+    MBX_CFG_MP3DIR,
+    /**
+     * If set to <tt>yes</tt>, decoded audio data is locked into RAM with
+     * mlock(), such that it can never be swapped out. This requires a
+     * sufficient <tt>RLIMIT_MEMLOCK</tt> (see <tt>ulimit -l</tt>).
+     * Any other value, or no value, disables locking.
+     */
+    MBX_CFG_MLOCK,
+    /**
+     * If set to <tt>yes</tt>, MP3 tracks are kept compressed in memory, and
+     * decoded block by block while they are played. This needs about a
+     * tenth of the memory, and costs a helper thread decoding ahead. Other
+     * files, like WAV files, are always decoded when they are loaded.
+     * Any other value, or no value, decodes tracks completely when they
+     * are loaded.
+     */
+    MBX_CFG_COMPRESSED,
+    /**
+     * The number of decks, between 1 and #MBX_CTRL_MAX_DECKS. The default
+     * is #MBX_CTRL_DEFAULT_DECKS.
+     */
+    MBX_CFG_DECKS,
+    /**
+     * The number of sample slots, between 1 and #MBX_CTRL_MAX_SAMPLE_SLOTS.
+     * The default is #MBX_CTRL_DEFAULT_SAMPLE_SLOTS.
+     */
+    MBX_CFG_SAMPLE_SLOTS,
+    /**
+     * The time in milliseconds that audio is rendered ahead of playback,
+     * between 1 and #MBX_CTRL_MAX_LOOKAHEAD_MS. A longer lookahead survives
+     * longer stalls of the system, and adds to the latency of the controls.
+     * The default is #MBX_CTRL_DEFAULT_LOOKAHEAD_MS.
+     */
+    MBX_CFG_LOOKAHEAD,
+    /**
+     * The time in milliseconds an output plays silence before its stream
+     * is corked, between 1 and #MBX_CTRL_MAX_IDLE_MS. A corked output
+     * renders nothing and does not wake up the CPU, until something is
+     * played on it. The default is #MBX_CTRL_DEFAULT_IDLE_MS.
+     */
+    MBX_CFG_IDLE,
+    /**
+     * The render load in percent above which quality is reduced to save CPU
+     * time, between 1 and #MBX_CTRL_MAX_OVERLOAD_PERCENT. The interpolation,
+     * the time-stretching, and the polyphony of the samples are reduced in
+     * steps, and restored when the load is back to normal. The default is
+     * #MBX_CTRL_DEFAULT_OVERLOAD_PERCENT.
+     */
+    MBX_CFG_OVERLOAD,
+    /**
+     * If set to <tt>yes</tt>, decoded audio is dithered when it is reduced
+     * to 16 bit, which makes quiet passages sound cleaner at the cost of a
+     * low noise floor. Any other value, or no value, only rounds.
+     */
+    MBX_CFG_DITHER
 } mbx_config_var;
 
 /**
@@ -56,6 +110,12 @@ extern mbx_error_code mbx_config_new(mbx_config *cfg_p);
 headphones alsa_output.pci-0000_00_1b.0.analog-stereo
 speakers alsa_output.pci-0000_00_1b.0.analog-stereo
 mp3dir /home/fabian/music/
+mlock yes
+compressed no
+decks 4
+samples 32
+lookahead 20
+idle 2000
 
    @endverbatim
  *
@@ -94,6 +154,12 @@ extern void mbx_config_set(mbx_config cfg, mbx_config_var var,
  *     #MBX_CFG_SPEAKERS_DEVICE, the function checks if the device exists.
  * <li>If <tt>var</tt> is #MBX_CFG_MP3DIR, the function checks if the
  *     directory exists and can be opened.
+ * <li>If <tt>var</tt> is #MBX_CFG_MLOCK, #MBX_CFG_COMPRESSED, or
+ *     #MBX_CFG_DITHER, the function checks if the value is <tt>yes</tt> or
+ *     <tt>no</tt>.
+ * <li>If <tt>var</tt> is #MBX_CFG_DECKS, #MBX_CFG_SAMPLE_SLOTS,
+ *     #MBX_CFG_LOOKAHEAD, #MBX_CFG_IDLE, or #MBX_CFG_OVERLOAD, the function
+ *     checks if the value is a number within the limits.
  * </ul>
  *
  * @param  cfg
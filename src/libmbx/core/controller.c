@@ -1,283 +1,1203 @@
 #include <assert.h>
 #include <unistd.h>
+#include <stdlib.h>
+#include <math.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include "controller.h"
 #include "libmbx/common/log.h"
 #include "libmbx/out/audio_output.h"
 #include "libmbx/common/mbx_errno.h"
 #include "libmbx/common/xmalloc.h"
+#include "libmbx/common/rt_check.h"
+#include "libmbx/common/worker_pool.h"
+#include "libmbx/mp3lib/pcm_arena.h"
+#include "libmbx/mp3lib/pcm_convert.h"
+#include "mixer.h"
+#include "varispeed.h"
+#include "scheduler.h"
+#include "voice_pool.h"
+#include "governor.h"
+#include "loader.h"
+#include "fader.h"
+#include "filter_bank.h"
+#include "graph.h"
+#include "ring.h"
 
-/* If buffer size exceeds 8 seconds, something is wrong... */
-#define MAX_SAMPLES_IN_BUFFER (MBX_SAMPLE_RATE * 2 * 8)
+/* Number of frames the render thread renders on the float mix bus at a
+ * time. Blocks are only shorter where a scheduled event splits them. */
+#define RENDER_BLOCK_FRAMES 128
 
-/*
- * The controller has two decks: deck A and deck B.
- * A deck is like a turntable.
- * You can load an MP3 file into a deck, and you can use the crossfacer
- * to mix the decks together.
- */
-struct deck {
-    _mbx_track track;
-    double vol;
-};
+/* The frames until the next event of an output when no event is scheduled,
+ * see _mbx_scheduler_frames_until_next(). */
+#define NO_EVENT ((size_t) INT64_MAX)
+
+/* SCHED_FIFO priority of the render threads, like the real-time threads of
+ * PulseAudio. */
+#define RENDER_THREAD_PRIORITY 5
 
 /*
  * The controller has two outputs: One for the speakers, one for the
  * headphones. The struct out represents one output.
+ *
+ * Each output has a render thread, which renders the output's graph block
+ * by block into a ring, until the lookahead is buffered. The output
+ * callback only copies from the ring, and wakes up the render thread. The
+ * ring is sized for the lookahead, see ring.h.
+ *
+ * When the graph was silent for the idle time, the render thread corks the
+ * output's stream and sleeps, with the output's clock following the wall
+ * clock. It uncorks the stream when an event is scheduled within the
+ * lookahead.
  */
 struct out {
     _mbx_out out;
-    sample_t buf_left[MAX_SAMPLES_IN_BUFFER];   // left stereo channel
-    sample_t buf_right[MAX_SAMPLES_IN_BUFFER];  // right stereo channel
-    sample_t *read_pos_left;
-    sample_t *read_pos_right;
-    sample_t *write_pos_left;
-    sample_t *write_pos_right;
+    const char *name;  // for log messages
+    struct _mbx_ring ring;  // from the render thread to the callback
+    size_t lookahead;  // frames rendered ahead, a multiple of the block size
+    pthread_t render_thread;
+    sem_t render_wakeup;  // posted when the callback took frames
+    atomic_int render_running;
+    int render_started;
+    atomic_int connected;  // set when out can be corked
+    size_t idle_timeout;  // silent frames before the stream is corked
+    size_t n_idle_frames;  // silent frames rendered, owned by the render thread
+    // While the stream is corked, the clock follows the wall clock: it was
+    // idle_clock at idle_since_ns on the monotonic clock. idle_since_ns is 0
+    // while the stream is not corked.
+    atomic_llong idle_since_ns;
+    atomic_llong idle_clock;
+    // Performance counters of the render thread, see mbx_out_stats.
+    atomic_ulong render_busy_ns;
+    atomic_ulong render_period_ns;
+    atomic_ulong render_max_load;  // in 1/100 percent
+    // Incremented before and after each block, so it is odd while the
+    // render thread renders a block. See retire().
+    atomic_ulong n_blocks;
+    struct _mbx_scheduler scheduler;  // events on this output's clock
+    struct _mbx_graph_slot graph;  // renders the mix bus, see graph.h
+    mbx_ctrl ctrl;  // for the nodes of the graph
+    enum _mbx_track_head head;
+    // playing[deck] is 1 while the head of deck plays on this output. It is
+    // set by events, and cleared by the deck's source node when the head
+    // stopped. Owned by the render thread.
+    char *playing;
+};
+
+/*
+ * A track replaced on a deck or a sample slot may still be used by the
+ * render threads, in the blocks they are rendering. It is retired instead of
+ * freed, with the block counters of the outputs, and freed by the control
+ * thread once each render thread finished that block, like the graphs of a
+ * graph slot (see graph.h).
+ */
+struct retired {
+    _mbx_track track;
+    unsigned long speakers_blocks;
+    unsigned long headphones_blocks;
+};
+
+/*
+ * Scheduled events, see scheduler.h. The target of an event is a deck or a
+ * sample slot, depending on the action.
+ */
+enum event_action {
+    EVENT_DECK_PLAY,
+    EVENT_DECK_PAUSE,
+    EVENT_DECK_ACTIVATE,  // add a deck whose head is playing to the list
+    EVENT_DECK_DOUBLE,    // start a copy of the source deck in sync with it
+    EVENT_SAMPLE_PLAY,
+    EVENT_SAMPLE_STOP
 };
 
 /*
  * This is the data structure for the controller.
+ * A deck is like a turntable. You can load an MP3 file into a deck, and you
+ * can use the crossfader to mix the decks together. The decks and sample
+ * slots are indexed, their state is kept in arrays.
  */
 struct _mbx_ctrl {
-    struct deck deck_a;
-    struct deck deck_b;
-    _mbx_track samples[MAX_SAMPLE_FILES];
+    int n_decks;
+    _mbx_track *decks;  // the track loaded on each deck, or NULL
+    struct _mbx_fader *faders;  // volume, pan and crossfader side of each deck
+    struct _mbx_filter_bank *filters;  // EQ and sweep filter of each deck
+    char *eq_used;  // the decks with an EQ node in the speakers' graph
+    int n_samples;
+    _mbx_track *samples;  // the track loaded into each slot, or NULL
+    atomic_uint *sample_generations;  // see voice_pool.h
+    struct _mbx_voice_pool voices;  // plays the samples, see voice_pool.h
+    // Reduces quality when the speakers' render thread is overloaded, see
+    // governor.h. The voices are rendered for the speakers only, and the
+    // speakers must not drop out, so their load is the one governed.
+    struct _mbx_governor *governor;
+    struct _mbx_loader loader;  // runs the asynchronous loads
+    // The latest asynchronous load of each deck and slot, or NULL. Loads
+    // that are not the latest on their target are cancelled.
+    struct _mbx_load_job **deck_jobs;
+    struct _mbx_load_job **sample_jobs;
     struct out speakers;
     struct out headphones;
-    struct deck *headphones_input;
-    double crossfader;
+    struct retired *retired;  // replaced tracks, not freed yet
+    int n_retired;
+    int max_retired;
+    _Atomic float crossfader;  // -1 is side A, 1 is side B
+    atomic_int crossfader_curve;
+    int compressed;  // keep tracks compressed in memory, see MBX_CFG_COMPRESSED
 };
 
 /* Helper function for the initialization of a new controller */
-static void init_deck(struct deck *deck);
-static void init_out(struct out *out);
-static mbx_error_code load(_mbx_track *track_p, const char *path);
+static int get_count(mbx_config cfg, mbx_config_var var, const char *name,
+        int default_count);
+static void init_out(struct out *out, mbx_ctrl ctrl, const char *name,
+        enum _mbx_track_head head, size_t lookahead, size_t idle_timeout);
+static void start_render_thread(struct out *out);
+static void install(mbx_ctrl ctrl, _mbx_track *track_p,
+        atomic_uint *generation, _mbx_track track);
+static void retire(mbx_ctrl ctrl, _mbx_track track);
+static void free_retired(mbx_ctrl ctrl, int all);
+static mbx_error_code load(mbx_ctrl ctrl, _mbx_track *track_p,
+        atomic_uint *generation, const char *path, int compressed);
+static mbx_load_job load_async(mbx_ctrl ctrl, int sample, int target,
+        const char *path, int compressed, mbx_load_cb cb, void *userdata);
+static struct _mbx_load_job **latest_job(mbx_ctrl ctrl,
+        struct _mbx_load_job *job);
+static void cancel_latest(struct _mbx_load_job **latest);
+static mbx_error_code schedule(struct out *out, int64_t time,
+        enum event_action action, int target);
+static mbx_error_code push_event(struct out *out,
+        const struct _mbx_event *event);
 
 /* The output callbacks are called by the audio_output when audio data must
- * be written to the output device. */
-static void output_cb_speakers(sample_t *left, sample_t *right,
-    size_t n_samples, void *userdata);
-static void output_cb_headphones(sample_t *left, sample_t *right,
-    size_t n_samples, void *userdata);
+ * be written to the output device. They copy the audio data rendered by the
+ * render threads. */
+static size_t output_cb_speakers(sample_t *frames, size_t n_frames,
+    void *userdata);
+static size_t output_cb_headphones(sample_t *frames, size_t n_frames,
+    void *userdata);
+
+/* The render graphs of the outputs */
+static struct _mbx_graph *speakers_graph(mbx_ctrl ctrl);
+static struct _mbx_graph *headphones_graph(mbx_ctrl ctrl);
 
 mbx_error_code mbx_ctrl_new(mbx_ctrl *ctrl_p, mbx_config cfg) {
     mbx_error_code r;
     int i;
-    const char *speakers_dev, *headphones_dev;
-    mbx_ctrl ctrl = _mbx_xmalloc(sizeof(struct _mbx_ctrl));
-    init_deck(&ctrl->deck_a);
-    init_deck(&ctrl->deck_b);
-    for ( i=0; i<MAX_SAMPLE_FILES; i++ ) {
+    const char *speakers_dev, *headphones_dev, *mlock, *compressed, *dither;
+    size_t lookahead, idle_timeout;
+    int overload;
+    mbx_ctrl ctrl = _mbx_xmalloc(MBX_LOG_CONTROLLER, sizeof(struct _mbx_ctrl));
+    _mbx_varispeed_init();
+    _mbx_fader_init();
+    ctrl->n_decks = get_count(cfg, MBX_CFG_DECKS, "decks",
+        MBX_CTRL_DEFAULT_DECKS);
+    ctrl->decks = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        ctrl->n_decks * sizeof(_mbx_track));
+    ctrl->faders = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        ctrl->n_decks * sizeof(struct _mbx_fader));
+    for ( i=0; i<ctrl->n_decks; i++ ) {
+        ctrl->decks[i] = NULL;
+        // The first two decks are on the crossfader, like on a DJ mixer.
+        _mbx_fader_reset(&ctrl->faders[i], i == 0 ? MBX_CROSSFADER_SIDE_A
+            : i == 1 ? MBX_CROSSFADER_SIDE_B : MBX_CROSSFADER_THRU);
+    }
+    ctrl->filters = _mbx_filter_bank_new(ctrl->n_decks);
+    ctrl->eq_used = _mbx_xmalloc(MBX_LOG_CONTROLLER, ctrl->n_decks);
+    bzero(ctrl->eq_used, ctrl->n_decks);
+    atomic_init(&ctrl->crossfader, 0);
+    atomic_init(&ctrl->crossfader_curve, MBX_CROSSFADER_CONSTANT_POWER);
+    ctrl->n_samples = get_count(cfg, MBX_CFG_SAMPLE_SLOTS, "samples",
+        MBX_CTRL_DEFAULT_SAMPLE_SLOTS);
+    ctrl->samples = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        ctrl->n_samples * sizeof(_mbx_track));
+    ctrl->sample_generations = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        ctrl->n_samples * sizeof(atomic_uint));
+    for ( i=0; i<ctrl->n_samples; i++ ) {
         ctrl->samples[i] = NULL;
+        atomic_init(&ctrl->sample_generations[i], 0);
+    }
+    _mbx_voice_pool_init(&ctrl->voices);
+    ctrl->retired = NULL;
+    ctrl->n_retired = 0;
+    ctrl->max_retired = 0;
+    _mbx_loader_init(&ctrl->loader);
+    ctrl->deck_jobs = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        ctrl->n_decks * sizeof(struct _mbx_load_job *));
+    for ( i=0; i<ctrl->n_decks; i++ ) {
+        ctrl->deck_jobs[i] = NULL;
+    }
+    ctrl->sample_jobs = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        ctrl->n_samples * sizeof(struct _mbx_load_job *));
+    for ( i=0; i<ctrl->n_samples; i++ ) {
+        ctrl->sample_jobs[i] = NULL;
     }
-    init_out(&ctrl->speakers);
-    init_out(&ctrl->headphones);
+    overload = get_count(cfg, MBX_CFG_OVERLOAD, "overload percent",
+        MBX_CTRL_DEFAULT_OVERLOAD_PERCENT);
+    ctrl->governor = _mbx_governor_new(overload, &ctrl->voices);
+    // The lookahead is rounded up to whole blocks.
+    lookahead = (size_t) get_count(cfg, MBX_CFG_LOOKAHEAD,
+        "lookahead milliseconds", MBX_CTRL_DEFAULT_LOOKAHEAD_MS)
+        * MBX_SAMPLE_RATE / 1000;
+    lookahead = ( lookahead + RENDER_BLOCK_FRAMES - 1 )
+        / RENDER_BLOCK_FRAMES * RENDER_BLOCK_FRAMES;
+    idle_timeout = (size_t) get_count(cfg, MBX_CFG_IDLE, "idle milliseconds",
+        MBX_CTRL_DEFAULT_IDLE_MS) * MBX_SAMPLE_RATE / 1000;
+    init_out(&ctrl->speakers, ctrl, "speakers", MBX_TRACK_SPEAKER, lookahead,
+        idle_timeout);
+    init_out(&ctrl->headphones, ctrl, "headphones", MBX_TRACK_CUE, lookahead,
+        idle_timeout);
+    _mbx_graph_slot_install(&ctrl->speakers.graph, speakers_graph(ctrl));
+    _mbx_graph_slot_install(&ctrl->headphones.graph, headphones_graph(ctrl));
+    // The render threads fill the rings before the outputs ask for audio.
+    start_render_thread(&ctrl->speakers);
+    start_render_thread(&ctrl->headphones);
+    mlock = mbx_config_get(cfg, MBX_CFG_MLOCK);
+    _mbx_pcm_arena_set_mlock(mlock != NULL && ! strcmp(mlock, "yes"));
+    dither = mbx_config_get(cfg, MBX_CFG_DITHER);
+    _mbx_pcm_convert_set_dither(dither != NULL && ! strcmp(dither, "yes"));
+    compressed = mbx_config_get(cfg, MBX_CFG_COMPRESSED);
+    ctrl->compressed = compressed != NULL && ! strcmp(compressed, "yes");
     speakers_dev = mbx_config_get(cfg, MBX_CFG_SPEAKERS_DEVICE);
-    if ( (r = _mbx_out_new(&ctrl->speakers.out, "speakers",
-            speakers_dev, output_cb_speakers, ctrl)) != MBX_SUCCESS ) {
+    if ( (r = _mbx_out_new(&ctrl->speakers.out, "speakers", speakers_dev,
+            lookahead, output_cb_speakers, ctrl)) != MBX_SUCCESS ) {
         mbx_ctrl_shutdown_and_free(ctrl);
         return r;
     }
+    atomic_store(&ctrl->speakers.connected, 1);
     headphones_dev = mbx_config_get(cfg, MBX_CFG_HEADPHONES_DEVICE);
-    if ( (r = _mbx_out_new(&ctrl->headphones.out, "headphones",
-            headphones_dev, output_cb_headphones, ctrl)) != MBX_SUCCESS ) {
+    if ( (r = _mbx_out_new(&ctrl->headphones.out, "headphones", headphones_dev,
+            lookahead, output_cb_headphones, ctrl)) != MBX_SUCCESS ) {
         mbx_ctrl_shutdown_and_free(ctrl);
         return r;
     }
+    atomic_store(&ctrl->headphones.connected, 1);
     *ctrl_p = ctrl;
     return MBX_SUCCESS;
 }
 
-static void init_deck(struct deck *deck) {
-    deck->track = NULL;
-    deck->vol = 1;
+/* The number of decks, sample slots, or milliseconds configured in var. */
+static int get_count(mbx_config cfg, mbx_config_var var, const char *name,
+        int default_count) {
+    int ok;
+    if ( mbx_config_get(cfg, var) == NULL ) {
+        return default_count;
+    }
+    mbx_config_check(cfg, var, &ok);
+    if ( ! ok ) {
+        mbx_log_warn(MBX_LOG_CONTROLLER, "Invalid number of %s: %s. Using %d.",
+            name, mbx_config_get(cfg, var), default_count);
+        return default_count;
+    }
+    return atoi(mbx_config_get(cfg, var));
 }
 
-static void init_out(struct out *out) {
-    bzero(out->buf_left, MAX_SAMPLES_IN_BUFFER * sizeof(sample_t));
-    bzero(out->buf_right, MAX_SAMPLES_IN_BUFFER * sizeof(sample_t));
-    out->read_pos_left = out->buf_left;
-    out->read_pos_right = out->buf_right;
-    out->write_pos_left = out->buf_left;
-    out->write_pos_right = out->buf_right;
+static void init_out(struct out *out, mbx_ctrl ctrl, const char *name,
+        enum _mbx_track_head head, size_t lookahead, size_t idle_timeout) {
+    out->name = name;
+    // The render thread fills the ring up to less than a block above the
+    // lookahead.
+    _mbx_ring_init(&out->ring, lookahead + RENDER_BLOCK_FRAMES);
+    out->lookahead = lookahead;
+    sem_init(&out->render_wakeup, 0, 0);
+    atomic_init(&out->render_running, 0);
+    out->render_started = 0;
+    atomic_init(&out->connected, 0);
+    out->idle_timeout = idle_timeout;
+    out->n_idle_frames = 0;
+    atomic_init(&out->idle_since_ns, 0);
+    atomic_init(&out->idle_clock, 0);
+    atomic_init(&out->render_busy_ns, 0);
+    atomic_init(&out->render_period_ns, 0);
+    atomic_init(&out->render_max_load, 0);
+    atomic_init(&out->n_blocks, 0);
+    _mbx_scheduler_init(&out->scheduler);
+    _mbx_graph_slot_init(&out->graph);
+    out->ctrl = ctrl;
+    out->head = head;
+    out->playing = _mbx_xmalloc(MBX_LOG_CONTROLLER, ctrl->n_decks);
+    bzero(out->playing, ctrl->n_decks);
     out->out = NULL;
 }
 
-mbx_error_code mbx_ctrl_deck_a_load(mbx_ctrl ctrl, const char *path) {
-    return load(&ctrl->deck_a.track, path);
+int mbx_ctrl_get_n_decks(mbx_ctrl ctrl) {
+    return ctrl->n_decks;
+}
+
+int mbx_ctrl_get_n_sample_slots(mbx_ctrl ctrl) {
+    return ctrl->n_samples;
 }
 
-mbx_error_code mbx_ctrl_deck_b_load(mbx_ctrl ctrl, const char *path) {
-    return load(&ctrl->deck_b.track, path);
+mbx_error_code mbx_ctrl_deck_load(mbx_ctrl ctrl, const char *path, int deck) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    cancel_latest(&ctrl->deck_jobs[deck]);
+    return load(ctrl, &ctrl->decks[deck], NULL, path, ctrl->compressed);
 }
 
 mbx_error_code mbx_ctrl_sample_load(mbx_ctrl ctrl, const char *path, int slot) {
-    assert ( slot >= 0 && slot < MAX_SAMPLE_FILES );
-    return load(&ctrl->samples[slot], path);
+    assert ( slot >= 0 && slot < ctrl->n_samples );
+    cancel_latest(&ctrl->sample_jobs[slot]);
+    // Samples are short, and are always decoded: each voice reads the
+    // decoded audio data directly, see voice_pool.h.
+    return load(ctrl, &ctrl->samples[slot], &ctrl->sample_generations[slot],
+        path, 0);
 }
 
-static mbx_error_code load(_mbx_track *track_p, const char *path) {
+/* Replace the track in *track_p with track. generation is the generation
+ * counter of a sample slot (see voice_pool.h), or NULL for a deck. It is
+ * incremented before the old track is retired, such that no voice uses
+ * the old track once it is freed. */
+static void install(mbx_ctrl ctrl, _mbx_track *track_p,
+        atomic_uint *generation, _mbx_track track) {
     _mbx_track old_track = *track_p;
-    mbx_error_code r;
-    if ( ( r = _mbx_track_new(track_p, path) ) != MBX_SUCCESS ) {
-        return MBX_FAILED_TO_LOAD_MP3;
+    *track_p = track;
+    if ( generation != NULL ) {
+        atomic_fetch_add(generation, 1);
     }
     if ( old_track != NULL ) {
-        _mbx_track_free(old_track);
+        retire(ctrl, old_track);
+    }
+}
+
+/* Free track once the render threads no longer use it, see struct retired.
+ * It must not be reachable from the controller anymore. */
+static void retire(mbx_ctrl ctrl, _mbx_track track) {
+    struct retired *r;
+    if ( ctrl->n_retired == ctrl->max_retired ) {
+        ctrl->max_retired = ctrl->max_retired == 0 ? 4
+            : 2 * ctrl->max_retired;
+        ctrl->retired = _mbx_xrealloc(MBX_LOG_CONTROLLER, ctrl->retired,
+            ctrl->max_retired * sizeof(struct retired));
+    }
+    r = &ctrl->retired[ctrl->n_retired++];
+    r->track = track;
+    // The track was replaced before the counters are read: a block started
+    // after an even count was read uses the new track.
+    atomic_thread_fence(memory_order_seq_cst);
+    r->speakers_blocks = atomic_load(&ctrl->speakers.n_blocks);
+    r->headphones_blocks = atomic_load(&ctrl->headphones.n_blocks);
+    free_retired(ctrl, 0);
+}
+
+/* 1 if the render thread of out is not rendering the block it rendered when
+ * its block counter was n_blocks. */
+static int block_done(struct out *out, unsigned long n_blocks) {
+    return n_blocks % 2 == 0 || atomic_load(&out->n_blocks) != n_blocks;
+}
+
+/* Free the retired tracks no render thread uses anymore, or all of them
+ * after the render threads stopped. */
+static void free_retired(mbx_ctrl ctrl, int all) {
+    int i = 0;
+    while ( i < ctrl->n_retired ) {
+        struct retired *r = &ctrl->retired[i];
+        if ( all || ( block_done(&ctrl->speakers, r->speakers_blocks)
+                && block_done(&ctrl->headphones, r->headphones_blocks) ) ) {
+            _mbx_track_free(r->track);
+            *r = ctrl->retired[--ctrl->n_retired];
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+static mbx_error_code load(mbx_ctrl ctrl, _mbx_track *track_p,
+        atomic_uint *generation, const char *path, int compressed) {
+    _mbx_track track;
+    mbx_error_code r;
+    if ( ( r = _mbx_track_new(&track, path, compressed, NULL) )
+            != MBX_SUCCESS ) {
+        return r;
     }
+    install(ctrl, track_p, generation, track);
     return MBX_SUCCESS;
 }
 
-void mbx_ctrl_deck_a_play(mbx_ctrl ctrl) {
-    if  ( ctrl->deck_a.track != NULL ) {
-        _mbx_track_play(ctrl->deck_a.track);
+mbx_load_job mbx_ctrl_deck_load_async(mbx_ctrl ctrl, const char *path,
+        int deck, mbx_load_cb cb, void *userdata) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    return load_async(ctrl, 0, deck, path, ctrl->compressed, cb, userdata);
+}
+
+mbx_load_job mbx_ctrl_sample_load_async(mbx_ctrl ctrl, const char *path,
+        int slot, mbx_load_cb cb, void *userdata) {
+    assert ( slot >= 0 && slot < ctrl->n_samples );
+    return load_async(ctrl, 1, slot, path, 0, cb, userdata);
+}
+
+/* Start a job as the latest load of a deck or a sample slot. */
+static mbx_load_job load_async(mbx_ctrl ctrl, int sample, int target,
+        const char *path, int compressed, mbx_load_cb cb, void *userdata) {
+    struct _mbx_load_job *job = _mbx_loader_job_new(path);
+    struct _mbx_load_job **latest;
+    job->compressed = compressed;
+    job->sample = sample;
+    job->target = target;
+    job->cb = cb;
+    job->userdata = userdata;
+    latest = latest_job(ctrl, job);
+    cancel_latest(latest);
+    *latest = job;
+    _mbx_loader_start(&ctrl->loader, job);
+    return job;
+}
+
+/* The latest load of the target of job. */
+static struct _mbx_load_job **latest_job(mbx_ctrl ctrl,
+        struct _mbx_load_job *job) {
+    return job->sample ? &ctrl->sample_jobs[job->target]
+        : &ctrl->deck_jobs[job->target];
+}
+
+/* Cancel the latest load of a target, if any. */
+static void cancel_latest(struct _mbx_load_job **latest) {
+    if ( *latest != NULL ) {
+        _mbx_loader_cancel(*latest);
+        *latest = NULL;
+    }
+}
+
+double mbx_load_job_get_progress(mbx_load_job job) {
+    long total = atomic_load(&job->progress.bytes_total);
+    long read = atomic_load(&job->progress.bytes_read);
+    if ( total <= 0 ) {
+        return 0;
     }
+    return read >= total ? 1 : (double) read / total;
 }
 
-void mbx_ctrl_deck_b_play(mbx_ctrl ctrl) {
-    if  ( ctrl->deck_b.track != NULL ) {
-        _mbx_track_play(ctrl->deck_b.track);
+void mbx_ctrl_cancel_load(mbx_ctrl ctrl, mbx_load_job job) {
+    struct _mbx_load_job **latest = latest_job(ctrl, job);
+    if ( *latest == job ) {
+        cancel_latest(latest);
     }
 }
 
+int mbx_ctrl_get_load_fd(mbx_ctrl ctrl) {
+    return _mbx_loader_get_fd(&ctrl->loader);
+}
+
+void mbx_ctrl_dispatch_loads(mbx_ctrl ctrl) {
+    struct _mbx_load_job *job, **latest;
+    mbx_error_code r;
+    while ( ( job = _mbx_loader_collect(&ctrl->loader) ) != NULL ) {
+        latest = latest_job(ctrl, job);
+        r = job->result;
+        if ( *latest == job ) {
+            *latest = NULL;
+        }
+        else if ( r == MBX_SUCCESS ) {
+            // Cancelled after the file was loaded.
+            _mbx_track_free(job->track);
+            r = MBX_LOAD_CANCELLED;
+        }
+        if ( r == MBX_SUCCESS ) {
+            if ( job->sample ) {
+                install(ctrl, &ctrl->samples[job->target],
+                    &ctrl->sample_generations[job->target], job->track);
+            }
+            else {
+                install(ctrl, &ctrl->decks[job->target], NULL, job->track);
+            }
+        }
+        if ( job->cb != NULL ) {
+            job->cb(job, r, job->userdata);
+        }
+        _mbx_loader_job_free(job);
+    }
+    // Tracks retired while a block was rendered are freed with the next
+    // load at the latest.
+    free_retired(ctrl, 0);
+}
+
+mbx_error_code mbx_ctrl_deck_double(mbx_ctrl ctrl, int from, int to) {
+    _mbx_track copy;
+    mbx_error_code r;
+    assert ( from >= 0 && from < ctrl->n_decks );
+    assert ( to >= 0 && to < ctrl->n_decks );
+    if ( ctrl->decks[from] == NULL || from == to ) {
+        return MBX_SUCCESS;
+    }
+    struct _mbx_event event = { MBX_CTRL_NOW, EVENT_DECK_DOUBLE, to, from };
+    // The copy is complete before the render threads can see it. It does
+    // not play yet: The speakers render thread works ahead of what is
+    // heard, so the position is taken over there, at a block boundary.
+    if ( ( r = _mbx_track_double(&copy, ctrl->decks[from]) )
+            != MBX_SUCCESS ) {
+        return r;
+    }
+    install(ctrl, &ctrl->decks[to], NULL, copy);
+    return push_event(&ctrl->speakers, &event);
+}
+
+void mbx_ctrl_deck_play(mbx_ctrl ctrl, int deck) {
+    mbx_ctrl_deck_play_at(ctrl, deck, MBX_CTRL_NOW);
+}
+
 void mbx_ctrl_sample_play(mbx_ctrl ctrl, int slot) {
-    assert ( slot >= 0 && slot < MAX_SAMPLE_FILES );
-    if ( ctrl->samples[slot] != NULL ) {
-        _mbx_track_play(ctrl->samples[slot]);
+    // The voices are started in the render thread.
+    mbx_ctrl_sample_play_at(ctrl, slot, MBX_CTRL_NOW);
+}
+
+void mbx_ctrl_sample_stop(mbx_ctrl ctrl, int slot) {
+    assert ( slot >= 0 && slot < ctrl->n_samples );
+    schedule(&ctrl->speakers, MBX_CTRL_NOW, EVENT_SAMPLE_STOP, slot);
+}
+
+void mbx_ctrl_deck_pause(mbx_ctrl ctrl, int deck) {
+    mbx_ctrl_deck_pause_at(ctrl, deck, MBX_CTRL_NOW);
+}
+
+mbx_error_code mbx_ctrl_deck_play_at(mbx_ctrl ctrl, int deck, int64_t time) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    return schedule(&ctrl->speakers, time, EVENT_DECK_PLAY, deck);
+}
+
+mbx_error_code mbx_ctrl_sample_play_at(mbx_ctrl ctrl, int slot, int64_t time) {
+    assert ( slot >= 0 && slot < ctrl->n_samples );
+    return schedule(&ctrl->speakers, time, EVENT_SAMPLE_PLAY, slot);
+}
+
+mbx_error_code mbx_ctrl_deck_pause_at(mbx_ctrl ctrl, int deck, int64_t time) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    return schedule(&ctrl->speakers, time, EVENT_DECK_PAUSE, deck);
+}
+
+static int64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/* The number of frames played between two times on the monotonic clock. */
+static int64_t frames_between(int64_t from_ns, int64_t to_ns) {
+    int64_t d = to_ns - from_ns;
+    return d / 1000000000 * MBX_SAMPLE_RATE
+        + d % 1000000000 * MBX_SAMPLE_RATE / 1000000000;
+}
+
+int64_t mbx_ctrl_get_time(mbx_ctrl ctrl) {
+    struct out *out = &ctrl->speakers;
+    int64_t time = _mbx_scheduler_get_time(&out->scheduler), idle_time;
+    int64_t since_ns = atomic_load_explicit(&out->idle_since_ns,
+        memory_order_acquire);
+    // The render thread advances the clock of a corked stream only when it
+    // wakes up.
+    if ( since_ns != 0 ) {
+        idle_time = atomic_load_explicit(&out->idle_clock,
+            memory_order_relaxed) + frames_between(since_ns, monotonic_ns());
+        if ( idle_time > time ) {
+            time = idle_time;
+        }
+    }
+    return time;
+}
+
+static mbx_error_code schedule(struct out *out, int64_t time,
+        enum event_action action, int target) {
+    struct _mbx_event event = { time, action, target, -1 };
+    return push_event(out, &event);
+}
+
+static mbx_error_code push_event(struct out *out,
+        const struct _mbx_event *event) {
+    if ( ! _mbx_scheduler_push(&out->scheduler, event) ) {
+        mbx_log_warn(MBX_LOG_CONTROLLER, "More than %d events are scheduled.",
+            MBX_SCHEDULER_CAPACITY);
+        return MBX_TOO_MANY_EVENTS;
     }
+    // Wakes up the render thread if it sleeps on a corked stream.
+    sem_post(&out->render_wakeup);
+    return MBX_SUCCESS;
 }
 
-void mbx_ctrl_deck_a_pause(mbx_ctrl ctrl) {
-    if  ( ctrl->deck_a.track != NULL ) {
-        _mbx_track_pause(ctrl->deck_a.track);
+/* The cue head may allocate a block cache when it starts, so it is started
+ * here, and the headphones output only adds it to its list. */
+mbx_error_code mbx_ctrl_deck_cue_play(mbx_ctrl ctrl, int deck) {
+    mbx_error_code r;
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( ctrl->decks[deck] == NULL ) {
+        return MBX_SUCCESS;
     }
+    if ( ( r = _mbx_track_play(ctrl->decks[deck], MBX_TRACK_CUE) )
+            != MBX_SUCCESS ) {
+        return r;
+    }
+    return schedule(&ctrl->headphones, MBX_CTRL_NOW, EVENT_DECK_ACTIVATE, deck);
 }
 
-void mbx_ctrl_deck_b_pause(mbx_ctrl ctrl) {
-    if  ( ctrl->deck_b.track != NULL ) {
-        _mbx_track_pause(ctrl->deck_b.track);
+void mbx_ctrl_deck_cue_pause(mbx_ctrl ctrl, int deck) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( ctrl->decks[deck] != NULL ) {
+        _mbx_track_pause(ctrl->decks[deck], MBX_TRACK_CUE);
     }
 }
 
-void mbx_ctrl_shutdown_and_free(mbx_ctrl ctrl) {
-    int slot;
-    if ( ctrl->speakers.out != NULL ) {
-        _mbx_out_shutdown_and_free(ctrl->speakers.out);
-        ctrl->speakers.out = NULL;
-    }
-    if ( ctrl->headphones.out != NULL ) {
-        _mbx_out_shutdown_and_free(ctrl->headphones.out);
-        ctrl->headphones.out = NULL;
-    }
-    for ( slot=0; slot<MAX_SAMPLE_FILES; slot++ ) {
-        if ( ctrl->samples[slot] != NULL ) {
-            _mbx_track_free(ctrl->samples[slot]);
-            ctrl->samples[slot] = NULL;
+mbx_error_code mbx_ctrl_deck_cue_seek(mbx_ctrl ctrl, int deck, double seconds) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( ctrl->decks[deck] == NULL ) {
+        return MBX_SUCCESS;
+    }
+    if ( seconds < 0 ) {
+        seconds = 0;
+    }
+    return _mbx_track_seek(ctrl->decks[deck], MBX_TRACK_CUE,
+        (size_t) ( seconds * MBX_SAMPLE_RATE ));
+}
+
+/* The cue head follows the rate of the deck, such that a pre-listened track
+ * can be beat matched on the headphones. */
+void mbx_ctrl_deck_set_rate(mbx_ctrl ctrl, int deck, double rate) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( ctrl->decks[deck] == NULL ) {
+        return;
+    }
+    _mbx_track_set_rate(ctrl->decks[deck], MBX_TRACK_SPEAKER, rate);
+    _mbx_track_set_rate(ctrl->decks[deck], MBX_TRACK_CUE, rate);
+}
+
+void mbx_ctrl_deck_set_keylock(mbx_ctrl ctrl, int deck, mbx_keylock keylock) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( ctrl->decks[deck] == NULL ) {
+        return;
+    }
+    _mbx_track_set_keylock(ctrl->decks[deck], MBX_TRACK_SPEAKER, keylock);
+    _mbx_track_set_keylock(ctrl->decks[deck], MBX_TRACK_CUE, keylock);
+}
+
+void mbx_ctrl_deck_set_volume(mbx_ctrl ctrl, int deck, double volume) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( volume < 0 ) {
+        volume = 0;
+    }
+    if ( volume > 1 ) {
+        volume = 1;
+    }
+    atomic_store_explicit(&ctrl->faders[deck].volume, (float) volume,
+        memory_order_relaxed);
+}
+
+void mbx_ctrl_deck_set_pan(mbx_ctrl ctrl, int deck, double pan) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( pan < -1 ) {
+        pan = -1;
+    }
+    if ( pan > 1 ) {
+        pan = 1;
+    }
+    atomic_store_explicit(&ctrl->faders[deck].pan, (float) pan,
+        memory_order_relaxed);
+}
+
+void mbx_ctrl_deck_set_crossfader_side(mbx_ctrl ctrl, int deck,
+        mbx_crossfader_side side) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    atomic_store_explicit(&ctrl->faders[deck].side, side,
+        memory_order_relaxed);
+}
+
+/* Boosts are limited, because the mix bus clips. Cuts are limited, because
+ * a band is removed with a kill. */
+#define EQ_MIN_DB -24.0
+#define EQ_MAX_DB 6.0
+
+/* Decks get an EQ node when their EQ is used for the first time, such that
+ * decks without EQ are mixed without a pass through the filter bank. */
+static void use_eq(mbx_ctrl ctrl, int deck) {
+    if ( ! ctrl->eq_used[deck] ) {
+        ctrl->eq_used[deck] = 1;
+        _mbx_graph_slot_install(&ctrl->speakers.graph, speakers_graph(ctrl));
+    }
+}
+
+void mbx_ctrl_deck_set_eq(mbx_ctrl ctrl, int deck, mbx_eq_band band,
+        double db) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( db < EQ_MIN_DB ) {
+        db = EQ_MIN_DB;
+    }
+    if ( db > EQ_MAX_DB ) {
+        db = EQ_MAX_DB;
+    }
+    _mbx_filter_bank_set_gain(ctrl->filters, deck, band,
+        (float) pow(10, db / 20));
+    use_eq(ctrl, deck);
+}
+
+void mbx_ctrl_deck_set_kill(mbx_ctrl ctrl, int deck, mbx_eq_band band,
+        int kill) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    _mbx_filter_bank_set_kill(ctrl->filters, deck, band, kill);
+    use_eq(ctrl, deck);
+}
+
+void mbx_ctrl_deck_set_filter(mbx_ctrl ctrl, int deck, double position) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    if ( position < -1 ) {
+        position = -1;
+    }
+    if ( position > 1 ) {
+        position = 1;
+    }
+    _mbx_filter_bank_set_sweep(ctrl->filters, deck, (float) position);
+    use_eq(ctrl, deck);
+}
+
+void mbx_ctrl_set_crossfader(mbx_ctrl ctrl, double position) {
+    if ( position < -1 ) {
+        position = -1;
+    }
+    if ( position > 1 ) {
+        position = 1;
+    }
+    atomic_store_explicit(&ctrl->crossfader, (float) position,
+        memory_order_relaxed);
+}
+
+void mbx_ctrl_set_crossfader_curve(mbx_ctrl ctrl, mbx_crossfader_curve curve) {
+    atomic_store_explicit(&ctrl->crossfader_curve, curve, memory_order_relaxed);
+}
+
+void mbx_ctrl_set_interpolation(mbx_ctrl ctrl, mbx_interpolation interpolation) {
+    _mbx_varispeed_set_interpolation(interpolation);
+}
+
+static size_t track_bytes(_mbx_track track) {
+    return track == NULL ? 0 : _mbx_track_get_resident_bytes(track);
+}
+
+static void get_out_stats(struct out *out, mbx_out_stats *stats) {
+    unsigned long period_ns;
+    _mbx_out_get_stats(out->out, stats);
+    stats->ring_fill_frames = _mbx_ring_fill(&out->ring);
+    period_ns = atomic_load_explicit(&out->render_period_ns,
+        memory_order_relaxed);
+    stats->render_load_percent = period_ns == 0 ? 0 : 100.0 *
+        atomic_load_explicit(&out->render_busy_ns, memory_order_relaxed)
+        / period_ns;
+    stats->render_load_max_percent = atomic_load_explicit(
+        &out->render_max_load, memory_order_relaxed) / 100.0;
+}
+
+void mbx_ctrl_get_stats(mbx_ctrl ctrl, mbx_ctrl_stats *stats) {
+    get_out_stats(&ctrl->speakers, &stats->speakers);
+    get_out_stats(&ctrl->headphones, &stats->headphones);
+    stats->quality_steps = _mbx_governor_get_level(ctrl->governor);
+}
+
+size_t mbx_ctrl_deck_get_resident_bytes(mbx_ctrl ctrl, int deck) {
+    assert ( deck >= 0 && deck < ctrl->n_decks );
+    return track_bytes(ctrl->decks[deck]);
+}
+
+size_t mbx_ctrl_sample_get_resident_bytes(mbx_ctrl ctrl, int slot) {
+    assert ( slot >= 0 && slot < ctrl->n_samples );
+    return track_bytes(ctrl->samples[slot]);
+}
+
+static void free_tracks(_mbx_track *tracks, int n) {
+    int i;
+    for ( i=0; i<n; i++ ) {
+        if ( tracks[i] != NULL ) {
+            _mbx_track_free(tracks[i]);
+            tracks[i] = NULL;
         }
     }
-    if ( ctrl->deck_a.track != NULL ) {
-        _mbx_track_free(ctrl->deck_a.track);
-        ctrl->deck_a.track = NULL;
+    _mbx_xfree(tracks);
+}
+
+/* The render thread is stopped first, such that it does not cork the stream
+ * during the shutdown. The callback plays silence from then on. */
+static void free_out(struct out *out) {
+    if ( out->render_started ) {
+        atomic_store(&out->render_running, 0);
+        sem_post(&out->render_wakeup);
+        pthread_join(out->render_thread, NULL);
+        out->render_started = 0;
+    }
+    if ( out->out != NULL ) {
+        _mbx_out_shutdown_and_free(out->out);
+        out->out = NULL;
     }
-    if ( ctrl->deck_b.track != NULL ) {
-        _mbx_track_free(ctrl->deck_b.track);
-        ctrl->deck_b.track = NULL;
+    sem_destroy(&out->render_wakeup);
+    _mbx_ring_free(&out->ring);
+    _mbx_graph_slot_free(&out->graph);
+    _mbx_xfree(out->playing);
+}
+
+void mbx_ctrl_shutdown_and_free(mbx_ctrl ctrl) {
+    int i;
+    for ( i=0; i<ctrl->n_decks; i++ ) {
+        cancel_latest(&ctrl->deck_jobs[i]);
     }
-    free(ctrl);
+    for ( i=0; i<ctrl->n_samples; i++ ) {
+        cancel_latest(&ctrl->sample_jobs[i]);
+    }
+    _mbx_loader_free(&ctrl->loader);
+    _mbx_xfree(ctrl->deck_jobs);
+    _mbx_xfree(ctrl->sample_jobs);
+    free_out(&ctrl->speakers);
+    free_out(&ctrl->headphones);
+    _mbx_governor_free(ctrl->governor);
+    free_retired(ctrl, 1);
+    _mbx_xfree(ctrl->retired);
+    free_tracks(ctrl->samples, ctrl->n_samples);
+    _mbx_xfree(ctrl->sample_generations);
+    free_tracks(ctrl->decks, ctrl->n_decks);
+    _mbx_xfree(ctrl->faders);
+    _mbx_filter_bank_free(ctrl->filters);
+    _mbx_xfree(ctrl->eq_used);
+    _mbx_xfree(ctrl);
 }
 
 /*****************************************************************************
  * Implementation of the output callbacks.
  ****************************************************************************/
 
-/* Helper function to make sure that at least n_samples are available in the
- * ctrl's output buffers. */
-static void fill_buffer(mbx_ctrl ctrl, size_t n_samples_to_write);
+/* Helper function writing up to n_frames from the ring of out. Returns the
+ * number of frames written: frames that are not rendered yet are left to
+ * the next callback, the server plays its buffer meanwhile. */
+static size_t write_output(struct out *out, sample_t *frames,
+        size_t n_frames);
 
-static void output_cb_headphones(sample_t *left, sample_t *right,
-        size_t n_samples, void *userdata) {
-    bzero(left, sizeof(sample_t) * n_samples);
-    bzero(right, sizeof(sample_t) * n_samples);
+static size_t output_cb_headphones(sample_t *frames, size_t n_frames,
+        void *userdata) {
+    mbx_ctrl ctrl = (mbx_ctrl) userdata;
+    assert ( ctrl != NULL );
+    return write_output(&ctrl->headphones, frames, n_frames);
 }
 
-static void output_cb_speakers(sample_t *left, sample_t *right,
-        size_t n_samples, void *userdata) {
-    size_t i = 0;
+static size_t output_cb_speakers(sample_t *frames, size_t n_frames,
+        void *userdata) {
     mbx_ctrl ctrl = (mbx_ctrl) userdata;
     assert ( ctrl != NULL );
-    // Make sure that at least n_samples are available in the ctrl's buffer.
-    fill_buffer(ctrl, n_samples);
-    // Write n_samples from the ctrl's buffer to the output.
-    for ( i = 0; i < n_samples; i++) {
-        left[i] = *ctrl->speakers.read_pos_left;
-        right[i] = *ctrl->speakers.read_pos_right;
-        ctrl->speakers.read_pos_left += 1;
-        ctrl->speakers.read_pos_right += 1;
-        if ( ctrl->speakers.read_pos_left >= ctrl->speakers.buf_left + MAX_SAMPLES_IN_BUFFER ) {
-            assert ( ctrl->speakers.read_pos_right >= ctrl->speakers.buf_right + MAX_SAMPLES_IN_BUFFER );
-            // log_debug(CONSUMER, "Read buffer cycle");
-            ctrl->speakers.read_pos_left -= MAX_SAMPLES_IN_BUFFER;
-            ctrl->speakers.read_pos_right -= MAX_SAMPLES_IN_BUFFER;
+    return write_output(&ctrl->speakers, frames, n_frames);
+}
+
+static size_t write_output(struct out *out, sample_t *frames,
+        size_t n_frames) {
+    size_t n_ready = _mbx_ring_read(&out->ring, frames, n_frames);
+    sem_post(&out->render_wakeup);
+    return n_ready;
+}
+
+/*****************************************************************************
+ * The render graphs, and their nodes.
+ ****************************************************************************/
+
+/* Source node: the head of a deck. */
+static int render_deck(void *userdata, int deck, float *buf,
+        struct _mbx_gain *gain, size_t n_frames) {
+    struct out *out = (struct out *) userdata;
+    _mbx_track track = out->ctrl->decks[deck];
+    if ( ! out->playing[deck] ) {
+        return 0;
+    }
+    if ( track == NULL || ! _mbx_track_is_playing(track, out->head) ) {
+        out->playing[deck] = 0;
+        return 0;
+    }
+    bzero(buf, 2 * n_frames * sizeof(float));
+    _mbx_track_mix(track, out->head, buf, n_frames, gain);
+    return 1;
+}
+
+/* Source node: the voices playing the sample slots. */
+static int render_voices(void *userdata, int arg, float *buf,
+        struct _mbx_gain *gain, size_t n_frames) {
+    mbx_ctrl ctrl = (mbx_ctrl) userdata;
+    if ( ctrl->voices.n_active == 0 ) {
+        return 0;
+    }
+    bzero(buf, 2 * n_frames * sizeof(float));
+    _mbx_voice_pool_mix(&ctrl->voices, ctrl->sample_generations, buf,
+        n_frames);
+    return 1;
+}
+
+/* Processing node: the EQ and the sweep filter of a deck. */
+static int apply_eq(void *userdata, int deck, float *buf,
+        struct _mbx_gain *gain, size_t n_frames) {
+    mbx_ctrl ctrl = (mbx_ctrl) userdata;
+    _mbx_filter_bank_process(ctrl->filters, deck, buf, n_frames);
+    return 1;
+}
+
+/* Processing node: the volume, pan, and crossfader of a deck. The gain is
+ * applied when the deck is added to the master bus. */
+static int apply_fader(void *userdata, int deck, float *buf,
+        struct _mbx_gain *gain, size_t n_frames) {
+    mbx_ctrl ctrl = (mbx_ctrl) userdata;
+    _mbx_fader_next_block(&ctrl->faders[deck],
+        atomic_load_explicit(&ctrl->crossfader, memory_order_relaxed),
+        atomic_load_explicit(&ctrl->crossfader_curve, memory_order_relaxed),
+        n_frames, gain);
+    return 1;
+}
+
+/* The speakers play the sample slots and the speaker heads of the decks,
+ * through their EQ (once used) and their fader, on the master bus. */
+static struct _mbx_graph *speakers_graph(mbx_ctrl ctrl) {
+    struct _mbx_graph *graph = _mbx_graph_new();
+    int master = _mbx_graph_add_bus(graph);
+    int deck, node;
+    _mbx_graph_connect(graph,
+        _mbx_graph_add_source(graph, render_voices, ctrl, 0), master);
+    for ( deck=0; deck<ctrl->n_decks; deck++ ) {
+        node = _mbx_graph_add_source(graph, render_deck, &ctrl->speakers,
+            deck);
+        if ( ctrl->eq_used[deck] ) {
+            node = _mbx_graph_add_process(graph, apply_eq, ctrl, deck, node);
         }
-        assert(ctrl->speakers.read_pos_right<ctrl->speakers.buf_right + MAX_SAMPLES_IN_BUFFER);
+        node = _mbx_graph_add_process(graph, apply_fader, ctrl, deck, node);
+        _mbx_graph_connect(graph, node, master);
     }
+    _mbx_graph_compile(graph, master, RENDER_BLOCK_FRAMES);
+    return graph;
 }
 
-static size_t diff(sample_t *a, sample_t *b) {
-    return a > b ? a - b : b - a;
+/* The headphones play the cue bus: the cue heads of the decks, before the
+ * EQ and the faders. */
+static struct _mbx_graph *headphones_graph(mbx_ctrl ctrl) {
+    struct _mbx_graph *graph = _mbx_graph_new();
+    int cue = _mbx_graph_add_bus(graph);
+    int deck;
+    for ( deck=0; deck<ctrl->n_decks; deck++ ) {
+        _mbx_graph_connect(graph, _mbx_graph_add_source(graph, render_deck,
+            &ctrl->headphones, deck), cue);
+    }
+    _mbx_graph_compile(graph, cue, RENDER_BLOCK_FRAMES);
+    return graph;
 }
 
-static void fill_buffer(mbx_ctrl ctrl, size_t n_samples_to_write) {
-    int i=0;
-    size_t n_samples_in_buffer = 0;
-    if ( n_samples_to_write > MAX_SAMPLES_IN_BUFFER ) {
-        mbx_log_fatal(MBX_LOG_CONTROLLER, "Output buffer exceeds %zu samples.", n_samples_to_write);
-        exit(-1);
+/* A deck starting to play starts at the current fader settings, and its
+ * filters start from silence. */
+static void activate(mbx_ctrl ctrl, struct out *out, int deck) {
+    if ( out->playing[deck] ) {
+        return;
     }
-    n_samples_in_buffer = diff(ctrl->speakers.read_pos_left, ctrl->speakers.write_pos_left);
-    assert ( n_samples_in_buffer == diff(ctrl->speakers.read_pos_right, ctrl->speakers.write_pos_right) );
-    // The loop writes one sample value at each time.
-    while ( n_samples_in_buffer < n_samples_to_write ) {
-        *ctrl->speakers.write_pos_left = 0;
-        *ctrl->speakers.write_pos_right = 0;
-        // Write audio data from all sample files that are currently playing.
-        for ( i=0; i<MAX_SAMPLE_FILES; i++ ) {
-            if ( ctrl->samples[i] != NULL ) {
-                if ( _mbx_track_is_playing(ctrl->samples[i]) ) {
-                    sample_t left;
-                    sample_t right;
-                    _mbx_track_get_next_sample(ctrl->samples[i], &left, &right);
-                    *ctrl->speakers.write_pos_left += left;
-                    *ctrl->speakers.write_pos_right += right;
+    out->playing[deck] = 1;
+    if ( out == &ctrl->speakers ) {
+        _mbx_fader_snap(&ctrl->faders[deck],
+            atomic_load_explicit(&ctrl->crossfader, memory_order_relaxed),
+            atomic_load_explicit(&ctrl->crossfader_curve,
+                memory_order_relaxed));
+        _mbx_filter_bank_reset(ctrl->filters, deck);
+    }
+}
+
+/* Apply an event in the render thread of out. The speaker heads were prepared
+ * when the tracks were created, so playing them does not allocate memory. */
+static void apply_event(mbx_ctrl ctrl, struct out *out,
+        struct _mbx_event *event) {
+    _mbx_track track;
+    unsigned generation;
+    switch ( event->action ) {
+        case EVENT_SAMPLE_PLAY:
+            // The generation is read first, see _mbx_voice_pool_trigger().
+            generation = atomic_load_explicit(
+                &ctrl->sample_generations[event->target],
+                memory_order_acquire);
+            _mbx_voice_pool_trigger(&ctrl->voices, event->target,
+                ctrl->samples[event->target], generation, 1.0f);
+            break;
+        case EVENT_SAMPLE_STOP:
+            _mbx_voice_pool_release(&ctrl->voices, event->target);
+            break;
+        case EVENT_DECK_PLAY:
+            track = ctrl->decks[event->target];
+            if ( track != NULL ) {
+                _mbx_track_play(track, out->head);
+                activate(ctrl, out, event->target);
+            }
+            break;
+        case EVENT_DECK_PAUSE:
+            track = ctrl->decks[event->target];
+            if ( track != NULL ) {
+                _mbx_track_pause(track, out->head);
+            }
+            break;
+        case EVENT_DECK_ACTIVATE:
+            activate(ctrl, out, event->target);
+            break;
+        case EVENT_DECK_DOUBLE:
+            // Neither deck has rendered this block yet, so the copy plays
+            // the same frames as the source from here on.
+            track = ctrl->decks[event->target];
+            if ( track != NULL && ctrl->decks[event->source] != NULL ) {
+                _mbx_track_sync(track, ctrl->decks[event->source], out->head);
+                if ( _mbx_track_is_playing(track, out->head) ) {
+                    activate(ctrl, out, event->target);
                 }
             }
+            break;
+    }
+}
+
+/*****************************************************************************
+ * The render threads.
+ ****************************************************************************/
+
+/* Render one block of out to block. The block is rendered in parts ending
+ * at the scheduled events, such that events are sample accurate. Returns 0
+ * if the block is silent. */
+static int render_block(mbx_ctrl ctrl, struct out *out, sample_t *block) {
+    struct _mbx_event event;
+    size_t n_left = RENDER_BLOCK_FRAMES, n_frames;
+    const float *mix;
+    int live = 0;
+    while ( n_left > 0 ) {
+        while ( _mbx_scheduler_pop_due(&out->scheduler, &event) ) {
+            apply_event(ctrl, out, &event);
         }
-        // Write audio data from deck A
-        if ( ctrl->deck_a.track != NULL && _mbx_track_is_playing(ctrl->deck_a.track) ) {
-            sample_t left;
-            sample_t right;
-            _mbx_track_get_next_sample(ctrl->deck_a.track, &left, &right);
-            *ctrl->speakers.write_pos_left += left;
-            *ctrl->speakers.write_pos_right += right;
+        n_frames = _mbx_scheduler_frames_until_next(&out->scheduler, n_left);
+        if ( n_frames == 0 ) {
+            continue; // an event arrived while applying the others
         }
-        // Write audio data from deck B
-        if ( ctrl->deck_b.track != NULL && _mbx_track_is_playing(ctrl->deck_b.track) ) {
-            sample_t left;
-            sample_t right;
-            _mbx_track_get_next_sample(ctrl->deck_b.track, &left, &right);
-            *ctrl->speakers.write_pos_left += left;
-            *ctrl->speakers.write_pos_right += right;
+        mix = _mbx_graph_render(_mbx_graph_slot_acquire(&out->graph),
+            n_frames);
+        if ( mix == NULL ) {
+            bzero(block, 2 * n_frames * sizeof(sample_t));
         }
-        // Move write position forward by one.
-        ctrl->speakers.write_pos_left += 1;
-        ctrl->speakers.write_pos_right += 1;
-        if ( ctrl->speakers.write_pos_left >= ctrl->speakers.buf_left + MAX_SAMPLES_IN_BUFFER ) {
-            assert ( ctrl->speakers.write_pos_right >= ctrl->speakers.buf_right + MAX_SAMPLES_IN_BUFFER );
-            // log_debug(CONSUMER, "Write buffer cycle");
-            ctrl->speakers.write_pos_left -= MAX_SAMPLES_IN_BUFFER;
-            ctrl->speakers.write_pos_right -= MAX_SAMPLES_IN_BUFFER;
+        else {
+            _mbx_mix_to_s16(block, mix, n_frames);
+            live = 1;
         }
-        assert(ctrl->speakers.write_pos_right<ctrl->speakers.buf_right + MAX_SAMPLES_IN_BUFFER);
-        n_samples_in_buffer++;
+        block += 2 * n_frames;
+        n_left -= n_frames;
+        _mbx_scheduler_advance(&out->scheduler, n_frames);
+    }
+    return live;
+}
+
+/* 1 if out was silent for the idle time, and its stream can be corked. */
+static int is_idle(struct out *out) {
+    return out->n_idle_frames >= out->idle_timeout
+        && atomic_load(&out->connected);
+}
+
+/* Render blocks until the lookahead is buffered, and measure how long each
+ * block takes. The ring always has space for the block. Stops early when
+ * the output became idle. */
+static void render_ahead(struct out *out) {
+    struct timespec start, end;
+    uint64_t busy_ns, period_ns = RENDER_BLOCK_FRAMES * 1000000000ULL
+        / MBX_SAMPLE_RATE;
+    unsigned long load;
+    sample_t block[2 * RENDER_BLOCK_FRAMES];
+    while ( _mbx_ring_fill(&out->ring) < out->lookahead && ! is_idle(out) ) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        _mbx_rt_enter();
+        atomic_fetch_add(&out->n_blocks, 1);
+        if ( render_block(out->ctrl, out, block) ) {
+            out->n_idle_frames = 0;
+        }
+        else {
+            out->n_idle_frames += RENDER_BLOCK_FRAMES;
+        }
+        atomic_fetch_add(&out->n_blocks, 1);
+        _mbx_ring_write(&out->ring, block, RENDER_BLOCK_FRAMES);
+        _mbx_rt_leave();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        busy_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL
+            + end.tv_nsec - start.tv_nsec;
+        atomic_fetch_add_explicit(&out->render_busy_ns, busy_ns,
+            memory_order_relaxed);
+        atomic_fetch_add_explicit(&out->render_period_ns, period_ns,
+            memory_order_relaxed);
+        if ( out == &out->ctrl->speakers ) {
+            _mbx_governor_account(out->ctrl->governor, busy_ns, period_ns);
+        }
+        load = busy_ns * 10000 / period_ns;
+        if ( load > atomic_load_explicit(&out->render_max_load,
+                memory_order_relaxed) ) {
+            atomic_store_explicit(&out->render_max_load, load,
+                memory_order_relaxed);
+        }
+    }
+}
+
+/* Cork the stream of the idle output out, and sleep until an event is due
+ * within the lookahead. The clock advances with the time slept, such that
+ * events keep their time, and the stream is uncorked in time for them. */
+static void sleep_while_idle(struct out *out) {
+    struct timespec deadline;
+    size_t n_until_next, n_slept = 0, n_elapsed;
+    uint64_t wait_ns;
+    int64_t start_ns = monotonic_ns();
+    atomic_store_explicit(&out->idle_clock,
+        _mbx_scheduler_get_time(&out->scheduler), memory_order_relaxed);
+    atomic_store_explicit(&out->idle_since_ns, start_ns, memory_order_release);
+    _mbx_out_set_corked(out->out, 1);
+    while ( atomic_load(&out->render_running) ) {
+        // Nothing plays until the next event, so time passes silently.
+        n_until_next = _mbx_scheduler_frames_until_next(&out->scheduler,
+            NO_EVENT);
+        n_elapsed = frames_between(start_ns, monotonic_ns());
+        if ( n_elapsed - n_slept > n_until_next ) {
+            n_elapsed = n_slept + n_until_next;
+        }
+        if ( n_until_next != NO_EVENT ) {
+            n_until_next -= n_elapsed - n_slept;
+        }
+        _mbx_scheduler_advance(&out->scheduler, n_elapsed - n_slept);
+        n_slept = n_elapsed;
+        if ( n_until_next <= out->lookahead ) {
+            break;
+        }
+        if ( n_until_next == NO_EVENT ) {
+            sem_wait(&out->render_wakeup);
+        }
+        else {
+            wait_ns = ( n_until_next - out->lookahead ) * 1000000000ULL
+                / MBX_SAMPLE_RATE;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            wait_ns += deadline.tv_nsec;
+            deadline.tv_sec += wait_ns / 1000000000ULL;
+            deadline.tv_nsec = wait_ns % 1000000000ULL;
+            sem_timedwait(&out->render_wakeup, &deadline);
+        }
+    }
+    out->n_idle_frames = 0;
+    atomic_store_explicit(&out->idle_since_ns, 0, memory_order_relaxed);
+    _mbx_out_set_corked(out->out, 0);
+}
+
+static void *render_main(void *userdata) {
+    struct out *out = (struct out *) userdata;
+    struct sched_param param;
+    int r;
+    // The workers of the pool stay off this CPU, see worker_pool.h.
+    _mbx_pool_set_audio_affinity(pthread_self());
+    param.sched_priority = RENDER_THREAD_PRIORITY;
+    if ( ( r = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) )
+            != 0 ) {
+        mbx_log_warn(MBX_LOG_CONTROLLER, "Failed to raise the priority of the "
+            "%s render thread: %s. Rendering with normal priority.",
+            out->name, strerror(r));
+    }
+    _mbx_mix_set_flush_to_zero();
+    while ( atomic_load(&out->render_running) ) {
+        render_ahead(out);
+        if ( is_idle(out) ) {
+            sleep_while_idle(out);
+        }
+        else {
+            sem_wait(&out->render_wakeup);
+        }
+    }
+    return NULL;
+}
+
+static void start_render_thread(struct out *out) {
+    atomic_store(&out->render_running, 1);
+    if ( pthread_create(&out->render_thread, NULL, render_main, out) != 0 ) {
+        mbx_log_fatal(MBX_LOG_CONTROLLER, "Failed to start the %s render "
+            "thread.", out->name);
+        exit(-1);
     }
+    out->render_started = 1;
 }
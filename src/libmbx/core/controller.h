@@ -1,23 +1,115 @@
 #ifndef CONTROLLER_H
 #define CONTROLLER_H
 
+#include <stdint.h>
 #include "libmbx/api.h"
 #include "libmbx/out/audio_output.h"
 #include "libmbx/common/mbx_errno.h"
 #include "libmbx/mp3lib/track.h"
 #include "libmbx/config/config.h"
+#include "interpolation.h"
+#include "keylock.h"
+#include "crossfader.h"
+#include "eq.h"
+#include "voice_pool.h"
 
-#define MAX_SAMPLE_FILES 16
+/**
+ * The number of decks if #MBX_CFG_DECKS is not set.
+ */
+#define MBX_CTRL_DEFAULT_DECKS 2
+
+/**
+ * The maximum value of #MBX_CFG_DECKS.
+ */
+#define MBX_CTRL_MAX_DECKS 64
+
+/**
+ * The number of sample slots if #MBX_CFG_SAMPLE_SLOTS is not set.
+ */
+#define MBX_CTRL_DEFAULT_SAMPLE_SLOTS 16
+
+/**
+ * The maximum value of #MBX_CFG_SAMPLE_SLOTS.
+ */
+#define MBX_CTRL_MAX_SAMPLE_SLOTS 1024
+
+/**
+ * The lookahead in milliseconds if #MBX_CFG_LOOKAHEAD is not set.
+ */
+#define MBX_CTRL_DEFAULT_LOOKAHEAD_MS 20
+
+/**
+ * The maximum value of #MBX_CFG_LOOKAHEAD.
+ */
+#define MBX_CTRL_MAX_LOOKAHEAD_MS 1000
+
+/**
+ * The idle time in milliseconds if #MBX_CFG_IDLE is not set.
+ */
+#define MBX_CTRL_DEFAULT_IDLE_MS 2000
+
+/**
+ * The maximum value of #MBX_CFG_IDLE.
+ */
+#define MBX_CTRL_MAX_IDLE_MS 3600000
+
+/**
+ * The render load in percent if #MBX_CFG_OVERLOAD is not set.
+ */
+#define MBX_CTRL_DEFAULT_OVERLOAD_PERCENT 75
+
+/**
+ * The maximum value of #MBX_CFG_OVERLOAD.
+ */
+#define MBX_CTRL_MAX_OVERLOAD_PERCENT 100
 
 typedef struct _mbx_ctrl *mbx_ctrl;
 
+/**
+ * An asynchronous load, see mbx_ctrl_deck_load_async().
+ */
+typedef struct _mbx_load_job *mbx_load_job;
+
+/**
+ * Called by mbx_ctrl_dispatch_loads() when an asynchronous load finished.
+ *
+ * @param  job
+ *         The load. It is freed when the callback returns.
+ * @param  result
+ *         #MBX_SUCCESS if the file is now loaded, #MBX_LOAD_CANCELLED if
+ *         another file was loaded on the same deck or sample slot in the
+ *         meantime, or the error of the load, see mbx_ctrl_deck_load().
+ * @param  userdata
+ *         The userdata passed when the load was started.
+ */
+typedef void (*mbx_load_cb)(mbx_load_job job, mbx_error_code result,
+        void *userdata);
+
+/**
+ * Snapshot of the controller's performance counters, see mbx_ctrl_get_stats().
+ */
+typedef struct {
+    /** Counters for the speakers output. */
+    mbx_out_stats speakers;
+    /** Counters for the headphones output. */
+    mbx_out_stats headphones;
+    /**
+     * The number of steps quality is reduced by because of the render
+     * load, see #MBX_CFG_OVERLOAD. <tt>0</tt> is full quality.
+     */
+    int quality_steps;
+} mbx_ctrl_stats;
+
 /**
  * Create and initialize a new music box controller.
  *
  * The music box controller is allocated and initialized with the values in
- * <tt>cfg</tt>. The initialization will also start background threads that
- * are used for playing audio. You must shut down and free the controller
- * using mbx_ctrl_shutdown_and_free().
+ * <tt>cfg</tt>. The number of decks and sample slots is taken from
+ * #MBX_CFG_DECKS and #MBX_CFG_SAMPLE_SLOTS, and does not change while the
+ * controller runs. The initialization will also start background threads
+ * that are used for playing audio: each output has a render thread, which
+ * renders audio #MBX_CFG_LOOKAHEAD ahead of playback. You must shut down
+ * and free the controller using mbx_ctrl_shutdown_and_free().
  *
  * @param  ctrl_p
  *         A pointer to the newly initialized controller will be put here.
@@ -28,78 +120,207 @@ typedef struct _mbx_ctrl *mbx_ctrl;
 extern mbx_error_code mbx_ctrl_new(mbx_ctrl *ctrl_p, mbx_config cfg);
 
 /**
- * Load an MP3 file on deck A.
- * <p>
- * If deck A is already loaded, the old file will be freed and replaced with
- * the new file.
+ * Get the number of decks.
+ *
+ * The decks are numbered from <tt>0</tt> to the number of decks minus one.
  *
  * @param  ctrl
  *         The controller
- * @param  path
- *         The path to the MP3 file to be loaded on deck A.
- * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3
+ * @return The number of decks, see #MBX_CFG_DECKS.
+ */
+extern int mbx_ctrl_get_n_decks(mbx_ctrl ctrl);
+
+/**
+ * Get the number of sample slots.
+ *
+ * The slots are numbered from <tt>0</tt> to the number of slots minus one.
+ *
+ * @param  ctrl
+ *         The controller
+ * @return The number of sample slots, see #MBX_CFG_SAMPLE_SLOTS.
  */
-extern mbx_error_code mbx_ctrl_deck_a_load(mbx_ctrl ctrl, const char *path);
+extern int mbx_ctrl_get_n_sample_slots(mbx_ctrl ctrl);
 
 /**
- * Load an MP3 file on deck B.
+ * Load an MP3 file on a deck.
  * <p>
- * If deck B is already loaded, the old file will be freed and replaced with
- * the new file.
+ * If the deck is already loaded, the old file will be freed and replaced
+ * with the new file. An asynchronous load on the deck is cancelled, see
+ * mbx_ctrl_deck_load_async().
  *
  * @param  ctrl
  *         The controller
  * @param  path
- *         The path to the MP3 file to be loaded on deck B.
- * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3
+ *         The path to the MP3 file to be loaded on the deck.
+ * @param  deck
+ *         The deck number, <tt>0 <= deck < </tt>mbx_ctrl_get_n_decks().
+ * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3, #MBX_OUT_OF_MEMORY if the
+ *         memory limit for decoded audio data would be exceeded, see
+ *         mbx_mem_set_limit().
  */
-extern mbx_error_code mbx_ctrl_deck_b_load(mbx_ctrl ctrl, const char *path);
+extern mbx_error_code mbx_ctrl_deck_load(mbx_ctrl ctrl, const char *path,
+        int deck);
 
 /**
  * Load an MP3 file into a sample slot.
  *
- * The controller provides two decks and #MAX_SAMPLE_FILES sample slots.
  * An MP3 file in a sample slot can be played, but there are no controls like
  * volume, crossfader, rewind, etc.
  * <p>
  * If the slot is already loaded, the old file will be freed and replaced with
- * the new file.
+ * the new file. An asynchronous load into the slot is cancelled.
  *
  * @param  ctrl
  *         The controller
  * @param  path
- *         The path to the MP3 file to be loaded on deck B.
+ *         The path to the MP3 file to be loaded into the slot.
  * @param  slot
  *         The slot number, where the file should be loaded.<br>
- *         <tt>0 <= slot < #MAX_SAMPLE_FILES</tt>
- * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3
+ *         <tt>0 <= slot < </tt>mbx_ctrl_get_n_sample_slots()
+ * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3, #MBX_OUT_OF_MEMORY if the
+ *         memory limit for decoded audio data would be exceeded, see
+ *         mbx_mem_set_limit().
  */
 extern mbx_error_code mbx_ctrl_sample_load(mbx_ctrl ctrl, const char *path,
         int slot);
 
 /**
- * Play/Resume the file currently loaded on deck A.
+ * Start loading an MP3 file on a deck in the background.
+ * <p>
+ * The function returns immediately, and the deck keeps playing the old file
+ * while the new one is loaded. When the load finished, the next call to
+ * mbx_ctrl_dispatch_loads() replaces the old file with the new one, and
+ * calls <tt>cb</tt>. A load started later on the same deck, synchronous or
+ * not, cancels this one: decoding stops, and <tt>cb</tt> is called with
+ * #MBX_LOAD_CANCELLED.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  path
+ *         The path to the MP3 file to be loaded on the deck.
+ * @param  deck
+ *         The deck number, <tt>0 <= deck < </tt>mbx_ctrl_get_n_decks().
+ * @param  cb
+ *         Called exactly once when the load finished, may be <tt>NULL</tt>.
+ * @param  userdata
+ *         Passed to <tt>cb</tt>.
+ * @return The load. It can be used until <tt>cb</tt> returns.
+ */
+extern mbx_load_job mbx_ctrl_deck_load_async(mbx_ctrl ctrl, const char *path,
+        int deck, mbx_load_cb cb, void *userdata);
+
+/**
+ * Start loading an MP3 file into a sample slot in the background.
+ * <p>
+ * Like mbx_ctrl_deck_load_async(), but for a sample slot.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  path
+ *         The path to the MP3 file to be loaded into the slot.
+ * @param  slot
+ *         The slot number, <tt>0 <= slot < </tt>
+ *         mbx_ctrl_get_n_sample_slots()
+ * @param  cb
+ *         Called exactly once when the load finished, may be <tt>NULL</tt>.
+ * @param  userdata
+ *         Passed to <tt>cb</tt>.
+ * @return The load. It can be used until <tt>cb</tt> returns.
+ */
+extern mbx_load_job mbx_ctrl_sample_load_async(mbx_ctrl ctrl,
+        const char *path, int slot, mbx_load_cb cb, void *userdata);
+
+/**
+ * Get the progress of an asynchronous load.
  *
- * If there is no file loaded on deck A, nothing happens.
+ * @param  job
+ *         The load
+ * @return The part of the file that was read, from <tt>0</tt> to
+ *         <tt>1</tt>.
+ */
+extern double mbx_load_job_get_progress(mbx_load_job job);
+
+/**
+ * Cancel an asynchronous load. Its callback is called with
+ * #MBX_LOAD_CANCELLED by the next call to mbx_ctrl_dispatch_loads() after
+ * the load stopped.
  *
  * @param  ctrl
  *         The controller
+ * @param  job
+ *         The load
  */
-extern void mbx_ctrl_deck_a_play(mbx_ctrl ctrl);
+extern void mbx_ctrl_cancel_load(mbx_ctrl ctrl, mbx_load_job job);
 
 /**
- * Play/Resume the file currently loaded on deck B.
+ * Get a file descriptor that is readable while asynchronous loads are
+ * finished, and mbx_ctrl_dispatch_loads() has work to do.
+ * <p>
+ * Front-ends with an event loop wait for it with poll() or select(). The
+ * file descriptor must not be read or closed.
  *
- * If there is no file loaded on deck B, nothing happens.
+ * @param  ctrl
+ *         The controller
+ * @return The file descriptor
+ */
+extern int mbx_ctrl_get_load_fd(mbx_ctrl ctrl);
+
+/**
+ * Install the files of the finished asynchronous loads on their decks and
+ * sample slots, and call the callbacks.
+ * <p>
+ * This function does not block. It must be called from the thread calling
+ * the other controller functions, so the callbacks are called in that
+ * thread, too.
  *
  * @param  ctrl
  *         The controller
  */
-extern void mbx_ctrl_deck_b_play(mbx_ctrl ctrl);
+extern void mbx_ctrl_dispatch_loads(mbx_ctrl ctrl);
 
 /**
- * Play the file currently loaded on a sample slot.
+ * Double a deck: Load the file on deck <tt>from</tt> onto deck <tt>to</tt>,
+ * at the same position.
+ * <p>
+ * If deck <tt>from</tt> is playing, deck <tt>to</tt> starts playing in sync.
+ * The decks share the decoded audio data, so this does not decode the file
+ * again, and takes no additional memory unless tracks are kept compressed
+ * (see #MBX_CFG_COMPRESSED). If deck <tt>to</tt> is already loaded, the old
+ * file will be freed and replaced. If there is no file loaded on deck
+ * <tt>from</tt>, or if <tt>from</tt> and <tt>to</tt> are the same deck,
+ * nothing happens.
  *
+ * @param  ctrl
+ *         The controller
+ * @param  from
+ *         The deck to be copied.
+ * @param  to
+ *         The deck where the copy is loaded.
+ * @return #MBX_SUCCESS, #MBX_OUT_OF_MEMORY if the memory limit for decoded
+ *         audio data would be exceeded, see mbx_mem_set_limit().
+ */
+extern mbx_error_code mbx_ctrl_deck_double(mbx_ctrl ctrl, int from, int to);
+
+/**
+ * Play/Resume the file currently loaded on a deck.
+ *
+ * Same as mbx_ctrl_deck_play_at() with #MBX_CTRL_NOW. If there is no file
+ * loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck to be played.
+ */
+extern void mbx_ctrl_deck_play(mbx_ctrl ctrl, int deck);
+
+/**
+ * Play the file currently loaded on a sample slot from the beginning.
+ * <p>
+ * Each call starts a new voice, so playing a slot again while it plays
+ * layers the sample. Up to #MBX_VOICES voices play at the same time. Beyond
+ * that, the oldest voices are faded out quickly.
+ * <p>
  * If there is no file loaded on that sample slot, nothing happens.
  *
  * @param  ctrl
@@ -110,24 +331,366 @@ extern void mbx_ctrl_deck_b_play(mbx_ctrl ctrl);
 extern void mbx_ctrl_sample_play(mbx_ctrl ctrl, int slot);
 
 /**
- * Pause the file currently loaded on deck A.
+ * Fade out all voices playing a sample slot, see mbx_ctrl_sample_play().
  *
- * If there is no file loaded on deck A, nothing happens.
+ * @param  ctrl
+ *         The controller
+ * @param  slot
+ *         The slot to be stopped.
+ */
+extern void mbx_ctrl_sample_stop(mbx_ctrl ctrl, int slot);
+
+/**
+ * Pause the file currently loaded on a deck.
+ *
+ * Same as mbx_ctrl_deck_pause_at() with #MBX_CTRL_NOW. If there is no file
+ * loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck to be paused.
+ */
+extern void mbx_ctrl_deck_pause(mbx_ctrl ctrl, int deck);
+
+/**
+ * Time value for the *_at() functions: apply the command as soon as
+ * possible.
+ */
+#define MBX_CTRL_NOW ((int64_t) -1)
+
+/**
+ * Get the current time of the speakers output.
+ * <p>
+ * The time is the number of frames rendered for the speakers since the
+ * controller was created. It runs ahead of what is audible by the output
+ * latency. Use it to compute the times for mbx_ctrl_deck_play_at() and
+ * the other *_at() functions, e.g. <tt>mbx_ctrl_get_time(ctrl) +
+ * MBX_SAMPLE_RATE</tt> for one second from now.
  *
  * @param  ctrl
  *         The controller
+ * @return The time in frames.
  */
-extern void mbx_ctrl_deck_a_pause(mbx_ctrl ctrl);
+extern int64_t mbx_ctrl_get_time(mbx_ctrl ctrl);
 
 /**
- * Pause the file currently loaded on deck B.
+ * Start a deck at an exact frame.
+ * <p>
+ * The command is applied when the speakers output renders the frame at
+ * time, independent of the output's buffer size. Commands at the same time
+ * are applied in the order they were given. Times in the past are applied
+ * as soon as possible.
+ * <p>
+ * If there is no file loaded on the deck at that time, nothing happens.
  *
- * If there is no file loaded on deck B, nothing happens.
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck to be played.
+ * @param  time
+ *         The frame on the clock of mbx_ctrl_get_time(), or #MBX_CTRL_NOW.
+ * @return #MBX_SUCCESS, or #MBX_TOO_MANY_EVENTS if too many commands are
+ *         waiting to be applied.
+ */
+extern mbx_error_code mbx_ctrl_deck_play_at(mbx_ctrl ctrl, int deck,
+        int64_t time);
+
+/**
+ * Play a sample slot at an exact frame, see mbx_ctrl_deck_play_at().
  *
  * @param  ctrl
  *         The controller
+ * @param  slot
+ *         The slot to be played.
+ * @param  time
+ *         The frame on the clock of mbx_ctrl_get_time(), or #MBX_CTRL_NOW.
+ * @return #MBX_SUCCESS, or #MBX_TOO_MANY_EVENTS.
+ */
+extern mbx_error_code mbx_ctrl_sample_play_at(mbx_ctrl ctrl, int slot,
+        int64_t time);
+
+/**
+ * Pause a deck at an exact frame, see mbx_ctrl_deck_play_at().
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck to be paused.
+ * @param  time
+ *         The frame on the clock of mbx_ctrl_get_time(), or #MBX_CTRL_NOW.
+ * @return #MBX_SUCCESS, or #MBX_TOO_MANY_EVENTS.
+ */
+extern mbx_error_code mbx_ctrl_deck_pause_at(mbx_ctrl ctrl, int deck,
+        int64_t time);
+
+/**
+ * Pre-listen to a deck on the headphones.
+ * <p>
+ * Each deck has a cue head, which plays on the headphones independently of
+ * the position and play state on the speakers. The cue head reads the same
+ * audio data as the speakers, so pre-listening does not load the file again.
+ * If there is no file loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck to be pre-listened.
+ * @return #MBX_SUCCESS, #MBX_OUT_OF_MEMORY if tracks are kept compressed
+ *         (see #MBX_CFG_COMPRESSED), and the memory limit for decoded audio
+ *         data would be exceeded, see mbx_mem_set_limit(),
+ *         #MBX_TOO_MANY_EVENTS if too many commands are waiting to be
+ *         applied on the headphones.
+ */
+extern mbx_error_code mbx_ctrl_deck_cue_play(mbx_ctrl ctrl, int deck);
+
+/**
+ * Pause the cue head of a deck, see mbx_ctrl_deck_cue_play().
+ *
+ * If there is no file loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ */
+extern void mbx_ctrl_deck_cue_pause(mbx_ctrl ctrl, int deck);
+
+/**
+ * Move the cue head of a deck, see mbx_ctrl_deck_cue_play().
+ *
+ * If there is no file loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  seconds
+ *         The new position of the cue head, in seconds from the beginning.
+ * @return #MBX_SUCCESS, #MBX_OUT_OF_MEMORY, see mbx_ctrl_deck_cue_play().
+ */
+extern mbx_error_code mbx_ctrl_deck_cue_seek(mbx_ctrl ctrl, int deck,
+        double seconds);
+
+/**
+ * Set the playback rate of a deck.
+ * <p>
+ * The rate applies to the speaker head and the cue head of the deck. It is
+ * approached within a few milliseconds, so it can be changed continuously
+ * for pitch bends, nudges and scratching. The pitch changes with the rate.
+ * <p>
+ * If there is no file loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  rate
+ *         <tt>1</tt> for normal speed, <tt>0</tt> to hold the record,
+ *         negative rates play in reverse. Rates are limited to <tt>-4</tt>
+ *         ... <tt>4</tt>.
+ */
+extern void mbx_ctrl_deck_set_rate(mbx_ctrl ctrl, int deck, double rate);
+
+/**
+ * Select whether a deck keeps its key when its rate changes.
+ * <p>
+ * With key lock, the rate set with mbx_ctrl_deck_set_rate() changes the
+ * tempo of the deck, but not its pitch. Stopping the deck, reverse play and
+ * scratching sound as without key lock.
+ * <p>
+ * If there is no file loaded on the deck, nothing happens.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  keylock
+ *         The time-stretching algorithm, or #MBX_KEYLOCK_OFF.
+ */
+extern void mbx_ctrl_deck_set_keylock(mbx_ctrl ctrl, int deck,
+        mbx_keylock keylock);
+
+/**
+ * Set the volume fader of a deck.
+ * <p>
+ * The volume applies to the speakers only, the headphones play the decks
+ * before the faders. Volume changes are smoothed within a few milliseconds,
+ * so the fader can be moved continuously without clicks.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  volume
+ *         From <tt>0</tt> (silent) to <tt>1</tt> (full volume, the default).
+ */
+extern void mbx_ctrl_deck_set_volume(mbx_ctrl ctrl, int deck, double volume);
+
+/**
+ * Set the pan control of a deck.
+ * <p>
+ * The pan control is a balance control on the speakers: at the center, both
+ * channels play at full level, towards a side the opposite channel fades
+ * out. Like the crossfader, it follows within one block of audio frames.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  pan
+ *         From <tt>-1</tt> (left) to <tt>1</tt> (right). The default is
+ *         <tt>0</tt>.
+ */
+extern void mbx_ctrl_deck_set_pan(mbx_ctrl ctrl, int deck, double pan);
+
+/**
+ * Set a band of the equalizer of a deck.
+ * <p>
+ * Like the volume, the equalizer applies to the speakers only. Gain changes
+ * ramp across one block of audio frames.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  band
+ *         The band
+ * @param  db
+ *         The gain in dB, from <tt>-24</tt> to <tt>6</tt>. The default is
+ *         <tt>0</tt>.
+ */
+extern void mbx_ctrl_deck_set_eq(mbx_ctrl ctrl, int deck, mbx_eq_band band,
+        double db);
+
+/**
+ * Kill a band of the equalizer of a deck.
+ * <p>
+ * A killed band is removed completely, not only attenuated, independent of
+ * its gain set with mbx_ctrl_deck_set_eq().
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  band
+ *         The band
+ * @param  kill
+ *         <tt>1</tt> to kill the band, <tt>0</tt> to restore it.
+ */
+extern void mbx_ctrl_deck_set_kill(mbx_ctrl ctrl, int deck, mbx_eq_band band,
+        int kill);
+
+/**
+ * Set the sweep filter of a deck.
+ * <p>
+ * The sweep filter is a resonant low-pass filter for negative positions,
+ * closing from 20 kHz at <tt>0</tt> to 20 Hz at <tt>-1</tt>, and a resonant
+ * high-pass filter for positive positions, closing from 20 Hz to 20 kHz at
+ * <tt>1</tt>. Around <tt>0</tt>, the filter is off.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  position
+ *         From <tt>-1</tt> to <tt>1</tt>. The default is <tt>0</tt>.
+ */
+extern void mbx_ctrl_deck_set_filter(mbx_ctrl ctrl, int deck,
+        double position);
+
+/**
+ * Assign a deck to a side of the crossfader.
+ * <p>
+ * By default, deck 0 is on side A, deck 1 on side B, and the other decks
+ * are not affected by the crossfader.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @param  side
+ *         The side, or #MBX_CROSSFADER_THRU.
+ */
+extern void mbx_ctrl_deck_set_crossfader_side(mbx_ctrl ctrl, int deck,
+        mbx_crossfader_side side);
+
+/**
+ * Move the crossfader.
+ * <p>
+ * The gains of the decks follow the crossfader within one block of audio
+ * frames, such that cuts stay sharp but do not click.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  position
+ *         <tt>-1</tt> plays side A only, <tt>1</tt> plays side B only.
+ *         The default is <tt>0</tt>, the center.
+ */
+extern void mbx_ctrl_set_crossfader(mbx_ctrl ctrl, double position);
+
+/**
+ * Select the curve of the crossfader.
+ *
+ * The default is #MBX_CROSSFADER_CONSTANT_POWER.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  curve
+ *         The curve
+ */
+extern void mbx_ctrl_set_crossfader_curve(mbx_ctrl ctrl,
+        mbx_crossfader_curve curve);
+
+/**
+ * Select the interpolation for decks playing at a rate other than 1.
+ *
+ * The default is #MBX_INTERPOLATION_CUBIC. #MBX_INTERPOLATION_SINC sounds
+ * best, but costs several times more CPU time.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  interpolation
+ *         The interpolation
+ */
+extern void mbx_ctrl_set_interpolation(mbx_ctrl ctrl,
+        mbx_interpolation interpolation);
+
+/**
+ * Get a snapshot of the controller's performance counters.
+ *
+ * The counters are updated by the audio threads without locking, so calling
+ * this function does not interfere with playback. The counters of an output
+ * accumulate from the moment the controller was created.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  stats
+ *         The current values of the counters are put here.
+ */
+extern void mbx_ctrl_get_stats(mbx_ctrl ctrl, mbx_ctrl_stats *stats);
+
+/**
+ * Get the bytes of decoded audio data held by a deck.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  deck
+ *         The deck
+ * @return The number of bytes, 0 if the deck is empty.
+ */
+extern size_t mbx_ctrl_deck_get_resident_bytes(mbx_ctrl ctrl, int deck);
+
+/**
+ * Get the bytes of decoded audio data held by a sample slot.
+ *
+ * @param  ctrl
+ *         The controller
+ * @param  slot
+ *         The sample slot
+ * @return The number of bytes, 0 if the slot is empty.
  */
-extern void mbx_ctrl_deck_b_pause(mbx_ctrl ctrl);
+extern size_t mbx_ctrl_sample_get_resident_bytes(mbx_ctrl ctrl, int slot);
 
 /**
  * Disconnect from the audio output, and free all resources.
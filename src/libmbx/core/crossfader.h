@@ -0,0 +1,32 @@
+#ifndef MBX_CROSSFADER_H
+#define MBX_CROSSFADER_H
+
+/**
+ * Shape of the crossfader, see mbx_ctrl_set_crossfader_curve().
+ */
+typedef enum {
+    /** The gain of a side falls linearly towards the other side. Both
+     *  sides are at half the gain in the center. */
+    MBX_CROSSFADER_LINEAR,
+    /** The summed power of both sides is constant. Both sides are at
+     *  -3 dB in the center. */
+    MBX_CROSSFADER_CONSTANT_POWER,
+    /** Both sides play at full gain, except in the last few percent of the
+     *  fader's travel towards the other side. For scratching. */
+    MBX_CROSSFADER_CUT
+} mbx_crossfader_curve;
+
+/**
+ * The side of the crossfader a deck is assigned to, see
+ * mbx_ctrl_deck_set_crossfader_side().
+ */
+typedef enum {
+    /** The crossfader does not change the gain of the deck. */
+    MBX_CROSSFADER_THRU,
+    /** The deck plays when the crossfader is on the left. */
+    MBX_CROSSFADER_SIDE_A,
+    /** The deck plays when the crossfader is on the right. */
+    MBX_CROSSFADER_SIDE_B
+} mbx_crossfader_side;
+
+#endif
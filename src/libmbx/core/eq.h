@@ -0,0 +1,16 @@
+#ifndef MBX_EQ_H
+#define MBX_EQ_H
+
+/**
+ * Band of a deck's equalizer, see mbx_ctrl_deck_set_eq().
+ */
+typedef enum {
+    /** Below 250 Hz: bass drum and bass line. */
+    MBX_EQ_LOW,
+    /** From 250 Hz to 2500 Hz: vocals and most instruments. */
+    MBX_EQ_MID,
+    /** Above 2500 Hz: hi-hats and cymbals. */
+    MBX_EQ_HIGH
+} mbx_eq_band;
+
+#endif
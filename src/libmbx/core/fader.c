@@ -0,0 +1,114 @@
+#include <math.h>
+#include <pthread.h>
+#include "fader.h"
+#include "libmbx/out/audio_output.h" /* defines MBX_SAMPLE_RATE */
+
+/* The curve tables hold the gain of a side for CURVE_STEPS + 1 distances of
+ * the crossfader from that side, from 0 (at the side) to 1 (at the other
+ * side). Gains between the steps are interpolated linearly. */
+#define CURVE_STEPS 256
+#define N_CURVES 3
+
+/* The part of the fader's travel where the cut curve fades. */
+#define CUT_WIDTH ( 1.0 / 32 )
+
+/* Time constant of the volume fader, in seconds. */
+#define VOLUME_TIME 0.005
+
+/* Below this distance, the volume snaps to its target (-80 dB). */
+#define VOLUME_EPSILON 0.0001f
+
+static float curves[N_CURVES][CURVE_STEPS + 1];
+static pthread_once_t curves_once = PTHREAD_ONCE_INIT;
+
+static void init_curves(void) {
+    int i;
+    for ( i=0; i<=CURVE_STEPS; i++ ) {
+        double x = (double) i / CURVE_STEPS;
+        curves[MBX_CROSSFADER_LINEAR][i] = 1 - x;
+        curves[MBX_CROSSFADER_CONSTANT_POWER][i] = cos(x * M_PI / 2);
+        curves[MBX_CROSSFADER_CUT][i] = x < 1 - CUT_WIDTH ? 1
+            : ( 1 - x ) / CUT_WIDTH;
+    }
+    // cos(M_PI / 2) is not exactly 0
+    curves[MBX_CROSSFADER_CONSTANT_POWER][CURVE_STEPS] = 0;
+}
+
+void _mbx_fader_init(void) {
+    pthread_once(&curves_once, init_curves);
+}
+
+void _mbx_fader_reset(struct _mbx_fader *fader, mbx_crossfader_side side) {
+    atomic_init(&fader->volume, 1);
+    atomic_init(&fader->pan, 0);
+    atomic_init(&fader->side, side);
+    fader->volume_current = 1;
+    fader->crossfader_current = 1;
+    fader->pan_left_current = 1;
+    fader->pan_right_current = 1;
+}
+
+float _mbx_fader_crossfader_gain(mbx_crossfader_curve curve,
+        mbx_crossfader_side side, float position) {
+    float x, f;
+    int i;
+    if ( side == MBX_CROSSFADER_THRU ) {
+        return 1;
+    }
+    if ( position < -1 ) {
+        position = -1;
+    }
+    if ( position > 1 ) {
+        position = 1;
+    }
+    x = ( side == MBX_CROSSFADER_SIDE_A ? 1 + position : 1 - position )
+        * ( CURVE_STEPS / 2 );
+    i = (int) x;
+    if ( i >= CURVE_STEPS ) {
+        return curves[curve][CURVE_STEPS];
+    }
+    f = x - i;
+    return curves[curve][i] + f * ( curves[curve][i+1] - curves[curve][i] );
+}
+
+static float crossfader_target(struct _mbx_fader *fader, float crossfader,
+        mbx_crossfader_curve curve) {
+    return _mbx_fader_crossfader_gain(curve,
+        atomic_load_explicit(&fader->side, memory_order_relaxed), crossfader);
+}
+
+void _mbx_fader_snap(struct _mbx_fader *fader, float crossfader,
+        mbx_crossfader_curve curve) {
+    fader->volume_current = atomic_load_explicit(&fader->volume,
+        memory_order_relaxed);
+    fader->crossfader_current = crossfader_target(fader, crossfader, curve);
+    _mbx_mix_pan_gains(atomic_load_explicit(&fader->pan, memory_order_relaxed),
+        &fader->pan_left_current, &fader->pan_right_current);
+}
+
+void _mbx_fader_next_block(struct _mbx_fader *fader, float crossfader,
+        mbx_crossfader_curve curve, size_t n_frames,
+        struct _mbx_gain *gain) {
+    float target = atomic_load_explicit(&fader->volume, memory_order_relaxed);
+    float volume = target;
+    float xfade = crossfader_target(fader, crossfader, curve);
+    float g0 = fader->volume_current * fader->crossfader_current;
+    float left, right;
+    _mbx_mix_pan_gains(atomic_load_explicit(&fader->pan, memory_order_relaxed),
+        &left, &right);
+    if ( target != fader->volume_current ) {
+        // One-pole smoothing, evaluated at the end of the block.
+        float k = expf(- (float) n_frames / ( VOLUME_TIME * MBX_SAMPLE_RATE ));
+        volume = target + ( fader->volume_current - target ) * k;
+        if ( fabsf(volume - target) < VOLUME_EPSILON ) {
+            volume = target;
+        }
+    }
+    fader->volume_current = volume;
+    fader->crossfader_current = xfade;
+    _mbx_gain_ramp(gain, g0 * fader->pan_left_current,
+        g0 * fader->pan_right_current, volume * xfade * left,
+        volume * xfade * right, n_frames);
+    fader->pan_left_current = left;
+    fader->pan_right_current = right;
+}
@@ -0,0 +1,58 @@
+#ifndef MBX_FADER_H
+#define MBX_FADER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "crossfader.h"
+#include "mixer.h"
+
+/******************************************************************************
+ * The gain stage of a deck on the speakers: its volume fader, its pan
+ * control, and the crossfader.
+ *
+ * The control thread sets the targets. Once per block, the audio thread
+ * moves the deck's gain towards them, and returns a ramp for the summation
+ * kernels (see struct _mbx_gain in mixer.h). The volume approaches its
+ * target exponentially, with a time constant of a few milliseconds. The
+ * crossfader and pan gains reach their targets linearly within one block,
+ * such that cuts stay sharp. The pan gains are those of
+ * _mbx_mix_pan_gains(). The crossfader curves are looked up in tables
+ * computed by _mbx_fader_init().
+ *****************************************************************************/
+
+struct _mbx_fader {
+    /* Set by the control thread. */
+    _Atomic float volume;
+    _Atomic float pan;  /* -1 (left) to 1 (right) */
+    atomic_int side;  /* mbx_crossfader_side */
+    /* Used by the audio thread only. */
+    float volume_current;
+    float crossfader_current;
+    float pan_left_current;
+    float pan_right_current;
+};
+
+/* Compute the curve tables. Must be called before the first call to
+ * _mbx_fader_next_block(), from any thread except the audio thread.
+ * Calling it again has no effect. */
+extern void _mbx_fader_init(void);
+
+/* Initialize fader at full volume and centered, assigned to side. */
+extern void _mbx_fader_reset(struct _mbx_fader *fader,
+        mbx_crossfader_side side);
+
+/* The gain of a crossfader side at position, from -1 (side A) to 1 (side B). */
+extern float _mbx_fader_crossfader_gain(mbx_crossfader_curve curve,
+        mbx_crossfader_side side, float position);
+
+/* Jump to the targets, e.g. when the deck starts playing. */
+extern void _mbx_fader_snap(struct _mbx_fader *fader, float crossfader,
+        mbx_crossfader_curve curve);
+
+/* Move the gain towards the targets across the next n_frames, and put the
+ * ramp in gain. */
+extern void _mbx_fader_next_block(struct _mbx_fader *fader, float crossfader,
+        mbx_crossfader_curve curve, size_t n_frames,
+        struct _mbx_gain *gain);
+
+#endif
@@ -0,0 +1,375 @@
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+#include <stdatomic.h>
+#include "filter_bank.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+#include "libmbx/out/audio_output.h" /* defines MBX_SAMPLE_RATE */
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Crossover frequencies of the isolator, see eq.h */
+#define LOW_FREQ 250.0
+#define HIGH_FREQ 2500.0
+#define BUTTERWORTH_Q 0.70710678
+
+/* The sweep filter moves from 20 kHz (low-pass) or 20 Hz (high-pass) to
+ * the other end of the audible range. Its resonance is fixed. Around 0,
+ * the filter is off. */
+#define SWEEP_MIN_FREQ 20.0
+#define SWEEP_MAX_FREQ 20000.0
+#define SWEEP_Q 1.5
+#define SWEEP_DEAD_ZONE 0.02f
+
+/* Band gains closer than this to their target are at the target. */
+#define GAIN_EPSILON 1e-6f
+
+#define N_BANDS 3
+
+/* Biquad stages of a deck, in transposed direct form II. Each stage has 4
+ * lanes: the left and right channel of two filters that run in parallel.
+ * The crossover is a Linkwitz-Riley crossover of 4th order at both
+ * frequencies: two Butterworth biquads in series split each band off. The
+ * low band passes an allpass with the phase of the high crossover, such
+ * that the bands sum to an allpass when all gains are 1. The stages with
+ * one filter have zero coefficients in lanes 2 and 3. */
+enum stage {
+    STAGE_SPLIT_1,       // low-pass for the low band | high-pass for the rest
+    STAGE_SPLIT_2,       // the same, 2nd biquad
+    STAGE_ALLPASS_MID,   // allpass of the low band | low-pass for the mid band
+    STAGE_HIGH_MID,      // high-pass for the high band | mid band, 2nd biquad
+    STAGE_HIGH,          // high band, 2nd biquad
+    STAGE_SWEEP,
+    N_STAGES
+};
+
+/* The filters of a deck. The coefficients are normalized by a0. */
+struct deck_filter {
+    float b0[N_STAGES][4], b1[N_STAGES][4], b2[N_STAGES][4];
+    float a1[N_STAGES][4], a2[N_STAGES][4];
+    float z1[N_STAGES][4], z2[N_STAGES][4];
+    float gain[N_BANDS];  // at the start of the next block
+    float sweep_used;     // the sweep position of the coefficients
+    int engaged;          // filtered since the deck started playing
+};
+
+struct _mbx_filter_bank {
+    int n_decks;
+    struct deck_filter *filters;  // used by the audio thread only
+    /* Parameters, set by the control thread. */
+    _Atomic float *band_gain;  // N_BANDS per deck
+    atomic_int *kill;          // bit mask of the killed bands per deck
+    _Atomic float *sweep;
+};
+
+enum biquad_type { LOW_PASS, HIGH_PASS, ALL_PASS, IDENTITY };
+
+/* Set the coefficients of the filter in lanes 2*half and 2*half+1 of a
+ * stage, see the Audio EQ Cookbook by Robert Bristow-Johnson. */
+static void set_biquad(struct deck_filter *f, int stage, int half,
+        enum biquad_type type, double freq, double q) {
+    double w0 = 2 * M_PI * freq / MBX_SAMPLE_RATE;
+    double cosw = cos(w0), alpha = sin(w0) / ( 2 * q );
+    double a0 = 1 + alpha;
+    double b0, b1, b2, a1 = -2 * cosw / a0, a2 = ( 1 - alpha ) / a0;
+    int lane;
+    switch ( type ) {
+        case LOW_PASS:
+            b0 = b2 = ( 1 - cosw ) / 2 / a0;
+            b1 = 2 * b0;
+            break;
+        case HIGH_PASS:
+            b0 = b2 = ( 1 + cosw ) / 2 / a0;
+            b1 = -2 * b0;
+            break;
+        case ALL_PASS:
+            b0 = a2;
+            b1 = a1;
+            b2 = 1;
+            break;
+        default:
+            b0 = 1;
+            b1 = b2 = a1 = a2 = 0;
+            break;
+    }
+    for ( lane=2*half; lane<2*half+2; lane++ ) {
+        f->b0[stage][lane] = b0;
+        f->b1[stage][lane] = b1;
+        f->b2[stage][lane] = b2;
+        f->a1[stage][lane] = a1;
+        f->a2[stage][lane] = a2;
+    }
+}
+
+static void init_filter(struct deck_filter *f) {
+    int i;
+    bzero(f, sizeof(struct deck_filter));
+    for ( i=0; i<2; i++ ) {
+        set_biquad(f, STAGE_SPLIT_1 + i, 0, LOW_PASS, LOW_FREQ, BUTTERWORTH_Q);
+        set_biquad(f, STAGE_SPLIT_1 + i, 1, HIGH_PASS, LOW_FREQ,
+            BUTTERWORTH_Q);
+    }
+    set_biquad(f, STAGE_ALLPASS_MID, 0, ALL_PASS, HIGH_FREQ, BUTTERWORTH_Q);
+    set_biquad(f, STAGE_ALLPASS_MID, 1, LOW_PASS, HIGH_FREQ, BUTTERWORTH_Q);
+    set_biquad(f, STAGE_HIGH_MID, 0, HIGH_PASS, HIGH_FREQ, BUTTERWORTH_Q);
+    set_biquad(f, STAGE_HIGH_MID, 1, LOW_PASS, HIGH_FREQ, BUTTERWORTH_Q);
+    set_biquad(f, STAGE_HIGH, 0, HIGH_PASS, HIGH_FREQ, BUTTERWORTH_Q);
+    set_biquad(f, STAGE_SWEEP, 0, IDENTITY, 0, 0);
+    for ( i=0; i<N_BANDS; i++ ) {
+        f->gain[i] = 1;
+    }
+}
+
+struct _mbx_filter_bank *_mbx_filter_bank_new(int n_decks) {
+    struct _mbx_filter_bank *bank = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        sizeof(struct _mbx_filter_bank));
+    int deck, b;
+    bank->n_decks = n_decks;
+    bank->filters = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        n_decks * sizeof(struct deck_filter));
+    bank->band_gain = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        n_decks * N_BANDS * sizeof(_Atomic float));
+    bank->kill = _mbx_xmalloc(MBX_LOG_CONTROLLER, n_decks * sizeof(atomic_int));
+    bank->sweep = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        n_decks * sizeof(_Atomic float));
+    for ( deck=0; deck<n_decks; deck++ ) {
+        init_filter(&bank->filters[deck]);
+        for ( b=0; b<N_BANDS; b++ ) {
+            atomic_init(&bank->band_gain[deck * N_BANDS + b], 1);
+        }
+        atomic_init(&bank->kill[deck], 0);
+        atomic_init(&bank->sweep[deck], 0);
+    }
+    return bank;
+}
+
+void _mbx_filter_bank_free(struct _mbx_filter_bank *bank) {
+    _mbx_xfree(bank->filters);
+    _mbx_xfree(bank->band_gain);
+    _mbx_xfree(bank->kill);
+    _mbx_xfree(bank->sweep);
+    _mbx_xfree(bank);
+}
+
+void _mbx_filter_bank_set_gain(struct _mbx_filter_bank *bank, int deck,
+        mbx_eq_band band, float gain) {
+    atomic_store_explicit(&bank->band_gain[deck * N_BANDS + band], gain,
+        memory_order_relaxed);
+}
+
+void _mbx_filter_bank_set_kill(struct _mbx_filter_bank *bank, int deck,
+        mbx_eq_band band, int kill) {
+    if ( kill ) {
+        atomic_fetch_or_explicit(&bank->kill[deck], 1 << band,
+            memory_order_relaxed);
+    }
+    else {
+        atomic_fetch_and_explicit(&bank->kill[deck], ~( 1 << band ),
+            memory_order_relaxed);
+    }
+}
+
+void _mbx_filter_bank_set_sweep(struct _mbx_filter_bank *bank, int deck,
+        float position) {
+    atomic_store_explicit(&bank->sweep[deck], position, memory_order_relaxed);
+}
+
+void _mbx_filter_bank_reset(struct _mbx_filter_bank *bank, int deck) {
+    bank->filters[deck].engaged = 0;
+}
+
+/* The gain the band of the deck is heading to. */
+static float target_gain(struct _mbx_filter_bank *bank, int deck, int band) {
+    if ( atomic_load_explicit(&bank->kill[deck], memory_order_relaxed)
+            & ( 1 << band ) ) {
+        return 0;
+    }
+    return atomic_load_explicit(&bank->band_gain[deck * N_BANDS + band],
+        memory_order_relaxed);
+}
+
+static int sweep_is_off(float position) {
+    return fabsf(position) < SWEEP_DEAD_ZONE;
+}
+
+/* Recompute the sweep coefficients of the deck for position. */
+static void set_sweep(struct deck_filter *f, float position) {
+    if ( sweep_is_off(position) ) {
+        set_biquad(f, STAGE_SWEEP, 0, IDENTITY, 0, 0);
+    }
+    else if ( position < 0 ) {
+        set_biquad(f, STAGE_SWEEP, 0, LOW_PASS, SWEEP_MAX_FREQ
+            * pow(SWEEP_MIN_FREQ / SWEEP_MAX_FREQ, -position), SWEEP_Q);
+    }
+    else {
+        set_biquad(f, STAGE_SWEEP, 0, HIGH_PASS, SWEEP_MIN_FREQ
+            * pow(SWEEP_MAX_FREQ / SWEEP_MIN_FREQ, position), SWEEP_Q);
+    }
+    f->sweep_used = position;
+}
+
+#ifdef __SSE2__
+/* The coefficients and state of a stage, one lane per element. */
+struct biquad4 {
+    __m128 b0, b1, b2, a1, a2;
+    __m128 z1, z2;
+};
+
+static inline __m128 biquad4(struct biquad4 *q, __m128 x) {
+    __m128 y = _mm_add_ps(_mm_mul_ps(q->b0, x), q->z1);
+    q->z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(q->b1, x),
+        _mm_mul_ps(q->a1, y)), q->z2);
+    q->z2 = _mm_sub_ps(_mm_mul_ps(q->b2, x), _mm_mul_ps(q->a2, y));
+    return y;
+}
+
+/* Filter n_frames of buf in place. The band gains ramp from the gains of f
+ * by step per frame, the output fades from the unfiltered input by
+ * dry_step per frame. */
+static void filter(struct deck_filter *f, float *buf, size_t n_frames,
+        const float *step, float dry, float dry_step) {
+    struct biquad4 q[N_STAGES];
+    __m128 g_low_mid = _mm_setr_ps(f->gain[MBX_EQ_LOW], f->gain[MBX_EQ_LOW],
+        f->gain[MBX_EQ_MID], f->gain[MBX_EQ_MID]);
+    __m128 step_low_mid = _mm_setr_ps(step[MBX_EQ_LOW], step[MBX_EQ_LOW],
+        step[MBX_EQ_MID], step[MBX_EQ_MID]);
+    __m128 g_high = _mm_set1_ps(f->gain[MBX_EQ_HIGH]);
+    __m128 step_high = _mm_set1_ps(step[MBX_EQ_HIGH]);
+    __m128 g_dry = _mm_set1_ps(dry);
+    __m128 step_dry = _mm_set1_ps(dry_step);
+    __m128 x = _mm_setzero_ps();
+    int s;
+    size_t i;
+    for ( s=0; s<N_STAGES; s++ ) {
+        q[s].b0 = _mm_loadu_ps(f->b0[s]);
+        q[s].b1 = _mm_loadu_ps(f->b1[s]);
+        q[s].b2 = _mm_loadu_ps(f->b2[s]);
+        q[s].a1 = _mm_loadu_ps(f->a1[s]);
+        q[s].a2 = _mm_loadu_ps(f->a2[s]);
+        q[s].z1 = _mm_loadu_ps(f->z1[s]);
+        q[s].z2 = _mm_loadu_ps(f->z2[s]);
+    }
+    for ( i=0; i<n_frames; i++ ) {
+        __m128 split, low_mid1, high1_mid, high, bands, y;
+        x = _mm_loadl_pi(x, (const __m64 *) (buf + 2*i));
+        x = _mm_movelh_ps(x, x);
+        split = biquad4(&q[STAGE_SPLIT_2], biquad4(&q[STAGE_SPLIT_1], x));
+        low_mid1 = biquad4(&q[STAGE_ALLPASS_MID], split);
+        high1_mid = biquad4(&q[STAGE_HIGH_MID],
+            _mm_shuffle_ps(split, low_mid1, _MM_SHUFFLE(3, 2, 3, 2)));
+        high = biquad4(&q[STAGE_HIGH], high1_mid);
+        // low and mid band in one register, then the sum of all bands
+        bands = _mm_mul_ps(g_low_mid,
+            _mm_shuffle_ps(low_mid1, high1_mid, _MM_SHUFFLE(3, 2, 1, 0)));
+        y = _mm_add_ps(_mm_add_ps(bands, _mm_movehl_ps(bands, bands)),
+            _mm_mul_ps(g_high, high));
+        y = biquad4(&q[STAGE_SWEEP], y);
+        y = _mm_add_ps(y, _mm_mul_ps(g_dry, _mm_sub_ps(x, y)));
+        _mm_storel_pi((__m64 *) (buf + 2*i), y);
+        g_low_mid = _mm_add_ps(g_low_mid, step_low_mid);
+        g_high = _mm_add_ps(g_high, step_high);
+        g_dry = _mm_add_ps(g_dry, step_dry);
+    }
+    for ( s=0; s<N_STAGES; s++ ) {
+        _mm_storeu_ps(f->z1[s], q[s].z1);
+        _mm_storeu_ps(f->z2[s], q[s].z2);
+    }
+}
+#else
+static float biquad(struct deck_filter *f, int stage, int lane, float x) {
+    float y = f->b0[stage][lane] * x + f->z1[stage][lane];
+    f->z1[stage][lane] = f->b1[stage][lane] * x - f->a1[stage][lane] * y
+        + f->z2[stage][lane];
+    f->z2[stage][lane] = f->b2[stage][lane] * x - f->a2[stage][lane] * y;
+    return y;
+}
+
+/* Without SSE, denormals are not flushed to zero by the FPU. */
+static void flush(float *z) {
+    if ( fabsf(*z) < 1e-15f ) {
+        *z = 0;
+    }
+}
+
+static void filter(struct deck_filter *f, float *buf, size_t n_frames,
+        const float *step, float dry, float dry_step) {
+    int c, s, b;
+    size_t i;
+    for ( c=0; c<2; c++ ) {
+        float g[N_BANDS];
+        float g_dry = dry;
+        for ( b=0; b<N_BANDS; b++ ) {
+            g[b] = f->gain[b];
+        }
+        for ( i=0; i<n_frames; i++ ) {
+            float x = buf[2*i + c];
+            float low, rest, mid, high, y;
+            low = biquad(f, STAGE_SPLIT_2, c, biquad(f, STAGE_SPLIT_1, c, x));
+            rest = biquad(f, STAGE_SPLIT_2, c + 2,
+                biquad(f, STAGE_SPLIT_1, c + 2, x));
+            low = biquad(f, STAGE_ALLPASS_MID, c, low);
+            mid = biquad(f, STAGE_HIGH_MID, c + 2,
+                biquad(f, STAGE_ALLPASS_MID, c + 2, rest));
+            high = biquad(f, STAGE_HIGH, c,
+                biquad(f, STAGE_HIGH_MID, c, rest));
+            y = g[MBX_EQ_LOW] * low + g[MBX_EQ_MID] * mid
+                + g[MBX_EQ_HIGH] * high;
+            y = biquad(f, STAGE_SWEEP, c, y);
+            buf[2*i + c] = y + g_dry * ( x - y );
+            for ( b=0; b<N_BANDS; b++ ) {
+                g[b] += step[b];
+            }
+            g_dry += dry_step;
+        }
+        for ( s=0; s<N_STAGES; s++ ) {
+            flush(&f->z1[s][c]);
+            flush(&f->z2[s][c]);
+            flush(&f->z1[s][c + 2]);
+            flush(&f->z2[s][c + 2]);
+        }
+    }
+}
+#endif
+
+void _mbx_filter_bank_process(struct _mbx_filter_bank *bank, int deck,
+        float *buf, size_t n_frames) {
+    struct deck_filter *f = &bank->filters[deck];
+    float sweep = atomic_load_explicit(&bank->sweep[deck],
+        memory_order_relaxed);
+    float target[N_BANDS], step[N_BANDS];
+    float dry = 0;
+    int b, neutral = sweep_is_off(sweep);
+    for ( b=0; b<N_BANDS; b++ ) {
+        target[b] = target_gain(bank, deck, b);
+        if ( fabsf(target[b] - f->gain[b]) < GAIN_EPSILON ) {
+            f->gain[b] = target[b];
+        }
+        neutral = neutral && target[b] == 1 && f->gain[b] == 1;
+    }
+    if ( ! f->engaged ) {
+        if ( neutral ) {
+            return;
+        }
+        // The filters start from silence, and the output fades from the
+        // unfiltered input to the filtered one. From now on, the deck is
+        // filtered until it stops, even when the filters are neutral: the
+        // allpass of the crossover would shift its phase when switching.
+        bzero(f->z1, sizeof(f->z1));
+        bzero(f->z2, sizeof(f->z2));
+        f->engaged = 1;
+        dry = 1;
+    }
+    if ( sweep != f->sweep_used ) {
+        set_sweep(f, sweep);
+    }
+    for ( b=0; b<N_BANDS; b++ ) {
+        step[b] = ( target[b] - f->gain[b] ) / n_frames;
+    }
+    filter(f, buf, n_frames, step, dry, - dry / n_frames);
+    for ( b=0; b<N_BANDS; b++ ) {
+        f->gain[b] = target[b];
+    }
+}
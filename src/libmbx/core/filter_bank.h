@@ -0,0 +1,59 @@
+#ifndef MBX_FILTER_BANK_H
+#define MBX_FILTER_BANK_H
+
+#include <stddef.h>
+#include "eq.h"
+
+/******************************************************************************
+ * The filter bank holds the equalizer and the sweep filter of the decks on
+ * the speakers.
+ *
+ * The equalizer of a deck is an isolator: a crossover of Linkwitz-Riley
+ * filters of 4th order splits the input into three bands, and each band has
+ * its own gain, so a killed band is removed, not only attenuated. When all
+ * gains are 1, the bands sum to an allpass. The sweep filter is a resonant
+ * biquad after the equalizer, low-pass or high-pass depending on its
+ * position.
+ *
+ * The filter state of a deck is stored in SIMD lanes: with SSE2, the left
+ * and right channel of two filters that do not depend on each other are
+ * processed in one register. Coefficients are recomputed only when the
+ * sweep position changes, band gains ramp across a block. A deck passes
+ * unchanged until its filters are used for the first time; from then on
+ * it is filtered until it stops, because the allpass would shift its phase
+ * when switching. The caller must enable flush to zero in the audio thread,
+ * see _mbx_mix_set_flush_to_zero().
+ *
+ * The _mbx_filter_bank_set_*() functions are called by the control thread.
+ * The other functions are called by the audio thread, they do not allocate
+ * memory.
+ *****************************************************************************/
+
+struct _mbx_filter_bank;
+
+extern struct _mbx_filter_bank *_mbx_filter_bank_new(int n_decks);
+
+extern void _mbx_filter_bank_free(struct _mbx_filter_bank *bank);
+
+/* Set the linear gain of a band, 1 is neutral. */
+extern void _mbx_filter_bank_set_gain(struct _mbx_filter_bank *bank,
+        int deck, mbx_eq_band band, float gain);
+
+/* Mute a band while kill is set, independent of its gain. */
+extern void _mbx_filter_bank_set_kill(struct _mbx_filter_bank *bank,
+        int deck, mbx_eq_band band, int kill);
+
+/* Set the sweep filter from -1 (low-pass, closed) over 0 (off) to 1
+ * (high-pass, closed). */
+extern void _mbx_filter_bank_set_sweep(struct _mbx_filter_bank *bank,
+        int deck, float position);
+
+/* The deck starts playing: its filters start from silence when they are
+ * used. */
+extern void _mbx_filter_bank_reset(struct _mbx_filter_bank *bank, int deck);
+
+/* Filter n_frames interleaved stereo frames of the deck in buf, in place. */
+extern void _mbx_filter_bank_process(struct _mbx_filter_bank *bank,
+        int deck, float *buf, size_t n_frames);
+
+#endif
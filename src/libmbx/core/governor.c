@@ -0,0 +1,157 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include "governor.h"
+#include "timestretch.h"
+#include "varispeed.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+#include "libmbx/common/worker_pool.h"
+
+/* A step down is taken when the load exceeded the threshold on this many
+ * more blocks than it did not, and at least HOLD_NS passed since the last
+ * step, so that the last step shows in the load. */
+#define OVERLOAD_BLOCKS 8
+#define HOLD_NS 250000000ULL
+
+/* A step up is taken when the load stayed below half the threshold for
+ * RECOVER_NS. */
+#define RECOVER_NS 2000000000ULL
+
+/* The polyphony at _MBX_GOVERNOR_POLYPHONY. */
+#define FEW_VOICES 8
+
+struct _mbx_governor {
+    unsigned long threshold;  // in 1/100 percent, like the load below
+    struct _mbx_voice_pool *voices;
+    // Owned by the render thread
+    int n_over;  // leaky count of blocks over the threshold
+    uint64_t since_step_ns;  // played since the last step
+    uint64_t calm_ns;  // played with the load below half the threshold
+    // Published to the logger thread
+    atomic_int level;
+    atomic_ulong step_load;  // the load of the block causing the last step
+    sem_t wakeup;
+    atomic_int running;
+    pthread_t logger;
+};
+
+static const char *level_names[_MBX_GOVERNOR_N_LEVELS] = {
+    "full quality",
+    "cubic interpolation",
+    "linear interpolation",
+    "linear interpolation, WSOLA time-stretching",
+    "linear interpolation, WSOLA time-stretching, limited polyphony"
+};
+
+/* Set the limits of level, in the render thread. */
+static void apply(struct _mbx_governor *gov, int level) {
+    _mbx_varispeed_set_limit(level >= _MBX_GOVERNOR_LINEAR
+        ? MBX_INTERPOLATION_LINEAR : level >= _MBX_GOVERNOR_CUBIC
+        ? MBX_INTERPOLATION_CUBIC : MBX_INTERPOLATION_SINC);
+    _mbx_stretch_set_limit(level >= _MBX_GOVERNOR_WSOLA
+        ? MBX_KEYLOCK_WSOLA : MBX_KEYLOCK_PHASE_VOCODER);
+    _mbx_voice_pool_set_limit(gov->voices,
+        level >= _MBX_GOVERNOR_POLYPHONY ? FEW_VOICES : MBX_VOICES);
+}
+
+/* Log the level changes. Levels passed quickly may be logged as one. */
+static void *logger_main(void *userdata) {
+    struct _mbx_governor *gov = userdata;
+    int logged = _MBX_GOVERNOR_FULL, level;
+    for (;;) {
+        if ( sem_wait(&gov->wakeup) != 0 ) {
+            continue;  // interrupted by a signal
+        }
+        if ( ! atomic_load(&gov->running) ) {
+            break;
+        }
+        level = atomic_load(&gov->level);
+        if ( level > logged ) {
+            mbx_log_warn(MBX_LOG_CONTROLLER, "Render load %.0f%% is over "
+                "%.0f%%. Reduced quality to %s.",
+                atomic_load(&gov->step_load) / 100.0, gov->threshold / 100.0,
+                level_names[level]);
+        }
+        else if ( level < logged ) {
+            mbx_log_info(MBX_LOG_CONTROLLER, "Render load is back to normal. "
+                "Restored quality to %s.", level_names[level]);
+        }
+        logged = level;
+    }
+    return NULL;
+}
+
+struct _mbx_governor *_mbx_governor_new(double threshold_percent,
+        struct _mbx_voice_pool *voices) {
+    struct _mbx_governor *gov = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        sizeof(struct _mbx_governor));
+    gov->threshold = (unsigned long) ( threshold_percent * 100 );
+    gov->voices = voices;
+    gov->n_over = 0;
+    gov->since_step_ns = HOLD_NS;
+    gov->calm_ns = 0;
+    atomic_init(&gov->level, _MBX_GOVERNOR_FULL);
+    atomic_init(&gov->step_load, 0);
+    sem_init(&gov->wakeup, 0, 0);
+    atomic_init(&gov->running, 1);
+    if ( pthread_create(&gov->logger, NULL, logger_main, gov) != 0 ) {
+        mbx_log_fatal(MBX_LOG_CONTROLLER, "Failed to start the governor "
+            "thread.");
+        exit(-1);
+    }
+    _mbx_pool_set_background_affinity(gov->logger);
+    return gov;
+}
+
+void _mbx_governor_free(struct _mbx_governor *gov) {
+    atomic_store(&gov->running, 0);
+    sem_post(&gov->wakeup);
+    pthread_join(gov->logger, NULL);
+    sem_destroy(&gov->wakeup);
+    apply(gov, _MBX_GOVERNOR_FULL);
+    _mbx_xfree(gov);
+}
+
+/* Take one step to level, in the render thread. */
+static void step(struct _mbx_governor *gov, int level, unsigned long load) {
+    apply(gov, level);
+    atomic_store(&gov->step_load, load);
+    atomic_store(&gov->level, level);
+    gov->n_over = 0;
+    gov->since_step_ns = 0;
+    gov->calm_ns = 0;
+    sem_post(&gov->wakeup);
+}
+
+void _mbx_governor_account(struct _mbx_governor *gov, uint64_t busy_ns,
+        uint64_t period_ns) {
+    unsigned long load = busy_ns * 10000 / period_ns;
+    int level = atomic_load_explicit(&gov->level, memory_order_relaxed);
+    gov->since_step_ns += period_ns;
+    if ( load > gov->threshold ) {
+        gov->n_over++;
+        gov->calm_ns = 0;
+    }
+    else {
+        if ( gov->n_over > 0 ) {
+            gov->n_over--;
+        }
+        gov->calm_ns = load < gov->threshold / 2 ? gov->calm_ns + period_ns : 0;
+    }
+    if ( gov->since_step_ns < HOLD_NS ) {
+        return;
+    }
+    if ( gov->n_over >= OVERLOAD_BLOCKS
+            && level < _MBX_GOVERNOR_N_LEVELS - 1 ) {
+        step(gov, level + 1, load);
+    }
+    else if ( gov->calm_ns >= RECOVER_NS && level > _MBX_GOVERNOR_FULL ) {
+        step(gov, level - 1, load);
+    }
+}
+
+enum _mbx_governor_level _mbx_governor_get_level(struct _mbx_governor *gov) {
+    return atomic_load_explicit(&gov->level, memory_order_relaxed);
+}
@@ -0,0 +1,53 @@
+#ifndef MBX_GOVERNOR_H
+#define MBX_GOVERNOR_H
+
+#include <stdint.h>
+#include "voice_pool.h"
+
+/******************************************************************************
+ * The overload governor trades sound quality for CPU time when rendering
+ * gets close to missing its deadline.
+ *
+ * The render thread reports the time spent on each block, and the period
+ * the block plays for. When the load exceeds the threshold on several
+ * blocks, the governor takes one step down the levels below, and waits for
+ * the step to take effect before taking the next one. When the load stays
+ * below half the threshold for a few seconds, it takes one step back up.
+ *
+ * The levels are global: they limit the interpolation (see varispeed.h) and
+ * time-stretching (see timestretch.h) of all decks, and the polyphony of the
+ * voice pool. The changes are logged by a thread of the governor, not by
+ * the render thread.
+ *****************************************************************************/
+
+enum _mbx_governor_level {
+    _MBX_GOVERNOR_FULL,      // no limits
+    _MBX_GOVERNOR_CUBIC,     // sinc interpolation falls back to cubic
+    _MBX_GOVERNOR_LINEAR,    // all interpolation is linear
+    _MBX_GOVERNOR_WSOLA,     // the phase vocoder falls back to WSOLA
+    _MBX_GOVERNOR_POLYPHONY, // few voices play samples at once
+    _MBX_GOVERNOR_N_LEVELS
+};
+
+struct _mbx_governor;
+
+/* Create a governor at full quality, shedding load when the render load
+ * exceeds threshold_percent. voices is the voice pool of the render thread
+ * calling _mbx_governor_account(). */
+extern struct _mbx_governor *_mbx_governor_new(double threshold_percent,
+        struct _mbx_voice_pool *voices);
+
+/* Restore full quality and free the governor, after the render thread
+ * stopped. */
+extern void _mbx_governor_free(struct _mbx_governor *gov);
+
+/* Account a block which took busy_ns to render and plays for period_ns.
+ * Called by the render thread after each block, does not block. */
+extern void _mbx_governor_account(struct _mbx_governor *gov, uint64_t busy_ns,
+        uint64_t period_ns);
+
+/* The current level, safe to call in any thread. */
+extern enum _mbx_governor_level _mbx_governor_get_level(
+        struct _mbx_governor *gov);
+
+#endif
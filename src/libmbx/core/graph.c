@@ -0,0 +1,361 @@
+#include <assert.h>
+#include <string.h>
+#include <strings.h>
+#include "graph.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+enum node_kind { NODE_SOURCE, NODE_PROCESS, NODE_BUS };
+
+struct node {
+    enum node_kind kind;
+    _mbx_node_fn fn;
+    void *userdata;
+    int arg;
+    int *inputs;
+    int n_inputs;
+    int n_readers;  // the number of nodes reading the output
+    /* Used while compiling */
+    enum { UNVISITED, VISITING, EMITTED } state;
+    int buf;  // the buffer holding the output
+};
+
+enum op_code {
+    OP_SOURCE,      // render node to dst
+    OP_PROCESS,     // process dst in place with node
+    OP_COPY,        // copy src to dst, for in place nodes on a shared input
+    OP_CLEAR,       // start a bus on dst
+    OP_ACCUMULATE   // add src to the bus on dst
+};
+
+struct op {
+    enum op_code code;
+    int node;
+    int dst;
+    int src;
+    int skip;  // OP_SOURCE: the next operation if the source is silent
+};
+
+struct _mbx_graph {
+    struct node *nodes;
+    int n_nodes;
+    struct op *ops;
+    int n_ops;
+    int output;  // the buffer of the output tap
+    size_t max_frames;
+    int n_buffers;
+    float *buffers;  // 2 * max_frames floats each
+    int *live;
+    struct _mbx_gain *gains;
+};
+
+struct _mbx_graph *_mbx_graph_new(void) {
+    struct _mbx_graph *graph = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        sizeof(struct _mbx_graph));
+    bzero(graph, sizeof(struct _mbx_graph));
+    return graph;
+}
+
+void _mbx_graph_free(struct _mbx_graph *graph) {
+    int i;
+    if ( graph == NULL ) {
+        return;
+    }
+    for ( i=0; i<graph->n_nodes; i++ ) {
+        _mbx_xfree(graph->nodes[i].inputs);
+    }
+    _mbx_xfree(graph->nodes);
+    _mbx_xfree(graph->ops);
+    _mbx_xfree(graph->buffers);
+    _mbx_xfree(graph->live);
+    _mbx_xfree(graph->gains);
+    _mbx_xfree(graph);
+}
+
+static int add_node(struct _mbx_graph *graph, enum node_kind kind,
+        _mbx_node_fn fn, void *userdata, int arg) {
+    struct node *node;
+    assert ( graph->ops == NULL );
+    graph->nodes = _mbx_xrealloc(MBX_LOG_CONTROLLER, graph->nodes,
+        ( graph->n_nodes + 1 ) * sizeof(struct node));
+    node = &graph->nodes[graph->n_nodes];
+    bzero(node, sizeof(struct node));
+    node->kind = kind;
+    node->fn = fn;
+    node->userdata = userdata;
+    node->arg = arg;
+    return graph->n_nodes++;
+}
+
+static void add_input(struct _mbx_graph *graph, int node, int input) {
+    struct node *n = &graph->nodes[node];
+    assert ( input >= 0 && input < graph->n_nodes );
+    n->inputs = _mbx_xrealloc(MBX_LOG_CONTROLLER, n->inputs,
+        ( n->n_inputs + 1 ) * sizeof(int));
+    n->inputs[n->n_inputs++] = input;
+    graph->nodes[input].n_readers++;
+}
+
+int _mbx_graph_add_source(struct _mbx_graph *graph, _mbx_node_fn fn,
+        void *userdata, int arg) {
+    return add_node(graph, NODE_SOURCE, fn, userdata, arg);
+}
+
+int _mbx_graph_add_process(struct _mbx_graph *graph, _mbx_node_fn fn,
+        void *userdata, int arg, int input) {
+    int node = add_node(graph, NODE_PROCESS, fn, userdata, arg);
+    add_input(graph, node, input);
+    return node;
+}
+
+int _mbx_graph_add_bus(struct _mbx_graph *graph) {
+    return add_node(graph, NODE_BUS, NULL, NULL, 0);
+}
+
+void _mbx_graph_connect(struct _mbx_graph *graph, int node, int bus) {
+    assert ( graph->nodes[bus].kind == NODE_BUS );
+    add_input(graph, bus, node);
+}
+
+/*****************************************************************************
+ * Compilation
+ ****************************************************************************/
+
+/* The buffers while compiling. A graph never needs more buffers than two
+ * per node: the node's output, and a copy of a shared input. */
+struct compiler {
+    int *readers;  // the number of readers still to run, per buffer
+    int *free;     // the free buffers
+    int n_free;
+};
+
+static int alloc_buffer(struct _mbx_graph *graph, struct compiler *c) {
+    if ( c->n_free > 0 ) {
+        return c->free[--c->n_free];
+    }
+    return graph->n_buffers++;
+}
+
+/* A reader of buf ran. */
+static void release_buffer(struct compiler *c, int buf) {
+    assert ( c->readers[buf] > 0 );
+    if ( --c->readers[buf] == 0 ) {
+        c->free[c->n_free++] = buf;
+    }
+}
+
+static int emit_op(struct _mbx_graph *graph, enum op_code code, int node,
+        int dst, int src) {
+    struct op *op = &graph->ops[graph->n_ops];
+    op->code = code;
+    op->node = node;
+    op->dst = dst;
+    op->src = src;
+    op->skip = graph->n_ops + 1;
+    return graph->n_ops++;
+}
+
+/* Emit the operations computing node after the operations of its inputs,
+ * and return the buffer holding its output. */
+static int emit(struct _mbx_graph *graph, struct compiler *c, int node) {
+    struct node *n = &graph->nodes[node];
+    int i, buf = -1, copy;
+    if ( n->state == EMITTED ) {
+        return n->buf;
+    }
+    assert ( n->state == UNVISITED ); // otherwise, the graph has a cycle
+    n->state = VISITING;
+    switch ( n->kind ) {
+        case NODE_SOURCE:
+            buf = alloc_buffer(graph, c);
+            emit_op(graph, OP_SOURCE, node, buf, -1);
+            break;
+        case NODE_PROCESS:
+            buf = emit(graph, c, n->inputs[0]);
+            if ( c->readers[buf] > 1 ) {
+                // Other nodes read the input later, work on a copy.
+                copy = alloc_buffer(graph, c);
+                emit_op(graph, OP_COPY, -1, copy, buf);
+                release_buffer(c, buf);
+                buf = copy;
+            }
+            emit_op(graph, OP_PROCESS, node, buf, -1);
+            break;
+        case NODE_BUS:
+            buf = alloc_buffer(graph, c);
+            emit_op(graph, OP_CLEAR, node, buf, -1);
+            for ( i=0; i<n->n_inputs; i++ ) {
+                int first = graph->n_ops, last, j, chain = 1;
+                int input = emit(graph, c, n->inputs[i]);
+                last = emit_op(graph, OP_ACCUMULATE, node, buf, input);
+                release_buffer(c, input);
+                // A source read by a chain of processing nodes only: when it
+                // is silent, the chain and the accumulation are skipped.
+                for ( j=first+1; j<last; j++ ) {
+                    chain = chain && graph->ops[j].code == OP_PROCESS
+                        && graph->ops[j].dst == input;
+                }
+                if ( first < last && graph->ops[first].code == OP_SOURCE
+                        && graph->ops[first].dst == input && chain
+                        && c->readers[input] == 0 ) {
+                    graph->ops[first].skip = last + 1;
+                }
+            }
+            break;
+    }
+    c->readers[buf] = n->n_readers;
+    n->buf = buf;
+    n->state = EMITTED;
+    return buf;
+}
+
+void _mbx_graph_compile(struct _mbx_graph *graph, int output,
+        size_t max_frames) {
+    struct compiler c;
+    int i, max_ops = 0;
+    assert ( output >= 0 && output < graph->n_nodes );
+    for ( i=0; i<graph->n_nodes; i++ ) {
+        // a bus has an accumulation per input, a process node may copy
+        max_ops += 2 + graph->nodes[i].n_inputs;
+    }
+    graph->ops = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        max_ops * sizeof(struct op));
+    c.readers = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        2 * graph->n_nodes * sizeof(int));
+    c.free = _mbx_xmalloc(MBX_LOG_CONTROLLER, 2 * graph->n_nodes * sizeof(int));
+    c.n_free = 0;
+    // The output tap is a reader of the output node.
+    graph->nodes[output].n_readers++;
+    graph->output = emit(graph, &c, output);
+    graph->nodes[output].n_readers--;
+    _mbx_xfree(c.readers);
+    _mbx_xfree(c.free);
+    graph->max_frames = max_frames;
+    graph->buffers = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        graph->n_buffers * 2 * max_frames * sizeof(float));
+    graph->live = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        graph->n_buffers * sizeof(int));
+    graph->gains = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        graph->n_buffers * sizeof(struct _mbx_gain));
+    mbx_log_debug(MBX_LOG_CONTROLLER,
+        "Compiled render graph: %d nodes, %d operations, %d buffers.",
+        graph->n_nodes, graph->n_ops, graph->n_buffers);
+}
+
+/*****************************************************************************
+ * Rendering
+ ****************************************************************************/
+
+const float *_mbx_graph_render(struct _mbx_graph *graph, size_t n_frames) {
+    size_t size = 2 * graph->max_frames;
+    struct node *node;
+    float *dst, *src;
+    int i = 0;
+    assert ( n_frames <= graph->max_frames );
+    while ( i < graph->n_ops ) {
+        struct op *op = &graph->ops[i];
+        dst = graph->buffers + op->dst * size;
+        switch ( op->code ) {
+            case OP_SOURCE:
+                node = &graph->nodes[op->node];
+                _mbx_gain_ramp(&graph->gains[op->dst], 1, 1, 1, 1, n_frames);
+                graph->live[op->dst] = node->fn(node->userdata, node->arg,
+                    dst, &graph->gains[op->dst], n_frames);
+                if ( ! graph->live[op->dst] ) {
+                    i = op->skip;
+                    continue;
+                }
+                break;
+            case OP_PROCESS:
+                node = &graph->nodes[op->node];
+                if ( graph->live[op->dst] ) {
+                    graph->live[op->dst] = node->fn(node->userdata, node->arg,
+                        dst, &graph->gains[op->dst], n_frames);
+                }
+                break;
+            case OP_COPY:
+                src = graph->buffers + op->src * size;
+                graph->live[op->dst] = graph->live[op->src];
+                graph->gains[op->dst] = graph->gains[op->src];
+                if ( graph->live[op->src] ) {
+                    memcpy(dst, src, 2 * n_frames * sizeof(float));
+                }
+                break;
+            case OP_CLEAR:
+                graph->live[op->dst] = 0;
+                _mbx_gain_ramp(&graph->gains[op->dst], 1, 1, 1, 1, n_frames);
+                break;
+            case OP_ACCUMULATE:
+                src = graph->buffers + op->src * size;
+                if ( ! graph->live[op->src] ) {
+                    break;
+                }
+                if ( graph->live[op->dst] ) {
+                    _mbx_mix_float(dst, src, n_frames, &graph->gains[op->src]);
+                }
+                else if ( _mbx_gain_is_unity(&graph->gains[op->src]) ) {
+                    memcpy(dst, src, 2 * n_frames * sizeof(float));
+                }
+                else {
+                    bzero(dst, 2 * n_frames * sizeof(float));
+                    _mbx_mix_float(dst, src, n_frames, &graph->gains[op->src]);
+                }
+                graph->live[op->dst] = 1;
+                break;
+        }
+        i++;
+    }
+    if ( ! graph->live[graph->output] ) {
+        return NULL;
+    }
+    dst = graph->buffers + graph->output * size;
+    if ( ! _mbx_gain_is_unity(&graph->gains[graph->output]) ) {
+        _mbx_mix_apply_gain(dst, n_frames, &graph->gains[graph->output]);
+    }
+    return dst;
+}
+
+/*****************************************************************************
+ * Installing graphs
+ ****************************************************************************/
+
+void _mbx_graph_slot_init(struct _mbx_graph_slot *slot) {
+    slot->current = NULL;
+    atomic_init(&slot->next, NULL);
+    atomic_init(&slot->retired, NULL);
+}
+
+void _mbx_graph_slot_install(struct _mbx_graph_slot *slot,
+        struct _mbx_graph *graph) {
+    _mbx_graph_free(atomic_exchange(&slot->retired, NULL));
+    // A graph installed before, which the audio thread did not pick up, was
+    // never used.
+    _mbx_graph_free(atomic_exchange(&slot->next, graph));
+}
+
+/* The audio thread only swaps when the retired graph was freed, so it never
+ * has to free a graph itself. */
+struct _mbx_graph *_mbx_graph_slot_acquire(struct _mbx_graph_slot *slot) {
+    struct _mbx_graph *next;
+    if ( atomic_load_explicit(&slot->next, memory_order_relaxed) == NULL ) {
+        return slot->current;
+    }
+    if ( slot->current != NULL && atomic_load(&slot->retired) != NULL ) {
+        return slot->current;
+    }
+    next = atomic_exchange(&slot->next, NULL);
+    if ( next != NULL ) {
+        if ( slot->current != NULL ) {
+            atomic_store(&slot->retired, slot->current);
+        }
+        slot->current = next;
+    }
+    return slot->current;
+}
+
+void _mbx_graph_slot_free(struct _mbx_graph_slot *slot) {
+    _mbx_graph_free(slot->current);
+    _mbx_graph_free(atomic_exchange(&slot->next, NULL));
+    _mbx_graph_free(atomic_exchange(&slot->retired, NULL));
+    slot->current = NULL;
+}
@@ -0,0 +1,88 @@
+#ifndef MBX_GRAPH_H
+#define MBX_GRAPH_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "mixer.h"
+
+/******************************************************************************
+ * The render graph of an output.
+ *
+ * A graph is a DAG of nodes: sources (like the head of a deck), processing
+ * nodes (like the equalizer or the fader of a deck), and buses summing
+ * their inputs. One node is the output tap. The control thread builds the
+ * graph and compiles it into a flat list of operations, in topological
+ * order, starting from the output. Nodes the output does not depend on are
+ * dropped. A bus becomes one accumulate operation per input, placed right
+ * after the input is rendered, and block buffers are assigned by liveness:
+ * a buffer is reused as soon as its last reader ran, and processing nodes
+ * work in place on the buffer of their input. The working set is a few
+ * blocks independent of the number of nodes, and stays in the cache.
+ *
+ * At run time, a buffer is either live or silent. A silent source skips
+ * the operations that only depend on it, so the cost of a render grows with
+ * the active nodes. Gains are not applied to a buffer by the node setting
+ * them, but when the buffer is added to a bus, in the same pass.
+ *
+ * The audio thread renders the graph installed in a struct _mbx_graph_slot.
+ * The control thread installs a new graph atomically; the audio thread picks
+ * it up at the start of its next block.
+ *****************************************************************************/
+
+/* The function of a node, rendering n_frames interleaved stereo frames in
+ * buf. A source finds buf undefined and gain at unity; it returns 0 if it
+ * is silent, or 1 if it rendered to buf. A processing node finds the live
+ * output of its input in buf and the input's gain in gain, and processes
+ * them in place; it returns 1, or 0 if the output is silent. gain is
+ * applied to buf when it is added to a bus. */
+typedef int (*_mbx_node_fn)(void *userdata, int arg, float *buf,
+        struct _mbx_gain *gain, size_t n_frames);
+
+struct _mbx_graph;
+
+extern struct _mbx_graph *_mbx_graph_new(void);
+
+extern void _mbx_graph_free(struct _mbx_graph *graph);
+
+/* Add nodes. The functions return the index of the new node. */
+extern int _mbx_graph_add_source(struct _mbx_graph *graph, _mbx_node_fn fn,
+        void *userdata, int arg);
+extern int _mbx_graph_add_process(struct _mbx_graph *graph, _mbx_node_fn fn,
+        void *userdata, int arg, int input);
+extern int _mbx_graph_add_bus(struct _mbx_graph *graph);
+
+/* Add node to the inputs of bus. */
+extern void _mbx_graph_connect(struct _mbx_graph *graph, int node, int bus);
+
+/* Compile the graph for rendering up to max_frames frames at a time, with
+ * output as the output tap. The graph must not have cycles. No nodes can be
+ * added afterwards. */
+extern void _mbx_graph_compile(struct _mbx_graph *graph, int output,
+        size_t max_frames);
+
+/* Render n_frames in the audio thread. Returns the output, or NULL if it
+ * is silent. */
+extern const float *_mbx_graph_render(struct _mbx_graph *graph,
+        size_t n_frames);
+
+struct _mbx_graph_slot {
+    struct _mbx_graph *current;            // used by the audio thread
+    _Atomic(struct _mbx_graph *) next;     // installed, not used yet
+    _Atomic(struct _mbx_graph *) retired;  // no longer used
+};
+
+extern void _mbx_graph_slot_init(struct _mbx_graph_slot *slot);
+
+/* Install a compiled graph, in the control thread. The slot owns the graph
+ * from now on. Graphs retired by the audio thread are freed. */
+extern void _mbx_graph_slot_install(struct _mbx_graph_slot *slot,
+        struct _mbx_graph *graph);
+
+/* The graph to render the next block with, in the audio thread. */
+extern struct _mbx_graph *_mbx_graph_slot_acquire(
+        struct _mbx_graph_slot *slot);
+
+/* Free all graphs of the slot, after the audio thread stopped. */
+extern void _mbx_graph_slot_free(struct _mbx_graph_slot *slot);
+
+#endif
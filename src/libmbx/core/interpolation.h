@@ -0,0 +1,17 @@
+#ifndef MBX_INTERPOLATION_H
+#define MBX_INTERPOLATION_H
+
+/**
+ * Interpolation used when a deck plays at a rate other than 1, see
+ * mbx_ctrl_set_interpolation().
+ */
+typedef enum {
+    /** Linear interpolation between two frames. Cheapest, dull highs. */
+    MBX_INTERPOLATION_LINEAR,
+    /** Cubic (Catmull-Rom) interpolation over four frames. */
+    MBX_INTERPOLATION_CUBIC,
+    /** Windowed sinc interpolation over 16 frames. Best quality. */
+    MBX_INTERPOLATION_SINC
+} mbx_interpolation;
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef MBX_KEYLOCK_H
+#define MBX_KEYLOCK_H
+
+/**
+ * Key lock mode of a deck, see mbx_ctrl_deck_set_keylock().
+ */
+typedef enum {
+    /** The pitch changes with the rate, like on a turntable. */
+    MBX_KEYLOCK_OFF,
+    /** Time-stretching by overlapping similar waveform segments (WSOLA).
+     *  Cheap (about 1.3% of an x86 core per deck at 48 kHz, measured with
+     *  src/bench), and good for beats. Sustained tones may warble. */
+    MBX_KEYLOCK_WSOLA,
+    /** Time-stretching in the frequency domain (phase vocoder). Smooth on
+     *  tonal music, softens transients. Costs about 4.5 times the CPU
+     *  time of WSOLA. */
+    MBX_KEYLOCK_PHASE_VOCODER
+} mbx_keylock;
+
+#endif
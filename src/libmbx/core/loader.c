@@ -0,0 +1,120 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "loader.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/worker_pool.h"
+#include "libmbx/common/xmalloc.h"
+
+void _mbx_loader_init(struct _mbx_loader *loader) {
+    pthread_mutex_init(&loader->mutex, NULL);
+    pthread_cond_init(&loader->finished, NULL);
+    loader->n_running = 0;
+    loader->done = NULL;
+    loader->done_tail = &loader->done;
+    if ( pipe(loader->pipe) != 0 ) {
+        mbx_log_fatal(MBX_LOG_CONTROLLER, "Failed to create the loader "
+            "pipe: %s", strerror(errno));
+        exit(-1);
+    }
+    fcntl(loader->pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(loader->pipe[1], F_SETFL, O_NONBLOCK);
+}
+
+void _mbx_loader_free(struct _mbx_loader *loader) {
+    struct _mbx_load_job *job;
+    pthread_mutex_lock(&loader->mutex);
+    while ( loader->n_running > 0 ) {
+        pthread_cond_wait(&loader->finished, &loader->mutex);
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    while ( ( job = _mbx_loader_collect(loader) ) != NULL ) {
+        if ( job->track != NULL ) {
+            _mbx_track_free(job->track);
+        }
+        _mbx_loader_job_free(job);
+    }
+    close(loader->pipe[0]);
+    close(loader->pipe[1]);
+    pthread_cond_destroy(&loader->finished);
+    pthread_mutex_destroy(&loader->mutex);
+}
+
+struct _mbx_load_job *_mbx_loader_job_new(const char *path) {
+    struct _mbx_load_job *job = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        sizeof(struct _mbx_load_job));
+    bzero(job, sizeof(struct _mbx_load_job));
+    job->path = _mbx_xstrdup(MBX_LOG_CONTROLLER, path);
+    atomic_init(&job->progress.bytes_read, 0);
+    atomic_init(&job->progress.bytes_total, 0);
+    atomic_init(&job->progress.cancel, 0);
+    return job;
+}
+
+void _mbx_loader_job_free(struct _mbx_load_job *job) {
+    _mbx_xfree(job->path);
+    bzero(job, sizeof(struct _mbx_load_job));
+    _mbx_xfree(job);
+}
+
+static void load_task(void *arg) {
+    struct _mbx_load_job *job = arg;
+    struct _mbx_loader *loader = job->loader;
+    job->result = _mbx_track_new(&job->track, job->path, job->compressed,
+        &job->progress);
+    if ( job->result != MBX_SUCCESS ) {
+        job->track = NULL;
+    }
+    pthread_mutex_lock(&loader->mutex);
+    *loader->done_tail = job;
+    loader->done_tail = &job->next;
+    // If the pipe is full, it is readable anyway.
+    if ( write(loader->pipe[1], "", 1) < 0 ) {
+        mbx_log_debug(MBX_LOG_CONTROLLER, "Loader pipe is full.");
+    }
+    // The loader may be freed as soon as the mutex is released.
+    loader->n_running--;
+    pthread_cond_broadcast(&loader->finished);
+    pthread_mutex_unlock(&loader->mutex);
+}
+
+void _mbx_loader_start(struct _mbx_loader *loader, struct _mbx_load_job *job) {
+    job->loader = loader;
+    job->next = NULL;
+    pthread_mutex_lock(&loader->mutex);
+    loader->n_running++;
+    pthread_mutex_unlock(&loader->mutex);
+    _mbx_pool_submit(job->sample ? _MBX_PRIORITY_SAMPLE_LOAD
+        : _MBX_PRIORITY_DECK_LOAD, load_task, job);
+}
+
+void _mbx_loader_cancel(struct _mbx_load_job *job) {
+    atomic_store(&job->progress.cancel, 1);
+}
+
+int _mbx_loader_get_fd(struct _mbx_loader *loader) {
+    return loader->pipe[0];
+}
+
+struct _mbx_load_job *_mbx_loader_collect(struct _mbx_loader *loader) {
+    struct _mbx_load_job *job;
+    char bytes[64];
+    pthread_mutex_lock(&loader->mutex);
+    job = loader->done;
+    if ( job != NULL ) {
+        loader->done = job->next;
+        if ( loader->done == NULL ) {
+            loader->done_tail = &loader->done;
+        }
+    }
+    if ( loader->done == NULL ) {
+        // Jobs finishing from now on write their byte after this.
+        while ( read(loader->pipe[0], bytes, sizeof(bytes)) > 0 ) {
+        }
+    }
+    pthread_mutex_unlock(&loader->mutex);
+    return job;
+}
@@ -0,0 +1,75 @@
+#ifndef MBX_LOADER_H
+#define MBX_LOADER_H
+
+#include <pthread.h>
+#include "controller.h"
+#include "libmbx/mp3lib/pcm_buffer.h"
+
+/******************************************************************************
+ * The loader runs the asynchronous loads of the controller, see
+ * mbx_ctrl_deck_load_async().
+ *
+ * Each job loads its file into a new track in a task of the worker pool,
+ * at the priority of its target, see worker_pool.h. A finished job
+ * is put on the done list, and a byte is written to a pipe, such that the
+ * front-end can wait for finished jobs with poll() or select(). The
+ * controller collects the finished jobs in its own thread, installs the
+ * tracks, and calls the callbacks. The loader does not know about decks or
+ * sample slots.
+ *****************************************************************************/
+
+struct _mbx_load_job {
+    // Set by the controller
+    char *path;
+    int compressed;
+    int sample;  // 1 if target is a sample slot, 0 if it is a deck
+    int target;
+    mbx_load_cb cb;
+    void *userdata;
+    // Set by the loading thread
+    struct _mbx_load_progress progress;
+    _mbx_track track;  // the loaded track if result is MBX_SUCCESS
+    mbx_error_code result;
+    // Private to loader.c
+    struct _mbx_loader *loader;
+    struct _mbx_load_job *next;
+};
+
+struct _mbx_loader {
+    pthread_mutex_t mutex;
+    pthread_cond_t finished;
+    int n_running;
+    struct _mbx_load_job *done;  // finished jobs, oldest first
+    struct _mbx_load_job **done_tail;
+    int pipe[2];  // readable while jobs are done, not blocking
+};
+
+extern void _mbx_loader_init(struct _mbx_loader *loader);
+
+/* Wait for the running jobs, and free all jobs that were not collected,
+ * with their tracks. Cancel the jobs first to make this quick. */
+extern void _mbx_loader_free(struct _mbx_loader *loader);
+
+/* Allocate a job loading path. The caller sets the other fields set by the
+ * controller. */
+extern struct _mbx_load_job *_mbx_loader_job_new(const char *path);
+
+/* Free a collected job. The track is not freed. */
+extern void _mbx_loader_job_free(struct _mbx_load_job *job);
+
+/* Start loading job->path into job->track. */
+extern void _mbx_loader_start(struct _mbx_loader *loader,
+        struct _mbx_load_job *job);
+
+/* Make the job stop early. It is still collected, with the result
+ * MBX_LOAD_CANCELLED unless it finished before. */
+extern void _mbx_loader_cancel(struct _mbx_load_job *job);
+
+/* The file descriptor that is readable while jobs are done. */
+extern int _mbx_loader_get_fd(struct _mbx_loader *loader);
+
+/* Remove the oldest finished job from the done list, or return NULL if no
+ * job is done. Does not block. */
+extern struct _mbx_load_job *_mbx_loader_collect(struct _mbx_loader *loader);
+
+#endif
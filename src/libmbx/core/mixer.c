@@ -0,0 +1,188 @@
+#include <math.h>
+#include "mixer.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+void _mbx_gain_ramp(struct _mbx_gain *gain, float left0, float right0,
+        float left1, float right1, size_t n_frames) {
+    gain->left = left0;
+    gain->right = right0;
+    gain->step_left = n_frames > 0 ? ( left1 - left0 ) / n_frames : 0;
+    gain->step_right = n_frames > 0 ? ( right1 - right0 ) / n_frames : 0;
+}
+
+void _mbx_gain_advance(struct _mbx_gain *gain, size_t n_frames) {
+    gain->left += gain->step_left * n_frames;
+    gain->right += gain->step_right * n_frames;
+}
+
+int _mbx_gain_is_unity(const struct _mbx_gain *gain) {
+    return gain->left == 1 && gain->right == 1
+        && gain->step_left == 0 && gain->step_right == 0;
+}
+
+void _mbx_mix_stereo(float *dst, const sample_t *src, size_t n_frames,
+        const struct _mbx_gain *gain) {
+    size_t i = 0;
+#ifdef __SSE2__
+    /* 4 frames = 8 samples per iteration. g is the gain of the first two
+     * frames, step moves it by two frames. */
+    const __m128 step = _mm_setr_ps(2 * gain->step_left, 2 * gain->step_right,
+        2 * gain->step_left, 2 * gain->step_right);
+    __m128 g = _mm_setr_ps(gain->left, gain->right,
+        gain->left + gain->step_left, gain->right + gain->step_right);
+    for ( ; i + 4 <= n_frames; i += 4 ) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + 2*i));
+        /* sign-extend 16 bit to 32 bit */
+        __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(s, s), 16);
+        __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(s, s), 16);
+        __m128 d0 = _mm_loadu_ps(dst + 2*i);
+        __m128 d1 = _mm_loadu_ps(dst + 2*i + 4);
+        d0 = _mm_add_ps(d0, _mm_mul_ps(_mm_cvtepi32_ps(lo), g));
+        g = _mm_add_ps(g, step);
+        d1 = _mm_add_ps(d1, _mm_mul_ps(_mm_cvtepi32_ps(hi), g));
+        g = _mm_add_ps(g, step);
+        _mm_storeu_ps(dst + 2*i, d0);
+        _mm_storeu_ps(dst + 2*i + 4, d1);
+    }
+#endif
+    for ( ; i < n_frames; i++ ) {
+        dst[2*i] += src[2*i] * ( gain->left + i * gain->step_left );
+        dst[2*i+1] += src[2*i+1] * ( gain->right + i * gain->step_right );
+    }
+}
+
+void _mbx_mix_mono(float *dst, const sample_t *src, size_t n_frames,
+        const struct _mbx_gain *gain) {
+    size_t i = 0;
+#ifdef __SSE2__
+    /* 8 frames = 8 samples per iteration, written as 16 floats */
+    const __m128 step = _mm_setr_ps(2 * gain->step_left, 2 * gain->step_right,
+        2 * gain->step_left, 2 * gain->step_right);
+    __m128 g = _mm_setr_ps(gain->left, gain->right,
+        gain->left + gain->step_left, gain->right + gain->step_right);
+    for ( ; i + 8 <= n_frames; i += 8 ) {
+        __m128i s = _mm_loadu_si128((const __m128i *) (src + i));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(s, s),
+            16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(s, s),
+            16));
+        /* duplicate each sample for the left and the right channel */
+        __m128 f0 = _mm_unpacklo_ps(lo, lo);
+        __m128 f1 = _mm_unpackhi_ps(lo, lo);
+        __m128 f2 = _mm_unpacklo_ps(hi, hi);
+        __m128 f3 = _mm_unpackhi_ps(hi, hi);
+        float *d = dst + 2*i;
+        _mm_storeu_ps(d,      _mm_add_ps(_mm_loadu_ps(d),      _mm_mul_ps(f0, g)));
+        g = _mm_add_ps(g, step);
+        _mm_storeu_ps(d + 4,  _mm_add_ps(_mm_loadu_ps(d + 4),  _mm_mul_ps(f1, g)));
+        g = _mm_add_ps(g, step);
+        _mm_storeu_ps(d + 8,  _mm_add_ps(_mm_loadu_ps(d + 8),  _mm_mul_ps(f2, g)));
+        g = _mm_add_ps(g, step);
+        _mm_storeu_ps(d + 12, _mm_add_ps(_mm_loadu_ps(d + 12), _mm_mul_ps(f3, g)));
+        g = _mm_add_ps(g, step);
+    }
+#endif
+    for ( ; i < n_frames; i++ ) {
+        dst[2*i] += src[i] * ( gain->left + i * gain->step_left );
+        dst[2*i+1] += src[i] * ( gain->right + i * gain->step_right );
+    }
+}
+
+void _mbx_mix_float(float *dst, const float *src, size_t n_frames,
+        const struct _mbx_gain *gain) {
+    size_t i = 0;
+#ifdef __SSE2__
+    /* 2 frames = 4 samples per iteration */
+    const __m128 step = _mm_setr_ps(2 * gain->step_left, 2 * gain->step_right,
+        2 * gain->step_left, 2 * gain->step_right);
+    __m128 g = _mm_setr_ps(gain->left, gain->right,
+        gain->left + gain->step_left, gain->right + gain->step_right);
+    for ( ; i + 2 <= n_frames; i += 2 ) {
+        __m128 d = _mm_loadu_ps(dst + 2*i);
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_loadu_ps(src + 2*i), g));
+        g = _mm_add_ps(g, step);
+        _mm_storeu_ps(dst + 2*i, d);
+    }
+#endif
+    for ( ; i < n_frames; i++ ) {
+        dst[2*i] += src[2*i] * ( gain->left + i * gain->step_left );
+        dst[2*i+1] += src[2*i+1] * ( gain->right + i * gain->step_right );
+    }
+}
+
+void _mbx_mix_apply_gain(float *buf, size_t n_frames,
+        const struct _mbx_gain *gain) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 step = _mm_setr_ps(2 * gain->step_left, 2 * gain->step_right,
+        2 * gain->step_left, 2 * gain->step_right);
+    __m128 g = _mm_setr_ps(gain->left, gain->right,
+        gain->left + gain->step_left, gain->right + gain->step_right);
+    for ( ; i + 2 <= n_frames; i += 2 ) {
+        _mm_storeu_ps(buf + 2*i, _mm_mul_ps(_mm_loadu_ps(buf + 2*i), g));
+        g = _mm_add_ps(g, step);
+    }
+#endif
+    for ( ; i < n_frames; i++ ) {
+        buf[2*i] *= gain->left + i * gain->step_left;
+        buf[2*i+1] *= gain->right + i * gain->step_right;
+    }
+}
+
+/* Clamped like _mm_min_ps() and _mm_max_ps() below, which turn NaN into
+ * the upper limit, and rounded to nearest even like _mm_cvtps_epi32(). */
+static sample_t saturate(float f) {
+    if ( ! ( f < 32767.0f ) ) {
+        f = 32767.0f;
+    } else if ( f < -32768.0f ) {
+        f = -32768.0f;
+    }
+    return (sample_t) lrintf(f);
+}
+
+void _mbx_mix_to_s16(sample_t *dst, const float *src, size_t n_frames) {
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    /* 8 frames per iteration. Values are clamped before the conversion,
+     * which returns INT_MIN for NaN and for values out of range. The
+     * conversion rounds to nearest (the default MXCSR rounding mode). */
+    for ( ; i + 16 <= 2 * n_frames; i += 16 ) {
+        __m128i a = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+            _mm_loadu_ps(src + i), hi), lo));
+        __m128i b = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+            _mm_loadu_ps(src + i + 4), hi), lo));
+        __m128i c = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+            _mm_loadu_ps(src + i + 8), hi), lo));
+        __m128i d = _mm_cvtps_epi32(_mm_max_ps(_mm_min_ps(
+            _mm_loadu_ps(src + i + 12), hi), lo));
+        _mm_storeu_si128((__m128i *) (dst + i), _mm_packs_epi32(a, b));
+        _mm_storeu_si128((__m128i *) (dst + i + 8), _mm_packs_epi32(c, d));
+    }
+#endif
+    for ( ; i < 2 * n_frames; i++ ) {
+        dst[i] = saturate(src[i]);
+    }
+}
+
+void _mbx_mix_pan_gains(float pan, float *gain_left, float *gain_right) {
+    if ( pan < -1 ) {
+        pan = -1;
+    }
+    if ( pan > 1 ) {
+        pan = 1;
+    }
+    *gain_left = pan > 0 ? 1 - pan : 1;
+    *gain_right = pan < 0 ? 1 + pan : 1;
+}
+
+void _mbx_mix_set_flush_to_zero(void) {
+#ifdef __SSE2__
+    // FTZ (bit 15) and DAZ (bit 6) of the MXCSR register
+    _mm_setcsr(_mm_getcsr() | 0x8040);
+#endif
+}
@@ -0,0 +1,74 @@
+#ifndef MBX_MIXER_H
+#define MBX_MIXER_H
+
+#include <stddef.h>
+#include "libmbx/out/audio_output.h" /* defines sample_t */
+
+/******************************************************************************
+ * Summation kernels for the controller's mix bus.
+ *
+ * The mix bus is a block of interleaved stereo float frames. Sources are
+ * added to the bus with a gain per stereo channel, which may ramp across the
+ * block (see struct _mbx_gain). The gain is applied in the summation, so
+ * volume changes need no pass of their own. The bus is converted to 16 bit
+ * with saturation when the block is complete. The kernels use SSE2
+ * when available, and process any number of frames.
+ *****************************************************************************/
+
+/* The gain of a source across a block. Frame i of the block is multiplied
+ * with left + i * step_left on the left channel, and right + i * step_right
+ * on the right channel, such that gain changes ramp without clicks. */
+struct _mbx_gain {
+    float left;
+    float right;
+    float step_left;
+    float step_right;
+};
+
+/* Ramp from the gains left0, right0 at the first frame to left1, right1
+ * after n_frames. With equal values, the gain is constant. */
+extern void _mbx_gain_ramp(struct _mbx_gain *gain, float left0, float right0,
+        float left1, float right1, size_t n_frames);
+
+/* Move the start of the ramp n_frames forward. */
+extern void _mbx_gain_advance(struct _mbx_gain *gain, size_t n_frames);
+
+/* 1 if the gain leaves the audio unchanged. */
+extern int _mbx_gain_is_unity(const struct _mbx_gain *gain);
+
+/* Add n_frames interleaved stereo frames from src to the mix bus dst. */
+extern void _mbx_mix_stereo(float *dst, const sample_t *src, size_t n_frames,
+        const struct _mbx_gain *gain);
+
+/* Add n_frames mono frames from src to both channels of the mix bus dst.
+ * The gains implement the panning of the mono source. */
+extern void _mbx_mix_mono(float *dst, const sample_t *src, size_t n_frames,
+        const struct _mbx_gain *gain);
+
+/* Add n_frames interleaved stereo float frames from src to dst, e.g. a
+ * bus to another bus. */
+extern void _mbx_mix_float(float *dst, const float *src, size_t n_frames,
+        const struct _mbx_gain *gain);
+
+/* Multiply n_frames of buf with gain, in place. */
+extern void _mbx_mix_apply_gain(float *buf, size_t n_frames,
+        const struct _mbx_gain *gain);
+
+/* Convert n_frames of the mix bus src to interleaved 16 bit frames in dst,
+ * rounding to the nearest value and clipping values out of range. */
+extern void _mbx_mix_to_s16(sample_t *dst, const float *src,
+        size_t n_frames);
+
+/* Compute the gains for a pan position between -1 (left) and 1 (right).
+ * This is a balance control: At the center, both gains are 1, such that a
+ * mono source is played at the same level as before the decoder kept mono
+ * tracks mono. Towards the sides, the opposite channel fades out. */
+extern void _mbx_mix_pan_gains(float pan, float *gain_left,
+        float *gain_right);
+
+/* Flush denormal floats to zero in the calling thread. Recursive filters
+ * decaying to silence would otherwise run into denormals, which are slow
+ * on x86. Without SSE2, this does nothing. */
+extern void _mbx_mix_set_flush_to_zero(void);
+
+#endif
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "ring.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+void _mbx_ring_init(struct _mbx_ring *ring, size_t min_frames) {
+    size_t capacity = 1;
+    while ( capacity < min_frames ) {
+        capacity *= 2;
+    }
+    ring->frames = _mbx_xmalloc(MBX_LOG_CONTROLLER,
+        2 * capacity * sizeof(sample_t));
+    bzero(ring->frames, 2 * capacity * sizeof(sample_t));
+    ring->mask = capacity - 1;
+    atomic_init(&ring->write_index, 0);
+    atomic_init(&ring->read_index, 0);
+}
+
+void _mbx_ring_free(struct _mbx_ring *ring) {
+    _mbx_xfree(ring->frames);
+    ring->frames = NULL;
+}
+
+size_t _mbx_ring_capacity(const struct _mbx_ring *ring) {
+    return ring->mask + 1;
+}
+
+size_t _mbx_ring_fill(struct _mbx_ring *ring) {
+    size_t r = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    size_t w = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    return w - r;
+}
+
+size_t _mbx_ring_write(struct _mbx_ring *ring, const sample_t *src,
+        size_t n_frames) {
+    size_t w = atomic_load_explicit(&ring->write_index, memory_order_relaxed);
+    size_t r = atomic_load_explicit(&ring->read_index, memory_order_acquire);
+    size_t pos = w & ring->mask, n_first;
+    if ( n_frames > ring->mask + 1 - ( w - r ) ) {
+        n_frames = ring->mask + 1 - ( w - r );
+    }
+    n_first = ring->mask + 1 - pos;
+    if ( n_first > n_frames ) {
+        n_first = n_frames;
+    }
+    memcpy(ring->frames + 2 * pos, src, 2 * n_first * sizeof(sample_t));
+    memcpy(ring->frames, src + 2 * n_first,
+        2 * ( n_frames - n_first ) * sizeof(sample_t));
+    atomic_store_explicit(&ring->write_index, w + n_frames,
+        memory_order_release);
+    return n_frames;
+}
+
+size_t _mbx_ring_read(struct _mbx_ring *ring, sample_t *dst,
+        size_t n_frames) {
+    size_t r = atomic_load_explicit(&ring->read_index, memory_order_relaxed);
+    size_t w = atomic_load_explicit(&ring->write_index, memory_order_acquire);
+    size_t pos = r & ring->mask, n_first;
+    if ( n_frames > w - r ) {
+        n_frames = w - r;
+    }
+    n_first = ring->mask + 1 - pos;
+    if ( n_first > n_frames ) {
+        n_first = n_frames;
+    }
+    memcpy(dst, ring->frames + 2 * pos, 2 * n_first * sizeof(sample_t));
+    memcpy(dst + 2 * n_first, ring->frames,
+        2 * ( n_frames - n_first ) * sizeof(sample_t));
+    atomic_store_explicit(&ring->read_index, r + n_frames,
+        memory_order_release);
+    return n_frames;
+}
@@ -0,0 +1,54 @@
+#ifndef MBX_RING_H
+#define MBX_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "libmbx/out/audio_output.h" /* defines sample_t */
+
+/******************************************************************************
+ * Single producer single consumer ring of interleaved stereo frames, from
+ * the render thread of an output to the output callback.
+ *
+ * The capacity is a power of two, so the indexes count frames forever and
+ * are masked to find the position in the ring. Only the producer moves
+ * write_index, only the consumer moves read_index, and each publishes its
+ * index with release semantics, so neither side ever waits for the other.
+ * Frames are copied in bulk, in at most two spans where the ring wraps.
+ *****************************************************************************/
+
+struct _mbx_ring {
+    sample_t *frames;  // 2 * (mask + 1) samples, left and right
+    size_t mask;       // capacity in frames minus 1
+    /* The indexes are on separate cache lines, because they are written
+     * by different threads. */
+    char pad_write[64];
+    atomic_size_t write_index;
+    char pad_read[64 - sizeof(atomic_size_t)];
+    atomic_size_t read_index;
+    char pad_end[64 - sizeof(atomic_size_t)];
+};
+
+/* Allocate a ring holding at least min_frames, rounded up to a power of
+ * two. The ring starts empty. */
+extern void _mbx_ring_init(struct _mbx_ring *ring, size_t min_frames);
+
+extern void _mbx_ring_free(struct _mbx_ring *ring);
+
+/* The number of frames the ring can hold. */
+extern size_t _mbx_ring_capacity(const struct _mbx_ring *ring);
+
+/* The number of frames written and not read yet. Exact when called by the
+ * producer or the consumer, a snapshot when called by any other thread. */
+extern size_t _mbx_ring_fill(struct _mbx_ring *ring);
+
+/* Copy up to n_frames from src into the ring, as many as there is space
+ * for. Called by the producer. Returns the number of frames copied. */
+extern size_t _mbx_ring_write(struct _mbx_ring *ring, const sample_t *src,
+        size_t n_frames);
+
+/* Copy up to n_frames from the ring to dst, as many as are available.
+ * Called by the consumer. Returns the number of frames copied. */
+extern size_t _mbx_ring_read(struct _mbx_ring *ring, sample_t *dst,
+        size_t n_frames);
+
+#endif
@@ -0,0 +1,73 @@
+#include <string.h>
+#include "scheduler.h"
+
+void _mbx_scheduler_init(struct _mbx_scheduler *s) {
+    atomic_init(&s->ring_write, 0);
+    atomic_init(&s->ring_read, 0);
+    atomic_init(&s->clock, 0);
+    s->n_pending = 0;
+}
+
+int _mbx_scheduler_push(struct _mbx_scheduler *s,
+        const struct _mbx_event *event) {
+    size_t w = atomic_load_explicit(&s->ring_write, memory_order_relaxed);
+    size_t r = atomic_load_explicit(&s->ring_read, memory_order_acquire);
+    if ( w - r == MBX_SCHEDULER_CAPACITY ) {
+        return 0;
+    }
+    s->ring[w % MBX_SCHEDULER_CAPACITY] = *event;
+    atomic_store_explicit(&s->ring_write, w + 1, memory_order_release);
+    return 1;
+}
+
+/* Move the events from the ring to the pending events. Events with the same
+ * time are kept in the order they were pushed. */
+static void take_from_ring(struct _mbx_scheduler *s) {
+    size_t r = atomic_load_explicit(&s->ring_read, memory_order_relaxed);
+    size_t w = atomic_load_explicit(&s->ring_write, memory_order_acquire);
+    int64_t clock = atomic_load_explicit(&s->clock, memory_order_relaxed);
+    for ( ; r != w && s->n_pending < MBX_SCHEDULER_CAPACITY; r++ ) {
+        struct _mbx_event ev = s->ring[r % MBX_SCHEDULER_CAPACITY];
+        size_t i = s->n_pending;
+        if ( ev.time < clock ) {
+            ev.time = clock;
+        }
+        while ( i > 0 && s->pending[i-1].time > ev.time ) {
+            s->pending[i] = s->pending[i-1];
+            i--;
+        }
+        s->pending[i] = ev;
+        s->n_pending++;
+    }
+    atomic_store_explicit(&s->ring_read, r, memory_order_release);
+}
+
+size_t _mbx_scheduler_frames_until_next(struct _mbx_scheduler *s,
+        size_t max_frames) {
+    int64_t clock = atomic_load_explicit(&s->clock, memory_order_relaxed);
+    take_from_ring(s);
+    if ( s->n_pending > 0 && s->pending[0].time - clock < (int64_t) max_frames ) {
+        return s->pending[0].time - clock;
+    }
+    return max_frames;
+}
+
+int _mbx_scheduler_pop_due(struct _mbx_scheduler *s, struct _mbx_event *event) {
+    int64_t clock = atomic_load_explicit(&s->clock, memory_order_relaxed);
+    take_from_ring(s);
+    if ( s->n_pending == 0 || s->pending[0].time > clock ) {
+        return 0;
+    }
+    *event = s->pending[0];
+    s->n_pending--;
+    memmove(s->pending, s->pending + 1, s->n_pending * sizeof(struct _mbx_event));
+    return 1;
+}
+
+void _mbx_scheduler_advance(struct _mbx_scheduler *s, size_t n_frames) {
+    atomic_fetch_add_explicit(&s->clock, n_frames, memory_order_relaxed);
+}
+
+int64_t _mbx_scheduler_get_time(struct _mbx_scheduler *s) {
+    return atomic_load_explicit(&s->clock, memory_order_relaxed);
+}
@@ -0,0 +1,68 @@
+#ifndef MBX_SCHEDULER_H
+#define MBX_SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/******************************************************************************
+ * The scheduler holds events for one output, which are applied at exact
+ * frames of the output's clock.
+ *
+ * The clock counts the frames rendered for the output. Events are pushed by
+ * the thread controlling the music box, and taken by the audio thread. The
+ * audio thread renders up to the next event, applies all events that are
+ * due, and continues, such that events are sample accurate independent of
+ * the buffer size.
+ *****************************************************************************/
+
+/* The maximum number of events that are not applied yet. */
+#define MBX_SCHEDULER_CAPACITY 64
+
+/* Time of events that are applied at the beginning of the next block. */
+#define MBX_SCHEDULER_NOW ((int64_t) -1)
+
+struct _mbx_event {
+    int64_t time; /* frame on the output's clock, or MBX_SCHEDULER_NOW */
+    int action; /* defined by the user of the scheduler */
+    int target;
+    int source; /* a second deck or slot, if the action needs one */
+};
+
+struct _mbx_scheduler {
+    /* Single producer single consumer ring from the controlling thread to
+     * the audio thread. */
+    struct _mbx_event ring[MBX_SCHEDULER_CAPACITY];
+    atomic_size_t ring_write;
+    atomic_size_t ring_read;
+    /* Only used by the audio thread: events taken from the ring, sorted by
+     * time. */
+    struct _mbx_event pending[MBX_SCHEDULER_CAPACITY];
+    size_t n_pending;
+    atomic_llong clock;
+};
+
+extern void _mbx_scheduler_init(struct _mbx_scheduler *scheduler);
+
+/* Add an event. Returns 0 if there are too many events not applied yet. */
+extern int _mbx_scheduler_push(struct _mbx_scheduler *scheduler,
+        const struct _mbx_event *event);
+
+/* The number of frames, up to max_frames, that can be rendered before the
+ * next event. Called in the audio thread. */
+extern size_t _mbx_scheduler_frames_until_next(
+        struct _mbx_scheduler *scheduler, size_t max_frames);
+
+/* Take the next event that is due at the current frame. Returns 0 if there
+ * is none. Called in the audio thread. */
+extern int _mbx_scheduler_pop_due(struct _mbx_scheduler *scheduler,
+        struct _mbx_event *event);
+
+/* Advance the clock by the n_frames rendered. Called in the audio thread. */
+extern void _mbx_scheduler_advance(struct _mbx_scheduler *scheduler,
+        size_t n_frames);
+
+/* The current frame of the clock. */
+extern int64_t _mbx_scheduler_get_time(struct _mbx_scheduler *scheduler);
+
+#endif
@@ -0,0 +1,370 @@
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include "timestretch.h"
+#include "varispeed.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+/* Both algorithms add one analysis frame per HOP output frames. */
+#define HOP 512
+
+/* WSOLA: segments of WSOLA_SIZE frames overlap by half. Each segment is
+ * moved by up to WSOLA_TOLERANCE frames, such that it continues the
+ * waveform of the previous one. The search first tests every
+ * WSOLA_COARSE-th offset on every second frame, then refines around the
+ * best one. */
+#define WSOLA_SIZE 1024
+#define WSOLA_TOLERANCE 192
+#define WSOLA_COARSE 4
+
+/* Phase vocoder: FFT size, the frames overlap four times. */
+#define PV_SIZE 2048
+#define PV_BINS ( PV_SIZE / 2 + 1 )
+
+/* Tempos above MAX_TEMPO are clamped, which bounds the source frames read
+ * per hop. */
+#define MAX_TEMPO 4
+#define IN_FRAMES ( HOP * MAX_TEMPO + PV_SIZE + 2 * WSOLA_TOLERANCE )
+
+struct _mbx_stretch {
+    mbx_keylock mode;
+    size_t size; /* frames per analysis frame, WSOLA_SIZE or PV_SIZE */
+    int primed;
+    int64_t next_phase; /* source position of the next analysis frame */
+    int64_t prev; /* start of the previous analysis frame */
+    int64_t hop_phase; /* source position of out_left[0] */
+    int64_t hop_tempo; /* tempo of the current hop */
+    size_t out_read, out_avail;
+    float window[PV_SIZE];
+    float in_left[IN_FRAMES], in_right[IN_FRAMES];
+    float mono[IN_FRAMES]; /* WSOLA: downmix for the waveform search */
+    float acc_left[PV_SIZE], acc_right[PV_SIZE]; /* overlap-add */
+    float out_left[HOP], out_right[HOP];
+    /* Phase vocoder */
+    float re[PV_SIZE], im[PV_SIZE];
+    float cos_table[PV_SIZE / 2], sin_table[PV_SIZE / 2];
+    unsigned short bitrev[PV_SIZE];
+    float last_phase[2][PV_BINS];
+    float synth_phase[2][PV_BINS];
+    float y_re[2][PV_BINS], y_im[2][PV_BINS];
+};
+
+static atomic_int limit = MBX_KEYLOCK_PHASE_VOCODER;
+
+struct _mbx_stretch *_mbx_stretch_new(mbx_keylock mode) {
+    struct _mbx_stretch *s;
+    size_t i, j, bits = 0;
+    s = _mbx_xmalloc(MBX_LOG_CONTROLLER, sizeof(struct _mbx_stretch));
+    bzero(s, sizeof(struct _mbx_stretch));
+    s->mode = mode;
+    s->size = mode == MBX_KEYLOCK_WSOLA ? WSOLA_SIZE : PV_SIZE;
+    // Periodic Hann window. At 50% overlap the windows sum up to 1, at 75%
+    // overlap the squared windows sum up to 1.5.
+    for ( i=0; i<s->size; i++ ) {
+        s->window[i] = 0.5 - 0.5 * cos(2 * M_PI * i / s->size);
+    }
+    while ( ( (size_t) 1 << bits ) < PV_SIZE ) {
+        bits++;
+    }
+    for ( i=0; i<PV_SIZE; i++ ) {
+        size_t r = 0;
+        for ( j=0; j<bits; j++ ) {
+            r |= ( ( i >> j ) & 1 ) << ( bits - 1 - j );
+        }
+        s->bitrev[i] = r;
+    }
+    for ( i=0; i<PV_SIZE/2; i++ ) {
+        s->cos_table[i] = cos(2 * M_PI * i / PV_SIZE);
+        s->sin_table[i] = sin(2 * M_PI * i / PV_SIZE);
+    }
+    return s;
+}
+
+void _mbx_stretch_free(struct _mbx_stretch *s) {
+    _mbx_xfree(s);
+}
+
+void _mbx_stretch_set_limit(mbx_keylock l) {
+    atomic_store_explicit(&limit, l, memory_order_relaxed);
+}
+
+mbx_keylock _mbx_stretch_limit(mbx_keylock mode) {
+    /* The modes are ordered by cost, and the limit is never
+     * MBX_KEYLOCK_OFF, so MBX_KEYLOCK_OFF stays off. */
+    int l = atomic_load_explicit(&limit, memory_order_relaxed);
+    return mode < l ? mode : l;
+}
+
+void _mbx_stretch_reset(struct _mbx_stretch *s, int64_t phase) {
+    s->primed = 0;
+    s->next_phase = phase;
+    s->hop_phase = phase;
+    s->hop_tempo = MBX_VARISPEED_ONE;
+    s->out_read = s->out_avail = 0;
+}
+
+/* Move the first HOP frames of the overlap-add buffer to the output. */
+static void emit(struct _mbx_stretch *s) {
+    memcpy(s->out_left, s->acc_left, HOP * sizeof(float));
+    memcpy(s->out_right, s->acc_right, HOP * sizeof(float));
+    memmove(s->acc_left, s->acc_left + HOP, ( s->size - HOP ) * sizeof(float));
+    memmove(s->acc_right, s->acc_right + HOP, ( s->size - HOP ) * sizeof(float));
+    bzero(s->acc_left + s->size - HOP, HOP * sizeof(float));
+    bzero(s->acc_right + s->size - HOP, HOP * sizeof(float));
+    s->out_read = 0;
+    s->out_avail = HOP;
+}
+
+/******************************************************************************
+ * WSOLA
+ *****************************************************************************/
+
+/* Normalized cross-correlation of ref with cand, on every step-th frame. */
+static float similarity(const float *ref, const float *cand, size_t n,
+        size_t step) {
+    float corr = 0, energy = 1e-9f;
+    size_t i;
+    for ( i=0; i<n; i+=step ) {
+        corr += ref[i] * cand[i];
+        energy += cand[i] * cand[i];
+    }
+    return corr / sqrtf(energy);
+}
+
+/* Find the offset from -WSOLA_TOLERANCE to WSOLA_TOLERANCE, at which mono
+ * + offset continues the waveform at ref best. */
+static int wsola_search(const float *ref, const float *mono) {
+    const size_t overlap = WSOLA_SIZE - HOP;
+    int best = 0, d, lo, hi;
+    float best_sim = similarity(ref, mono, overlap, 2);
+    for ( d = -WSOLA_TOLERANCE; d <= WSOLA_TOLERANCE; d += WSOLA_COARSE ) {
+        float sim = similarity(ref, mono + d, overlap, 2);
+        if ( sim > best_sim ) {
+            best_sim = sim;
+            best = d;
+        }
+    }
+    lo = best - WSOLA_COARSE + 1;
+    hi = best + WSOLA_COARSE - 1;
+    lo = lo < -WSOLA_TOLERANCE ? -WSOLA_TOLERANCE : lo;
+    hi = hi > WSOLA_TOLERANCE ? WSOLA_TOLERANCE : hi;
+    best_sim = similarity(ref, mono + best, overlap, 1);
+    for ( d = lo; d <= hi; d++ ) {
+        float sim = similarity(ref, mono + d, overlap, 1);
+        if ( sim > best_sim ) {
+            best_sim = sim;
+            best = d;
+        }
+    }
+    return best;
+}
+
+/* Add the segment at source frame a, moved to continue the previous
+ * segment if search is set. */
+static void wsola_frame(struct _mbx_stretch *s, int64_t a, int search,
+        _mbx_stretch_fetch fetch, void *userdata) {
+    int64_t cont = s->prev + HOP, lo = a, hi = a + WSOLA_SIZE, p = a;
+    size_t i, n;
+    const float *l, *r;
+    if ( search ) {
+        lo = a - WSOLA_TOLERANCE < cont ? a - WSOLA_TOLERANCE : cont;
+        hi = a + WSOLA_TOLERANCE + WSOLA_SIZE > cont + WSOLA_SIZE - HOP ?
+            a + WSOLA_TOLERANCE + WSOLA_SIZE : cont + WSOLA_SIZE - HOP;
+    }
+    n = hi - lo;
+    fetch(userdata, lo, n, s->in_left, s->in_right);
+    if ( search ) {
+        for ( i=0; i<n; i++ ) {
+            s->mono[i] = s->in_left[i] + s->in_right[i];
+        }
+        p = a + wsola_search(s->mono + ( cont - lo ), s->mono + ( a - lo ));
+    }
+    l = s->in_left + ( p - lo );
+    r = s->in_right + ( p - lo );
+    for ( i=0; i<WSOLA_SIZE; i++ ) {
+        s->acc_left[i] += s->window[i] * l[i];
+        s->acc_right[i] += s->window[i] * r[i];
+    }
+    s->prev = p;
+}
+
+/******************************************************************************
+ * Phase vocoder
+ *
+ * Both channels are transformed with one complex FFT: the left channel is
+ * the real part, the right channel the imaginary part.
+ *****************************************************************************/
+
+static void fft(struct _mbx_stretch *s, float *re, float *im, int inverse) {
+    size_t i, j, len;
+    for ( i=0; i<PV_SIZE; i++ ) {
+        j = s->bitrev[i];
+        if ( j > i ) {
+            float t = re[i]; re[i] = re[j]; re[j] = t;
+            t = im[i]; im[i] = im[j]; im[j] = t;
+        }
+    }
+    for ( len=2; len<=PV_SIZE; len<<=1 ) {
+        size_t half = len / 2, step = PV_SIZE / len;
+        for ( i=0; i<PV_SIZE; i+=len ) {
+            for ( j=0; j<half; j++ ) {
+                float wr = s->cos_table[j*step];
+                float wi = inverse ? s->sin_table[j*step] : -s->sin_table[j*step];
+                size_t a = i + j, b = i + j + half;
+                float tr = wr * re[b] - wi * im[b];
+                float ti = wr * im[b] + wi * re[b];
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] += tr;
+                im[a] += ti;
+            }
+        }
+    }
+}
+
+static float wrap(float phase) {
+    return phase - 2 * M_PI * rintf(phase / ( 2 * M_PI ));
+}
+
+/* Move bin k of channel ch from the analysis to the synthesis phase. The
+ * frequency of the bin is estimated from the phase difference to the
+ * previous analysis frame, hop_a frames earlier. */
+static void vocode(struct _mbx_stretch *s, int ch, size_t k, float re,
+        float im, int64_t hop_a) {
+    float mag = sqrtf(re * re + im * im);
+    float phase = atan2f(im, re);
+    float synth;
+    if ( ! s->primed && hop_a == 0 ) {
+        synth = phase;
+    }
+    else {
+        // The expected phase advances are computed modulo the FFT size,
+        // such that they are exact.
+        float expected = 2 * M_PI * ( ( k * hop_a ) % PV_SIZE ) / PV_SIZE;
+        float advance = 2 * M_PI * ( ( k * HOP ) % PV_SIZE ) / PV_SIZE;
+        float deviation = wrap(phase - s->last_phase[ch][k] - expected);
+        synth = s->synth_phase[ch][k] + advance
+            + ( hop_a > 0 ? deviation * HOP / hop_a : 0 );
+        synth = wrap(synth);
+    }
+    s->last_phase[ch][k] = phase;
+    s->synth_phase[ch][k] = synth;
+    s->y_re[ch][k] = mag * cosf(synth);
+    s->y_im[ch][k] = mag * sinf(synth);
+}
+
+/* Add the frame at source frame a, hop_a frames after the previous one
+ * (0 for the first frame after a reset). */
+static void pv_frame(struct _mbx_stretch *s, int64_t a, int64_t hop_a,
+        _mbx_stretch_fetch fetch, void *userdata) {
+    const float scale = 1.0f / ( 1.5f * PV_SIZE );
+    size_t i, k;
+    fetch(userdata, a, PV_SIZE, s->in_left, s->in_right);
+    for ( i=0; i<PV_SIZE; i++ ) {
+        s->re[i] = s->window[i] * s->in_left[i];
+        s->im[i] = s->window[i] * s->in_right[i];
+    }
+    fft(s, s->re, s->im, 0);
+    // Separate the spectra of both channels.
+    for ( k=0; k<PV_BINS; k++ ) {
+        size_t j = ( PV_SIZE - k ) & ( PV_SIZE - 1 );
+        float a_re = s->re[k], a_im = s->im[k], b_re = s->re[j], b_im = s->im[j];
+        vocode(s, 0, k, 0.5f * ( a_re + b_re ), 0.5f * ( a_im - b_im ), hop_a);
+        vocode(s, 1, k, 0.5f * ( a_im + b_im ), 0.5f * ( b_re - a_re ), hop_a);
+    }
+    // Combine them again, left + i * right, with conjugate symmetric spectra.
+    s->re[0] = s->y_re[0][0];
+    s->im[0] = s->y_re[1][0];
+    s->re[PV_SIZE/2] = s->y_re[0][PV_SIZE/2];
+    s->im[PV_SIZE/2] = s->y_re[1][PV_SIZE/2];
+    for ( k=1; k<PV_SIZE/2; k++ ) {
+        s->re[k] = s->y_re[0][k] - s->y_im[1][k];
+        s->im[k] = s->y_im[0][k] + s->y_re[1][k];
+        s->re[PV_SIZE-k] = s->y_re[0][k] + s->y_im[1][k];
+        s->im[PV_SIZE-k] = s->y_re[1][k] - s->y_im[0][k];
+    }
+    fft(s, s->re, s->im, 1);
+    for ( i=0; i<PV_SIZE; i++ ) {
+        s->acc_left[i] += s->window[i] * s->re[i] * scale;
+        s->acc_right[i] += s->window[i] * s->im[i] * scale;
+    }
+    s->prev = a;
+}
+
+/******************************************************************************
+ * Common
+ *****************************************************************************/
+
+static void frame(struct _mbx_stretch *s, int64_t a, int search,
+        _mbx_stretch_fetch fetch, void *userdata) {
+    if ( s->mode == MBX_KEYLOCK_WSOLA ) {
+        wsola_frame(s, a, search, fetch, userdata);
+    }
+    else {
+        pv_frame(s, a, search ? a - s->prev : 0, fetch, userdata);
+    }
+}
+
+/* Analyse the frames before next_phase at normal speed, such that the
+ * overlap-add buffer is complete at next_phase. */
+static void prime(struct _mbx_stretch *s, _mbx_stretch_fetch fetch,
+        void *userdata) {
+    int64_t a = ( s->next_phase >> 32 ) - (int64_t) ( s->size - HOP );
+    bzero(s->acc_left, sizeof(s->acc_left));
+    bzero(s->acc_right, sizeof(s->acc_right));
+    frame(s, a, 0, fetch, userdata);
+    emit(s);
+    for ( a += HOP; a < s->next_phase >> 32; a += HOP ) {
+        frame(s, a, 1, fetch, userdata);
+        emit(s);
+    }
+    s->out_read = s->out_avail = 0;
+    s->primed = 1;
+}
+
+int64_t _mbx_stretch_process(struct _mbx_stretch *s, float *dst,
+        size_t *n_frames, int64_t tempo, int64_t end,
+        _mbx_stretch_fetch fetch, void *userdata,
+        const struct _mbx_gain *gain) {
+    struct _mbx_gain g = *gain;
+    size_t done = 0, i;
+    if ( tempo > MAX_TEMPO * MBX_VARISPEED_ONE ) {
+        tempo = MAX_TEMPO * MBX_VARISPEED_ONE;
+    }
+    if ( tempo < 0 ) {
+        tempo = 0;
+    }
+    if ( ! s->primed ) {
+        prime(s, fetch, userdata);
+    }
+    while ( done < *n_frames ) {
+        size_t n;
+        if ( s->out_read == s->out_avail ) {
+            if ( s->next_phase >> 32 >= end ) {
+                break;
+            }
+            frame(s, s->next_phase >> 32, 1, fetch, userdata);
+            emit(s);
+            s->hop_phase = s->next_phase;
+            s->hop_tempo = tempo;
+            s->next_phase += tempo * HOP;
+        }
+        n = s->out_avail - s->out_read;
+        if ( n > *n_frames - done ) {
+            n = *n_frames - done;
+        }
+        for ( i=0; i<n; i++ ) {
+            dst[2*(done+i)] += s->out_left[s->out_read+i]
+                * ( g.left + i * g.step_left );
+            dst[2*(done+i)+1] += s->out_right[s->out_read+i]
+                * ( g.right + i * g.step_right );
+        }
+        _mbx_gain_advance(&g, n);
+        s->out_read += n;
+        done += n;
+    }
+    *n_frames = done;
+    return s->hop_phase + (int64_t) s->out_read * s->hop_tempo;
+}
@@ -0,0 +1,56 @@
+#ifndef MBX_TIMESTRETCH_H
+#define MBX_TIMESTRETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "keylock.h"
+#include "mixer.h"
+
+/******************************************************************************
+ * Time-stretching: changing the tempo of audio data without changing its
+ * pitch, see mbx_keylock.
+ *
+ * A stretcher renders one read head. It reads the source through a fetch
+ * callback at any position, and adds the stretched frames to the
+ * interleaved stereo mix bus (see mixer.h). Positions and tempos are 32.32
+ * fixed point numbers, as in varispeed.h.
+ *
+ * All buffers are allocated by _mbx_stretch_new(), so the other functions
+ * can be called in the audio thread.
+ *****************************************************************************/
+
+struct _mbx_stretch;
+
+/* Convert n source frames starting at frame first to planar float. Frames
+ * outside of the source are silent. */
+typedef void (*_mbx_stretch_fetch)(void *userdata, int64_t first, size_t n,
+        float *left, float *right);
+
+/* Create a stretcher for mode (not MBX_KEYLOCK_OFF). Free it with
+ * _mbx_stretch_free(). */
+extern struct _mbx_stretch *_mbx_stretch_new(mbx_keylock mode);
+
+extern void _mbx_stretch_free(struct _mbx_stretch *stretch);
+
+/* Use at most the mode limit (not MBX_KEYLOCK_OFF) for all heads, even if a
+ * more expensive mode is selected. Used by the governor, see governor.h. */
+extern void _mbx_stretch_set_limit(mbx_keylock limit);
+
+/* The mode to use instead of mode, safe to call in the audio thread. */
+extern mbx_keylock _mbx_stretch_limit(mbx_keylock mode);
+
+/* Continue at the source position phase, after a seek or when the stretcher
+ * was not used for a while. The next call to _mbx_stretch_process()
+ * analyses the audio data before phase, so there is no fade in. */
+extern void _mbx_stretch_reset(struct _mbx_stretch *stretch, int64_t phase);
+
+/* Add *n_frames stretched frames to dst, consuming the source at tempo
+ * (MBX_VARISPEED_ONE is normal speed, must be positive). If the source
+ * position reaches the frame end, *n_frames is reduced to the frames added.
+ * Returns the source position of the next frame. */
+extern int64_t _mbx_stretch_process(struct _mbx_stretch *stretch, float *dst,
+        size_t *n_frames, int64_t tempo, int64_t end,
+        _mbx_stretch_fetch fetch, void *userdata,
+        const struct _mbx_gain *gain);
+
+#endif
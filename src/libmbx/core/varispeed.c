@@ -0,0 +1,284 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "varispeed.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* The windowed sinc has SINC_TAPS taps, centered between the frames at
+ * position and position+1. The table holds the taps for SINC_PHASES
+ * fractional positions, plus one for interpolating between the phases. */
+#define SINC_TAPS 16
+#define SINC_PHASES 256
+
+/* Cutoff frequency relative to the Nyquist frequency. Slightly below 1 in
+ * order to keep the transition band out of the audible range. */
+#define SINC_CUTOFF 0.9
+
+/* Number of frames whose positions are computed at a time. */
+#define CHUNK 64
+
+static float sinc_table[SINC_PHASES + 1][SINC_TAPS] __attribute__ ((aligned (16)));
+static pthread_once_t sinc_table_once = PTHREAD_ONCE_INIT;
+static atomic_int interpolation = MBX_INTERPOLATION_CUBIC;
+static atomic_int interpolation_limit = MBX_INTERPOLATION_SINC;
+
+/* Blackman-windowed sinc. The taps of each phase are normalized to sum up
+ * to 1, such that there is no DC ripple between the phases. */
+static void init_sinc_table(void) {
+    int p, k;
+    for ( p=0; p<=SINC_PHASES; p++ ) {
+        double frac = (double) p / SINC_PHASES;
+        double sum = 0;
+        double taps[SINC_TAPS];
+        for ( k=0; k<SINC_TAPS; k++ ) {
+            // distance of tap k from the position, tap 7 is the frame
+            // at or before the position
+            double d = k - ( SINC_TAPS / 2 - 1 ) - frac;
+            double x = M_PI * SINC_CUTOFF * d;
+            double w = 0.42 + 0.5 * cos(M_PI * d / ( SINC_TAPS / 2 ))
+                + 0.08 * cos(2 * M_PI * d / ( SINC_TAPS / 2 ));
+            taps[k] = ( x == 0 ? 1 : sin(x) / x ) * w;
+            sum += taps[k];
+        }
+        for ( k=0; k<SINC_TAPS; k++ ) {
+            sinc_table[p][k] = taps[k] / sum;
+        }
+    }
+}
+
+void _mbx_varispeed_init(void) {
+    pthread_once(&sinc_table_once, init_sinc_table);
+}
+
+void _mbx_varispeed_set_interpolation(mbx_interpolation i) {
+    atomic_store_explicit(&interpolation, i, memory_order_relaxed);
+}
+
+void _mbx_varispeed_set_limit(mbx_interpolation limit) {
+    atomic_store_explicit(&interpolation_limit, limit, memory_order_relaxed);
+}
+
+mbx_interpolation _mbx_varispeed_get_interpolation(void) {
+    int i = atomic_load_explicit(&interpolation, memory_order_relaxed);
+    int limit = atomic_load_explicit(&interpolation_limit,
+        memory_order_relaxed);
+    return i < limit ? i : limit;
+}
+
+int64_t _mbx_varispeed_advance(int64_t phase, int64_t inc, int64_t dinc,
+        size_t n_frames) {
+    return phase + (int64_t) n_frames * inc
+        + (int64_t) ( n_frames * ( n_frames - 1 ) / 2 ) * dinc;
+}
+
+/******************************************************************************
+ * Scalar kernels, used for the remainder of a chunk, and when SSE2 is not
+ * available. s points to the frame at or before the position, f is the
+ * fraction.
+ *****************************************************************************/
+
+static float linear(const float *s, float f) {
+    return s[0] + f * ( s[1] - s[0] );
+}
+
+static void cubic_weights(float f, float *w) {
+    float f2 = f * f, f3 = f2 * f;
+    w[0] = 0.5f * ( -f3 + 2*f2 - f );
+    w[1] = 0.5f * ( 3*f3 - 5*f2 + 2 );
+    w[2] = 0.5f * ( -3*f3 + 4*f2 + f );
+    w[3] = 0.5f * ( f3 - f2 );
+}
+
+static float cubic(const float *s, const float *w) {
+    return w[0]*s[-1] + w[1]*s[0] + w[2]*s[1] + w[3]*s[2];
+}
+
+/* Interpolate the taps of the two phases next to f. */
+static void sinc_taps(float f, float *taps) {
+    float p = f * SINC_PHASES;
+    int i = (int) p;
+    float t = p - i;
+    int k;
+#ifdef __SSE2__
+    __m128 vt = _mm_set1_ps(t);
+    for ( k=0; k<SINC_TAPS; k+=4 ) {
+        __m128 a = _mm_load_ps(&sinc_table[i][k]);
+        __m128 b = _mm_load_ps(&sinc_table[i+1][k]);
+        _mm_store_ps(taps + k, _mm_add_ps(a, _mm_mul_ps(vt, _mm_sub_ps(b, a))));
+    }
+#else
+    for ( k=0; k<SINC_TAPS; k++ ) {
+        taps[k] = sinc_table[i][k] + t * ( sinc_table[i+1][k] - sinc_table[i][k] );
+    }
+#endif
+}
+
+static float sinc(const float *s, const float *taps) {
+    const float *p = s - ( SINC_TAPS / 2 - 1 );
+    int k;
+#ifdef __SSE2__
+    __m128 acc = _mm_setzero_ps();
+    float r[4];
+    for ( k=0; k<SINC_TAPS; k+=4 ) {
+        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(p + k), _mm_load_ps(taps + k)));
+    }
+    _mm_storeu_ps(r, acc);
+    return ( r[0] + r[1] ) + ( r[2] + r[3] );
+#else
+    float acc = 0;
+    for ( k=0; k<SINC_TAPS; k++ ) {
+        acc += p[k] * taps[k];
+    }
+    return acc;
+#endif
+}
+
+static void interpolate_scalar(float *dst, const float *left,
+        const float *right, const int32_t *idx, const float *frac,
+        size_t n, mbx_interpolation interp, const struct _mbx_gain *gain) {
+    float w[SINC_TAPS] __attribute__ ((aligned (16)));
+    size_t i;
+    for ( i=0; i<n; i++ ) {
+        float l, r;
+        switch ( interp ) {
+            case MBX_INTERPOLATION_LINEAR:
+                l = linear(left + idx[i], frac[i]);
+                r = right != NULL ? linear(right + idx[i], frac[i]) : l;
+                break;
+            case MBX_INTERPOLATION_CUBIC:
+                cubic_weights(frac[i], w);
+                l = cubic(left + idx[i], w);
+                r = right != NULL ? cubic(right + idx[i], w) : l;
+                break;
+            default:
+                sinc_taps(frac[i], w);
+                l = sinc(left + idx[i], w);
+                r = right != NULL ? sinc(right + idx[i], w) : l;
+                break;
+        }
+        dst[2*i] += l * ( gain->left + i * gain->step_left );
+        dst[2*i+1] += r * ( gain->right + i * gain->step_right );
+    }
+}
+
+#ifdef __SSE2__
+/******************************************************************************
+ * SSE2 kernels for linear and cubic interpolation: 4 frames per iteration.
+ * The source frames are gathered, the weights and sums are computed in
+ * parallel. The windowed sinc is vectorized over its taps instead, see
+ * sinc() above.
+ *****************************************************************************/
+
+static inline __m128 gather(const float *s, const int32_t *idx, int offset) {
+    return _mm_setr_ps(s[idx[0] + offset], s[idx[1] + offset],
+        s[idx[2] + offset], s[idx[3] + offset]);
+}
+
+static inline __m128 linear4(const float *s, const int32_t *idx, __m128 f) {
+    __m128 s0 = gather(s, idx, 0);
+    __m128 s1 = gather(s, idx, 1);
+    return _mm_add_ps(s0, _mm_mul_ps(f, _mm_sub_ps(s1, s0)));
+}
+
+static inline __m128 cubic4(const float *s, const int32_t *idx,
+        const __m128 *w) {
+    __m128 y = _mm_mul_ps(w[0], gather(s, idx, -1));
+    y = _mm_add_ps(y, _mm_mul_ps(w[1], gather(s, idx, 0)));
+    y = _mm_add_ps(y, _mm_mul_ps(w[2], gather(s, idx, 1)));
+    return _mm_add_ps(y, _mm_mul_ps(w[3], gather(s, idx, 2)));
+}
+
+static inline void cubic_weights4(__m128 f, __m128 *w) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128 f2 = _mm_mul_ps(f, f);
+    __m128 f3 = _mm_mul_ps(f2, f);
+    __m128 two_f2 = _mm_add_ps(f2, f2);
+    __m128 three_f3 = _mm_add_ps(f3, _mm_add_ps(f3, f3));
+    // 0.5 * ( -f3 + 2*f2 - f )
+    w[0] = _mm_mul_ps(half, _mm_sub_ps(_mm_sub_ps(two_f2, f3), f));
+    // 0.5 * ( 3*f3 - 5*f2 + 2 )
+    w[1] = _mm_mul_ps(half, _mm_add_ps(_mm_sub_ps(three_f3,
+        _mm_mul_ps(_mm_set1_ps(5.0f), f2)), _mm_set1_ps(2.0f)));
+    // 0.5 * ( -3*f3 + 4*f2 + f )
+    w[2] = _mm_mul_ps(half, _mm_add_ps(_mm_sub_ps(_mm_add_ps(two_f2, two_f2),
+        three_f3), f));
+    // 0.5 * ( f3 - f2 )
+    w[3] = _mm_mul_ps(half, _mm_sub_ps(f3, f2));
+}
+
+/* Add 4 frames to the interleaved mix bus. */
+static inline void add4(float *dst, __m128 l, __m128 r, __m128 gain_left,
+        __m128 gain_right) {
+    l = _mm_mul_ps(l, gain_left);
+    r = _mm_mul_ps(r, gain_right);
+    _mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), _mm_unpacklo_ps(l, r)));
+    _mm_storeu_ps(dst + 4, _mm_add_ps(_mm_loadu_ps(dst + 4), _mm_unpackhi_ps(l, r)));
+}
+
+/* Returns the number of frames done, the rest is done by the scalar code. */
+static size_t interpolate_sse(float *dst, const float *left,
+        const float *right, const int32_t *idx, const float *frac,
+        size_t n, mbx_interpolation interp, const struct _mbx_gain *gain) {
+    const __m128 ramp_left = _mm_mul_ps(_mm_setr_ps(0, 1, 2, 3),
+        _mm_set1_ps(gain->step_left));
+    const __m128 ramp_right = _mm_mul_ps(_mm_setr_ps(0, 1, 2, 3),
+        _mm_set1_ps(gain->step_right));
+    size_t i = 0;
+    if ( interp == MBX_INTERPOLATION_SINC ) {
+        return 0;
+    }
+    for ( ; i + 4 <= n; i += 4 ) {
+        __m128 f = _mm_loadu_ps(frac + i);
+        __m128 gl = _mm_add_ps(_mm_set1_ps(gain->left + i * gain->step_left),
+            ramp_left);
+        __m128 gr = _mm_add_ps(_mm_set1_ps(gain->right + i * gain->step_right),
+            ramp_right);
+        __m128 l, r;
+        if ( interp == MBX_INTERPOLATION_LINEAR ) {
+            l = linear4(left, idx + i, f);
+            r = right != NULL ? linear4(right, idx + i, f) : l;
+        }
+        else {
+            __m128 w[4];
+            cubic_weights4(f, w);
+            l = cubic4(left, idx + i, w);
+            r = right != NULL ? cubic4(right, idx + i, w) : l;
+        }
+        add4(dst + 2*i, l, r, gl, gr);
+    }
+    return i;
+}
+#endif
+
+void _mbx_varispeed_mix(float *dst, const float *left, const float *right,
+        int64_t phase, int64_t inc, int64_t dinc, size_t n_frames,
+        mbx_interpolation interp, const struct _mbx_gain *gain) {
+    int32_t idx[CHUNK];
+    float frac[CHUNK];
+    struct _mbx_gain g = *gain;
+    size_t done = 0;
+    while ( done < n_frames ) {
+        size_t n = n_frames - done < CHUNK ? n_frames - done : CHUNK;
+        size_t i = 0;
+        for ( i=0; i<n; i++ ) {
+            idx[i] = (int32_t) ( phase >> 32 );
+            // 24 bits of the fraction, such that it is exact, and below 1
+            frac[i] = ( (uint32_t) phase >> 8 ) * ( 1.0f / 16777216.0f );
+            phase += inc;
+            inc += dinc;
+        }
+        i = 0;
+#ifdef __SSE2__
+        i = interpolate_sse(dst + 2*done, left, right, idx, frac, n, interp,
+            &g);
+        _mbx_gain_advance(&g, i);
+#endif
+        interpolate_scalar(dst + 2*(done + i), left, right, idx + i,
+            frac + i, n - i, interp, &g);
+        _mbx_gain_advance(&g, n - i);
+        done += n;
+    }
+}
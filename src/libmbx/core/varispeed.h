@@ -0,0 +1,59 @@
+#ifndef MBX_VARISPEED_H
+#define MBX_VARISPEED_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "interpolation.h"
+#include "mixer.h"
+
+/******************************************************************************
+ * Interpolation kernels for playing audio data at a variable rate.
+ *
+ * Positions and rates are signed 32.32 fixed point numbers: the upper 32 bits
+ * are the frame, the lower 32 bits the fraction. A rate of
+ * #MBX_VARISPEED_ONE plays at normal speed, negative rates play in reverse.
+ *
+ * The kernels read planar float source frames and add the interpolated frames
+ * to the interleaved stereo mix bus (see mixer.h). The rate may change
+ * linearly within a block, such that rate changes are smoothed without
+ * zipper noise. The kernels use SSE2 when available.
+ *****************************************************************************/
+
+/* The fixed point value 1.0 */
+#define MBX_VARISPEED_ONE ((int64_t) 1 << 32)
+
+/* Number of source frames the kernels read before and after the position,
+ * for any interpolation. */
+#define MBX_VARISPEED_PAD 8
+
+/* Compute the interpolation tables. Must be called before the first call to
+ * _mbx_varispeed_mix(), from any thread except the audio thread. Calling it
+ * again has no effect. */
+extern void _mbx_varispeed_init(void);
+
+/* Add n_frames to the mix bus dst. Frame i is interpolated at position
+ * phase + i*inc + i*(i-1)/2*dinc, relative to left[0] and right[0]. The
+ * source must have MBX_VARISPEED_PAD frames before the first and after the
+ * last position. right is NULL for mono sources, which are played on both
+ * channels. */
+extern void _mbx_varispeed_mix(float *dst, const float *left,
+        const float *right, int64_t phase, int64_t inc, int64_t dinc,
+        size_t n_frames, mbx_interpolation interpolation,
+        const struct _mbx_gain *gain);
+
+/* The position after n_frames, see _mbx_varispeed_mix(). */
+extern int64_t _mbx_varispeed_advance(int64_t phase, int64_t inc,
+        int64_t dinc, size_t n_frames);
+
+/* Select the interpolation for all decks. Takes effect with the next block. */
+extern void _mbx_varispeed_set_interpolation(mbx_interpolation interpolation);
+
+/* Use at most the quality of limit, even if a better interpolation is
+ * selected. Used by the governor, see governor.h. */
+extern void _mbx_varispeed_set_limit(mbx_interpolation limit);
+
+/* The interpolation selected, within the limit. Safe to call in the audio
+ * thread. */
+extern mbx_interpolation _mbx_varispeed_get_interpolation(void);
+
+#endif
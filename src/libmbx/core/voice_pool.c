@@ -0,0 +1,142 @@
+#include <math.h>
+#include <string.h>
+#include <strings.h>
+#include "voice_pool.h"
+#include "mixer.h"
+
+/* When this many voices play, the oldest one is released for each new one.
+ * The remaining voices are left for the voices fading out. */
+#define SOFT_LIMIT ( MBX_VOICES - 4 )
+
+/* Fade out time of released and stolen voices, about 1.5 ms. */
+#define RELEASE_FRAMES 64
+
+void _mbx_voice_pool_init(struct _mbx_voice_pool *pool) {
+    int i;
+    bzero(pool, sizeof(struct _mbx_voice_pool));
+    for ( i=0; i<MBX_VOICES; i++ ) {
+        pool->free[i] = MBX_VOICES - 1 - i;
+    }
+    pool->n_free = MBX_VOICES;
+    pool->limit = MBX_VOICES;
+}
+
+static void release(struct _mbx_voice_pool *pool, int v) {
+    if ( pool->env_step[v] == 0 ) {
+        pool->env_step[v] = -1.0f / RELEASE_FRAMES;
+    }
+}
+
+/* Remove the i-th active voice. */
+static void stop(struct _mbx_voice_pool *pool, int i) {
+    pool->free[pool->n_free++] = pool->active[i];
+    pool->n_active--;
+    memmove(pool->active + i, pool->active + i + 1,
+        ( pool->n_active - i ) * sizeof(int));
+}
+
+/* Release the oldest playing voices until at most n play. */
+static void release_beyond(struct _mbx_voice_pool *pool, int n) {
+    int i, n_playing = 0;
+    for ( i=0; i<pool->n_active; i++ ) {
+        n_playing += pool->env_step[pool->active[i]] == 0;
+    }
+    for ( i=0; i<pool->n_active && n_playing > n; i++ ) {
+        if ( pool->env_step[pool->active[i]] == 0 ) {
+            release(pool, pool->active[i]);
+            n_playing--;
+        }
+    }
+}
+
+void _mbx_voice_pool_set_limit(struct _mbx_voice_pool *pool, int limit) {
+    pool->limit = limit;
+    release_beyond(pool, limit);
+}
+
+void _mbx_voice_pool_trigger(struct _mbx_voice_pool *pool, int slot,
+        _mbx_track track, unsigned generation, float gain) {
+    int v;
+    if ( track == NULL || _mbx_track_get_sample_data(track) == NULL ) {
+        return;
+    }
+    release_beyond(pool,
+        ( pool->limit < SOFT_LIMIT ? pool->limit : SOFT_LIMIT ) - 1);
+    if ( pool->n_free == 0 ) {
+        // All voices are busy, even with the soft limit. Steal the oldest.
+        stop(pool, 0);
+    }
+    v = pool->free[--pool->n_free];
+    pool->active[pool->n_active++] = v;
+    pool->slot[v] = slot;
+    pool->track[v] = track;
+    pool->generation[v] = generation;
+    pool->pos[v] = 0;
+    pool->gain[v] = gain;
+    pool->env[v] = 1;
+    pool->env_step[v] = 0;
+}
+
+void _mbx_voice_pool_release(struct _mbx_voice_pool *pool, int slot) {
+    int i;
+    for ( i=0; i<pool->n_active; i++ ) {
+        if ( pool->slot[pool->active[i]] == slot ) {
+            release(pool, pool->active[i]);
+        }
+    }
+}
+
+/* The frames until the envelope of a voice fading out reaches 0. */
+static size_t release_frames(struct _mbx_voice_pool *pool, int v) {
+    return (size_t) ceilf(pool->env[v] / -pool->env_step[v]);
+}
+
+void _mbx_voice_pool_mix(struct _mbx_voice_pool *pool,
+        const atomic_uint *generations, float *dst, size_t n_frames) {
+    int i = 0;
+    while ( i < pool->n_active ) {
+        int v = pool->active[i];
+        _mbx_track track = pool->track[v];
+        const sample_t *data;
+        struct _mbx_gain gain;
+        unsigned channels;
+        size_t length, n;
+        float g0, g1;
+        // The track is not freed before the block ends if the generation is
+        // still the same here, see retire() in controller.c.
+        if ( atomic_load_explicit(&generations[pool->slot[v]],
+                memory_order_acquire) != pool->generation[v] ) {
+            stop(pool, i);
+            continue;
+        }
+        data = _mbx_track_get_sample_data(track);
+        channels = _mbx_track_get_channels(track);
+        length = _mbx_track_get_n_frames(track);
+        if ( pool->pos[v] >= length ) {
+            stop(pool, i);
+            continue;
+        }
+        n = length - pool->pos[v] < n_frames ? length - pool->pos[v] : n_frames;
+        data += pool->pos[v] * channels;
+        if ( pool->env_step[v] != 0 && n > release_frames(pool, v) ) {
+            n = release_frames(pool, v);
+        }
+        // The envelope is a linear ramp, applied by the summation kernels.
+        g0 = pool->gain[v] * pool->env[v];
+        pool->env[v] += pool->env_step[v] * n;
+        g1 = pool->gain[v] * ( pool->env[v] > 0 ? pool->env[v] : 0 );
+        _mbx_gain_ramp(&gain, g0, g0, g1, g1, n);
+        if ( channels == 1 ) {
+            _mbx_mix_mono(dst, data, n, &gain);
+        }
+        else {
+            _mbx_mix_stereo(dst, data, n, &gain);
+        }
+        pool->pos[v] += n;
+        if ( pool->pos[v] >= length || pool->env[v] <= 0 ) {
+            stop(pool, i);
+            continue;
+        }
+        i++;
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef MBX_VOICE_POOL_H
+#define MBX_VOICE_POOL_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "libmbx/mp3lib/track.h"
+
+/******************************************************************************
+ * The voice pool plays the sample slots polyphonically.
+ *
+ * Each trigger of a slot starts a voice, which reads the slot's decoded
+ * audio data from the beginning, with its own gain and envelope. Triggering
+ * a slot again while it plays layers a new voice over the old one. When too
+ * many voices play, the oldest one is faded out quickly to make room.
+ *
+ * The voices are stored as structure of arrays, and the active voices are
+ * kept in a list, such that mixing touches neither idle voices nor idle
+ * slots. All functions except _mbx_voice_pool_init() are called in the audio
+ * thread, they do not allocate memory.
+ *
+ * Each slot has a generation counter, which the control thread increments
+ * whenever it loads another track on the slot. A voice stops when the
+ * generation of its slot changed, before it touches its track again: the
+ * track may have been freed, and a new one may have been loaded at the
+ * same address.
+ *****************************************************************************/
+
+/* The number of voices. */
+#define MBX_VOICES 32
+
+struct _mbx_voice_pool {
+    /* The active voices, oldest first, and the free voices. */
+    int active[MBX_VOICES];
+    int n_active;
+    int free[MBX_VOICES];
+    int n_free;
+    /* Voice state */
+    int slot[MBX_VOICES];
+    _mbx_track track[MBX_VOICES]; /* the track the voice was started on */
+    unsigned generation[MBX_VOICES]; /* of the slot, when started */
+    size_t pos[MBX_VOICES];
+    float gain[MBX_VOICES];
+    float env[MBX_VOICES]; /* envelope, 1 while playing */
+    float env_step[MBX_VOICES]; /* per frame, negative while releasing */
+    int limit; /* the most voices playing at once, see below */
+};
+
+extern void _mbx_voice_pool_init(struct _mbx_voice_pool *pool);
+
+/* Start a voice playing track, which is loaded on slot. generation is the
+ * generation of the slot, read before track. */
+extern void _mbx_voice_pool_trigger(struct _mbx_voice_pool *pool, int slot,
+        _mbx_track track, unsigned generation, float gain);
+
+/* Fade out all voices of slot. */
+extern void _mbx_voice_pool_release(struct _mbx_voice_pool *pool, int slot);
+
+/* Let at most limit voices play at once (1 to MBX_VOICES), to save CPU
+ * time. The oldest voices beyond the limit are faded out. */
+extern void _mbx_voice_pool_set_limit(struct _mbx_voice_pool *pool,
+        int limit);
+
+/* Add n_frames of all active voices to the mix bus dst. generations are the
+ * generation counters of the slots. Voices whose slot was loaded with
+ * another track since they were started stop. */
+extern void _mbx_voice_pool_mix(struct _mbx_voice_pool *pool,
+        const atomic_uint *generations, float *dst, size_t n_frames);
+
+#endif
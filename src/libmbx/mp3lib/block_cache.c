@@ -0,0 +1,344 @@
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <assert.h>
+#include <mad.h>
+#include "block_cache.h"
+#include "mad_decoder.h"
+#include "pcm_convert.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+#include "libmbx/common/worker_pool.h"
+
+/* Number of MPEG frames per block. With 1152 samples per frame, a block
+ * holds 0.42 seconds at 44.1 kHz. */
+#define BLOCK_MP3_FRAMES 16
+
+/* Number of decoded blocks held per track. */
+#define N_SLOTS 8
+
+/* Number of blocks decoded ahead of the block being played. The other
+ * slots keep the least recently used blocks. */
+#define LOOKAHEAD 3
+
+/* Main data of a layer III frame may start up to 511 bytes before the frame
+ * header. After a jump, decoding starts early enough to have that data, plus
+ * one frame to fill the synthesis filter. */
+#define MAX_MAIN_DATA_BEGIN 511
+
+/* Value of slot.tag while the slot does not hold a decoded block. */
+#define NO_BLOCK (-1L)
+
+struct slot {
+    atomic_long tag;            // index of the decoded block, or NO_BLOCK
+    atomic_ulong last_used;     // value of cache.tick when last read
+    sample_t *pcm;
+};
+
+struct _mbx_block_cache {
+    const struct _mbx_pcm_buffer *buf;
+    unsigned channels;
+    size_t frames_per_block;
+    size_t n_blocks;
+    struct slot slots[N_SLOTS];
+    atomic_long read_block;     // block being read by the audio thread
+    atomic_ulong tick;
+    atomic_ulong misses;
+    // Decoder state, only used in the thread decoding blocks.
+    struct mad_stream stream;
+    struct mad_frame frame;
+    struct mad_synth synth;
+    struct _mbx_dither dither;
+    size_t next_mp3_frame;      // next frame of a sequential decode
+    int decoder_valid;
+    struct _mbx_block_cache *next;
+};
+
+/* The helper thread decodes ahead for all caches in the list. The mutex
+ * protects the list, and is held while decoding. */
+static pthread_mutex_t helper_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t helper_thread;
+static sem_t helper_wakeup;
+static int helper_running = 0;
+static struct _mbx_block_cache *caches = NULL;
+
+static void decode_block(struct _mbx_block_cache *cache, long block,
+        sample_t *pcm);
+static void prefetch(struct _mbx_block_cache *cache);
+static void *helper_main(void *arg);
+
+mbx_error_code _mbx_block_cache_new(struct _mbx_block_cache **cache_p,
+        const struct _mbx_pcm_buffer *buf, size_t pos) {
+    struct _mbx_block_cache *cache;
+    int i;
+    assert ( buf->mp3 != NULL );
+    cache = _mbx_xmalloc(MBX_LOG_MP3LIB, sizeof(struct _mbx_block_cache));
+    bzero(cache, sizeof(struct _mbx_block_cache));
+    cache->buf = buf;
+    cache->channels = buf->channels;
+    cache->frames_per_block = BLOCK_MP3_FRAMES * buf->frames_per_mp3_frame;
+    cache->n_blocks = ( buf->n_index + BLOCK_MP3_FRAMES - 1 ) / BLOCK_MP3_FRAMES;
+    for ( i=0; i<N_SLOTS; i++ ) {
+        atomic_init(&cache->slots[i].tag, NO_BLOCK);
+        atomic_init(&cache->slots[i].last_used, 0);
+    }
+    atomic_init(&cache->read_block, pos / cache->frames_per_block);
+    atomic_init(&cache->tick, 0);
+    atomic_init(&cache->misses, 0);
+    mad_stream_init(&cache->stream);
+    mad_frame_init(&cache->frame);
+    mad_synth_init(&cache->synth);
+    _mbx_dither_init(&cache->dither);
+    for ( i=0; i<N_SLOTS; i++ ) {
+        cache->slots[i].pcm = _mbx_try_realloc(MBX_LOG_PCM, NULL,
+            cache->frames_per_block * cache->channels * sizeof(sample_t));
+        if ( cache->slots[i].pcm == NULL ) {
+            _mbx_block_cache_free(cache);
+            return MBX_OUT_OF_MEMORY;
+        }
+    }
+    // The first blocks are decoded here, such that playback can start
+    // immediately.
+    prefetch(cache);
+    pthread_mutex_lock(&helper_mutex);
+    cache->next = caches;
+    caches = cache;
+    if ( ! helper_running ) {
+        sem_init(&helper_wakeup, 0, 0);
+        if ( pthread_create(&helper_thread, NULL, helper_main, NULL) != 0 ) {
+            mbx_log_fatal(MBX_LOG_MP3LIB, "Failed to start the block decoder thread.");
+            exit(-1);
+        }
+        // It is woken by the audio thread, so it is not a task of the
+        // worker pool, but it runs on the same CPUs.
+        _mbx_pool_set_background_affinity(helper_thread);
+        helper_running = 1;
+    }
+    pthread_mutex_unlock(&helper_mutex);
+    *cache_p = cache;
+    return MBX_SUCCESS;
+}
+
+void _mbx_block_cache_free(struct _mbx_block_cache *cache) {
+    struct _mbx_block_cache **p;
+    int i, stop = 0;
+    pthread_mutex_lock(&helper_mutex);
+    for ( p = &caches; *p != NULL; p = &(*p)->next ) {
+        if ( *p == cache ) {
+            *p = cache->next;
+            break;
+        }
+    }
+    if ( caches == NULL && helper_running ) {
+        helper_running = 0;
+        stop = 1;
+    }
+    pthread_mutex_unlock(&helper_mutex);
+    if ( stop ) {
+        sem_post(&helper_wakeup);
+        pthread_join(helper_thread, NULL);
+        sem_destroy(&helper_wakeup);
+    }
+    for ( i=0; i<N_SLOTS; i++ ) {
+        _mbx_xfree(cache->slots[i].pcm);
+    }
+    mad_synth_finish(&cache->synth);
+    mad_frame_finish(&cache->frame);
+    mad_stream_finish(&cache->stream);
+    bzero(cache, sizeof(struct _mbx_block_cache));
+    _mbx_xfree(cache);
+}
+
+size_t _mbx_block_cache_get_resident_bytes(struct _mbx_block_cache *cache) {
+    return N_SLOTS * cache->frames_per_block * cache->channels * sizeof(sample_t);
+}
+
+unsigned long _mbx_block_cache_get_misses(struct _mbx_block_cache *cache) {
+    return atomic_load_explicit(&cache->misses, memory_order_relaxed);
+}
+
+/*
+ * The audio thread publishes the block it reads in read_block before looking
+ * up the slot, and the helper thread claims a slot before checking
+ * read_block. With sequentially consistent ordering, the helper either sees
+ * the block being read and leaves the slot alone, or the audio thread sees
+ * the slot claimed. The audio thread only updates read_block when it is done
+ * with the previous block.
+ */
+const sample_t *_mbx_block_cache_get(struct _mbx_block_cache *cache,
+        size_t pos, size_t *n_frames) {
+    long block = pos / cache->frames_per_block;
+    size_t offset = pos - block * cache->frames_per_block;
+    int i;
+    if ( block != atomic_load(&cache->read_block) ) {
+        atomic_store(&cache->read_block, block);
+        sem_post(&helper_wakeup);
+    }
+    *n_frames = cache->frames_per_block - offset;
+    for ( i=0; i<N_SLOTS; i++ ) {
+        struct slot *slot = &cache->slots[i];
+        if ( atomic_load(&slot->tag) == block ) {
+            atomic_store_explicit(&slot->last_used,
+                atomic_fetch_add_explicit(&cache->tick, 1, memory_order_relaxed),
+                memory_order_relaxed);
+            return slot->pcm + offset * cache->channels;
+        }
+    }
+    atomic_fetch_add_explicit(&cache->misses, 1, memory_order_relaxed);
+    sem_post(&helper_wakeup);
+    return NULL;
+}
+
+/* Find the MPEG frame starting at p, or return -1 if p is not indexed. */
+static long find_mp3_frame(struct _mbx_block_cache *cache,
+        const unsigned char *p) {
+    const struct _mbx_pcm_buffer *buf = cache->buf;
+    size_t offset = p - buf->mp3;
+    size_t lo = 0, hi = buf->n_index;
+    while ( lo < hi ) {
+        size_t mid = lo + ( hi - lo ) / 2;
+        if ( buf->index[mid] < offset ) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo < buf->n_index && buf->index[lo] == offset ? (long) lo : -1;
+}
+
+/* Reset the decoder and position it such that frame first decodes
+ * correctly. */
+static void seek_decoder(struct _mbx_block_cache *cache, size_t first) {
+    const struct _mbx_pcm_buffer *buf = cache->buf;
+    size_t start = first;
+    while ( start > 0 && buf->index[first] - buf->index[start] <= MAX_MAIN_DATA_BEGIN ) {
+        start--;
+    }
+    if ( start > 0 ) {
+        start--;
+    }
+    mad_synth_finish(&cache->synth);
+    mad_frame_finish(&cache->frame);
+    mad_stream_finish(&cache->stream);
+    mad_stream_init(&cache->stream);
+    mad_frame_init(&cache->frame);
+    mad_synth_init(&cache->synth);
+    mad_stream_buffer(&cache->stream, buf->mp3 + buf->index[start],
+        buf->mp3_size + MAD_BUFFER_GUARD - buf->index[start]);
+    cache->next_mp3_frame = start;
+    cache->decoder_valid = 1;
+}
+
+/* Decode a block into pcm. Frames that cannot be decoded are left silent. */
+static void decode_block(struct _mbx_block_cache *cache, long block,
+        sample_t *pcm) {
+    size_t first = block * BLOCK_MP3_FRAMES;
+    size_t last = first + BLOCK_MP3_FRAMES;
+    size_t frame_samples = cache->buf->frames_per_mp3_frame * cache->channels;
+    if ( last > cache->buf->n_index ) {
+        last = cache->buf->n_index;
+    }
+    bzero(pcm, cache->frames_per_block * cache->channels * sizeof(sample_t));
+    if ( ! cache->decoder_valid || cache->next_mp3_frame != first ) {
+        seek_decoder(cache, first);
+    }
+    while ( cache->next_mp3_frame < last ) {
+        long k;
+        int failed = mad_frame_decode(&cache->frame, &cache->stream);
+        if ( failed && ! MAD_RECOVERABLE(cache->stream.error) ) {
+            // MAD_ERROR_BUFLEN: end of file
+            cache->decoder_valid = 0;
+            break;
+        }
+        if ( ( k = find_mp3_frame(cache, cache->stream.this_frame) ) < 0 ) {
+            continue;
+        }
+        cache->next_mp3_frame = k + 1;
+        if ( failed ) {
+            continue;
+        }
+        // Frames before the block are decoded only to fill the bit
+        // reservoir and the synthesis filter.
+        mad_synth_frame(&cache->synth, &cache->frame);
+        if ( k >= first && k < last
+                && cache->synth.pcm.length == cache->buf->frames_per_mp3_frame ) {
+            // Same channel handling as in mad_decoder.c
+            _mbx_pcm_convert(pcm + ( k - first ) * frame_samples,
+                cache->channels, &cache->synth.pcm, &cache->dither);
+        }
+    }
+}
+
+/* Decode the blocks ahead of the read head that are not decoded yet. */
+static void prefetch(struct _mbx_block_cache *cache) {
+    long read_block = atomic_load(&cache->read_block);
+    long block, end = read_block + LOOKAHEAD + 1;
+    int i;
+    if ( end > (long) cache->n_blocks ) {
+        end = cache->n_blocks;
+    }
+    for ( block = read_block; block < end; block++ ) {
+        struct slot *victim = NULL;
+        long victim_tag;
+        for ( i=0; i<N_SLOTS; i++ ) {
+            if ( atomic_load(&cache->slots[i].tag) == block ) {
+                break;
+            }
+        }
+        if ( i < N_SLOTS ) {
+            continue;
+        }
+        // Take an empty slot, or the least recently used slot that is not
+        // within the lookahead window.
+        for ( i=0; i<N_SLOTS; i++ ) {
+            struct slot *slot = &cache->slots[i];
+            long tag = atomic_load(&slot->tag);
+            if ( tag == NO_BLOCK ) {
+                victim = slot;
+                break;
+            }
+            if ( tag >= read_block && tag < end ) {
+                continue;
+            }
+            if ( victim == NULL || atomic_load(&slot->last_used)
+                    < atomic_load(&victim->last_used) ) {
+                victim = slot;
+            }
+        }
+        if ( victim == NULL ) {
+            return;
+        }
+        victim_tag = atomic_exchange(&victim->tag, NO_BLOCK);
+        if ( victim_tag != NO_BLOCK
+                && atomic_load(&cache->read_block) == victim_tag ) {
+            // The audio thread jumped back to this block. It has woken the
+            // helper thread, so the lookahead is decoded in the next run.
+            atomic_store(&victim->tag, victim_tag);
+            return;
+        }
+        decode_block(cache, block, victim->pcm);
+        atomic_store(&victim->last_used,
+            atomic_load_explicit(&cache->tick, memory_order_relaxed));
+        atomic_store(&victim->tag, block);
+    }
+}
+
+static void *helper_main(void *arg) {
+    struct _mbx_block_cache *cache;
+    for ( ;; ) {
+        sem_wait(&helper_wakeup);
+        pthread_mutex_lock(&helper_mutex);
+        if ( ! helper_running ) {
+            pthread_mutex_unlock(&helper_mutex);
+            return NULL;
+        }
+        for ( cache = caches; cache != NULL; cache = cache->next ) {
+            prefetch(cache);
+        }
+        pthread_mutex_unlock(&helper_mutex);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef MBX_BLOCK_CACHE_H
+#define MBX_BLOCK_CACHE_H
+
+#include <stddef.h>
+#include "pcm_buffer.h"
+
+/******************************************************************************
+ * The block cache decodes a compressed PCM buffer (see pcm_buffer.h) in
+ * blocks on demand, for one read head.
+ *
+ * The decoded audio data is split into blocks of a fixed number of MPEG
+ * frames. A small number of decoded blocks is kept in memory: The blocks
+ * ahead of the read head are decoded by a helper thread, the least recently
+ * used blocks are kept for rewinds and cue jumps. Any other position is
+ * reached through the frame index of the PCM buffer.
+ *
+ * Sequential blocks are decoded with the same decoder state, such that the
+ * audio data is the same as if the whole file was decoded at once. After a
+ * jump, decoding starts a few frames earlier in order to fill the bit
+ * reservoir and the synthesis filter.
+ *
+ * _mbx_block_cache_get() is called in the audio thread, all other functions
+ * are called in the thread loading the tracks.
+ *****************************************************************************/
+
+struct _mbx_block_cache;
+
+/* Create a cache for a compressed PCM buffer, and decode the blocks at the
+ * frame position pos. The buffer must outlive the cache. The cache must be
+ * freed with _mbx_block_cache_free().
+ * Returns #MBX_SUCCESS, or #MBX_OUT_OF_MEMORY if the limit for MBX_LOG_PCM
+ * is exceeded. */
+extern mbx_error_code _mbx_block_cache_new(struct _mbx_block_cache **cache,
+        const struct _mbx_pcm_buffer *buf, size_t pos);
+
+/* Free the cache. Waits for the helper thread if it is decoding a block for
+ * this cache. */
+extern void _mbx_block_cache_free(struct _mbx_block_cache *cache);
+
+/* The memory used by the decoded blocks of the cache. */
+extern size_t _mbx_block_cache_get_resident_bytes(
+        struct _mbx_block_cache *cache);
+
+/* The number of times _mbx_block_cache_get() found a block not decoded. */
+extern unsigned long _mbx_block_cache_get_misses(
+        struct _mbx_block_cache *cache);
+
+/* Get the decoded audio data at frame position pos. *n_frames is set to the
+ * number of frames available from pos until the end of the block. Returns
+ * NULL if the block is not decoded yet. In that case, the caller plays
+ * silence for *n_frames frames.
+ *
+ * This is called in the audio thread. It does not block, and wakes the
+ * helper thread when the read head enters a new block. */
+extern const sample_t *_mbx_block_cache_get(struct _mbx_block_cache *cache,
+        size_t pos, size_t *n_frames);
+
+#endif
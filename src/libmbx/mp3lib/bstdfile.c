@@ -57,6 +57,7 @@
 #include <string.h>
 #include <sys/types.h>
 #include "bstdfile.h"
+#include "libmbx/common/xmalloc.h"
 
 /****************************************************************************
  * Preprocessor definitions													*
@@ -125,12 +126,7 @@ bstdfile_t *NewBstdFile(FILE *fp)
 	bstdfile_t	*BstdFile;
 
 	/* Allocate the bstdfile structure. */
-	BstdFile=(bstdfile_t *)malloc(sizeof(bstdfile_t));
-	if(BstdFile==NULL)
-	{
-		errno=ENOMEM;
-		return(NULL);
-	}
+	BstdFile=(bstdfile_t *)_mbx_xmalloc(MBX_LOG_MP3LIB,sizeof(bstdfile_t));
 
 	/* Initialize the structure to safe defaults. */
 	BstdFile->live=BstdFile->buffer;
@@ -153,7 +149,7 @@ int BstdFileDestroy(bstdfile_t *BstdFile)
 		errno=EBADF;
 		return(1);
 	}
-	free(BstdFile);
+	_mbx_xfree(BstdFile);
 	return(0);
 }
 
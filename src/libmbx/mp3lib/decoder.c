@@ -0,0 +1,30 @@
+#include "decoder.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+/* The backends in the order they are probed, see decoder.h */
+static const struct _mbx_decoder *const decoders[] = {
+    &_mbx_wav_decoder,
+    &_mbx_mad_decoder
+};
+
+#define N_DECODERS ( sizeof(decoders) / sizeof(decoders[0]) )
+
+const struct _mbx_decoder *_mbx_decoder_find(FILE *file) {
+    const struct _mbx_decoder *decoder = NULL;
+    unsigned char *head;
+    size_t n, i;
+    // Too large to be put on the stack.
+    head = _mbx_xmalloc(MBX_LOG_MP3LIB, _MBX_DECODER_PROBE_BYTES);
+    n = fread(head, 1, _MBX_DECODER_PROBE_BYTES, file);
+    if ( ! ferror(file) ) {
+        rewind(file);
+        for ( i=0; i<N_DECODERS && decoder == NULL; i++ ) {
+            if ( decoders[i]->probe(head, n) ) {
+                decoder = decoders[i];
+            }
+        }
+    }
+    _mbx_xfree(head);
+    return decoder;
+}
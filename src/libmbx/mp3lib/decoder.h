@@ -0,0 +1,50 @@
+#ifndef MBX_DECODER_H
+#define MBX_DECODER_H
+
+#include <stdio.h>
+#include "libmbx/common/mbx_errno.h"
+#include "pcm_buffer.h"
+
+/******************************************************************************
+ * Decoder backends. A backend decodes a whole file into the PCM arena, see
+ * mad_decode() for the contract of decode().
+ *
+ * The backend is selected per file by the type of the file, which is
+ * recognized from its first bytes rather than from its name. libmad comes
+ * last, because an MP3 file is only recognized by an ID3 tag or an MPEG
+ * frame header, which is a weaker signature than those of the other types.
+ *
+ * Only MP3 files can be kept compressed in memory, see block_cache.h. Files
+ * of the other types are decoded completely in compressed mode as well.
+ *
+ * libmad is the only MP3 backend so far. A faster decoder with float output
+ * would be added as another backend probed before libmad, converting its
+ * output with _mbx_pcm_convert_float() like the WAV backend.
+ *****************************************************************************/
+
+/* The number of bytes at the start of a file passed to probe(). MP3 files
+ * may have junk or padding of some kilobytes before the first frame. */
+#define _MBX_DECODER_PROBE_BYTES 65536
+
+struct _mbx_decoder {
+    const char *name;
+    /* 1 if the file starting with the n bytes of head is of the type of
+     * this backend. n is less than _MBX_DECODER_PROBE_BYTES for short
+     * files. */
+    int (*probe)(const unsigned char *head, size_t n);
+    /* Decode the file from its start, see mad_decode(). */
+    mbx_error_code (*decode)(FILE *file, signed short **output,
+            size_t *n_samples, unsigned *channels,
+            struct _mbx_load_progress *progress);
+    /* 1 if the files can be played compressed, see block_cache.h */
+    int compressed;
+};
+
+extern const struct _mbx_decoder _mbx_mad_decoder;
+extern const struct _mbx_decoder _mbx_wav_decoder;
+
+/* Select the backend for file, and rewind the file. Returns NULL if the
+ * file cannot be read, or if no backend recognizes it. */
+extern const struct _mbx_decoder *_mbx_decoder_find(FILE *file);
+
+#endif
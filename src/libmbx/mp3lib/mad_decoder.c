@@ -61,9 +61,15 @@
 #include <unistd.h>
 #include <ctype.h>
 #include <assert.h>
+#include <pthread.h>
 #include "bstdfile.h"
 #include "mad_decoder.h"
+#include "decoder.h"
 #include "libmbx/common/log.h"
+#include "libmbx/common/worker_pool.h"
+#include "libmbx/common/xmalloc.h"
+#include "pcm_arena.h"
+#include "pcm_convert.h"
 
 /* Should we use getopt() for command-line arguments parsing? */
 /*
@@ -170,43 +176,6 @@ static const char *MadErrorString(const struct mad_stream *Stream)
 }
 #endif
 
-/****************************************************************************
- * Converts a sample from libmad's fixed point number format to a signed	*
- * short (16 bits).															*
- ****************************************************************************/
-static signed short MadFixedToSshort(mad_fixed_t Fixed)
-{
-	/* A fixed point number is formed of the following bit pattern:
-	 *
-	 * SWWWFFFFFFFFFFFFFFFFFFFFFFFFFFFF
-	 * MSB                          LSB
-	 * S ==> Sign (0 is positive, 1 is negative)
-	 * W ==> Whole part bits
-	 * F ==> Fractional part bits
-	 *
-	 * This pattern contains MAD_F_FRACBITS fractional bits, one
-	 * should alway use this macro when working on the bits of a fixed
-	 * point number. It is not guaranteed to be constant over the
-	 * different platforms supported by libmad.
-	 *
-	 * The signed short value is formed, after clipping, by the least
-	 * significant whole part bit, followed by the 15 most significant
-	 * fractional part bits. Warning: this is a quick and dirty way to
-	 * compute the 16-bit number, madplay includes much better
-	 * algorithms.
-	 */
-
-	/* Clipping */
-	if(Fixed>=MAD_F_ONE)
-		return(SHRT_MAX);
-	if(Fixed<=-MAD_F_ONE)
-		return(-SHRT_MAX);
-
-	/* Conversion. */
-	Fixed=Fixed>>(MAD_F_FRACBITS-15);
-	return((signed short)Fixed);
-}
-
 /****************************************************************************
  * Print human readable informations about an audio MPEG frame.				*
  ****************************************************************************/
@@ -322,15 +291,200 @@ static void ApplyFilter(struct mad_frame *Frame)
 */
 
 /****************************************************************************
- * Main decoding loop. This is where mad is used.							*
+ * Synthesis pipeline. The decoding loop below only parses the frames, and	*
+ * hands them to a second thread over a bounded ring. That thread			*
+ * synthesizes the frames to PCM and stores the samples in the output		*
+ * buffer. Parsing and synthesis take about the same time, so the two		*
+ * stages overlap for a single stream, whatever its source.					*
  ****************************************************************************/
 #define INPUT_BUFFER_SIZE	(5*8192)
 #define OUTPUT_BUFFER_SIZE	8192 /* Must be an integer multiple of 4. */
-static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n_samples)
+#define STATUS_OUT_OF_MEMORY	3 /* The memory limit for PCM was exceeded. */
+#define STATUS_CANCELLED	4 /* The load was cancelled, see pcm_buffer.h */
+#define GROW_STEP	(8L*1024*1024) /* samples, see the output buffer below */
+#define PIPELINE_FRAMES	32 /* Frames in the ring, about 0.8 s of audio. */
+
+struct Pipeline
+{
+	pthread_mutex_t		mutex;
+	pthread_cond_t		changed;
+	struct mad_frame	*Frames; /* the ring, PIPELINE_FRAMES long */
+	unsigned long		head, /* frames taken by the synthesis thread */
+						tail; /* frames put by the decoding loop */
+	int					eof; /* no frames will be put anymore */
+	int					Status; /* non zero if synthesis failed */
+	unsigned			channels; /* set before the first frame is put */
+	signed short		**sample_data;
+	size_t				*n_samples,
+						sample_data_size;
+	struct _mbx_dither	Dither;
+	pthread_t			thread;
+};
+
+/* Append the synthesized samples to the output buffer, growing it as
+ * needed. Returns STATUS_OUT_OF_MEMORY if it could not grow.
+ */
+static int StorePcm(struct Pipeline *p, const struct mad_pcm *Pcm)
+{
+	size_t	needed=*p->n_samples+Pcm->length*p->channels;
+
+	while ( needed > p->sample_data_size ) {
+		/* Arena regions grow without copying, so there is no need
+		 * to over-allocate large buffers. */
+		size_t grow_by = p->sample_data_size < GROW_STEP ?
+				p->sample_data_size : GROW_STEP;
+		signed short *grown = _mbx_pcm_arena_grow(*p->sample_data,
+				(p->sample_data_size + grow_by) * sizeof(signed short));
+		if ( grown == NULL ) {
+			mbx_log_error(MBX_LOG_MP3LIB, "mad-decoder: memory limit "
+					"exceeded after %zu samples", *p->n_samples);
+			return(STATUS_OUT_OF_MEMORY);
+		}
+		p->sample_data_size += grow_by;
+		*p->sample_data = grown;
+	}
+
+	/* Synthesized samples must be converted from libmad's fixed
+	 * point number to the consumer format, signed 16 bit integers.
+	 * Mono streams are stored with one channel only, the mixer pans
+	 * them to the output channels. Should a mono stream contain a
+	 * stereo frame, it is mixed down. If a stereo stream contains a
+	 * monophonic frame, then the right output channel is the same as
+	 * the left one.
+	 */
+	_mbx_pcm_convert(*p->sample_data+*p->n_samples,p->channels,Pcm,
+			&p->Dither);
+	*p->n_samples+=Pcm->length*p->channels;
+	return(0);
+}
+
+/* The synthesis thread. Runs until the ring is empty after the end of the
+ * stream, or until the output buffer can't grow.
+ */
+static void *SynthesisMain(void *userdata)
+{
+	struct Pipeline		*p=userdata;
+	struct mad_synth	Synth;
+	struct mad_frame	*Frame;
+	int					Status=0;
+
+	mad_synth_init(&Synth);
+	pthread_mutex_lock(&p->mutex);
+	for ( ;; ) {
+		while ( p->head == p->tail && !p->eof )
+			pthread_cond_wait(&p->changed, &p->mutex);
+		if ( p->head == p->tail )
+			break;
+		Frame=&p->Frames[p->head % PIPELINE_FRAMES];
+		pthread_mutex_unlock(&p->mutex);
+
+		/* Once decoded the frame is synthesized to PCM samples. No
+		 * errors are reported by mad_synth_frame();
+		 */
+		mad_synth_frame(&Synth,Frame);
+		Status=StorePcm(p,&Synth.pcm);
+
+		pthread_mutex_lock(&p->mutex);
+		p->head++;
+		p->Status=Status;
+		pthread_cond_broadcast(&p->changed);
+		if ( Status )
+			break;
+	}
+	pthread_mutex_unlock(&p->mutex);
+	mad_synth_finish(&Synth);
+	return(NULL);
+}
+
+static void PipelineStart(struct Pipeline *p, signed short **sample_data,
+		size_t *n_samples, size_t sample_data_size)
+{
+	int	i;
+
+	pthread_mutex_init(&p->mutex,NULL);
+	pthread_cond_init(&p->changed,NULL);
+	p->Frames=_mbx_xmalloc(MBX_LOG_MP3LIB,
+			PIPELINE_FRAMES*sizeof(struct mad_frame));
+	for(i=0;i<PIPELINE_FRAMES;i++)
+		mad_frame_init(&p->Frames[i]);
+	p->head=p->tail=0;
+	p->eof=0;
+	p->Status=0;
+	p->channels=2;
+	p->sample_data=sample_data;
+	p->n_samples=n_samples;
+	p->sample_data_size=sample_data_size;
+	_mbx_dither_init(&p->Dither);
+	if ( pthread_create(&p->thread, NULL, SynthesisMain, p) != 0 ) {
+		mbx_log_fatal(MBX_LOG_MP3LIB, "Failed to start a synthesis thread.");
+		exit(-1);
+	}
+	/* Both stages wait for each other, so the synthesis can't be a
+	 * task of the worker pool, but it runs on the same CPUs. */
+	_mbx_pool_set_background_affinity(p->thread);
+}
+
+/* Copy the parsed frame to the ring, waiting while it is full. Returns
+ * the status of the synthesis thread.
+ */
+static int PipelinePut(struct Pipeline *p, const struct mad_frame *Frame)
+{
+	struct mad_frame	*Slot;
+	int					Status;
+
+	pthread_mutex_lock(&p->mutex);
+	while ( p->tail - p->head == PIPELINE_FRAMES && !p->Status )
+		pthread_cond_wait(&p->changed, &p->mutex);
+	Status=p->Status;
+	pthread_mutex_unlock(&p->mutex);
+	if ( Status )
+		return(Status);
+
+	/* The slot is not read before tail is incremented. Synthesis only
+	 * needs the header and the subband samples, the overlap of layer
+	 * III stays with the decoding loop's frame.
+	 */
+	Slot=&p->Frames[p->tail % PIPELINE_FRAMES];
+	Slot->header=Frame->header;
+	Slot->options=Frame->options;
+	memcpy(Slot->sbsample,Frame->sbsample,sizeof(Frame->sbsample));
+
+	pthread_mutex_lock(&p->mutex);
+	p->tail++;
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->mutex);
+	return(0);
+}
+
+/* Let the synthesis thread finish the frames in the ring, and return its
+ * status.
+ */
+static int PipelineFinish(struct Pipeline *p)
+{
+	int	i;
+
+	pthread_mutex_lock(&p->mutex);
+	p->eof=1;
+	pthread_cond_broadcast(&p->changed);
+	pthread_mutex_unlock(&p->mutex);
+	pthread_join(p->thread,NULL);
+	for(i=0;i<PIPELINE_FRAMES;i++)
+		mad_frame_finish(&p->Frames[i]);
+	_mbx_xfree(p->Frames);
+	pthread_cond_destroy(&p->changed);
+	pthread_mutex_destroy(&p->mutex);
+	return(p->Status);
+}
+
+/****************************************************************************
+ * Main decoding loop. This is where mad is used.							*
+ ****************************************************************************/
+static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n_samples,
+		unsigned *channels, struct _mbx_load_progress *progress)
 {
 	struct mad_stream	Stream;
 	struct mad_frame	Frame;
-	struct mad_synth	Synth;
+	struct Pipeline		Pipeline;
 	mad_timer_t			Timer;
 	unsigned char		InputBuffer[INPUT_BUFFER_SIZE+MAD_BUFFER_GUARD],
 /*
@@ -342,19 +496,25 @@ static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n
 	const unsigned char	*OutputBufferEnd=OutputBuffer+OUTPUT_BUFFER_SIZE;
 */
 	int					Status=0,
-						i;
+						SynthesisStatus;
 	unsigned long		FrameCount=0;
 	bstdfile_t			*BstdFile;
 
-	/* initialize output buffer */
+	/* initialize output buffer. The decoded data is stored in the PCM arena,
+	 * and is subject to the limit set with mbx_mem_set_limit(). */
 	size_t sample_data_size = 16;
-	*sample_data = calloc(sample_data_size, 2);
+	*sample_data = _mbx_pcm_arena_alloc(sample_data_size * sizeof(signed short));
 	*n_samples = 0;
+	*channels = 2;
+	if(*sample_data==NULL)
+	{
+		mbx_log_error(MBX_LOG_MP3LIB, "mad-decoder: memory limit exceeded");
+		return(STATUS_OUT_OF_MEMORY);
+	}
 
 	/* First the structures used by libmad must be initialized. */
 	mad_stream_init(&Stream);
 	mad_frame_init(&Frame);
-	mad_synth_init(&Synth);
 	mad_timer_reset(&Timer);
 
 	/* Decoding options can here be set in the options field of the
@@ -373,9 +533,14 @@ static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n
 	if(BstdFile==NULL)
 	{
 		mbx_log_error(MBX_LOG_MP3LIB, "mad-decoder: can't create a new bstdfile_t (%s)", strerror(errno));
+		_mbx_pcm_arena_free(*sample_data);
+		*sample_data=NULL;
 		return(1);
 	}
 
+	/* The synthesis thread stores the samples from now on. */
+	PipelineStart(&Pipeline,sample_data,n_samples,sample_data_size);
+
 	/* This is the decoding loop. */
 	do
 	{
@@ -435,6 +600,20 @@ static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n
 				break;
 			}
 
+			/* Report the progress, and stop if the load was cancelled.
+			 * The input buffer holds a few hundred milliseconds of audio,
+			 * so a cancelled load stops quickly. */
+			if(progress!=NULL)
+			{
+				atomic_fetch_add(&progress->bytes_read,ReadSize);
+				if(atomic_load(&progress->cancel))
+				{
+					mbx_log_debug(MBX_LOG_MP3LIB, "mad-decoder: cancelled");
+					Status=STATUS_CANCELLED;
+					break;
+				}
+			}
+
 			/* {3} When decoding the last frame of a file, it must be
 			 * followed by MAD_BUFFER_GUARD zero bytes if one wants to
 			 * decode that last frame. When the end of file is
@@ -534,11 +713,17 @@ static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n
 		 * stream.
 		 */
 		if(FrameCount==0)
+		{
 			if(PrintFrameInfo(&Frame.header))
 			{
 				Status=1;
 				break;
 			}
+			/* The channel layout of the first frame is used for the
+			 * whole stream. */
+			*channels=MAD_NCHANNELS(&Frame.header);
+			Pipeline.channels=*channels;
+		}
 
 		/* Accounting. The computed frame duration is in the frame
 		 * header structure. It is expressed as a fixed point number
@@ -562,61 +747,22 @@ static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n
 			ApplyFilter(&Frame);
 */
 
-		/* Once decoded the frame is synthesized to PCM samples. No errors
-		 * are reported by mad_synth_frame();
-		 */
-		mad_synth_frame(&Synth,&Frame);
-
-		/* Synthesized samples must be converted from libmad's fixed
-		 * point number to the consumer format. Here we use unsigned
-		 * 16 bit big endian integers on two channels. Integer samples
-		 * are temporarily stored in a buffer that is flushed when
-		 * full.
+		/* Once decoded the frame is synthesized to PCM samples and
+		 * stored by the synthesis thread, see PipelinePut(). Leave the
+		 * decoding loop if the output buffer could not grow.
 		 */
-		for(i=0;i<Synth.pcm.length;i++)
-		{
-			signed short	Sample;
-
-			/* Left channel */
-			Sample=MadFixedToSshort(Synth.pcm.samples[0][i]);
-/*
-			*(OutputPtr++)=Sample>>8;
-			*(OutputPtr++)=Sample&0xff;
-*/
-			(*sample_data)[(*n_samples)++] = Sample;
-
-			/* Right channel. If the decoded stream is monophonic then
-			 * the right output channel is the same as the left one.
-			 */
-			if(MAD_NCHANNELS(&Frame.header)==2)
-				Sample=MadFixedToSshort(Synth.pcm.samples[1][i]);
-			(*sample_data)[(*n_samples)++] = Sample;
-/*
-			*(OutputPtr++)=Sample>>8;
-			*(OutputPtr++)=Sample&0xff;
-*/
-
-			/* Flush the output buffer if it is full. */
-			if ( *n_samples == sample_data_size ) {
-				sample_data_size *= 2L;
-				*sample_data = realloc(*sample_data, sample_data_size * sizeof(signed short));
-			}
-/*
-			if(OutputPtr==OutputBufferEnd)
-			{
-				if(fwrite(OutputBuffer,1,OUTPUT_BUFFER_SIZE,OutputFp)!=OUTPUT_BUFFER_SIZE)
-				{
-					fprintf(stderr,"%s: PCM write error (%s).\n",
-							ProgName,strerror(errno));
-					Status=2;
-					break;
-				}
-				OutputPtr=OutputBuffer;
-			}
-*/
-		}
+		Status=PipelinePut(&Pipeline,&Frame);
+		if(Status)
+			break;
 	}while(1);
 
+	/* The synthesis thread stores the last frames of the ring, even if
+	 * the decoding loop failed, before the output buffer is freed.
+	 */
+	SynthesisStatus=PipelineFinish(&Pipeline);
+	if(Status==0)
+		Status=SynthesisStatus;
+
 	/* The input file was completely read; the memory allocated by our
 	 * reading module must be reclaimed.
 	 */
@@ -625,7 +771,6 @@ static int MpegAudioDecoder(FILE *InputFp, signed short **sample_data, size_t *n
 	/* Mad is no longer used, the structures that were initialized must
      * now be cleared.
 	 */
-	mad_synth_finish(&Synth);
 	mad_frame_finish(&Frame);
 	mad_stream_finish(&Stream);
 
@@ -923,13 +1068,90 @@ int main(int argc, char *argv[])
  * End of file madlld.c														*
  ****************************************************************************/
 
-mbx_error_code mad_decode(FILE *file, signed short **sample_data, size_t *n_samples) {
+mbx_error_code mad_decode(FILE *file, signed short **sample_data,
+        size_t *n_samples, unsigned *channels,
+        struct _mbx_load_progress *progress) {
     int r;
     assert(file != NULL);
-    r = MpegAudioDecoder(file, sample_data, n_samples);
-    mbx_log_debug(MBX_LOG_MP3LIB, "Decoded %zu samples.", *n_samples);
+    r = MpegAudioDecoder(file, sample_data, n_samples, channels, progress);
+    mbx_log_debug(MBX_LOG_MP3LIB, "Decoded %zu samples (%s).", *n_samples,
+        *channels == 1 ? "mono" : "stereo");
     if ( r != 0 ) {
-        return MBX_FAILED_TO_LOAD_MP3;
+        _mbx_pcm_arena_free(*sample_data);
+        *sample_data = NULL;
+        return r == STATUS_OUT_OF_MEMORY ? MBX_OUT_OF_MEMORY
+            : r == STATUS_CANCELLED ? MBX_LOAD_CANCELLED
+            : MBX_FAILED_TO_LOAD_MP3;
     }
     return MBX_SUCCESS;
 }
+
+/* 1 if p is a valid MPEG audio frame header: the 11 bit sync word, and no
+ * reserved version, layer, bitrate, or sample rate. */
+static int is_frame_header(const unsigned char *p) {
+    return p[0] == 0xff && ( p[1] & 0xe0 ) == 0xe0
+        && ( p[1] & 0x18 ) != 0x08 && ( p[1] & 0x06 ) != 0
+        && ( p[2] & 0xf0 ) != 0xf0 && ( p[2] & 0x0c ) != 0x0c;
+}
+
+/* The length in bytes of the frame starting with the valid header p, or 0
+ * for free format frames, whose length is not in the header. */
+static size_t frame_length(const unsigned char *p) {
+    /* kbit/s of MPEG 1 layer I, II, III, MPEG 2 layer I, II and III */
+    static const unsigned short bitrates[5][15] = {
+        { 0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416,
+            448 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384 },
+        { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 },
+        { 0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256 },
+        { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160 }
+    };
+    static const unsigned rates[3] = { 44100, 48000, 32000 };
+    int mpeg1 = ( p[1] & 0x18 ) == 0x18, layer = 4 - ( ( p[1] >> 1 ) & 3 );
+    unsigned bitrate, rate = rates[( p[2] >> 2 ) & 3];
+    unsigned padding = ( p[2] >> 1 ) & 1;
+    if ( mpeg1 ) {
+        bitrate = bitrates[layer - 1][p[2] >> 4];
+    }
+    else {
+        bitrate = bitrates[layer == 1 ? 3 : 4][p[2] >> 4];
+        rate /= ( p[1] & 0x18 ) == 0x10 ? 2 : 4; /* MPEG 2 or 2.5 */
+    }
+    bitrate *= 1000;
+    if ( layer == 1 ) {
+        return ( 12 * bitrate / rate + padding ) * 4;
+    }
+    return ( layer == 3 && ! mpeg1 ? 72 : 144 ) * bitrate / rate + padding;
+}
+
+/* MP3 files start with an ID3v2 tag or with an MPEG frame. libmad skips
+ * junk and padding before the first frame, so a frame header is searched
+ * in all probed bytes. Past the first byte, a sync word may occur by
+ * chance, so a header there must be followed by the next one, unless that
+ * is beyond the probed bytes. */
+static int mad_probe(const unsigned char *head, size_t n) {
+    size_t i, length;
+    if ( n >= 3 && ! memcmp(head, "ID3", 3) ) {
+        return 1;
+    }
+    if ( n >= 4 && is_frame_header(head) ) {
+        return 1;
+    }
+    for ( i=1; i+4<=n; i++ ) {
+        if ( ! is_frame_header(head + i) ||
+                ( length = frame_length(head + i) ) == 0 ) {
+            continue;
+        }
+        if ( i + length + 4 > n || is_frame_header(head + i + length) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const struct _mbx_decoder _mbx_mad_decoder = {
+    "libmad",
+    mad_probe,
+    mad_decode,
+    1
+};
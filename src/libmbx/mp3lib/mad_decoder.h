@@ -2,15 +2,27 @@
 #define MAD_DECODER_H
 
 #include <stdio.h>
+#include <mad.h>
 #include "libmbx/common/mbx_errno.h"
+#include "pcm_buffer.h"
 
 /******************************************************************************
- * Decode mp3 file using the mad library
+ * Decode mp3 file using the mad library. This is the libmad backend of
+ * decoder.h.
  *****************************************************************************/
 
 /* Decode an mp3 file and write the decoded sample data to *output.
- * *output will be newly allocated ane must be freed.
- * The number of samples will be put in *n_samples */
-extern mbx_error_code mad_decode(FILE *file, signed short **output, size_t *n_samples);
+ * *output will be newly allocated in the PCM arena and must be freed with
+ * _mbx_pcm_arena_free(). The number of samples will be put in *n_samples.
+ * The number of channels (1 or 2) is put in *channels. Stereo samples are
+ * interleaved, mono files are stored with one sample per frame.
+ * The bytes read are added to progress, unless it is NULL.
+ * The frames are parsed in the calling thread and synthesized in a second
+ * thread, see the synthesis pipeline in mad_decoder.c.
+ * Returns MBX_OUT_OF_MEMORY if the limit for MBX_LOG_PCM is exceeded, or
+ * MBX_LOAD_CANCELLED if progress->cancel is set while decoding. */
+extern mbx_error_code mad_decode(FILE *file, signed short **output,
+        size_t *n_samples, unsigned *channels,
+        struct _mbx_load_progress *progress);
 
 #endif
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE /* for mremap() and MAP_HUGETLB */
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "pcm_arena.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+/* Regions are multiples of the huge page size on x86_64. */
+#define REGION_UNIT (2UL * 1024 * 1024)
+
+/* Free regions are kept for reuse as long as they don't exceed this size in
+ * total. Larger amounts are returned to the operating system. */
+#define MAX_CACHED_BYTES (512UL * 1024 * 1024)
+
+struct region {
+    char *addr;
+    size_t capacity;
+    int hugetlb;   /* mapped with MAP_HUGETLB, cannot be mremap()ed */
+    int locked;    /* mlock()ed */
+    int in_use;
+    struct region *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct region *regions = NULL;
+static size_t cached_bytes = 0;
+static int use_mlock = 0;
+static int hugetlb_failed = 0;  /* don't retry MAP_HUGETLB if it failed once */
+
+static size_t round_up(size_t size) {
+    if ( size == 0 ) {
+        size = 1;
+    }
+    return (size + REGION_UNIT - 1) / REGION_UNIT * REGION_UNIT;
+}
+
+/* Map new memory, preferably with explicit huge pages. Must be called with
+ * lock held. */
+static struct region *map_region(size_t capacity) {
+    struct region *r;
+    void *addr = MAP_FAILED;
+    int hugetlb = 0;
+    if ( ! _mbx_mem_account(MBX_LOG_PCM, (long) capacity, 1) ) {
+        return NULL;
+    }
+#ifdef MAP_HUGETLB
+    if ( ! hugetlb_failed ) {
+        addr = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if ( addr == MAP_FAILED ) {
+            mbx_log_debug(MBX_LOG_MP3LIB, "No explicit huge pages available "
+                "(%s), using transparent huge pages.", strerror(errno));
+            hugetlb_failed = 1;
+        }
+        else {
+            hugetlb = 1;
+        }
+    }
+#endif
+    if ( addr == MAP_FAILED ) {
+        addr = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if ( addr == MAP_FAILED ) {
+            mbx_log_error(MBX_LOG_MP3LIB, "Failed to map %zu bytes for "
+                "decoded audio data: %s", capacity, strerror(errno));
+            _mbx_mem_account(MBX_LOG_PCM, -(long) capacity, -1);
+            return NULL;
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(addr, capacity, MADV_HUGEPAGE);
+#endif
+    }
+    r = _mbx_xmalloc(MBX_LOG_MP3LIB, sizeof(struct region));
+    r->addr = addr;
+    r->capacity = capacity;
+    r->hugetlb = hugetlb;
+    r->locked = 0;
+    r->in_use = 1;
+    r->next = regions;
+    regions = r;
+    return r;
+}
+
+/* Return a region to the operating system. Must be called with lock held. */
+static void unmap_region(struct region *r) {
+    struct region **pp;
+    for ( pp = &regions; *pp != r; pp = &(*pp)->next ) {
+        assert ( *pp != NULL );
+    }
+    *pp = r->next;
+    munmap(r->addr, r->capacity);
+    _mbx_mem_account(MBX_LOG_PCM, -(long) r->capacity, -1);
+    _mbx_xfree(r);
+}
+
+static struct region *find_region(void *p) {
+    struct region *r;
+    for ( r = regions; r != NULL; r = r->next ) {
+        if ( r->addr == p ) {
+            return r;
+        }
+    }
+    assert ( "Pointer was not allocated by the PCM arena" == NULL );
+    return NULL;
+}
+
+/* Find the smallest free region with at least capacity bytes. */
+static struct region *best_fit(size_t capacity) {
+    struct region *r, *best = NULL;
+    for ( r = regions; r != NULL; r = r->next ) {
+        if ( ! r->in_use && r->capacity >= capacity
+                && ( best == NULL || r->capacity < best->capacity ) ) {
+            best = r;
+        }
+    }
+    return best;
+}
+
+/* Unmap free regions until at most max_cached bytes are cached. */
+static void trim_cache(size_t max_cached) {
+    struct region *r, *next;
+    for ( r = regions; r != NULL && cached_bytes > max_cached; r = next ) {
+        next = r->next;
+        if ( ! r->in_use ) {
+            cached_bytes -= r->capacity;
+            unmap_region(r);
+        }
+    }
+}
+
+/* Get a region from the cache, or map a new one. If the memory limit is
+ * reached, cached regions are given back to make room. */
+static struct region *get_region(size_t capacity) {
+    struct region *r = best_fit(capacity);
+    if ( r != NULL ) {
+        r->in_use = 1;
+        cached_bytes -= r->capacity;
+        return r;
+    }
+    if ( ( r = map_region(capacity) ) == NULL && cached_bytes > 0 ) {
+        trim_cache(0);
+        r = map_region(capacity);
+    }
+    return r;
+}
+
+void *_mbx_pcm_arena_alloc(size_t size) {
+    struct region *r;
+    pthread_mutex_lock(&lock);
+    r = get_region(round_up(size));
+    pthread_mutex_unlock(&lock);
+    return r == NULL ? NULL : r->addr;
+}
+
+void *_mbx_pcm_arena_grow(void *p, size_t size) {
+    struct region *r, *new_r;
+    size_t capacity = round_up(size);
+    void *addr;
+    pthread_mutex_lock(&lock);
+    r = find_region(p);
+    if ( capacity <= r->capacity ) {
+        pthread_mutex_unlock(&lock);
+        return p;
+    }
+    /* Anonymous mappings can grow in place or move without copying. */
+    if ( ! r->hugetlb && ! r->locked && _mbx_mem_account(MBX_LOG_PCM,
+            (long) (capacity - r->capacity), 0) ) {
+        addr = mremap(r->addr, r->capacity, capacity, MREMAP_MAYMOVE);
+        if ( addr != MAP_FAILED ) {
+#ifdef MADV_HUGEPAGE
+            madvise(addr, capacity, MADV_HUGEPAGE);
+#endif
+            r->addr = addr;
+            r->capacity = capacity;
+            pthread_mutex_unlock(&lock);
+            return addr;
+        }
+        _mbx_mem_account(MBX_LOG_PCM, -(long) (capacity - r->capacity),
+            0);
+    }
+    /* Otherwise copy to a new region. */
+    if ( ( new_r = get_region(capacity) ) == NULL ) {
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+    memcpy(new_r->addr, r->addr, r->capacity);
+    r->in_use = 0;
+    cached_bytes += r->capacity;
+    trim_cache(MAX_CACHED_BYTES);
+    pthread_mutex_unlock(&lock);
+    return new_r->addr;
+}
+
+void _mbx_pcm_arena_finish(void *p) {
+    struct region *r;
+    size_t offset;
+    pthread_mutex_lock(&lock);
+    r = find_region(p);
+    /* Regions are populated when they are mapped, but a part that was added
+     * by mremap() may not be resident yet. */
+#ifdef MADV_POPULATE_WRITE
+    if ( madvise(r->addr, r->capacity, MADV_POPULATE_WRITE) != 0 )
+#endif
+    for ( offset = 0; offset < r->capacity; offset += getpagesize() ) {
+        ((volatile char *) r->addr)[offset] = r->addr[offset];
+    }
+    if ( use_mlock && ! r->locked ) {
+        if ( mlock(r->addr, r->capacity) == 0 ) {
+            r->locked = 1;
+        }
+        else {
+            mbx_log_warn(MBX_LOG_MP3LIB, "Failed to lock %zu bytes of decoded "
+                "audio data into RAM: %s", r->capacity, strerror(errno));
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+void _mbx_pcm_arena_free(void *p) {
+    struct region *r;
+    if ( p == NULL ) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    r = find_region(p);
+    r->in_use = 0;
+    cached_bytes += r->capacity;
+    trim_cache(MAX_CACHED_BYTES);
+    pthread_mutex_unlock(&lock);
+}
+
+void _mbx_pcm_arena_set_mlock(int enabled) {
+    pthread_mutex_lock(&lock);
+    use_mlock = enabled;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,43 @@
+#ifndef MBX_PCM_ARENA_H
+#define MBX_PCM_ARENA_H
+
+#include <stddef.h>
+
+/******************************************************************************
+ * The PCM arena holds the decoded audio data of the tracks.
+ *
+ * Decoded tracks are large, and are read sequentially by the audio thread.
+ * In order to avoid page faults and TLB misses in the audio thread, the arena
+ * maps memory in units of 2 MB, using explicit huge pages if the system has
+ * them configured, and transparent huge pages otherwise. Pages are faulted in
+ * when they are mapped, i.e. in the thread loading the track, and can
+ * optionally be locked into RAM with mlock().
+ *
+ * Freed regions are not returned to the operating system, but kept for the
+ * next track that is loaded. All memory is accounted as MBX_LOG_PCM, see
+ * mem_stats.h, including the regions that are kept for reuse.
+ *
+ * The arena functions may be called from any thread except the audio thread.
+ *****************************************************************************/
+
+/* Allocate a region of at least size bytes. Returns NULL if this would
+ * exceed the memory limit for MBX_LOG_PCM or if mmap() fails. */
+extern void *_mbx_pcm_arena_alloc(size_t size);
+
+/* Grow a region to at least size bytes, keeping its content. Returns the
+ * (possibly moved) region, or NULL if the region cannot grow. In that case,
+ * p is left untouched. */
+extern void *_mbx_pcm_arena_grow(void *p, size_t size);
+
+/* Called when the region is filled with audio data: make sure that the pages
+ * are resident, and lock them into RAM if enabled with
+ * _mbx_pcm_arena_set_mlock(). */
+extern void _mbx_pcm_arena_finish(void *p);
+
+/* Return a region to the arena for reuse. p may be NULL. */
+extern void _mbx_pcm_arena_free(void *p);
+
+/* Enable or disable mlock() for regions that are finished from now on. */
+extern void _mbx_pcm_arena_set_mlock(int enabled);
+
+#endif
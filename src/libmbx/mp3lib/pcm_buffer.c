@@ -0,0 +1,251 @@
+#include <string.h>
+#include <strings.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <mad.h>
+#include "pcm_buffer.h"
+#include "decoder.h"
+#include "pcm_arena.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+/* The registry holds all buffers with a reference. The mutex protects the
+ * list and the reference counts. */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct _mbx_pcm_buffer *registry = NULL;
+
+static mbx_error_code load_decoded(struct _mbx_pcm_buffer *buf, FILE *file,
+        const struct _mbx_decoder *decoder,
+        struct _mbx_load_progress *progress);
+static mbx_error_code load_compressed(struct _mbx_pcm_buffer *buf, FILE *file,
+        struct _mbx_load_progress *progress);
+static void free_buffer(struct _mbx_pcm_buffer *buf);
+
+static int same_file(struct _mbx_pcm_buffer *buf, struct stat *st,
+        int compressed) {
+    return buf->dev == st->st_dev && buf->ino == st->st_ino
+        && buf->size == st->st_size
+        && buf->mtime.tv_sec == st->st_mtim.tv_sec
+        && buf->mtime.tv_nsec == st->st_mtim.tv_nsec
+        && buf->compressed == compressed;
+}
+
+/* Look up a buffer and take a reference. Must be called with the mutex. */
+static struct _mbx_pcm_buffer *lookup(struct stat *st, int compressed) {
+    struct _mbx_pcm_buffer *buf;
+    for ( buf = registry; buf != NULL; buf = buf->next ) {
+        if ( same_file(buf, st, compressed) ) {
+            buf->refcount++;
+            return buf;
+        }
+    }
+    return NULL;
+}
+
+mbx_error_code _mbx_pcm_buffer_get(struct _mbx_pcm_buffer **buf_p,
+        const char *path, int compressed, struct _mbx_load_progress *progress) {
+    struct _mbx_pcm_buffer *buf, *loaded;
+    const struct _mbx_decoder *decoder;
+    struct stat st;
+    FILE *file;
+    mbx_error_code r;
+    if ( ( file = fopen(path, "r") ) == NULL ) {
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    if ( fstat(fileno(file), &st) != 0 ) {
+        fclose(file);
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    if ( ( decoder = _mbx_decoder_find(file) ) == NULL ) {
+        mbx_log_error(MBX_LOG_MP3LIB, "%s is not an MP3 or WAV file.", path);
+        fclose(file);
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    if ( progress != NULL ) {
+        atomic_store(&progress->bytes_total, st.st_size);
+    }
+    pthread_mutex_lock(&registry_mutex);
+    loaded = lookup(&st, compressed);
+    pthread_mutex_unlock(&registry_mutex);
+    if ( loaded != NULL ) {
+        fclose(file);
+        if ( progress != NULL ) {
+            atomic_store(&progress->bytes_read, st.st_size);
+        }
+        mbx_log_debug(MBX_LOG_MP3LIB, "%s is already loaded.", path);
+        *buf_p = loaded;
+        return MBX_SUCCESS;
+    }
+    // The file is loaded without holding the mutex, such that loading
+    // other files is not blocked.
+    buf = _mbx_xmalloc(MBX_LOG_MP3LIB, sizeof(struct _mbx_pcm_buffer));
+    bzero(buf, sizeof(struct _mbx_pcm_buffer));
+    buf->dev = st.st_dev;
+    buf->ino = st.st_ino;
+    buf->size = st.st_size;
+    buf->mtime = st.st_mtim;
+    buf->compressed = compressed;
+    buf->refcount = 1;
+    if ( compressed && ! decoder->compressed ) {
+        mbx_log_debug(MBX_LOG_MP3LIB, "%s cannot be kept compressed, it is "
+            "decoded with %s.", path, decoder->name);
+    }
+    r = compressed && decoder->compressed
+        ? load_compressed(buf, file, progress)
+        : load_decoded(buf, file, decoder, progress);
+    fclose(file);
+    if ( r != MBX_SUCCESS ) {
+        free_buffer(buf);
+        return r;
+    }
+    pthread_mutex_lock(&registry_mutex);
+    // Another thread may have loaded the same file in the meantime.
+    if ( ( loaded = lookup(&st, compressed) ) == NULL ) {
+        buf->next = registry;
+        registry = buf;
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if ( loaded != NULL ) {
+        free_buffer(buf);
+        buf = loaded;
+    }
+    *buf_p = buf;
+    return MBX_SUCCESS;
+}
+
+struct _mbx_pcm_buffer *_mbx_pcm_buffer_ref(struct _mbx_pcm_buffer *buf) {
+    pthread_mutex_lock(&registry_mutex);
+    buf->refcount++;
+    pthread_mutex_unlock(&registry_mutex);
+    return buf;
+}
+
+void _mbx_pcm_buffer_unref(struct _mbx_pcm_buffer *buf) {
+    struct _mbx_pcm_buffer **p;
+    int last;
+    pthread_mutex_lock(&registry_mutex);
+    last = --buf->refcount == 0;
+    if ( last ) {
+        for ( p = &registry; *p != NULL; p = &(*p)->next ) {
+            if ( *p == buf ) {
+                *p = buf->next;
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&registry_mutex);
+    if ( last ) {
+        free_buffer(buf);
+    }
+}
+
+size_t _mbx_pcm_buffer_get_resident_bytes(struct _mbx_pcm_buffer *buf) {
+    if ( buf->sample_data == NULL ) {
+        return buf->mp3_size + buf->n_index * sizeof(uint32_t);
+    }
+    return buf->n_frames * buf->channels * sizeof(sample_t);
+}
+
+static void free_buffer(struct _mbx_pcm_buffer *buf) {
+    _mbx_pcm_arena_free(buf->sample_data);
+    _mbx_xfree(buf->mp3);
+    _mbx_xfree(buf->index);
+    bzero(buf, sizeof(struct _mbx_pcm_buffer));
+    _mbx_xfree(buf);
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static mbx_error_code load_decoded(struct _mbx_pcm_buffer *buf, FILE *file,
+        const struct _mbx_decoder *decoder,
+        struct _mbx_load_progress *progress) {
+    size_t length;
+    mbx_error_code r;
+    double start = now(), seconds;
+    if ( ( r = decoder->decode(file, &buf->sample_data, &length,
+            &buf->channels, progress) ) != MBX_SUCCESS ) {
+        buf->sample_data = NULL;
+        return r;
+    }
+    _mbx_pcm_arena_finish(buf->sample_data);
+    buf->n_frames = length / buf->channels;
+    // The speed of the backends can be compared on the debug log.
+    seconds = now() - start;
+    mbx_log_debug(MBX_LOG_MP3LIB, "%s decoded %.1f s of audio in %.3f s "
+        "(%.0f times real time).", decoder->name,
+        (double) buf->n_frames / MBX_SAMPLE_RATE, seconds,
+        seconds > 0 ? buf->n_frames / ( seconds * MBX_SAMPLE_RATE ) : 0);
+    return MBX_SUCCESS;
+}
+
+/* Read the MP3 file into memory, and scan the headers of all MPEG frames.
+ * This is much faster than decoding, as neither the audio data nor the
+ * synthesis is computed. */
+static mbx_error_code load_compressed(struct _mbx_pcm_buffer *buf, FILE *file,
+        struct _mbx_load_progress *progress) {
+    struct mad_stream stream;
+    struct mad_header header;
+    size_t capacity = 1024;
+    if ( buf->size <= 0 || buf->size > UINT32_MAX ) {
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    buf->mp3_size = buf->size;
+    buf->mp3 = _mbx_try_realloc(MBX_LOG_PCM, NULL,
+        buf->mp3_size + MAD_BUFFER_GUARD);
+    if ( buf->mp3 == NULL ) {
+        return MBX_OUT_OF_MEMORY;
+    }
+    if ( fread(buf->mp3, 1, buf->mp3_size, file) != buf->mp3_size ) {
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    // Scanning the headers takes little time compared to reading the file.
+    if ( progress != NULL ) {
+        atomic_store(&progress->bytes_read, buf->mp3_size);
+        if ( atomic_load(&progress->cancel) ) {
+            return MBX_LOAD_CANCELLED;
+        }
+    }
+    // libmad needs MAD_BUFFER_GUARD zero bytes to decode the last frame.
+    memset(buf->mp3 + buf->mp3_size, 0, MAD_BUFFER_GUARD);
+    buf->index = _mbx_xmalloc(MBX_LOG_MP3LIB, capacity * sizeof(uint32_t));
+    mad_stream_init(&stream);
+    mad_header_init(&header);
+    mad_stream_buffer(&stream, buf->mp3, buf->mp3_size + MAD_BUFFER_GUARD);
+    for ( ;; ) {
+        if ( mad_header_decode(&header, &stream) ) {
+            if ( MAD_RECOVERABLE(stream.error) ) {
+                continue;
+            }
+            break; // MAD_ERROR_BUFLEN: end of file
+        }
+        if ( stream.this_frame >= buf->mp3 + buf->mp3_size ) {
+            break;
+        }
+        if ( buf->n_index == 0 ) {
+            // The first frame is representative of the entire stream,
+            // see mad_decoder.c
+            buf->channels = MAD_NCHANNELS(&header);
+            buf->frames_per_mp3_frame = 32 * MAD_NSBSAMPLES(&header);
+        }
+        if ( buf->n_index == capacity ) {
+            capacity *= 2;
+            buf->index = _mbx_xrealloc(MBX_LOG_MP3LIB, buf->index,
+                capacity * sizeof(uint32_t));
+        }
+        buf->index[buf->n_index++] = stream.this_frame - buf->mp3;
+    }
+    mad_header_finish(&header);
+    mad_stream_finish(&stream);
+    if ( buf->n_index == 0 ) {
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    buf->n_frames = buf->n_index * buf->frames_per_mp3_frame;
+    mbx_log_debug(MBX_LOG_MP3LIB, "Indexed %zu MPEG frames (%zu bytes).",
+        buf->n_index, buf->mp3_size);
+    return MBX_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#ifndef MBX_PCM_BUFFER_H
+#define MBX_PCM_BUFFER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <time.h>
+#include "libmbx/common/mbx_errno.h"
+#include "libmbx/out/audio_output.h" /* defines sample_t */
+
+/******************************************************************************
+ * A PCM buffer holds the audio data of a file, either decoded by one of the
+ * backends of decoder.h, or, for MP3 files, compressed with a frame index
+ * (see block_cache.h).
+ *
+ * PCM buffers are immutable and reference counted. A process-wide registry
+ * keeps the buffers that are in use, keyed by file identity (device, inode,
+ * size, and modification time). Loading a file that is already loaded, for
+ * example on the other deck or in several sample slots, takes a reference to
+ * the existing buffer instead of decoding the file again. Tracks are read
+ * heads over a buffer, see track.h.
+ *
+ * The functions may be called from any thread except the audio thread. The
+ * audio thread only reads the audio data.
+ *****************************************************************************/
+
+struct _mbx_pcm_buffer {
+    unsigned channels;          // 1 for mono, 2 for interleaved stereo
+    size_t n_frames;            // one sample per channel
+    sample_t *sample_data;      // decoded audio data, or NULL if compressed
+    // Compressed audio data
+    unsigned char *mp3;         // the MP3 file followed by MAD_BUFFER_GUARD
+    size_t mp3_size;
+    uint32_t *index;            // offset of each MPEG frame in mp3
+    size_t n_index;
+    size_t frames_per_mp3_frame;
+    // Registry, private to pcm_buffer.c
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    int compressed;
+    int refcount;
+    struct _mbx_pcm_buffer *next;
+};
+
+/* Progress of a load, shared between the loading thread and the thread
+ * that started the load. */
+struct _mbx_load_progress {
+    atomic_long bytes_read;   // of the file
+    atomic_long bytes_total;  // the size of the file, 0 until known
+    atomic_int cancel;        // set to make the load stop early
+};
+
+/* Get the buffer for an audio file. If the file is loaded in the requested
+ * mode, a reference to the loaded buffer is returned. Otherwise, the file is
+ * loaded. The reference must be dropped with _mbx_pcm_buffer_unref().
+ * progress is updated while the file is read, and may be NULL. Returns
+ * #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3, #MBX_OUT_OF_MEMORY if the limit for
+ * MBX_LOG_PCM is exceeded, or #MBX_LOAD_CANCELLED if progress->cancel was
+ * set. */
+extern mbx_error_code _mbx_pcm_buffer_get(struct _mbx_pcm_buffer **buf,
+        const char *path, int compressed, struct _mbx_load_progress *progress);
+
+/* Take another reference to a buffer. Returns buf. */
+extern struct _mbx_pcm_buffer *_mbx_pcm_buffer_ref(
+        struct _mbx_pcm_buffer *buf);
+
+/* Drop a reference. The buffer is freed when the last reference is gone. */
+extern void _mbx_pcm_buffer_unref(struct _mbx_pcm_buffer *buf);
+
+/* The memory used by the audio data of the buffer. */
+extern size_t _mbx_pcm_buffer_get_resident_bytes(struct _mbx_pcm_buffer *buf);
+
+#endif
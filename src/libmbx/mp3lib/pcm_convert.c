@@ -0,0 +1,178 @@
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <mad.h>
+#include "pcm_convert.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Samples are halved first, so that adding the rounding offset and the
+ * dither to a sample close to the limits of mad_fixed_t can't overflow.
+ * SHIFT converts a halved sample to 16 bit, ONE is one LSB of the result. */
+#define SHIFT ( MAD_F_FRACBITS - 1 - 15 )
+#define ONE ( 1 << SHIFT )
+
+static atomic_int use_dither = 0;
+
+static atomic_uint next_seed = 1;
+
+void _mbx_dither_init(struct _mbx_dither *dither) {
+    uint32_t seed = atomic_fetch_add(&next_seed, 4);
+    int i;
+    for ( i=0; i<4; i++ ) {
+        // Any non-zero state works for xorshift, spread the seeds.
+        dither->state[i] = ( seed + i ) * 0x9e3779b9u;
+    }
+}
+
+void _mbx_pcm_convert_set_dither(int enabled) {
+    atomic_store(&use_dither, enabled);
+}
+
+/* The sum of two uniform values in [0, ONE), minus ONE: triangular noise
+ * in [-ONE, ONE). Both values are taken from one xorshift32 step. */
+static inline int32_t noise(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return (int32_t) ( x & ( ONE - 1 ) )
+        + (int32_t) ( ( x >> 16 ) & ( ONE - 1 ) ) - ONE;
+}
+
+static inline signed short to_s16(mad_fixed_t half, int32_t n) {
+    int32_t v = ( half + n + ONE / 2 ) >> SHIFT;
+    return v > SHRT_MAX ? SHRT_MAX : v < SHRT_MIN ? SHRT_MIN : v;
+}
+
+#ifdef __SSE2__
+/* noise() for four samples, one per lane of state. */
+static inline __m128i noise4(__m128i *state) {
+    const __m128i mask = _mm_set1_epi32(ONE - 1);
+    __m128i x = *state;
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    *state = x;
+    return _mm_sub_epi32(_mm_add_epi32(_mm_and_si128(x, mask),
+        _mm_and_si128(_mm_srli_epi32(x, 16), mask)), _mm_set1_epi32(ONE));
+}
+
+/* 8 halved samples to 16 bit, _mm_packs_epi32 saturates. */
+static inline __m128i to_s16_8(__m128i half0, __m128i half1, int dithered,
+        __m128i *state) {
+    const __m128i round = _mm_set1_epi32(ONE / 2);
+    if ( dithered ) {
+        half0 = _mm_add_epi32(half0, noise4(state));
+        half1 = _mm_add_epi32(half1, noise4(state));
+    }
+    half0 = _mm_srai_epi32(_mm_add_epi32(half0, round), SHIFT);
+    half1 = _mm_srai_epi32(_mm_add_epi32(half1, round), SHIFT);
+    return _mm_packs_epi32(half0, half1);
+}
+
+static inline __m128i load_half(const mad_fixed_t *src) {
+    return _mm_srai_epi32(_mm_loadu_si128((const __m128i *) src), 1);
+}
+
+/* The mono mix of two channels, halved. */
+static inline __m128i load_mix_half(const mad_fixed_t *left,
+        const mad_fixed_t *right) {
+    return _mm_add_epi32(
+        _mm_srai_epi32(_mm_loadu_si128((const __m128i *) left), 2),
+        _mm_srai_epi32(_mm_loadu_si128((const __m128i *) right), 2));
+}
+#endif
+
+void _mbx_pcm_convert(signed short *dst, unsigned channels,
+        const struct mad_pcm *pcm, struct _mbx_dither *dither) {
+    const mad_fixed_t *left = pcm->samples[0];
+    const mad_fixed_t *right = pcm->samples[pcm->channels == 2 ? 1 : 0];
+    int mix = channels == 1 && pcm->channels == 2;
+    int dithered = atomic_load_explicit(&use_dither, memory_order_relaxed);
+    unsigned i = 0, n = pcm->length;
+    signed short l, r;
+#ifdef __SSE2__
+    __m128i state = _mm_loadu_si128((const __m128i *) dither->state);
+    /* 8 frames per iteration */
+    for ( ; i + 8 <= n; i += 8 ) {
+        __m128i a, b;
+        if ( mix ) {
+            a = to_s16_8(load_mix_half(left + i, right + i),
+                load_mix_half(left + i + 4, right + i + 4), dithered, &state);
+        } else {
+            a = to_s16_8(load_half(left + i), load_half(left + i + 4),
+                dithered, &state);
+        }
+        if ( channels == 1 ) {
+            _mm_storeu_si128((__m128i *) (dst + i), a);
+            continue;
+        }
+        // A mono block is copied with the same dither on both channels.
+        b = pcm->channels == 2 ? to_s16_8(load_half(right + i),
+            load_half(right + i + 4), dithered, &state) : a;
+        _mm_storeu_si128((__m128i *) (dst + 2*i), _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i *) (dst + 2*i + 8), _mm_unpackhi_epi16(a, b));
+    }
+    _mm_storeu_si128((__m128i *) dither->state, state);
+#endif
+    for ( ; i < n; i++ ) {
+        l = to_s16(mix ? ( left[i] >> 2 ) + ( right[i] >> 2 ) : left[i] >> 1,
+            dithered ? noise(&dither->state[0]) : 0);
+        if ( channels == 1 ) {
+            dst[i] = l;
+            continue;
+        }
+        r = pcm->channels == 2 ? to_s16(right[i] >> 1,
+            dithered ? noise(&dither->state[0]) : 0) : l;
+        dst[2*i] = l;
+        dst[2*i+1] = r;
+    }
+}
+
+void _mbx_pcm_convert_float(signed short *dst, const float *src, size_t n,
+        float scale, struct _mbx_dither *dither) {
+    int dithered = atomic_load_explicit(&use_dither, memory_order_relaxed);
+    size_t i = 0;
+    float f;
+#ifdef __SSE2__
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 lsb = _mm_set1_ps(1.0f / ONE);
+    const __m128 hi = _mm_set1_ps(32767.0f);
+    const __m128 lo = _mm_set1_ps(-32768.0f);
+    __m128i state = _mm_loadu_si128((const __m128i *) dither->state);
+    /* 8 samples per iteration. Values are clamped before the conversion,
+     * which returns INT_MIN for values out of range. The conversion rounds
+     * to nearest (the default MXCSR rounding mode). */
+    for ( ; i + 8 <= n; i += 8 ) {
+        __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), s);
+        __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), s);
+        if ( dithered ) {
+            a = _mm_add_ps(a, _mm_mul_ps(_mm_cvtepi32_ps(noise4(&state)), lsb));
+            b = _mm_add_ps(b, _mm_mul_ps(_mm_cvtepi32_ps(noise4(&state)), lsb));
+        }
+        a = _mm_max_ps(_mm_min_ps(a, hi), lo);
+        b = _mm_max_ps(_mm_min_ps(b, hi), lo);
+        _mm_storeu_si128((__m128i *) (dst + i),
+            _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+    _mm_storeu_si128((__m128i *) dither->state, state);
+#endif
+    for ( ; i < n; i++ ) {
+        f = src[i] * scale;
+        if ( dithered ) {
+            f += (float) noise(&dither->state[0]) / ONE;
+        }
+        // Clamped like _mm_min_ps() and _mm_max_ps() above, which turn NaN
+        // into the upper limit.
+        if ( ! ( f < 32767.0f ) ) {
+            f = 32767.0f;
+        } else if ( f < -32768.0f ) {
+            f = -32768.0f;
+        }
+        dst[i] = lrintf(f);
+    }
+}
@@ -0,0 +1,45 @@
+#ifndef MBX_PCM_CONVERT_H
+#define MBX_PCM_CONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct mad_pcm;
+
+/******************************************************************************
+ * Conversion of the samples synthesized by libmad, and of the float samples
+ * of other decoders (see decoder.h), to the 16 bit samples of the tracks.
+ *
+ * A whole mad_pcm block is converted at a time, with SSE2 where available.
+ * Samples are rounded to the nearest 16 bit value and saturated. With dither
+ * enabled, triangular (TPDF) noise of up to one LSB is added before rounding.
+ * This replaces the truncation distortion of quiet passages, which is
+ * correlated with the signal, by a constant noise floor.
+ *****************************************************************************/
+
+/* The state of the noise generator of a decoder. It is not thread safe,
+ * each decoding thread has its own. */
+struct _mbx_dither {
+    uint32_t state[4];
+};
+
+extern void _mbx_dither_init(struct _mbx_dither *dither);
+
+/* Convert the pcm->length frames of pcm to interleaved frames with channels
+ * channels (1 or 2) in dst. A stereo block is mixed down to mono if
+ * channels is 1, a mono block is copied to both channels if channels is 2.
+ * dither is only used if dither is enabled, see
+ * _mbx_pcm_convert_set_dither(). */
+extern void _mbx_pcm_convert(signed short *dst, unsigned channels,
+        const struct mad_pcm *pcm, struct _mbx_dither *dither);
+
+/* Convert n float samples of src, multiplied by scale, to 16 bit samples
+ * in dst, e.g. with scale 32768 for samples between -1 and 1. Rounds,
+ * saturates, and dithers like _mbx_pcm_convert(). */
+extern void _mbx_pcm_convert_float(signed short *dst, const float *src,
+        size_t n, float scale, struct _mbx_dither *dither);
+
+/* Enable or disable dither for blocks converted from now on. */
+extern void _mbx_pcm_convert_set_dither(int enabled);
+
+#endif
@@ -1,12 +1,18 @@
 #include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <assert.h>
 #include <unistd.h>
+#include <stdatomic.h>
 #include "track.h"
-#include "mad_decoder.h"
+#include "pcm_buffer.h"
+#include "block_cache.h"
 #include "libmbx/common/log.h"
 #include "libmbx/common/xmalloc.h"
+#include "libmbx/core/mixer.h"
+#include "libmbx/core/varispeed.h"
+#include "libmbx/core/timestretch.h"
 
 // static error_code write_next_sample(audio_producer *,short *,size_t,short **);
 
@@ -20,70 +26,494 @@ enum state {
     TRACK_END_OF_MP3
 };
 
+/* Number of frames rendered with the same rate ramp. */
+#define VARISPEED_BLOCK 256
+
+/* Rates are limited to +/- MAX_RATE, which bounds the source frames read
+ * per block. */
+#define MAX_RATE 4
+#define SCRATCH_FRAMES ( VARISPEED_BLOCK * MAX_RATE + 2 * MBX_VARISPEED_PAD + 4 )
+
+/* Each block, the rate moves 1/RATE_SMOOTHING of the way to the target
+ * rate, i.e. a time constant of about 20 ms. */
+#define RATE_SMOOTHING 4
+
+/*
+ * A read head is written by the thread controlling the track (play, pause,
+ * seek, rate) and by the audio thread rendering it (advancing the position,
+ * reaching the end). The audio thread only commits a new position if it was
+ * not changed by a seek in the meantime.
+ */
+struct head {
+    atomic_int state;
+    atomic_llong phase; /* read position, 32.32 fixed point, see varispeed.h */
+    atomic_llong rate_target; /* 32.32 fixed point */
+    int64_t rate; /* smoothed rate, only used by the audio thread */
+    float *scratch; /* planar source frames for the interpolation */
+    struct _mbx_block_cache *cache; /* compressed tracks only, see below */
+    /* Key lock: the stretchers are created when a mode is selected first,
+     * and kept until the track is freed, such that switching modes while
+     * playing does not free memory the audio thread is using. */
+    atomic_int keylock;
+    struct _mbx_stretch *wsola;
+    struct _mbx_stretch *vocoder;
+    /* Only used by the audio thread: the mode and position the stretcher
+     * continues from. After a seek or a mode change, it is reset. */
+    int keylock_used;
+    int64_t stretch_phase;
+};
+
 struct _mbx_track {
-    enum state state;
-    sample_t *sample_data;
-    sample_t *current_pos_speaker;
-    sample_t *end_pos;
-    const char *filename;
+    unsigned channels; /* 1 for mono, 2 for interleaved stereo */
+    struct _mbx_pcm_buffer *buf; /* shared with other tracks of the same file */
+    const sample_t *sample_data; /* decoded audio data, or NULL if compressed */
+    size_t n_frames;
+    struct head heads[_MBX_TRACK_N_HEADS];
 };
 
-mbx_error_code _mbx_track_new(_mbx_track *track_p, const char *path) {
-    sample_t *data;
-    size_t length;
-    FILE *file;
+/* In compressed mode, each head has its own block cache, because the blocks
+ * decoded depend on where the head is. It is created when the head is used
+ * first, such that a cue head that is never used costs no memory. */
+static mbx_error_code prepare_head(_mbx_track track, struct head *head,
+        size_t pos) {
+    if ( track->sample_data != NULL || head->cache != NULL ) {
+        return MBX_SUCCESS;
+    }
+    return _mbx_block_cache_new(&head->cache, track->buf, pos);
+}
+
+/* Create a track over buf with the speaker head at phase. Takes over the
+ * reference. */
+static mbx_error_code new_track(_mbx_track *track_p,
+        struct _mbx_pcm_buffer *buf, int64_t phase) {
+    _mbx_track track;
+    mbx_error_code r;
+    int i;
+    track = _mbx_xmalloc(MBX_LOG_MP3LIB, sizeof(struct _mbx_track));
+    bzero(track, sizeof(struct _mbx_track));
+    track->buf = buf;
+    track->sample_data = buf->sample_data;
+    track->channels = buf->channels;
+    track->n_frames = buf->n_frames;
+    for ( i=0; i<_MBX_TRACK_N_HEADS; i++ ) {
+        atomic_init(&track->heads[i].state, TRACK_READY);
+        atomic_init(&track->heads[i].phase, 0);
+        atomic_init(&track->heads[i].rate_target, MBX_VARISPEED_ONE);
+        atomic_init(&track->heads[i].keylock, MBX_KEYLOCK_OFF);
+        track->heads[i].rate = MBX_VARISPEED_ONE;
+    }
+    atomic_init(&track->heads[MBX_TRACK_SPEAKER].phase, phase);
+    if ( ( r = prepare_head(track, &track->heads[MBX_TRACK_SPEAKER],
+            phase / MBX_VARISPEED_ONE) ) != MBX_SUCCESS ) {
+        _mbx_track_free(track);
+        return r;
+    }
+    *track_p = track;
+    return MBX_SUCCESS;
+}
+
+mbx_error_code _mbx_track_new(_mbx_track *track_p, const char *path,
+        int compressed, struct _mbx_load_progress *progress) {
+    struct _mbx_pcm_buffer *buf;
     mbx_error_code r;
-    if ( ( file = fopen(path, "r") ) == NULL ) {
-        return MBX_FAILED_TO_LOAD_MP3;
-    }
-    if ( ( r = mad_decode(file, &data, &length) ) != MBX_SUCCESS ) {
-        fclose(file);
-        return MBX_FAILED_TO_LOAD_MP3;
-    }
-    fclose(file);
-    *track_p = _mbx_xmalloc(sizeof(struct _mbx_track));
-    bzero(*track_p, sizeof(struct _mbx_track));
-    (*track_p)->sample_data = data;
-    (*track_p)->end_pos = data + length;
-    (*track_p)->current_pos_speaker = data;
-    (*track_p)->state = TRACK_READY;
+    if ( ( r = _mbx_pcm_buffer_get(&buf, path, compressed, progress) )
+            != MBX_SUCCESS ) {
+        return r;
+    }
+    return new_track(track_p, buf, 0);
+}
+
+mbx_error_code _mbx_track_double(_mbx_track *copy_p, _mbx_track track) {
+    struct head *head = &track->heads[MBX_TRACK_SPEAKER];
+    mbx_error_code r;
+    if ( ( r = new_track(copy_p, _mbx_pcm_buffer_ref(track->buf),
+            atomic_load(&head->phase)) ) != MBX_SUCCESS ) {
+        return r;
+    }
+    _mbx_track_set_rate(*copy_p, MBX_TRACK_SPEAKER,
+        (double) atomic_load(&head->rate_target) / MBX_VARISPEED_ONE);
+    _mbx_track_set_keylock(*copy_p, MBX_TRACK_SPEAKER,
+        atomic_load(&head->keylock));
     return MBX_SUCCESS;
 }
 
+void _mbx_track_sync(_mbx_track copy, _mbx_track track,
+        enum _mbx_track_head h) {
+    struct head *dst = &copy->heads[h], *src = &track->heads[h];
+    int keylock = atomic_load(&src->keylock);
+    if ( copy->buf != track->buf ) {
+        return;
+    }
+    atomic_store(&dst->phase, atomic_load(&src->phase));
+    atomic_store(&dst->rate_target, atomic_load(&src->rate_target));
+    dst->rate = src->rate;
+    // The stretchers cannot be created here. If the mode was changed since
+    // the copy was made, the copy keeps the mode it was made with.
+    if ( ( keylock != MBX_KEYLOCK_WSOLA || dst->wsola != NULL ) &&
+            ( keylock != MBX_KEYLOCK_PHASE_VOCODER || dst->vocoder != NULL ) ) {
+        atomic_store(&dst->keylock, keylock);
+    }
+    atomic_store(&dst->state, atomic_load(&src->state));
+}
+
 void _mbx_track_free(_mbx_track track) {
-    _mbx_xfree((void *) track->filename);
-    _mbx_xfree((void *) track->sample_data);
+    int i;
+    for ( i=0; i<_MBX_TRACK_N_HEADS; i++ ) {
+        if ( track->heads[i].cache != NULL ) {
+            _mbx_block_cache_free(track->heads[i].cache);
+        }
+        _mbx_xfree(track->heads[i].scratch);
+        if ( track->heads[i].wsola != NULL ) {
+            _mbx_stretch_free(track->heads[i].wsola);
+        }
+        if ( track->heads[i].vocoder != NULL ) {
+            _mbx_stretch_free(track->heads[i].vocoder);
+        }
+    }
+    _mbx_pcm_buffer_unref(track->buf);
     bzero(track, sizeof(struct _mbx_track));
     _mbx_xfree(track);
 }
 
-void _mbx_track_play(_mbx_track track) {
-    track->state = TRACK_PLAYING;
+mbx_error_code _mbx_track_play(_mbx_track track, enum _mbx_track_head h) {
+    struct head *head = &track->heads[h];
+    mbx_error_code r;
+    if ( ( r = prepare_head(track, head,
+            _mbx_track_get_position(track, h)) ) != MBX_SUCCESS ) {
+        return r;
+    }
+    atomic_store(&head->state, TRACK_PLAYING);
+    return MBX_SUCCESS;
+}
+
+void _mbx_track_pause(_mbx_track track, enum _mbx_track_head h) {
+    atomic_store(&track->heads[h].state, TRACK_READY);
+}
+
+int _mbx_track_is_playing(_mbx_track track, enum _mbx_track_head h) {
+    return atomic_load_explicit(&track->heads[h].state,
+        memory_order_relaxed) == TRACK_PLAYING;
+}
+
+mbx_error_code _mbx_track_seek(_mbx_track track, enum _mbx_track_head h,
+        size_t pos) {
+    struct head *head = &track->heads[h];
+    int state = TRACK_END_OF_MP3;
+    mbx_error_code r;
+    if ( pos > track->n_frames ) {
+        pos = track->n_frames;
+    }
+    if ( ( r = prepare_head(track, head, pos) ) != MBX_SUCCESS ) {
+        return r;
+    }
+    atomic_store(&head->phase, (int64_t) pos * MBX_VARISPEED_ONE);
+    // A head that ran off the end can be played again.
+    atomic_compare_exchange_strong(&head->state, &state, TRACK_READY);
+    return MBX_SUCCESS;
+}
+
+size_t _mbx_track_get_position(_mbx_track track, enum _mbx_track_head h) {
+    int64_t phase = atomic_load_explicit(&track->heads[h].phase,
+        memory_order_relaxed);
+    return phase < 0 ? 0 : phase / MBX_VARISPEED_ONE;
+}
+
+void _mbx_track_set_keylock(_mbx_track track, enum _mbx_track_head h,
+        mbx_keylock keylock) {
+    struct head *head = &track->heads[h];
+    if ( keylock == MBX_KEYLOCK_WSOLA && head->wsola == NULL ) {
+        head->wsola = _mbx_stretch_new(MBX_KEYLOCK_WSOLA);
+    }
+    if ( keylock == MBX_KEYLOCK_PHASE_VOCODER && head->vocoder == NULL ) {
+        head->vocoder = _mbx_stretch_new(MBX_KEYLOCK_PHASE_VOCODER);
+    }
+    /* The governor may fall back from the phase vocoder to WSOLA at any
+     * time, see _mbx_stretch_limit(). */
+    if ( keylock == MBX_KEYLOCK_PHASE_VOCODER && head->wsola == NULL ) {
+        head->wsola = _mbx_stretch_new(MBX_KEYLOCK_WSOLA);
+    }
+    atomic_store(&head->keylock, keylock);
+}
+
+void _mbx_track_set_rate(_mbx_track track, enum _mbx_track_head h,
+        double rate) {
+    struct head *head = &track->heads[h];
+    if ( head->scratch == NULL ) {
+        head->scratch = _mbx_xmalloc(MBX_LOG_MP3LIB,
+            2 * SCRATCH_FRAMES * sizeof(float));
+    }
+    if ( rate > MAX_RATE ) {
+        rate = MAX_RATE;
+    }
+    if ( rate < -MAX_RATE ) {
+        rate = -MAX_RATE;
+    }
+    atomic_store(&head->rate_target, (int64_t) ( rate * MBX_VARISPEED_ONE ));
+}
+
+size_t _mbx_track_get_n_frames(_mbx_track track) {
+    return track->n_frames;
 }
 
-void _mbx_track_pause(_mbx_track track) {
-    track->state = TRACK_READY;
+size_t _mbx_track_get_resident_bytes(_mbx_track track) {
+    size_t bytes = _mbx_pcm_buffer_get_resident_bytes(track->buf);
+    int i;
+    for ( i=0; i<_MBX_TRACK_N_HEADS; i++ ) {
+        if ( track->heads[i].cache != NULL ) {
+            bytes += _mbx_block_cache_get_resident_bytes(track->heads[i].cache);
+        }
+    }
+    return bytes;
 }
 
-int _mbx_track_is_playing(_mbx_track track) {
-    return track->state == TRACK_PLAYING;
+unsigned _mbx_track_get_channels(_mbx_track track) {
+    return track->channels;
+}
+
+const sample_t *_mbx_track_get_sample_data(_mbx_track track) {
+    return track->sample_data;
+}
+
+static void mix(_mbx_track track, float *dst, const sample_t *src,
+        size_t n_frames, const struct _mbx_gain *gain) {
+    if ( track->channels == 1 ) {
+        _mbx_mix_mono(dst, src, n_frames, gain);
+    }
+    else {
+        _mbx_mix_stereo(dst, src, n_frames, gain);
+    }
 }
 
-void _mbx_track_get_next_sample(_mbx_track track, sample_t *left, sample_t *right) {
-    if ( track->state != TRACK_PLAYING ) {
-        *left = *right = 0;
+/* Mix n_frames at normal speed, starting at frame pos. */
+static void mix_direct(_mbx_track track, struct head *head, float *dst,
+        size_t pos, size_t n_frames, const struct _mbx_gain *gain) {
+    struct _mbx_gain g = *gain;
+    size_t n_done = 0;
+    if ( head->cache == NULL ) {
+        mix(track, dst, track->sample_data + pos * track->channels,
+            n_frames, gain);
+        return;
     }
-    else if ( track->current_pos_speaker >= track->end_pos ) {
-        if ( track->state != TRACK_END_OF_MP3 ) {
-            mbx_log_debug(MBX_LOG_MP3LIB, "Reached end of file. Stopping.");
-            track->state = TRACK_END_OF_MP3;
+    /* In compressed mode, the audio data is read block by block. A block
+     * that is not decoded in time is played as silence, such that the
+     * track keeps its timing. */
+    while ( n_done < n_frames ) {
+        size_t n;
+        const sample_t *src = _mbx_block_cache_get(head->cache,
+            pos + n_done, &n);
+        if ( n > n_frames - n_done ) {
+            n = n_frames - n_done;
+        }
+        if ( src != NULL ) {
+            mix(track, dst + 2 * n_done, src, n, &g);
+        }
+        _mbx_gain_advance(&g, n);
+        n_done += n;
+    }
+}
+
+static void to_float(const sample_t *src, unsigned channels, size_t n,
+        float *left, float *right) {
+    size_t i;
+    if ( channels == 1 ) {
+        for ( i=0; i<n; i++ ) {
+            left[i] = src[i];
         }
     }
     else {
-        *left = *track->current_pos_speaker;
-        track->current_pos_speaker += 1;
-        *right = *track->current_pos_speaker;
-        track->current_pos_speaker += 1;
+        for ( i=0; i<n; i++ ) {
+            left[i] = src[2*i];
+            right[i] = src[2*i+1];
+        }
     }
 }
 
+/* Convert count frames starting at frame first (which may be negative) to
+ * planar float. Frames outside of the track are silent. */
+static void fetch(_mbx_track track, struct head *head, int64_t first,
+        size_t count, float *left, float *right) {
+    size_t i = 0;
+    while ( i < count ) {
+        int64_t pos = first + (int64_t) i;
+        size_t n = count - i;
+        if ( pos < 0 || pos >= (int64_t) track->n_frames ) {
+            if ( pos < 0 && n > (size_t) -pos ) {
+                n = -pos;
+            }
+            memset(left + i, 0, n * sizeof(float));
+            memset(right + i, 0, n * sizeof(float));
+        }
+        else {
+            const sample_t *src;
+            if ( n > track->n_frames - pos ) {
+                n = track->n_frames - pos;
+            }
+            if ( head->cache == NULL ) {
+                src = track->sample_data + pos * track->channels;
+            }
+            else {
+                size_t n_block;
+                src = _mbx_block_cache_get(head->cache, pos, &n_block);
+                if ( n > n_block ) {
+                    n = n_block;
+                }
+            }
+            if ( src != NULL ) {
+                to_float(src, track->channels, n, left + i, right + i);
+            }
+            else {
+                memset(left + i, 0, n * sizeof(float));
+                memset(right + i, 0, n * sizeof(float));
+            }
+        }
+        i += n;
+    }
+}
+
+/* Mix *n_frames at a variable rate, starting at phase. Returns the new
+ * phase. If the head ran off the track in either direction, *end is set and
+ * *n_frames is reduced to the frames mixed. */
+static int64_t mix_varispeed(_mbx_track track, struct head *head, float *dst,
+        int64_t phase, int64_t target, size_t *n_frames,
+        const struct _mbx_gain *gain, int *end) {
+    const int64_t length = (int64_t) track->n_frames * MBX_VARISPEED_ONE;
+    mbx_interpolation interpolation = _mbx_varispeed_get_interpolation();
+    float *left = head->scratch, *right = head->scratch + SCRATCH_FRAMES;
+    struct _mbx_gain g = *gain;
+    size_t done = 0;
+    while ( done < *n_frames ) {
+        size_t n = *n_frames - done;
+        int64_t rate = head->rate, new_rate, dinc, next, lo, hi, first;
+        if ( n > VARISPEED_BLOCK ) {
+            n = VARISPEED_BLOCK;
+        }
+        // Smooth the rate per block, and ramp it linearly within the block.
+        new_rate = rate + ( target - rate ) / RATE_SMOOTHING;
+        if ( llabs(target - new_rate) < ( MBX_VARISPEED_ONE >> 16 ) ) {
+            new_rate = target;
+        }
+        dinc = ( new_rate - rate ) / (int64_t) n;
+        next = _mbx_varispeed_advance(phase, rate, dinc, n);
+        // Convert the source frames needed for this block.
+        lo = ( phase < next ? phase : next ) >> 32;
+        hi = ( phase < next ? next : phase ) >> 32;
+        first = lo - MBX_VARISPEED_PAD;
+        fetch(track, head, first, hi - lo + 2 * MBX_VARISPEED_PAD + 2, left, right);
+        _mbx_varispeed_mix(dst + 2 * done, left,
+            track->channels == 2 ? right : NULL,
+            phase - first * MBX_VARISPEED_ONE, rate, dinc, n, interpolation,
+            &g);
+        _mbx_gain_advance(&g, n);
+        head->rate = new_rate;
+        phase = next;
+        done += n;
+        if ( phase >= length || phase < 0 ) {
+            phase = phase < 0 ? 0 : length;
+            *n_frames = done;
+            *end = 1;
+            break;
+        }
+    }
+    return phase;
+}
+
+struct fetch_args {
+    _mbx_track track;
+    struct head *head;
+};
+
+static void stretch_fetch(void *userdata, int64_t first, size_t n,
+        float *left, float *right) {
+    struct fetch_args *args = userdata;
+    fetch(args->track, args->head, first, n, left, right);
+    if ( args->track->channels == 1 ) {
+        memcpy(right, left, n * sizeof(float));
+    }
+}
+
+/* Mix *n_frames with key lock, starting at phase. Like mix_varispeed(),
+ * except that the rate changes the tempo, but not the pitch. */
+static int64_t mix_stretched(_mbx_track track, struct head *head, float *dst,
+        int64_t phase, int64_t target, int keylock, size_t *n_frames,
+        const struct _mbx_gain *gain, int *end) {
+    struct _mbx_stretch *stretch =
+        keylock == MBX_KEYLOCK_WSOLA ? head->wsola : head->vocoder;
+    struct fetch_args args = { track, head };
+    struct _mbx_gain g = *gain;
+    size_t done = 0;
+    if ( keylock != head->keylock_used || phase != head->stretch_phase ) {
+        _mbx_stretch_reset(stretch, phase);
+        head->keylock_used = keylock;
+    }
+    while ( done < *n_frames ) {
+        size_t n = *n_frames - done, requested;
+        int64_t new_rate = head->rate + ( target - head->rate ) / RATE_SMOOTHING;
+        if ( llabs(target - new_rate) < ( MBX_VARISPEED_ONE >> 16 ) ) {
+            new_rate = target;
+        }
+        if ( n > VARISPEED_BLOCK ) {
+            n = VARISPEED_BLOCK;
+        }
+        requested = n;
+        head->rate = new_rate;
+        phase = _mbx_stretch_process(stretch, dst + 2 * done, &n,
+            new_rate > 0 ? new_rate : 0, track->n_frames, stretch_fetch,
+            &args, &g);
+        _mbx_gain_advance(&g, n);
+        done += n;
+        if ( n < requested ) {
+            *n_frames = done;
+            *end = 1;
+            break;
+        }
+    }
+    head->stretch_phase = phase;
+    return phase;
+}
+
+size_t _mbx_track_mix(_mbx_track track, enum _mbx_track_head h, float *dst,
+        size_t n_frames, const struct _mbx_gain *gain) {
+    struct head *head = &track->heads[h];
+    int64_t phase = atomic_load_explicit(&head->phase, memory_order_relaxed);
+    int64_t target = atomic_load_explicit(&head->rate_target,
+        memory_order_acquire); /* pairs with the scratch allocation */
+    int keylock = _mbx_stretch_limit(
+        atomic_load_explicit(&head->keylock, memory_order_acquire));
+    int64_t next;
+    int end = 0;
+    if ( atomic_load_explicit(&head->state, memory_order_relaxed) != TRACK_PLAYING ) {
+        /* A paused head starts right away at the new rate. */
+        head->rate = target;
+        return 0;
+    }
+    if ( target == MBX_VARISPEED_ONE && head->rate == MBX_VARISPEED_ONE ) {
+        /* Normal speed: no interpolation needed, and nothing to stretch
+         * with key lock. After a rate change, the head snaps to the nearest
+         * frame, which shifts it by less than half a frame. */
+        size_t pos = ( phase + MBX_VARISPEED_ONE / 2 ) / MBX_VARISPEED_ONE;
+        if ( pos > track->n_frames ) {
+            pos = track->n_frames;
+        }
+        if ( n_frames >= track->n_frames - pos ) {
+            /* No logging here, this runs in the audio thread (see rt_check.h) */
+            n_frames = track->n_frames - pos;
+            end = 1;
+        }
+        mix_direct(track, head, dst, pos, n_frames, gain);
+        next = (int64_t) ( pos + n_frames ) * MBX_VARISPEED_ONE;
+    }
+    else if ( keylock != MBX_KEYLOCK_OFF && target > 0 ) {
+        /* Reverse play and scratching are not time-stretched. */
+        next = mix_stretched(track, head, dst, phase, target, keylock,
+            &n_frames, gain, &end);
+    }
+    else {
+        next = mix_varispeed(track, head, dst, phase, target, &n_frames,
+            gain, &end);
+    }
+    if ( atomic_compare_exchange_strong(&head->phase, &phase, next) && end ) {
+        int state = TRACK_PLAYING;
+        atomic_compare_exchange_strong(&head->state, &state, TRACK_END_OF_MP3);
+    }
+    return n_frames;
+}
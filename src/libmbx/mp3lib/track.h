@@ -5,23 +5,98 @@
 #include <stdlib.h>
 #include "libmbx/common/mbx_errno.h"
 #include "libmbx/out/audio_output.h" /* defines sample_t */
+#include "libmbx/core/keylock.h"
+#include "libmbx/core/mixer.h"
+
+struct _mbx_load_progress; /* see pcm_buffer.h */
 
 /**
- * A #_mbx_track represents an MP3 file.
+ * A #_mbx_track plays the audio data of an MP3 file.
+ *
+ * Tracks of the same file share the audio data, see pcm_buffer.h. Each track
+ * has independent read heads (see #_mbx_track_head) with their own position
+ * and play/pause state, such that a part of the track can be pre-listened on
+ * the headphones while another part is playing on the speakers.
  */
 typedef struct _mbx_track *_mbx_track;
 
+/**
+ * The read heads of a #_mbx_track.
+ */
+enum _mbx_track_head {
+    /** The head playing on the speakers */
+    MBX_TRACK_SPEAKER,
+    /** The head for pre-listening on the headphones */
+    MBX_TRACK_CUE,
+    /** Number of heads, not a head itself */
+    _MBX_TRACK_N_HEADS
+};
+
 /**
  * Allocate a new #_mbx_track, and initialize it with the audio data from an
  * MP3 file. The #_mbx_track must be freed with _mbx_track_free().
  *
+ * If the file is already loaded in the same mode, the track shares the audio
+ * data with the tracks that are loaded. Otherwise, the whole file is decoded
+ * when it is loaded by default. In compressed
+ * mode, only the MP3 data is kept in memory, and it is decoded block by
+ * block during playback, see block_cache.h. This needs about a tenth of the
+ * memory.
+ *
  * @param  track
  *         A pointer to the newly created #_mbx_track is put here.
  * @param  path
  *         The path to the MP3 file to be loaded.
- * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3
+ * @param  compressed
+ *         <tt>1</tt> to keep the track compressed in memory, <tt>0</tt> to
+ *         decode it completely.
+ * @param  progress
+ *         Updated while the file is read, see pcm_buffer.h. May be
+ *         <tt>NULL</tt>.
+ * @return #MBX_SUCCESS, #MBX_FAILED_TO_LOAD_MP3, #MBX_OUT_OF_MEMORY if the
+ *         memory limit for decoded audio data would be exceeded,
+ *         #MBX_LOAD_CANCELLED if <tt>progress->cancel</tt> was set.
  */
-extern mbx_error_code _mbx_track_new(_mbx_track *track, const char *path);
+extern mbx_error_code _mbx_track_new(_mbx_track *track, const char *path,
+        int compressed, struct _mbx_load_progress *progress);
+
+/**
+ * Allocate a new #_mbx_track reading the same audio data as track. The
+ * speaker head of the copy starts at the position of the speaker head of
+ * track, with the same rate and key lock mode, but does not play. The cue
+ * head starts at the beginning. To start the copy in sync, the audio thread
+ * calls _mbx_track_sync().
+ *
+ * This takes a reference to the shared audio data, and does not decode
+ * anything unless the track is compressed. The copy must be freed with
+ * _mbx_track_free().
+ *
+ * @param  copy
+ *         A pointer to the newly created #_mbx_track is put here.
+ * @param  track
+ *         The track to be copied.
+ * @return #MBX_SUCCESS, #MBX_OUT_OF_MEMORY if the track is compressed and
+ *         the memory limit for decoded blocks would be exceeded.
+ */
+extern mbx_error_code _mbx_track_double(_mbx_track *copy, _mbx_track track);
+
+/**
+ * Set a read head of copy to the position, rate and state of the same head
+ * of track, such that both play the same frames from now on.
+ *
+ * This function is called by the audio thread rendering the head, between
+ * two calls to _mbx_track_mix(), and does not allocate memory. Nothing
+ * happens if the tracks do not read the same audio data.
+ *
+ * @param  copy
+ *         The copy
+ * @param  track
+ *         The #_mbx_track that was copied.
+ * @param  head
+ *         The read head.
+ */
+extern void _mbx_track_sync(_mbx_track copy, _mbx_track track,
+        enum _mbx_track_head head);
 
 /**
  * Free an #_mbx_track
@@ -35,51 +110,184 @@ extern void _mbx_track_free(_mbx_track track);
  * Start playing, or resume playing at the current position.
  *
  * This function is called by the #mbx_ctrl. The function just sets a flag,
- * such that consecutive calles to _mbx_track_get_next_sample() will return
- * audio data.
+ * such that consecutive calles to _mbx_track_mix() will add audio data to
+ * the mix bus.
  *
  * @param  track
  *         The #_mbx_track that should start playing.
+ * @param  head
+ *         The read head that should start playing.
+ * @return #MBX_SUCCESS, #MBX_OUT_OF_MEMORY if the track is compressed, the
+ *         head is used for the first time, and the memory limit for decoded
+ *         blocks would be exceeded.
  */
-extern void _mbx_track_play(_mbx_track track);
+extern mbx_error_code _mbx_track_play(_mbx_track track,
+        enum _mbx_track_head head);
 
 /**
  * Pause playing at the current position.
  *
  * This function is called by the #mbx_ctrl. The function just removes a flag,
- * such that consecutive calles to _mbx_track_get_next_sample() will no longer
- * return audio data.
+ * such that consecutive calles to _mbx_track_mix() will no longer add
+ * audio data to the mix bus.
  *
  * @param  track
  *         The #_mbx_track that should pause playing.
+ * @param  head
+ *         The read head that should pause playing.
  */
-extern void _mbx_track_pause(_mbx_track track);
+extern void _mbx_track_pause(_mbx_track track, enum _mbx_track_head head);
 
 /**
- * Check if the producer is playing.
+ * Check if a read head is playing.
  *
- * If true, then _mbx_track_get_next_sample() will return audio data. If false,
- * then _mbx_track_get_next_sample() will return zeros.
+ * If true, then _mbx_track_mix() will add audio data to the mix bus. If
+ * false, then _mbx_track_mix() will leave the mix bus unchanged.
  *
  * @param  track
  *         The #_mbx_track, that should be checked.
- * @return <tt>1</tt> if the track is playing, <tt>0</tt> otherwise.
+ * @param  head
+ *         The read head, that should be checked.
+ * @return <tt>1</tt> if the head is playing, <tt>0</tt> otherwise.
+ */
+extern int _mbx_track_is_playing(_mbx_track track, enum _mbx_track_head head);
+
+/**
+ * Move a read head to a new position.
+ *
+ * The head keeps playing if it is playing. A head that reached the end of
+ * the track can be played again after it was moved.
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @param  head
+ *         The read head to be moved.
+ * @param  pos
+ *         The new position in frames. Positions after the end of the track
+ *         are moved to the end.
+ * @return #MBX_SUCCESS, #MBX_OUT_OF_MEMORY, see _mbx_track_play().
  */
-extern int _mbx_track_is_playing(_mbx_track track);
+extern mbx_error_code _mbx_track_seek(_mbx_track track,
+        enum _mbx_track_head head, size_t pos);
 
 /**
- * This function is called by #mbx_ctrl in order to get the next audio samples
- * to be played.
+ * Get the position of a read head.
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @param  head
+ *         The read head.
+ * @return The position in frames.
+ */
+extern size_t _mbx_track_get_position(_mbx_track track,
+        enum _mbx_track_head head);
+
+/**
+ * Set the playback rate of a read head.
+ *
+ * The rate is approached smoothly within a few milliseconds, such that
+ * pitch bends, nudges and scratches do not click. At rates other than 1,
+ * the audio data is interpolated as selected with
+ * _mbx_varispeed_set_interpolation().
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @param  head
+ *         The read head.
+ * @param  rate
+ *         <tt>1</tt> for normal speed, negative rates play in reverse.
+ *         Rates are limited to <tt>-4</tt> ... <tt>4</tt>.
+ */
+extern void _mbx_track_set_rate(_mbx_track track, enum _mbx_track_head head,
+        double rate);
+
+/**
+ * Select whether a read head keeps the pitch when its rate changes.
+ *
+ * With key lock, positive rates change the tempo only: the audio data is
+ * time-stretched with the selected algorithm. At a rate of exactly 1, and
+ * at rates of 0 and below, the audio is played as without key lock, such
+ * that normal speed costs nothing and scratching sounds as usual.
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @param  head
+ *         The read head.
+ * @param  keylock
+ *         The time-stretching algorithm, or #MBX_KEYLOCK_OFF.
+ */
+extern void _mbx_track_set_keylock(_mbx_track track,
+        enum _mbx_track_head head, mbx_keylock keylock);
+
+/**
+ * Get the length of the track.
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @return The number of frames (one sample per channel).
+ */
+extern size_t _mbx_track_get_n_frames(_mbx_track track);
+
+/**
+ * Get the size of the audio data held in memory.
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @return The number of bytes of decoded audio data, or in compressed mode,
+ *         of MP3 data and decoded blocks. Audio data shared with other
+ *         tracks is included.
+ */
+extern size_t _mbx_track_get_resident_bytes(_mbx_track track);
+
+/**
+ * Get the number of channels the audio data is stored with.
+ *
+ * Mono MP3 files are kept mono in memory, they are panned to both output
+ * channels by _mbx_track_mix().
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @return <tt>1</tt> for mono tracks, <tt>2</tt> for stereo tracks.
+ */
+extern unsigned _mbx_track_get_channels(_mbx_track track);
+
+/**
+ * Get the decoded audio data of the track.
+ *
+ * The data is shared with other tracks of the same file, and must not be
+ * modified. It is valid until the track is freed.
+ *
+ * @param  track
+ *         The #_mbx_track
+ * @return The interleaved frames (see _mbx_track_get_channels()), or
+ *         <tt>NULL</tt> if the track is kept compressed.
+ */
+extern const sample_t *_mbx_track_get_sample_data(_mbx_track track);
+
+/**
+ * This function is called by #mbx_ctrl in order to add the next audio frames
+ * to be played to the mix bus (see mixer.h).
+ *
+ * If the head is not playing, the mix bus is left unchanged. If the end of
+ * the track is reached, less than n_frames are added.
  *
- * If the track is not playing, zeros are returned.
+ * Different heads may be rendered by different threads, but each head must
+ * be rendered by one thread only.
  *
  * @param   track
- *          The track whose audio samples are requested.
- * @param   left
- *          The next audio sample for the left stereo channel will be put here.
- * @param   right
- *          The next audio sample for the right stereo channel will be put here.
+ *          The track whose audio frames are requested.
+ * @param   head
+ *          The read head to be rendered. Its position is advanced.
+ * @param   dst
+ *          The mix bus, n_frames interleaved stereo float frames.
+ * @param   n_frames
+ *          The number of stereo frames requested.
+ * @param   gain
+ *          The gain applied to the output channels, ramping across the
+ *          n_frames, see mixer.h.
+ * @return  The number of frames added to the mix bus.
  */
-extern void _mbx_track_get_next_sample(_mbx_track track, sample_t *left, sample_t *right);
+extern size_t _mbx_track_mix(_mbx_track track, enum _mbx_track_head head,
+        float *dst, size_t n_frames, const struct _mbx_gain *gain);
 
 #endif
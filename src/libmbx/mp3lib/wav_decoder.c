@@ -0,0 +1,203 @@
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "decoder.h"
+#include "pcm_arena.h"
+#include "pcm_convert.h"
+#include "libmbx/common/log.h"
+#include "libmbx/common/xmalloc.h"
+
+/* WAV files are a list of RIFF chunks. The "fmt " chunk describes the
+ * samples, which are stored in the "data" chunk. Integer samples with 16 or
+ * 24 bits and float samples with 32 bits are supported, mono or stereo.
+ * All values are little endian, like the x86-64 host the build targets, so
+ * 16 bit and float samples are read as they are. */
+
+#define FORMAT_PCM 1
+#define FORMAT_FLOAT 3
+#define FORMAT_EXTENSIBLE 0xfffe
+
+/* Samples converted at a time. Cancelling is checked after each block. */
+#define BLOCK_SAMPLES 65536
+
+struct format {
+    unsigned tag;
+    unsigned channels;
+    unsigned rate;
+    unsigned bits;
+};
+
+static unsigned le16(const unsigned char *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t le32(const unsigned char *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static int wav_probe(const unsigned char *head, size_t n) {
+    return n >= 12 && ! memcmp(head, "RIFF", 4)
+        && ! memcmp(head + 8, "WAVE", 4);
+}
+
+/* Skip the rest of a chunk, chunks are padded to an even size. */
+static int skip(FILE *file, uint32_t n) {
+    return fseek(file, (long) n, SEEK_CUR) == 0;
+}
+
+static int read_format(FILE *file, uint32_t size, struct format *fmt) {
+    unsigned char b[40];
+    size_t n = size < sizeof(b) ? size : sizeof(b);
+    if ( size < 16 || fread(b, 1, n, file) != n ) {
+        return 0;
+    }
+    fmt->tag = le16(b);
+    fmt->channels = le16(b + 2);
+    fmt->rate = le32(b + 4);
+    fmt->bits = le16(b + 14);
+    // The format of an extensible file is in the first two bytes of the
+    // sub-format GUID.
+    if ( fmt->tag == FORMAT_EXTENSIBLE && n >= 26 ) {
+        fmt->tag = le16(b + 24);
+    }
+    return skip(file, size - n + ( size & 1 ));
+}
+
+/* Find the data chunk, and return its size, limited to the rest of the
+ * file. Returns 0 if there is no valid format or data chunk. */
+static uint32_t find_data(FILE *file, struct format *fmt) {
+    unsigned char b[12];
+    struct stat st;
+    uint32_t size;
+    long pos;
+    if ( fread(b, 1, 12, file) != 12 || ! wav_probe(b, 12) ) {
+        return 0;
+    }
+    for ( ;; ) {
+        if ( fread(b, 1, 8, file) != 8 ) {
+            mbx_log_error(MBX_LOG_MP3LIB, "wav-decoder: no data chunk");
+            return 0;
+        }
+        size = le32(b + 4);
+        if ( ! memcmp(b, "data", 4) ) {
+            break;
+        }
+        if ( ! memcmp(b, "fmt ", 4) ? ! read_format(file, size, fmt)
+                : ! skip(file, size + ( size & 1 )) ) {
+            mbx_log_error(MBX_LOG_MP3LIB, "wav-decoder: truncated chunk");
+            return 0;
+        }
+    }
+    // Files written while recording may have no valid data size.
+    if ( fstat(fileno(file), &st) == 0 && ( pos = ftell(file) ) >= 0
+            && (off_t) size > st.st_size - pos ) {
+        size = st.st_size - pos;
+    }
+    return size;
+}
+
+static int supported(const struct format *fmt) {
+    if ( fmt->channels != 1 && fmt->channels != 2 ) {
+        return 0;
+    }
+    return ( fmt->tag == FORMAT_PCM && ( fmt->bits == 16 || fmt->bits == 24 ) )
+        || ( fmt->tag == FORMAT_FLOAT && fmt->bits == 32 );
+}
+
+static mbx_error_code wav_decode(FILE *file, signed short **output,
+        size_t *n_samples, unsigned *channels,
+        struct _mbx_load_progress *progress) {
+    struct format fmt = { 0, 0, 0, 0 };
+    struct _mbx_dither dither;
+    unsigned char *raw;
+    float *block;
+    size_t bytes, n, done, count, i;
+    uint32_t size;
+    mbx_error_code r = MBX_SUCCESS;
+    *output = NULL;
+    *n_samples = 0;
+    if ( ( size = find_data(file, &fmt) ) == 0 ) {
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    if ( ! supported(&fmt) ) {
+        mbx_log_error(MBX_LOG_MP3LIB, "wav-decoder: unsupported format %u "
+            "with %u bits and %u channels", fmt.tag, fmt.bits, fmt.channels);
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    if ( fmt.rate != MBX_SAMPLE_RATE ) {
+        mbx_log_warn(MBX_LOG_MP3LIB, "wav-decoder: %u Hz file is played at "
+            "%d Hz", fmt.rate, MBX_SAMPLE_RATE);
+    }
+    bytes = fmt.bits / 8;
+    n = size / bytes / fmt.channels * fmt.channels;
+    if ( n == 0 ) {
+        mbx_log_error(MBX_LOG_MP3LIB, "wav-decoder: no samples");
+        return MBX_FAILED_TO_LOAD_MP3;
+    }
+    // The size is known, so the buffer is allocated once.
+    if ( ( *output = _mbx_pcm_arena_alloc(n * sizeof(signed short)) )
+            == NULL ) {
+        mbx_log_error(MBX_LOG_MP3LIB, "wav-decoder: memory limit exceeded");
+        return MBX_OUT_OF_MEMORY;
+    }
+    raw = _mbx_xmalloc(MBX_LOG_MP3LIB, BLOCK_SAMPLES * bytes);
+    block = _mbx_xmalloc(MBX_LOG_MP3LIB, BLOCK_SAMPLES * sizeof(float));
+    _mbx_dither_init(&dither);
+    for ( done = 0; done < n; done += count ) {
+        count = n - done < BLOCK_SAMPLES ? n - done : BLOCK_SAMPLES;
+        if ( fmt.bits == 16 ) {
+            count = fread(*output + done, bytes, count, file);
+        } else if ( fmt.bits == 32 ) {
+            count = fread(block, bytes, count, file);
+            _mbx_pcm_convert_float(*output + done, block, count, 32768.0f,
+                &dither);
+        } else {
+            count = fread(raw, bytes, count, file);
+            for ( i=0; i<count; i++ ) {
+                // Sign extend to 32 bit.
+                block[i] = (int32_t) ( (uint32_t) raw[3*i] << 8
+                    | (uint32_t) raw[3*i+1] << 16
+                    | (uint32_t) raw[3*i+2] << 24 ) >> 8;
+            }
+            _mbx_pcm_convert_float(*output + done, block, count,
+                1.0f / 256, &dither);
+        }
+        if ( progress != NULL ) {
+            atomic_fetch_add(&progress->bytes_read, count * bytes);
+            if ( atomic_load(&progress->cancel) ) {
+                mbx_log_debug(MBX_LOG_MP3LIB, "wav-decoder: cancelled");
+                r = MBX_LOAD_CANCELLED;
+                break;
+            }
+        }
+        if ( count == 0 ) {
+            if ( ferror(file) ) {
+                mbx_log_error(MBX_LOG_MP3LIB, "wav-decoder: read error");
+                r = MBX_FAILED_TO_LOAD_MP3;
+            }
+            break;
+        }
+    }
+    _mbx_xfree(raw);
+    _mbx_xfree(block);
+    // A short read leaves a partial frame at the end.
+    *n_samples = done / fmt.channels * fmt.channels;
+    if ( r == MBX_SUCCESS && *n_samples == 0 ) {
+        r = MBX_FAILED_TO_LOAD_MP3;
+    }
+    if ( r != MBX_SUCCESS ) {
+        _mbx_pcm_arena_free(*output);
+        *output = NULL;
+        *n_samples = 0;
+        return r;
+    }
+    *channels = fmt.channels;
+    return MBX_SUCCESS;
+}
+
+const struct _mbx_decoder _mbx_wav_decoder = {
+    "wav",
+    wav_probe,
+    wav_decode,
+    0
+};
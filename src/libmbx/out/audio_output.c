@@ -1,9 +1,13 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <pulse/pulseaudio.h>
 #include "audio_output.h"
 #include "audio_output.h"
+#include "libmbx/common/histogram.h"
+#include "libmbx/common/rt_check.h"
 #include "log_context_state.h"
 #include "libmbx/common/log.h"
 #include "libmbx/common/xmalloc.h"
@@ -17,13 +21,16 @@ static void stream_drain_complete_cb(pa_stream*, int, void *);
 static void context_drain_complete_cb(pa_context *, void *);
 /* helper functions */
 static const char *pa_msg(_mbx_out);
-static pa_buffer_attr make_bufattr();
+static pa_buffer_attr make_bufattr(_mbx_out out);
 static void context_ready(_mbx_out out);
-static void malloc_and_init(_mbx_out *out_p, const char *, const char *, _mbx_out_cb cb, void *userdata);
+static void malloc_and_init(_mbx_out *out_p, const char *, const char *,
+        size_t latency_frames, _mbx_out_cb cb, void *userdata);
 static void unset_all_callbacks(_mbx_out out);
 static void do_free_audio_output(_mbx_out out);
 static void do_shutdown(_mbx_out out);
 static mbx_error_code init_pulseaudio(_mbx_out out);
+static size_t call_output_cb(_mbx_out out, sample_t *frames,
+        size_t n_frames);
 
 enum state {
     _MBX_OUT_INITIALIZING,     /* Not yet connected to PulseAudio */
@@ -35,6 +42,7 @@ enum state {
 struct _mbx_out {
     const char *name;     /* For debug messages. "headphones" or "speakers" */
     const char *dev_name; /* Name of PulseAudio sink */
+    size_t latency_frames; /* Target length of the server's buffer */
     _mbx_out_cb cb;
     void *output_cb_userdata;
     pa_sample_spec sample_spec;
@@ -43,15 +51,23 @@ struct _mbx_out {
     pa_stream *stream;
     pa_proplist *pa_props;
     enum state state;
-    int underflows;            // Counter for underflow events.
+    atomic_ulong underflows;   // Counter for underflow events.
+    atomic_ulong late_frames;  // Frames missing at underflows.
+    size_t missing_frames;     // Requested but not written by the callback.
     int trigger_shutdown;      // Becomes true when shutdown() is called.
+    int corked;                // Guarded by the mainloop lock.
+    /* Performance counters, written by the PulseAudio mainloop thread. */
+    struct _mbx_histogram cb_duration_ns;
+    atomic_ulong cb_busy_ns;   // Sum of callback durations.
+    atomic_ulong cb_period_ns; // Sum of playback times of callback output.
+    atomic_ulong cb_max_load;  // Highest load of a callback in 1/100 percent.
 };
 
 /******************************************************************************
  * _mbx_out_new() and its helper functions
  *****************************************************************************/
 
-mbx_error_code _mbx_out_new(_mbx_out *out_p, const char *name, const char *dev_name, _mbx_out_cb cb, void *output_cb_userdata) {
+mbx_error_code _mbx_out_new(_mbx_out *out_p, const char *name, const char *dev_name, size_t latency_frames, _mbx_out_cb cb, void *output_cb_userdata) {
     int dev_exists = 0;
     if ( mbx_output_device_exists(dev_name, &dev_exists) != MBX_SUCCESS ) {
         return MBX_PULSEAUDIO_ERROR;
@@ -59,7 +75,8 @@ mbx_error_code _mbx_out_new(_mbx_out *out_p, const char *name, const char *dev_n
     if ( ! dev_exists ) {
         return MBX_DEVICE_DOES_NOT_EXIST;
     }
-    malloc_and_init(out_p, name, dev_name, cb, output_cb_userdata);
+    malloc_and_init(out_p, name, dev_name, latency_frames, cb,
+        output_cb_userdata);
     if ( init_pulseaudio(*out_p) != MBX_SUCCESS ) {
         unset_all_callbacks(*out_p);
         do_free_audio_output(*out_p);
@@ -78,15 +95,15 @@ mbx_error_code _mbx_out_new(_mbx_out *out_p, const char *name, const char *dev_n
 
 /* Initialize a new _mbx_out. This is a helper function for _mbx_out_new() */
 static void malloc_and_init(_mbx_out *out_p,
-        const char *name, const char *dev_name, _mbx_out_cb cb,
-        void *output_cb_userdata)
+        const char *name, const char *dev_name, size_t latency_frames,
+        _mbx_out_cb cb, void *output_cb_userdata)
 {
-    *out_p = _mbx_xmalloc(sizeof(struct _mbx_out));
+    *out_p = _mbx_xmalloc(MBX_LOG_AUDIO_OUTPUT, sizeof(struct _mbx_out));
     bzero(*out_p, sizeof(struct _mbx_out));
     (*out_p)->state = _MBX_OUT_INITIALIZING;
     (*out_p)->output_cb_userdata = output_cb_userdata;
-    (*out_p)->name = _mbx_xstrdup(name);
-    (*out_p)->dev_name = _mbx_xstrdup(dev_name);
+    (*out_p)->name = _mbx_xstrdup(MBX_LOG_AUDIO_OUTPUT, name);
+    (*out_p)->dev_name = _mbx_xstrdup(MBX_LOG_AUDIO_OUTPUT, dev_name);
     /* TODO: The sample spec is hard coded. It should be determined depending
      * on the capabilities of the sound card. */
     (*out_p)->sample_spec.rate = MBX_SAMPLE_RATE;
@@ -94,7 +111,9 @@ static void malloc_and_init(_mbx_out *out_p,
     (*out_p)->sample_spec.format = PA_SAMPLE_S16LE;
     /* an invalid sample spec would be a programming error */
     assert(pa_sample_spec_valid(&(*out_p)->sample_spec));
+    (*out_p)->latency_frames = latency_frames;
     (*out_p)->cb = cb;
+    _mbx_histogram_init(&(*out_p)->cb_duration_ns);
 }
 
 /******************************************************************************
@@ -178,7 +197,7 @@ static void context_ready(_mbx_out out) {
     pa_stream_set_write_callback(out->stream, stream_write_cb, out);
     /* will be called when an buffer underflow occurs */
     pa_stream_set_underflow_callback(out->stream, stream_underflow_cb, out);
-    pa_buffer_attr bufattr = make_bufattr();
+    pa_buffer_attr bufattr = make_bufattr(out);
     int r = pa_stream_connect_playback(out->stream, out->dev_name, &bufattr,
         PA_STREAM_INTERPOLATE_TIMING |
         PA_STREAM_ADJUST_LATENCY |
@@ -193,17 +212,19 @@ static void context_ready(_mbx_out out) {
 }
 
 /* Helper function for context_ready().
- * Initializes pa_buffer_attr for the given latency.
- * TODO: We don't use any latency settings so far. For more info on the bufattr
+ * Initializes pa_buffer_attr for the latency of out. Only the target length
+ * is set, PulseAudio chooses the other fields. Without a target length,
+ * PulseAudio buffers about two seconds. For more info on the bufattr
  * fields see http://freedesktop.org/software/pulseaudio/doxygen/streams.html
  */
-static pa_buffer_attr make_bufattr() {
+static pa_buffer_attr make_bufattr(_mbx_out out) {
     pa_buffer_attr bufattr;
     bufattr.fragsize  = (uint32_t)-1;
     bufattr.maxlength = (uint32_t)-1;
     bufattr.minreq    = (uint32_t)-1;
     bufattr.prebuf    = (uint32_t)-1;
-    bufattr.tlength   = (uint32_t)-1;
+    bufattr.tlength   = (uint32_t) pa_frame_size(&out->sample_spec)
+        * out->latency_frames;
     return bufattr;
 }
 
@@ -222,8 +243,10 @@ static void stream_write_cb(pa_stream *s, size_t n_requested_bytes,
         do_shutdown(out);
         return;
     }
+    out->missing_frames = 0;
     while ( n_bytes_written < n_requested_bytes ) {
         int r;
+        size_t n_frames;
         size_t n_bytes_to_write = n_requested_bytes - n_bytes_written;
         r = pa_stream_begin_write(s, (void**)&data_to_write, &n_bytes_to_write);
         assert(n_bytes_to_write % (2*sizeof(sample_t)) == 0);
@@ -233,21 +256,59 @@ static void stream_write_cb(pa_stream *s, size_t n_requested_bytes,
             pa_stream_cancel_write(s);
             return;
         }
-        if ( n_bytes_to_write > 0 ) {
-            int i;
-            assert ( n_bytes_to_write / sizeof(sample_t) < 44100L*2*8 );
-            sample_t left[44100L*2*8];
-            sample_t right[44100L*2*8];
-            out->cb(left, right, n_bytes_to_write / (2*sizeof(sample_t)), out->output_cb_userdata);
-            for ( i=0; i<n_bytes_to_write/(2*sizeof(sample_t)); i++ ) {
-                data_to_write[2*i] = left[i];
-                data_to_write[2*i+1] = right[i];
-            }
-            pa_stream_write(s, data_to_write, n_bytes_to_write, NULL, 0,
-                PA_SEEK_RELATIVE);
-            n_bytes_written += n_bytes_to_write;
+        if ( n_bytes_to_write == 0 ) {
+            continue;
+        }
+        // The controller writes directly into PulseAudio's buffer. Only the
+        // frames it had ready are written. Padding the rest with silence
+        // would put a gap into the stream while the server still plays
+        // audio; the missing frames are requested again with the next call.
+        n_frames = call_output_cb(out, data_to_write,
+            n_bytes_to_write / (2*sizeof(sample_t)));
+        if ( n_frames == 0 ) {
+            pa_stream_cancel_write(s);
+        }
+        else {
+            pa_stream_write(s, data_to_write, n_frames * 2*sizeof(sample_t),
+                NULL, 0, PA_SEEK_RELATIVE);
+        }
+        if ( n_frames * 2*sizeof(sample_t) < n_bytes_to_write ) {
+            out->missing_frames = ( n_requested_bytes - n_bytes_written )
+                / (2*sizeof(sample_t)) - n_frames;
+            return;
+        }
+        n_bytes_written += n_bytes_to_write;
+    }
+}
+
+/* Helper function for stream_write_cb().
+ * Calls the output callback, and measures how long it takes. Returns the
+ * number of frames the callback wrote. */
+static size_t call_output_cb(_mbx_out out, sample_t *frames,
+        size_t n_frames) {
+    struct timespec start, end;
+    uint64_t busy_ns, period_ns;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    _mbx_rt_enter();
+    n_frames = out->cb(frames, n_frames, out->output_cb_userdata);
+    _mbx_rt_leave();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    busy_ns = (end.tv_sec - start.tv_sec) * 1000000000ULL
+        + end.tv_nsec - start.tv_nsec;
+    period_ns = n_frames * 1000000000ULL / MBX_SAMPLE_RATE;
+    _mbx_histogram_add(&out->cb_duration_ns, busy_ns);
+    atomic_fetch_add_explicit(&out->cb_busy_ns, busy_ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&out->cb_period_ns, period_ns,
+        memory_order_relaxed);
+    if ( period_ns > 0 ) {
+        unsigned long load = busy_ns * 10000 / period_ns;
+        if ( load > atomic_load_explicit(&out->cb_max_load,
+                memory_order_relaxed) ) {
+            atomic_store_explicit(&out->cb_max_load, load,
+                memory_order_relaxed);
         }
     }
+    return n_frames;
 }
 
 /******************************************************************************
@@ -258,10 +319,81 @@ static void stream_write_cb(pa_stream *s, size_t n_requested_bytes,
 static void stream_underflow_cb(pa_stream *s, void *userdata) {
     mbx_log_info(MBX_LOG_AUDIO_OUTPUT, "Pulseaudio buffer underflow.");
     _mbx_out out = (_mbx_out ) userdata;
-    out->underflows++;
+    atomic_fetch_add_explicit(&out->underflows, 1, memory_order_relaxed);
+    /* The frames the last callback could not deliver are the ones the
+     * server ran out of. */
+    atomic_fetch_add_explicit(&out->late_frames, out->missing_frames,
+        memory_order_relaxed);
     /* TODO: increase latency, as in SimpleAsyncPlayback.c */
 }
 
+/******************************************************************************
+ * _mbx_out_get_stats()
+ *****************************************************************************/
+
+void _mbx_out_get_stats(_mbx_out out, mbx_out_stats *stats) {
+    pa_usec_t latency;
+    int negative = 0;
+    unsigned long period_ns;
+    assert ( out != NULL );
+    stats->n_callbacks = atomic_load_explicit(&out->cb_duration_ns.count,
+        memory_order_relaxed);
+    stats->callback_p50_usec =
+        _mbx_histogram_percentile(&out->cb_duration_ns, 50) / 1000.0;
+    stats->callback_p99_usec =
+        _mbx_histogram_percentile(&out->cb_duration_ns, 99) / 1000.0;
+    stats->callback_max_usec = atomic_load_explicit(&out->cb_duration_ns.max,
+        memory_order_relaxed) / 1000.0;
+    period_ns = atomic_load_explicit(&out->cb_period_ns, memory_order_relaxed);
+    stats->dsp_load_percent = period_ns == 0 ? 0 : 100.0 *
+        atomic_load_explicit(&out->cb_busy_ns, memory_order_relaxed)
+        / period_ns;
+    stats->dsp_load_max_percent = atomic_load_explicit(&out->cb_max_load,
+        memory_order_relaxed) / 100.0;
+    stats->underflows = atomic_load_explicit(&out->underflows,
+        memory_order_relaxed);
+    stats->latency_usec = -1;
+    /* The stream is owned by the mainloop thread, so we must lock it. */
+    pa_threaded_mainloop_lock(out->pa_ml);
+    if ( out->state == _MBX_OUT_READY && out->stream != NULL ) {
+        if ( pa_stream_get_latency(out->stream, &latency, &negative) == 0 ) {
+            stats->latency_usec = negative ? -(long) latency : (long) latency;
+        }
+    }
+    pa_threaded_mainloop_unlock(out->pa_ml);
+    stats->ring_fill_frames = 0;
+    stats->render_load_percent = 0;
+    stats->render_load_max_percent = 0;
+    stats->late_frames = atomic_load_explicit(&out->late_frames,
+        memory_order_relaxed);
+}
+
+/******************************************************************************
+ * _mbx_out_set_corked()
+ *****************************************************************************/
+
+void _mbx_out_set_corked(_mbx_out out, int corked) {
+    pa_operation *o;
+    assert ( out != NULL );
+    /* The stream is owned by the mainloop thread, so we must lock it. */
+    pa_threaded_mainloop_lock(out->pa_ml);
+    if ( out->state == _MBX_OUT_READY && out->stream != NULL
+            && out->corked != corked ) {
+        o = pa_stream_cork(out->stream, corked, NULL, NULL);
+        if ( o == NULL ) {
+            mbx_log_error(MBX_LOG_AUDIO_OUTPUT, "Failed to %s the %s stream: %s",
+                corked ? "cork" : "uncork", out->name, pa_msg(out));
+        }
+        else {
+            pa_operation_unref(o);
+            out->corked = corked;
+            mbx_log_debug(MBX_LOG_AUDIO_OUTPUT, "%s the %s stream.",
+                corked ? "Corked" : "Uncorked", out->name);
+        }
+    }
+    pa_threaded_mainloop_unlock(out->pa_ml);
+}
+
 /******************************************************************************
  * shutdown()
  *****************************************************************************/
@@ -270,6 +402,8 @@ static void stream_underflow_cb(pa_stream *s, void *userdata) {
  * starts in stream_write_cb(), when do_shutdown() is called */
 void _mbx_out_shutdown_and_free(_mbx_out out) {
     assert ( out != NULL );
+    /* A corked stream neither calls stream_write_cb() nor drains. */
+    _mbx_out_set_corked(out, 0);
     out->trigger_shutdown = 1;
     while ( out->state == _MBX_OUT_READY ) {
         usleep(10*1000);
@@ -5,6 +5,7 @@
 #include <pulse/pulseaudio.h>
 #include "libmbx/common/mbx_errno.h"
 #include "audio_output.h"
+#include "out_stats.h"
 
 /******************************************************************************
  * An audio_output represents a pulseaudio sink.
@@ -34,22 +35,34 @@ typedef struct _mbx_out *_mbx_out;
  * Callback that is used by the audio output to get sample values from the
  * controller.
  *
- * @param  left
- *         An array of #sample_t. The sample values for the left stereo channel
- *         must be put into .
- * @param  right
- *         An array of #sample_t. The sample values for the right stereo
- *         channel must be put here.
- * @param  n_samples
- *         Number of sample values requested
+ * @param  frames
+ *         An array of #sample_t. The interleaved stereo frames, left sample
+ *         first, must be put here.
+ * @param  n_frames
+ *         Number of stereo frames requested
  * @param  userdata
  *         The #output_cb_userdata will be put here, see new_audio_output()
+ * @return The number of frames put in <tt>frames</tt>, at most
+ *         <tt>n_frames</tt>. Only these are written to the stream, the
+ *         rest is requested again later. The server keeps playing what it
+ *         has buffered in the meantime.
  */
-typedef void (* _mbx_out_cb)
-    (sample_t *left, sample_t *right, size_t n_samples, void *userdata);
+typedef size_t (* _mbx_out_cb)
+    (sample_t *frames, size_t n_frames, void *userdata);
 
-/* Create a new audio_output and connect it to pulseaudio. */
-extern mbx_error_code _mbx_out_new(_mbx_out *, const char *name, const char *dev_name, _mbx_out_cb cb, void *output_cb_userdata);
+/* Create a new audio_output and connect it to pulseaudio. PulseAudio is
+ * asked to keep about latency_frames buffered on the server. */
+extern mbx_error_code _mbx_out_new(_mbx_out *, const char *name, const char *dev_name, size_t latency_frames, _mbx_out_cb cb, void *output_cb_userdata);
+
+/* Get a snapshot of the performance counters of the audio output. The
+ * ring_fill_frames and render load fields are not known to the audio output
+ * and are set to 0. */
+extern void _mbx_out_get_stats(_mbx_out out, mbx_out_stats *stats);
+
+/* Cork or uncork the stream. A corked stream does not call the output
+ * callback. May block for a short time, and must not be called while
+ * rendering audio. */
+extern void _mbx_out_set_corked(_mbx_out out, int corked);
 
 /* Shutdown the connection to pulseaudio and free all resources associated
  * with the connection. */
@@ -159,8 +159,8 @@ mbx_error_code mbx_output_device_exists(const char *name, int *result) {
 static void push_a_copy(const char *s, struct list_of_strings *list) {
     if ( list->size < list->n_strings + 2 ) { // including terminating NULL
         list->size = list->size == 0 ? 2 : list->size * 2;
-        list->strings = _mbx_xrealloc(list->strings, list->size*sizeof(char *));
+        list->strings = _mbx_xrealloc(MBX_LOG_AUDIO_OUTPUT, list->strings, list->size*sizeof(char *));
     }
-    list->strings[list->n_strings++] = _mbx_xstrdup(s);
+    list->strings[list->n_strings++] = _mbx_xstrdup(MBX_LOG_AUDIO_OUTPUT, s);
     list->strings[list->n_strings] = NULL;
 }
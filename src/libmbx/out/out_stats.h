@@ -0,0 +1,65 @@
+#ifndef MBX_OUT_STATS_H
+#define MBX_OUT_STATS_H
+
+#include <stddef.h>
+
+/**
+ * Performance counters of an audio output.
+ *
+ * The counters are updated by the audio thread without locking. A snapshot
+ * can be taken at any time with mbx_ctrl_get_stats().
+ */
+typedef struct {
+    /**
+     * Number of times the audio output asked the controller for audio data.
+     */
+    unsigned long n_callbacks;
+    /**
+     * Time spent in the controller's output callback, in microseconds.
+     * The percentiles are estimated from a histogram, their relative error
+     * is below 25%.
+     */
+    double callback_p50_usec;
+    double callback_p99_usec;
+    double callback_max_usec;
+    /**
+     * Time spent in the output callback as a percentage of the playback
+     * time of the audio data produced, averaged over all callbacks.
+     */
+    double dsp_load_percent;
+    /**
+     * Highest DSP load of a single callback.
+     */
+    double dsp_load_max_percent;
+    /**
+     * Number of buffer underflows reported by PulseAudio.
+     */
+    unsigned long underflows;
+    /**
+     * Current playback latency as reported by pa_stream_get_latency(),
+     * or <tt>-1</tt> if PulseAudio has no timing information yet.
+     */
+    long latency_usec;
+    /**
+     * Number of stereo frames that are rendered but not yet played.
+     */
+    size_t ring_fill_frames;
+    /**
+     * Time the render thread spent rendering as a percentage of the
+     * playback time of the audio data rendered, averaged over all blocks.
+     * The callback only copies rendered audio data, so this is the load
+     * of the audio processing.
+     */
+    double render_load_percent;
+    /**
+     * Highest render load of a single block.
+     */
+    double render_load_max_percent;
+    /**
+     * Number of stereo frames missing from the server's buffer when it
+     * underflowed, because the render thread did not render them in time.
+     */
+    unsigned long late_frames;
+} mbx_out_stats;
+
+#endif
@@ -4,6 +4,7 @@
 #include <assert.h>
 #include <stdarg.h>
 #include <unistd.h>
+#include <poll.h>
 #include <readline/readline.h>
 #include <readline/history.h>
 #include "shell.h"
@@ -22,14 +23,32 @@ static int exec_run(int argc, char **argv);
 static int exec_load(int argc, char **argv);
 static int exec_play(int argc, char **argv);
 static int exec_pause(int argc, char **argv);
+static int exec_double(int argc, char **argv);
+static int exec_cue(int argc, char **argv);
+static int exec_rate(int argc, char **argv);
+static int exec_interpolation(int argc, char **argv);
+static int exec_keylock(int argc, char **argv);
+static int exec_volume(int argc, char **argv);
+static int exec_pan(int argc, char **argv);
+static int exec_crossfader(int argc, char **argv);
+static int exec_eq(int argc, char **argv);
+static int exec_kill(int argc, char **argv);
+static int exec_filter(int argc, char **argv);
+static int exec_at(int argc, char **argv);
 static int exec_sleep(int argc, char **argv);
+static int exec_stats(int argc, char **argv);
+static int exec_mem(int argc, char **argv);
 static int exec_quit(int argc, char **argv);
 static int exec_help(int argc, char **argv);
 
-static char get_deck(int argc, char **argv);
+static int get_deck(int argc, char **argv);
 static int get_sample_num(int argc, char **argv);
+static int check_sample_num(int n);
+static int get_band(const char *name);
 
 static void initialize_readline();
+static int dispatch_loads(void);
+static void wait_for_loads(void);
 static char *next_non_whitespace(char *line);
 static void split(char *line, int *argc_p, char **argv_p[]);
 static int execute_cmdline(char *line);
@@ -75,7 +94,15 @@ static struct command config_commands[] = {
       "The following variables are available:\n"
       "set headphones <device>\n"
       "set speakers <device>\n"
-      "set mp3dir <path>\n"},
+      "set mp3dir <path>\n"
+      "set mlock [yes|no]\n"
+      "set compressed [yes|no]\n"
+      "set decks <n>\n"
+      "set samples <n>\n"
+      "set lookahead <milliseconds>\n"
+      "set idle <milliseconds>\n"
+      "set overload <percent>\n"
+      "set dither [yes|no]\n"},
     { "show",
       exec_config_show,
       NULL,
@@ -105,15 +132,66 @@ static struct command config_commands[] = {
 /* Array containing all commands supported by this shell.
  * This array is terminated with a NULL command */
 static struct command run_commands[] = {
-    { "load", exec_load, NULL, "load <file.mp3> on deck [a|b]\nload <file.mp3> as sample <n>\n",
+    { "load", exec_load, NULL, "load <file.mp3> on deck <d>\nload <file.mp3> as sample <n>\n",
       "Load an mp3 file and store it in variable <var>\n"
-      "For filenames with spaces, type the filename in \"double quotes\".\n"},
-    { "play", exec_play, NULL, "play deck [a|b]\nplay sample <n>\n",
+      "For filenames with spaces, type the filename in \"double quotes\".\n"
+      "Decks <d> are named a, b, c, ... or numbered 1, 2, 3, ...\n"},
+    { "play", exec_play, NULL, "play deck <d>\nplay sample <n>\n",
       "Start playing the file loaded as <var>\n" },
-    { "pause", exec_pause, NULL, "pause deck [a|b]\n",
-       "Pause the file loaded as <var>\n" },
+    { "pause", exec_pause, NULL, "pause deck <d>\npause sample <n>\n",
+       "Pause the file loaded as <var>\n"
+       "For samples, all voices playing the sample fade out.\n" },
+    { "double", exec_double, NULL, "double deck <d>\ndouble deck <d> to deck <d>\n",
+      "Load the file on the deck onto another deck, at the same position.\n"
+      "If the deck is playing, the other deck starts playing in sync.\n"
+      "With two decks, the other deck is the default.\n" },
+    { "cue", exec_cue, NULL,
+      "cue play deck <d>\ncue pause deck <d>\ncue seek <seconds> deck <d>\n",
+      "Pre-listen to a deck on the headphones. The cue position is\n"
+      "independent of the position playing on the speakers.\n" },
+    { "rate", exec_rate, NULL, "rate <rate> deck <d>\n",
+      "Set the playback rate of a deck: 1 is normal speed, 1.08 is 8%\n"
+      "faster, 0 stops the deck, negative rates play in reverse.\n" },
+    { "interpolation", exec_interpolation, NULL,
+      "interpolation [linear|cubic|sinc]\n",
+      "Select the interpolation for decks playing at a rate other than 1.\n"
+      "sinc sounds best, linear needs the least CPU time.\n" },
+    { "keylock", exec_keylock, NULL,
+      "keylock [off|wsola|vocoder] deck <d>\n",
+      "Keep the key of a deck when its rate changes. wsola is cheap and\n"
+      "good for beats, vocoder is smoother on tonal music.\n" },
+    { "volume", exec_volume, NULL, "volume <volume> deck <d>\n",
+      "Set the volume of a deck on the speakers, from 0 to 1.\n" },
+    { "pan", exec_pan, NULL, "pan <position> deck <d>\n",
+      "Pan a deck on the speakers, from -1 (left) to 1 (right).\n" },
+    { "crossfader", exec_crossfader, NULL,
+      "crossfader <position>\ncrossfader curve [linear|power|cut]\n"
+      "crossfader assign [a|b|thru] deck <d>\n",
+      "Move the crossfader from -1 (side a) to 1 (side b), select its\n"
+      "curve, or assign a deck to a side. Decks 1 and 2 are on sides\n"
+      "a and b, the other decks are not on the crossfader.\n" },
+    { "eq", exec_eq, NULL, "eq [low|mid|high] <db> deck <d>\n",
+      "Set a band of the equalizer of a deck, from -24 to 6 dB.\n" },
+    { "kill", exec_kill, NULL, "kill [low|mid|high] [on|off] deck <d>\n",
+      "Remove a band of a deck completely, or restore it.\n" },
+    { "filter", exec_filter, NULL, "filter <position> deck <d>\n",
+      "Sweep the filter of a deck: from 0 (off) to -1 the low-pass\n"
+      "filter closes, from 0 to 1 the high-pass filter closes.\n" },
+    { "at", exec_at, NULL,
+      "at [+]<seconds> play deck <d>\nat [+]<seconds> play sample <n>\n"
+      "at [+]<seconds> pause deck <d>\n",
+      "Schedule a command at an exact time. With +, the time is relative to\n"
+      "now, otherwise it is the time since the music box was started.\n" },
     { "sleep", exec_sleep, NULL, "sleep <seconds>\n",
       "sleep for <seconds> seconds\n" },
+    { "stats", exec_stats, NULL, "stats\n",
+      "Print performance counters of the audio outputs and the memory\n"
+      "used by the loaded files.\n" },
+    { "mem", exec_mem, NULL, "mem\nmem limit <megabytes>\n",
+      "Print the memory used by each component of the music box.\n"
+      "With \"limit\", set the maximum memory for decoded audio data.\n"
+      "Loading a file fails if it would exceed the limit. 0 means no "
+      "limit.\n" },
     { "quit", exec_quit, NULL, "quit\n",
       "quit this application\n" },
     { "exit", exec_quit, NULL, NULL, NULL },
@@ -126,6 +204,8 @@ static struct command run_commands[] = {
 static struct command *commands;
 static int quiet = 0; /* when true: do not print to stdout */
 static int done = 0;  /* when true: exit the main loop */
+static int reading = 0;  /* when true: readline() shows the prompt */
+static int loads_pending = 0;  /* asynchronous loads started by the shell */
 static mbx_config cfg;
 static mbx_ctrl ctrl;
 
@@ -151,7 +231,10 @@ void shell_run() {
     initialize_readline();
     enter_config_mode();
     while ( ! done ) {
+        reading = 1;
         line = readline(quiet ? NULL : "> ");
+        reading = 0;
+        dispatch_loads();
         if ( line == NULL ) {
             usr_msg("\n");
             exec_quit(0, NULL);
@@ -325,6 +408,8 @@ static void initialize_readline() {
     rl_filename_dequoting_function = dequote_filename;
     rl_char_is_quoted_p = char_is_quoted;
     rl_attempted_completion_function = command_completion;
+    // Loads finish while the user types, see exec_load().
+    rl_event_hook = dispatch_loads;
 }
 
 /* Find out if the string s contains the character c */
@@ -433,7 +518,9 @@ static char *cmd_completion_list(const char *text, int state) {
 
 static char *cmd_completion_config_vars(const char *text, int state) {
     static size_t i, len;
-    char *vars[] = { "headphones", "speakers", "mp3dir", NULL };
+    char *vars[] = { "headphones", "speakers", "mp3dir", "mlock", "compressed",
+        "decks", "samples", "lookahead", "idle", "overload",
+        "dither", NULL };
     char *var;
     if ( ! state ) { /* first call */
         i = 0;
@@ -521,6 +608,30 @@ static int exec_config_set(int argc, char **argv) {
     else if ( ! strcmp("mp3dir", argv[1]) ) {
         mbx_config_set(cfg, MBX_CFG_MP3DIR, argv[2]);
     }
+    else if ( ! strcmp("mlock", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_MLOCK, argv[2]);
+    }
+    else if ( ! strcmp("compressed", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_COMPRESSED, argv[2]);
+    }
+    else if ( ! strcmp("decks", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_DECKS, argv[2]);
+    }
+    else if ( ! strcmp("samples", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_SAMPLE_SLOTS, argv[2]);
+    }
+    else if ( ! strcmp("lookahead", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_LOOKAHEAD, argv[2]);
+    }
+    else if ( ! strcmp("idle", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_IDLE, argv[2]);
+    }
+    else if ( ! strcmp("overload", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_OVERLOAD, argv[2]);
+    }
+    else if ( ! strcmp("dither", argv[1]) ) {
+        mbx_config_set(cfg, MBX_CFG_DITHER, argv[2]);
+    }
     else {
         usr_msg("Usage:\n%s\n", find_command(argv[0])->usage);
         return -1;
@@ -542,6 +653,14 @@ static int exec_config_show(int argc, char **argv) {
     print_config(MBX_CFG_HEADPHONES_DEVICE, "headphones");
     print_config(MBX_CFG_SPEAKERS_DEVICE, "speakers");
     print_config(MBX_CFG_MP3DIR, "mp3dir");
+    print_config(MBX_CFG_MLOCK, "mlock");
+    print_config(MBX_CFG_COMPRESSED, "compressed");
+    print_config(MBX_CFG_DECKS, "decks");
+    print_config(MBX_CFG_SAMPLE_SLOTS, "samples");
+    print_config(MBX_CFG_LOOKAHEAD, "lookahead");
+    print_config(MBX_CFG_IDLE, "idle");
+    print_config(MBX_CFG_OVERLOAD, "overload");
+    print_config(MBX_CFG_DITHER, "dither");
     return 0;
 }
 
@@ -579,8 +698,72 @@ static int exec_run(int argc, char **argv) {
  * Implementation of the music box shell commands
  *****************************************************************************/
 
+/* Print a message about a finished load. If readline is showing the prompt,
+ * the message goes above it, and the line being typed is kept. */
+static void load_msg(const char *fmt, ...) {
+    va_list args;
+    char *line = NULL;
+    int point = rl_point;
+    if ( quiet ) {
+        return;
+    }
+    if ( reading ) {
+        line = rl_copy_text(0, rl_end);
+        rl_save_prompt();
+        rl_replace_line("", 0);
+        rl_redisplay();
+    }
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    if ( reading ) {
+        rl_restore_prompt();
+        rl_replace_line(line, 0);
+        rl_point = point;
+        rl_redisplay();
+        free(line);
+    }
+}
+
+/* Called when a load finished. userdata is the deck number plus one, or
+ * minus the sample number. */
+static void load_done(mbx_load_job job, mbx_error_code r, void *userdata) {
+    long target = (long) userdata;
+    loads_pending--;
+    if ( r == MBX_SUCCESS ) {
+        load_msg("Loaded %s %ld.\n", target > 0 ? "deck" : "sample",
+            target > 0 ? target : -target);
+    }
+    else if ( r != MBX_LOAD_CANCELLED ) {
+        load_msg("Error loading %s %ld: %s\n", target > 0 ? "deck" : "sample",
+            target > 0 ? target : -target, mbx_error_code_to_string(r));
+    }
+}
+
+/* Install the finished loads, called by readline while it waits for
+ * input. */
+static int dispatch_loads(void) {
+    if ( loads_pending > 0 ) {
+        mbx_ctrl_dispatch_loads(ctrl);
+    }
+    return 0;
+}
+
+/* Wait until the loads started by the shell finished. */
+static void wait_for_loads(void) {
+    struct pollfd fd;
+    while ( loads_pending > 0 ) {
+        fd.fd = mbx_ctrl_get_load_fd(ctrl);
+        fd.events = POLLIN;
+        poll(&fd, 1, -1);
+        mbx_ctrl_dispatch_loads(ctrl);
+    }
+}
+
+/* Files are loaded in the background, so the prompt is back right away. In
+ * quiet mode, the shell runs scripts, and the next command expects the file
+ * to be loaded, so the load is waited for. */
 static int exec_load(int argc, char **argv) {
-    mbx_error_code r;
     if ( argc != 5 ) {
         usr_msg("Usage:\n%s\n", find_command(argv[0])->usage);
         usr_msg("If the filename contains spaces, put the filename in "
@@ -588,33 +771,29 @@ static int exec_load(int argc, char **argv) {
         return -1;
     }
     if ( ! strcmp("deck", argv[3]) ) {
-        switch ( get_deck(argc, argv) ) {
-            case 'a':
-                r = mbx_ctrl_deck_a_load(ctrl, argv[1]);
-                break;
-            case 'b':
-                r = mbx_ctrl_deck_b_load(ctrl, argv[1]);
-                break;
-            default:
-                usr_msg("Usage: %s", find_command(argv[0])->usage);
-                return -1;
+        int deck = get_deck(argc, argv);
+        if ( deck < 0 ) {
+            usr_msg("Usage: %s", find_command(argv[0])->usage);
+            return -1;
         }
+        mbx_ctrl_deck_load_async(ctrl, argv[1], deck, load_done,
+            (void *) (long) ( deck + 1 ));
     }
     else if ( ! strcmp("sample", argv[3]) ) {
         int n = get_sample_num(argc, argv);
-        if ( n <= 0 || n > MAX_SAMPLE_FILES ) {
-            usr_msg("<n> must be between 1 and %d\n", MAX_SAMPLE_FILES);
+        if ( ! check_sample_num(n) ) {
             return -1;
         }
-        r = mbx_ctrl_sample_load(ctrl, argv[1], n-1);
+        mbx_ctrl_sample_load_async(ctrl, argv[1], n-1, load_done,
+            (void *) (long) -n);
     }
     else {
         usr_msg("Usage: %s", find_command(argv[0])->usage);
         return -1;
     }
-    if ( r != MBX_SUCCESS ) {
-        usr_msg("Error executing load: %s\n", mbx_error_code_to_string(r));
-        return -1;
+    loads_pending++;
+    if ( quiet ) {
+        wait_for_loads();
     }
     return 0;
 }
@@ -625,22 +804,16 @@ static int exec_play(int argc, char **argv) {
         return -1;
     }
     if ( ! strcmp("deck", argv[1]) ) {
-        switch ( get_deck(argc, argv) ) {
-            case 'a':
-                mbx_ctrl_deck_a_play(ctrl);
-                break;
-            case 'b':
-                mbx_ctrl_deck_b_play(ctrl);
-                break;
-            default:
-                usr_msg("Usage: %s", find_command(argv[0])->usage);
-                return -1;
+        int deck = get_deck(argc, argv);
+        if ( deck < 0 ) {
+            usr_msg("Usage: %s", find_command(argv[0])->usage);
+            return -1;
         }
+        mbx_ctrl_deck_play(ctrl, deck);
     }
     else if ( ! strcmp("sample", argv[1]) ) {
         int n = get_sample_num(argc, argv);
-        if ( n <= 0 || n > MAX_SAMPLE_FILES ) {
-            usr_msg("<n> must be between 1 and %d\n", MAX_SAMPLE_FILES);
+        if ( ! check_sample_num(n) ) {
             return -1;
         }
         mbx_ctrl_sample_play(ctrl, n-1);
@@ -653,20 +826,35 @@ static int exec_play(int argc, char **argv) {
 }
 
 /*
- * Der Befehl endet mit "deck a" oder "deck b"
- * Es wird 'a' oder 'b' oder '\0' zurueckgeliefert.
+ * The command ends with "deck <d>", where <d> is a letter "a", "b", ...
+ * or a number "1", "2", ...
+ * Returns the deck index, or -1 if there is no such deck.
  */
-static char get_deck(int argc, char **argv) {
+static int get_deck(int argc, char **argv) {
+    const char *name;
+    char *endp;
+    long n;
     if ( argc < 2 ) {
-        return '\0';
+        return -1;
     }
     if ( strcmp("deck", argv[argc-2]) ) {
-        return '\0';
+        return -1;
+    }
+    name = argv[argc-1];
+    if ( name[0] >= 'a' && name[0] <= 'z' && name[1] == '\0' ) {
+        n = name[0] - 'a' + 1;
+    }
+    else {
+        n = strtol(name, &endp, 10);
+        if ( *name == '\0' || *endp != '\0' ) {
+            return -1;
+        }
     }
-    if ( ! strcmp("a", argv[argc-1]) || ! strcmp("b", argv[argc-1]) ) {
-        return *argv[argc-1];
+    if ( n <= 0 || n > mbx_ctrl_get_n_decks(ctrl) ) {
+        usr_msg("There are %d decks.\n", mbx_ctrl_get_n_decks(ctrl));
+        return -1;
     }
-    return '\0';
+    return (int) n - 1;
 }
 
 /*
@@ -687,14 +875,342 @@ static int get_sample_num(int argc, char **argv) {
     return (int) result;
 }
 
+/*
+ * Returns 1 if n is a valid sample number, otherwise prints an error.
+ */
+static int check_sample_num(int n) {
+    if ( n <= 0 || n > mbx_ctrl_get_n_sample_slots(ctrl) ) {
+        usr_msg("<n> must be between 1 and %d\n",
+            mbx_ctrl_get_n_sample_slots(ctrl));
+        return 0;
+    }
+    return 1;
+}
+
+/* The equalizer band called name, or -1. */
+static int get_band(const char *name) {
+    if ( ! strcmp("low", name) ) {
+        return MBX_EQ_LOW;
+    }
+    if ( ! strcmp("mid", name) ) {
+        return MBX_EQ_MID;
+    }
+    if ( ! strcmp("high", name) ) {
+        return MBX_EQ_HIGH;
+    }
+    return -1;
+}
 
 static int exec_pause(int argc, char **argv) {
-    char deck = get_deck(argc, argv);
-    if ( argc != 3 || ! deck ) {
+    int deck;
+    if ( argc == 3 && ! strcmp("sample", argv[1]) ) {
+        int n = get_sample_num(argc, argv);
+        if ( ! check_sample_num(n) ) {
+            return -1;
+        }
+        mbx_ctrl_sample_stop(ctrl, n-1);
+        return 0;
+    }
+    deck = get_deck(argc, argv);
+    if ( argc != 3 || deck < 0 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    mbx_ctrl_deck_pause(ctrl, deck);
+    return 0;
+}
+
+static int exec_double(int argc, char **argv) {
+    mbx_error_code r;
+    int from, to;
+    if ( argc == 3 && mbx_ctrl_get_n_decks(ctrl) == 2 ) {
+        // with two decks, the target is the other deck
+        from = get_deck(argc, argv);
+        to = 1 - from;
+    }
+    else if ( argc == 6 && ! strcmp("to", argv[3]) ) {
+        from = get_deck(3, argv);
+        to = get_deck(argc, argv);
+    }
+    else {
+        from = to = -1;
+    }
+    if ( from < 0 || to < 0 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    r = mbx_ctrl_deck_double(ctrl, from, to);
+    if ( r != MBX_SUCCESS ) {
+        usr_msg("Error executing double: %s\n", mbx_error_code_to_string(r));
+        return -1;
+    }
+    return 0;
+}
+
+static int exec_cue(int argc, char **argv) {
+    mbx_error_code r = MBX_SUCCESS;
+    int deck = get_deck(argc, argv);
+    char *endp;
+    double seconds;
+    if ( argc == 4 && deck >= 0 && ! strcmp("play", argv[1]) ) {
+        r = mbx_ctrl_deck_cue_play(ctrl, deck);
+    }
+    else if ( argc == 4 && deck >= 0 && ! strcmp("pause", argv[1]) ) {
+        mbx_ctrl_deck_cue_pause(ctrl, deck);
+    }
+    else if ( argc == 5 && deck >= 0 && ! strcmp("seek", argv[1]) ) {
+        seconds = strtod(argv[2], &endp);
+        if ( *argv[2] == '\0' || *endp != '\0' || seconds < 0 ) {
+            usr_msg("Error executing cue: %s is not a position in seconds.\n",
+                argv[2]);
+            return -1;
+        }
+        r = mbx_ctrl_deck_cue_seek(ctrl, deck, seconds);
+    }
+    else {
+        usr_msg("Usage:\n%s", find_command(argv[0])->usage);
+        return -1;
+    }
+    if ( r != MBX_SUCCESS ) {
+        usr_msg("Error executing cue: %s\n", mbx_error_code_to_string(r));
+        return -1;
+    }
+    return 0;
+}
+
+static int exec_rate(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    char *endp;
+    double rate;
+    if ( argc != 4 || deck < 0 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    rate = strtod(argv[1], &endp);
+    if ( *argv[1] == '\0' || *endp != '\0' ) {
+        usr_msg("Error executing rate: %s is not a number.\n", argv[1]);
+        return -1;
+    }
+    mbx_ctrl_deck_set_rate(ctrl, deck, rate);
+    return 0;
+}
+
+static int exec_interpolation(int argc, char **argv) {
+    if ( argc == 2 && ! strcmp("linear", argv[1]) ) {
+        mbx_ctrl_set_interpolation(ctrl, MBX_INTERPOLATION_LINEAR);
+    }
+    else if ( argc == 2 && ! strcmp("cubic", argv[1]) ) {
+        mbx_ctrl_set_interpolation(ctrl, MBX_INTERPOLATION_CUBIC);
+    }
+    else if ( argc == 2 && ! strcmp("sinc", argv[1]) ) {
+        mbx_ctrl_set_interpolation(ctrl, MBX_INTERPOLATION_SINC);
+    }
+    else {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    return 0;
+}
+
+static int exec_keylock(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    mbx_keylock keylock;
+    if ( argc == 4 && deck >= 0 && ! strcmp("off", argv[1]) ) {
+        keylock = MBX_KEYLOCK_OFF;
+    }
+    else if ( argc == 4 && deck >= 0 && ! strcmp("wsola", argv[1]) ) {
+        keylock = MBX_KEYLOCK_WSOLA;
+    }
+    else if ( argc == 4 && deck >= 0 && ! strcmp("vocoder", argv[1]) ) {
+        keylock = MBX_KEYLOCK_PHASE_VOCODER;
+    }
+    else {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    mbx_ctrl_deck_set_keylock(ctrl, deck, keylock);
+    return 0;
+}
+
+static int exec_volume(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    char *endp;
+    double volume;
+    if ( argc != 4 || deck < 0 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    volume = strtod(argv[1], &endp);
+    if ( *argv[1] == '\0' || *endp != '\0' || volume < 0 || volume > 1 ) {
+        usr_msg("Error executing volume: %s is not between 0 and 1.\n",
+            argv[1]);
+        return -1;
+    }
+    mbx_ctrl_deck_set_volume(ctrl, deck, volume);
+    return 0;
+}
+
+static int exec_pan(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    char *endp;
+    double pan;
+    if ( argc != 4 || deck < 0 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    pan = strtod(argv[1], &endp);
+    if ( *argv[1] == '\0' || *endp != '\0' || pan < -1 || pan > 1 ) {
+        usr_msg("Error executing pan: %s is not between -1 and 1.\n",
+            argv[1]);
+        return -1;
+    }
+    mbx_ctrl_deck_set_pan(ctrl, deck, pan);
+    return 0;
+}
+
+static int exec_crossfader(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    char *endp;
+    double position;
+    if ( argc == 3 && ! strcmp("curve", argv[1]) ) {
+        if ( ! strcmp("linear", argv[2]) ) {
+            mbx_ctrl_set_crossfader_curve(ctrl, MBX_CROSSFADER_LINEAR);
+        }
+        else if ( ! strcmp("power", argv[2]) ) {
+            mbx_ctrl_set_crossfader_curve(ctrl, MBX_CROSSFADER_CONSTANT_POWER);
+        }
+        else if ( ! strcmp("cut", argv[2]) ) {
+            mbx_ctrl_set_crossfader_curve(ctrl, MBX_CROSSFADER_CUT);
+        }
+        else {
+            usr_msg("Usage:\n%s", find_command(argv[0])->usage);
+            return -1;
+        }
+        return 0;
+    }
+    if ( argc == 5 && deck >= 0 && ! strcmp("assign", argv[1]) ) {
+        if ( ! strcmp("a", argv[2]) ) {
+            mbx_ctrl_deck_set_crossfader_side(ctrl, deck, MBX_CROSSFADER_SIDE_A);
+        }
+        else if ( ! strcmp("b", argv[2]) ) {
+            mbx_ctrl_deck_set_crossfader_side(ctrl, deck, MBX_CROSSFADER_SIDE_B);
+        }
+        else if ( ! strcmp("thru", argv[2]) ) {
+            mbx_ctrl_deck_set_crossfader_side(ctrl, deck, MBX_CROSSFADER_THRU);
+        }
+        else {
+            usr_msg("Usage:\n%s", find_command(argv[0])->usage);
+            return -1;
+        }
+        return 0;
+    }
+    if ( argc != 2 ) {
+        usr_msg("Usage:\n%s", find_command(argv[0])->usage);
+        return -1;
+    }
+    position = strtod(argv[1], &endp);
+    if ( *argv[1] == '\0' || *endp != '\0' || position < -1 || position > 1 ) {
+        usr_msg("Error executing crossfader: %s is not between -1 and 1.\n",
+            argv[1]);
+        return -1;
+    }
+    mbx_ctrl_set_crossfader(ctrl, position);
+    return 0;
+}
+
+static int exec_eq(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    int band = argc == 5 ? get_band(argv[1]) : -1;
+    char *endp;
+    double db;
+    if ( argc != 5 || deck < 0 || band < 0 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    db = strtod(argv[2], &endp);
+    if ( *argv[2] == '\0' || *endp != '\0' || db < -24 || db > 6 ) {
+        usr_msg("Error executing eq: %s is not between -24 and 6.\n",
+            argv[2]);
+        return -1;
+    }
+    mbx_ctrl_deck_set_eq(ctrl, deck, band, db);
+    return 0;
+}
+
+static int exec_kill(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    int band = argc == 5 ? get_band(argv[1]) : -1;
+    if ( argc != 5 || deck < 0 || band < 0
+            || ( strcmp("on", argv[2]) && strcmp("off", argv[2]) ) ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    mbx_ctrl_deck_set_kill(ctrl, deck, band, ! strcmp("on", argv[2]));
+    return 0;
+}
+
+static int exec_filter(int argc, char **argv) {
+    int deck = get_deck(argc, argv);
+    char *endp;
+    double position;
+    if ( argc != 4 || deck < 0 ) {
         usr_msg("Usage: %s", find_command(argv[0])->usage);
         return -1;
     }
-    deck == 'a' ? mbx_ctrl_deck_a_pause(ctrl) : mbx_ctrl_deck_b_pause(ctrl);
+    position = strtod(argv[1], &endp);
+    if ( *argv[1] == '\0' || *endp != '\0' || position < -1 || position > 1 ) {
+        usr_msg("Error executing filter: %s is not between -1 and 1.\n",
+            argv[1]);
+        return -1;
+    }
+    mbx_ctrl_deck_set_filter(ctrl, deck, position);
+    return 0;
+}
+
+static int exec_at(int argc, char **argv) {
+    mbx_error_code r = MBX_SUCCESS;
+    int deck = -1;
+    char *endp;
+    double seconds;
+    int64_t time;
+    int n;
+    if ( argc != 5 ) {
+        usr_msg("Usage:\n%s", find_command(argv[0])->usage);
+        return -1;
+    }
+    seconds = strtod(argv[1], &endp);
+    if ( *argv[1] == '\0' || *endp != '\0' || seconds < 0 ) {
+        usr_msg("Error executing at: %s is not a time in seconds.\n", argv[1]);
+        return -1;
+    }
+    time = (int64_t) ( seconds * MBX_SAMPLE_RATE );
+    if ( *argv[1] == '+' ) {
+        time += mbx_ctrl_get_time(ctrl);
+    }
+    if ( ! strcmp("deck", argv[3]) ) {
+        deck = get_deck(argc, argv);
+    }
+    if ( ! strcmp("play", argv[2]) && deck >= 0 ) {
+        r = mbx_ctrl_deck_play_at(ctrl, deck, time);
+    }
+    else if ( ! strcmp("pause", argv[2]) && deck >= 0 ) {
+        r = mbx_ctrl_deck_pause_at(ctrl, deck, time);
+    }
+    else if ( ! strcmp("play", argv[2]) && ! strcmp("sample", argv[3]) ) {
+        n = get_sample_num(argc, argv);
+        if ( ! check_sample_num(n) ) {
+            return -1;
+        }
+        r = mbx_ctrl_sample_play_at(ctrl, n-1, time);
+    }
+    else {
+        usr_msg("Usage:\n%s", find_command(argv[0])->usage);
+        return -1;
+    }
+    if ( r != MBX_SUCCESS ) {
+        usr_msg("Error executing at: %s\n", mbx_error_code_to_string(r));
+        return -1;
+    }
     return 0;
 }
 
@@ -714,9 +1230,94 @@ static int exec_sleep(int argc, char **argv) {
     return 0;
 }
 
+static void print_out_stats(const char *name, mbx_out_stats *stats) {
+    usr_msg("%s:\n", name);
+    usr_msg("  callbacks:  %lu\n", stats->n_callbacks);
+    usr_msg("  duration:   p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        stats->callback_p50_usec, stats->callback_p99_usec,
+        stats->callback_max_usec);
+    usr_msg("  dsp load:   %.2f%% (max %.2f%%)\n", stats->dsp_load_percent,
+        stats->dsp_load_max_percent);
+    usr_msg("  underflows: %lu\n", stats->underflows);
+    if ( stats->latency_usec < 0 ) {
+        usr_msg("  latency:    unknown\n");
+    }
+    else {
+        usr_msg("  latency:    %.1f ms\n", stats->latency_usec / 1000.0);
+    }
+    usr_msg("  buffered:   %zu frames\n", stats->ring_fill_frames);
+    usr_msg("  render:     %.2f%% (max %.2f%%)\n", stats->render_load_percent,
+        stats->render_load_max_percent);
+    usr_msg("  late:       %lu frames\n", stats->late_frames);
+}
+
+static int exec_stats(int argc, char **argv) {
+    mbx_ctrl_stats stats;
+    int i;
+    if ( argc != 1 ) {
+        usr_msg("Usage: %s", find_command(argv[0])->usage);
+        return -1;
+    }
+    mbx_ctrl_get_stats(ctrl, &stats);
+    mbx_rt_check_report();
+    print_out_stats("speakers", &stats.speakers);
+    print_out_stats("headphones", &stats.headphones);
+    usr_msg("quality:      %s\n", stats.quality_steps == 0 ? "full"
+        : "reduced because of the render load");
+    usr_msg("decoded audio data:\n");
+    for ( i=0; i<mbx_ctrl_get_n_decks(ctrl); i++ ) {
+        usr_msg("  deck %2d:   %zu bytes\n", i+1,
+            mbx_ctrl_deck_get_resident_bytes(ctrl, i));
+    }
+    for ( i=0; i<mbx_ctrl_get_n_sample_slots(ctrl); i++ ) {
+        size_t n_bytes = mbx_ctrl_sample_get_resident_bytes(ctrl, i);
+        if ( n_bytes > 0 ) {
+            usr_msg("  sample %2d: %zu bytes\n", i+1, n_bytes);
+        }
+    }
+    return 0;
+}
+
+static int exec_mem(int argc, char **argv) {
+    mbx_mem_stats stats;
+    char *endp;
+    int i;
+    if ( argc == 3 && ! strcmp("limit", argv[1]) ) {
+        long mb = strtol(argv[2], &endp, 10);
+        if ( *argv[2] == '\0' || *endp != '\0' || mb < 0 ) {
+            usr_msg("Error executing mem: %s is not a number.\n", argv[2]);
+            return -1;
+        }
+        mbx_mem_set_limit(MBX_LOG_PCM, (size_t) mb * 1024 * 1024);
+        return 0;
+    }
+    if ( argc != 1 ) {
+        usr_msg("Usage:\n%s\n", find_command(argv[0])->usage);
+        return -1;
+    }
+    usr_msg("%-18s %12s %12s %10s %10s\n", "component", "current", "peak",
+        "allocs", "frees");
+    for ( i=0; i<_MBX_N_COMPONENTS; i++ ) {
+        mbx_mem_get_stats(i, &stats);
+        if ( stats.n_allocs == 0 ) {
+            continue;
+        }
+        usr_msg("%-18s %12zu %12zu %10lu %10lu\n", mbx_log_component_name(i),
+            stats.current_bytes, stats.peak_bytes, stats.n_allocs,
+            stats.n_frees);
+    }
+    mbx_mem_get_stats(MBX_LOG_PCM, &stats);
+    if ( stats.limit_bytes > 0 ) {
+        usr_msg("limit for %s: %zu bytes\n", mbx_log_component_name(MBX_LOG_PCM),
+            stats.limit_bytes);
+    }
+    return 0;
+}
+
 static int exec_quit(int argc, char **argv) {
     usr_msg("shutting down...\n");
     mbx_ctrl_shutdown_and_free(ctrl);
+    mbx_rt_check_report();
     done = 1;
     return 0;
 }